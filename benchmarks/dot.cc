@@ -0,0 +1,37 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+std::vector<double> make_data(int64_t n, double scale) {
+  std::vector<double> v;
+  for (int64_t i = 0; i < n; ++i) {
+    v.push_back((i % 1000) * scale);
+  }
+  return v;
+}
+
+double dot(const std::vector<double> &a, const std::vector<double> &b) {
+  double total = 0.0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    total += a[i] * b[i];
+  }
+  return total;
+}
+
+int main() {
+  const int64_t n = 10000000;
+  const int repeats = 20;
+  auto a = make_data(n, 0.5);
+  auto b = make_data(n, 0.25);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  double result = 0.0;
+  for (int i = 0; i < repeats; ++i) {
+    result = dot(a, b);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double, std::milli> elapsed = end - start;
+  std::cout << "scalar: " << result << ", finished in "
+            << (int64_t)elapsed.count() << "ms" << std::endl;
+  return 0;
+}
@@ -0,0 +1,54 @@
+# writes dispatch.bon: count classes, each with a Print and an Eq impl, and
+#  a main calling all of them
+#   python3 gen_dispatch.py [count] > dispatch.bon
+
+import sys
+
+HEADER = """\
+# compile time benchmark for typeclass method lookup: every call to str,
+#  print and == is resolved against one impl per class below
+#   time bon dispatch.bon
+# generated by gen_dispatch.py, edit that instead
+"""
+
+CLASS = """
+class shape{i:03d}:
+  Shape{i:03d}(n:int)
+
+impl Print(shape{i:03d}):
+  def to_string(x:shape{i:03d}) -> string:
+    return "shape{i:03d}(" ++ x.n.str() ++ ")"
+
+  def print(x:shape{i:03d}) -> ():
+    print(x.to_string())
+
+  def write(x:shape{i:03d}) -> ():
+    write(x.to_string())
+
+impl Eq(shape{i:03d}):
+  def operator==(a:shape{i:03d}, b:shape{i:03d}) -> bool:
+    return a.n == b.n
+
+  def operator!=(a:shape{i:03d}, b:shape{i:03d}) -> bool:
+    return a.n != b.n
+"""
+
+CALLS = """\
+  print(Shape{i:03d}({i}))
+  if Shape{i:03d}({i}) == Shape{i:03d}({i}) and Shape{i:03d}({i}) != Shape{i:03d}({j}):
+    equal = equal + 1
+"""
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 120
+    out = [HEADER]
+    for i in range(count):
+        out.append(CLASS.format(i=i))
+    out.append("\ndef main():\n  equal = 0\n")
+    for i in range(count):
+        out.append(CALLS.format(i=i, j=i + 1))
+    out.append('  print("equal: " ++ equal.str() ++ " of {}")\n'.format(count))
+    out.append("\nmain()\n")
+    sys.stdout.write("".join(out))
+
+main()
@@ -1,47 +1,10 @@
 #include <iostream>
 #include <stdint.h>
 #include <vector>
+#include <algorithm>
+#include <string>
 #include <chrono>
 
-void swap(std::vector<int64_t> &xs, int64_t i, int64_t j) {
-  auto tmp = xs[j];
-  xs[j] = xs[i];
-  xs[i] = tmp;
-}
-
-// identical algorithm to sort in Bon
-void qsort(std::vector<int64_t> &xs, int64_t low, int64_t high) {
-    int64_t mid = low + ((high - low) / 2);
-    int64_t pivot = xs[mid];
-    int64_t i = low;
-    int64_t j = high;
-    while (i <= j) {
-        while (xs[i] < pivot) {
-            i = i + 1;
-        }
-        while (xs[j] > pivot) {
-            j = j - 1;
-        }
-        if (i <= j) {
-            swap(xs, i, j);
-            i = i + 1;
-            j = j - 1;
-        }
-    }
-
-    if (low < j) {
-        qsort(xs, low, j);
-    }
-
-    if (i < high) {
-        qsort(xs, i, high);
-    }
-}
-
-void sort(std::vector<int64_t> &xs) {
-    qsort(xs, 0, xs.size()-1);
-}
-
 // psuedo-random number generation
 // intentional functionally identical to rand in Bon (same output, same seed)
 int64_t s[2];
@@ -90,17 +53,80 @@ int64_t get_time() {
   return value_ms;
 }
 
-int main() {
-  seed_random(172344);
+std::vector<int64_t> random_ints(size_t n, int64_t seed) {
+  seed_random(seed);
   std::vector<int64_t> xs;
-  for (size_t i = 0; i < 1000000; ++i) {
+  for (size_t i = 0; i < n; ++i) {
     xs.push_back(xoroshiro128plus());
   }
+  return xs;
+}
+
+std::vector<int64_t> sorted_ints(size_t n) {
+  std::vector<int64_t> xs;
+  for (size_t i = 0; i < n; ++i) {
+    xs.push_back(i);
+  }
+  return xs;
+}
+
+std::vector<int64_t> reversed_ints(size_t n) {
+  std::vector<int64_t> xs;
+  for (size_t i = n; i > 0; --i) {
+    xs.push_back(i);
+  }
+  return xs;
+}
+
+// only 16 distinct values
+std::vector<int64_t> few_unique_ints(size_t n, int64_t seed) {
+  seed_random(seed);
+  std::vector<int64_t> xs;
+  for (size_t i = 0; i < n; ++i) {
+    xs.push_back(xoroshiro128plus() & 15);
+  }
+  return xs;
+}
+
+void report(const std::string &name, int64_t start_time) {
+  auto total_time = get_time() - start_time;
+  std::cout << name << ": finished in " << (total_time/1000) << "ms"
+            << std::endl;
+}
 
+// same cases as sort.bon, using the standard library sorts
+int main() {
+  const size_t batch_size = 1000000;
+
+  auto shuffled = random_ints(batch_size, 172344);
   auto start_time = get_time();
-  sort(xs);
-  auto end_time = get_time();
-  auto total_time = end_time-start_time;
-  std::cout << "Finished in " << (total_time/1000) << "ms" << std::endl;
+  std::sort(shuffled.begin(), shuffled.end());
+  report("random", start_time);
+
+  auto random_stable = random_ints(batch_size, 172344);
+  start_time = get_time();
+  std::stable_sort(random_stable.begin(), random_stable.end());
+  report("random (stable_sort)", start_time);
+
+  auto sorted = sorted_ints(batch_size);
+  start_time = get_time();
+  std::sort(sorted.begin(), sorted.end());
+  report("sorted", start_time);
+
+  auto reversed = reversed_ints(batch_size);
+  start_time = get_time();
+  std::sort(reversed.begin(), reversed.end());
+  report("reversed", start_time);
+
+  auto few_unique = few_unique_ints(batch_size, 172344);
+  start_time = get_time();
+  std::sort(few_unique.begin(), few_unique.end());
+  report("few unique", start_time);
+
+  auto large = random_ints(100000000, 172344);
+  start_time = get_time();
+  std::sort(large.begin(), large.end());
+  report("random, 100M elements", start_time);
+
   return 0;
 }
@@ -0,0 +1,82 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Embeds Bon with libbon: compiles a source string, and calls into it.
+|*  built along with libbon (see src/CMakeLists.txt), run with
+|*  BON_STDLIB_PATH set. exits with 1 if any result is wrong
+|*
+L*----------------------------------------------------------------------------*/
+#include "libbon.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+static const char* s_source =
+  "import env\n"
+  "\n"
+  "cdef host_scale(x:int) -> int\n"
+  "\n"
+  "def add(a:int, b:int) -> int:\n"
+  "  return a + b\n"
+  "\n"
+  "def scaled(x:int) -> int:\n"
+  "  return host_scale(x) + 1\n"
+  "\n"
+  "def arg_count(unused:int) -> int:\n"
+  "  return get_args().len()\n";
+
+// called from Bon through the cdef above
+static int64_t host_scale(int64_t x) {
+  return x * 10;
+}
+
+static int check(const char* name, int64_t value, int64_t expected) {
+  if (value != expected) {
+    printf("%s: expected %lld, got %lld\n", name, (long long)expected,
+           (long long)value);
+    return 0;
+  }
+  printf("%s: ok\n", name);
+  return 1;
+}
+
+int main(int argc, const char** argv) {
+  const char* error;
+  bon_context* context = bon_create(NULL, &error);
+  if (!context) {
+    printf("bon_create failed: %s\n", error);
+    return 1;
+  }
+
+  if (bon_set_args(argc, argv) != 0
+      || bon_add_source(context, "host.bon", s_source) != 0
+      || bon_register_function(context, "host_scale",
+                               (void*)host_scale) != 0
+      || bon_compile(context) != 0) {
+    printf("compile failed: %s\n", bon_last_error(context));
+    bon_destroy(context);
+    return 1;
+  }
+
+  int64_t (*add)(int64_t, int64_t) =
+    (int64_t (*)(int64_t, int64_t))bon_lookup(context, "add",
+                                              "int * int -> int");
+  int64_t (*scaled)(int64_t) =
+    (int64_t (*)(int64_t))bon_lookup(context, "scaled", "int -> int");
+  int64_t (*arg_count)(int64_t) =
+    (int64_t (*)(int64_t))bon_lookup(context, "arg_count", "int -> int");
+  // the type has to match the function's, so this lookup fails
+  void* wrong_type = bon_lookup(context, "add", "float * float -> float");
+
+  int ok = add && scaled && arg_count && !wrong_type;
+  if (!ok) {
+    printf("lookup failed: %s\n", bon_last_error(context));
+  }
+  else {
+    ok &= check("add", add(2, 3), 5);
+    ok &= check("scaled", scaled(4), 41);
+    ok &= check("arg_count", arg_count(0), argc);
+  }
+
+  bon_destroy(context);
+  return ok ? 0 : 1;
+}
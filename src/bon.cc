@@ -3,23 +3,9 @@
 |* Main entry point
 |*
 L*----------------------------------------------------------------------------*/
-#include "bonAST.h"
-#include "bonTokenizer.h"
-#include "bonParser.h"
-#include "bonLogger.h"
-#include "bonDebugASTPass.h"
-#include "bonScopeAnalysisPass.h"
-#include "bonTypeAnalysisPass.h"
-#include "bonCodeGenPass.h"
-#include "bonLLVM.h"
-#include "utils.h"
-#include "auto_scope.h"
-#include "term_colors.h"
+#include "bonCompiler.h"
 #include "optionparser.h"
 
-#include "llvm/Transforms/IPO/PassManagerBuilder.h"
-#include "llvm/IR/LegacyPassManagers.h"
-
 #include <iostream>
 #include <sstream>
 #include <cstdlib>
@@ -29,199 +15,9 @@ L*----------------------------------------------------------------------------*/
   #define BON_VERSION "UNKNOWN_VERSION"
 #endif
 
-bool DUMP_ASM = false;
-bool VERBOSE_OUTPUT = false;
-int OPTIMIZATION_LEVEL = 3;
-
-std::vector<std::string> s_args;
-
-namespace bon {
-
-// compilation state stored in obj for easier access in compile passes
-ModuleState state_;
-Parser parser_(state_);
-
-void init_module_and_passes() {
-  // create new module for current file
-  state_.current_module = llvm::make_unique<Module>("bon", state_.llvm_context);
-  state_.current_module->setDataLayout(
-                          state_.JIT->getTargetMachine().createDataLayout());
-  state_.current_module->setSourceFileName(bon::logger.get_current_file());
-
-  // add pass manager to module for optimizations
-  state_.function_pass_manager =
-    llvm::make_unique<legacy::FunctionPassManager>(state_.current_module.get());
-  state_.module_pass_manager =
-    llvm::make_unique<legacy::PassManager>();
-
-  // add standard optimization passes
-  PassManagerBuilder Builder;
-  Builder.SizeLevel = 0;
-  Builder.OptLevel = OPTIMIZATION_LEVEL;
-  Builder.Inliner = createFunctionInliningPass(OPTIMIZATION_LEVEL, 0);
-  Builder.populateFunctionPassManager(*state_.function_pass_manager);
-  Builder.populateModulePassManager(*state_.module_pass_manager);
-  // Builder.populateLTOPassManager(*state_.module_pass_manager);
-
-  // add additional useful passes
-  if (OPTIMIZATION_LEVEL == 0) {
-    state_.function_pass_manager->add(createInstructionCombiningPass());
-  }
-  else {
-    state_.function_pass_manager->add(createSpeculativeExecutionPass());
-    state_.function_pass_manager->add(createJumpThreadingPass());
-
-    state_.function_pass_manager->add(createTailCallEliminationPass());
-
-    state_.function_pass_manager->add(createLoopSimplifyPass());
-    state_.function_pass_manager->add(createLoopRotatePass());
-    state_.function_pass_manager->add(createLoopUnswitchPass());
-    state_.function_pass_manager->add(createLoopUnrollPass());
-    state_.function_pass_manager->add(createLoopSinkPass());
-
-    state_.function_pass_manager->add(createInstructionCombiningPass());
-  }
-
-  state_.function_pass_manager->doInitialization();
-}
-
-bool run_scope_analysis() {
-  // typeclass type analysis
-  ScopeAnalysisPass scope_analysis_pass(state_);
-  for (auto &tclass_entry : state_.typeclasses) {
-    auto &tclass = tclass_entry.second;
-    tclass->run_pass(&scope_analysis_pass);
-  }
-
-  // function type analysis
-  for (auto func_name : state_.function_names) {
-    auto &funcAST = state_.all_functions[func_name];
-    funcAST->run_pass(&scope_analysis_pass);
-  }
-
-  // top-level type analysis
-  for (auto &funcAST : state_.toplevel_expressions) {
-    funcAST->run_pass(&scope_analysis_pass);
-  }
-
-  if (logger.had_errors()) {
-    logger.finalize();
-    return false;
-  }
-
-  return true;
-}
-
-bool run_type_analysis() {
-  TypeAnalysisPass type_analysis_pass(state_);
-  for (auto func : state_.ordered_functions) {
-    func->run_pass(&type_analysis_pass);
-  }
-
-  // top-level type analysis
-  for (auto &funcAST : state_.toplevel_expressions) {
-    funcAST->run_pass(&type_analysis_pass);
-  }
-
-  if (logger.had_errors()) {
-    logger.finalize();
-    return false;
-  }
-
-  return true;
-}
-
-bool run_codegen() {
-  // DebugASTPass debug_ast_pass;
-  // for (auto &tclass_entry : state_.typeclasses) {
-  //   auto &tclass = tclass_entry.second;
-  //   tclass->run_pass(&debug_ast_pass);
-  //   for (auto &impl : tclass->impls) {
-  //     impl->run_pass(&debug_ast_pass);
-  //   }
-  // }
-
-  CodeGenPass code_gen_pass(state_);
-
-  for (auto func : state_.ordered_functions) {
-    func->run_pass(&code_gen_pass);
-    if (DUMP_ASM ||
-        (VERBOSE_OUTPUT && verifyModule(*state_.current_module, &errs()))) {
-      state_.current_module->dump();
-    }
-    state_.function_pass_manager->doFinalization();
-    state_.module_pass_manager->run(*state_.current_module);
-    state_.JIT->addModule(std::move(state_.current_module));
-    init_module_and_passes();
-  }
-
-  if (logger.had_errors()) {
-    logger.finalize();
-    return false;
-  }
-
-  logger.finalize();
-
-  // top-level expression code gen
-  for (auto &funcAST : state_.toplevel_expressions) {
-    funcAST->run_pass(&code_gen_pass);
-    if (auto* function_ir = code_gen_pass.result()) {
-      if (DUMP_ASM ||
-          (VERBOSE_OUTPUT && verifyModule(*state_.current_module, &errs()))) {
-        state_.current_module->dump();
-      }
-      state_.function_pass_manager->doFinalization();
-      state_.module_pass_manager->run(*state_.current_module);
-      auto H = state_.JIT->addModule(std::move(state_.current_module));
-      init_module_and_passes();
-
-      // search the JIT for the top-level function we just generated
-      auto func_symbol = state_.JIT->findSymbol("top-level = () -> ()");
-      assert(func_symbol && "Function not found");
-
-      // get the symbol's address and cast it to the right type (takes no
-      // arguments, returns a double) so we can call it as a native function.
-      double (*FP)() = (double (*)())(intptr_t)func_symbol.getAddress();
-      FP();
-      // delete top-level expression module from the JIT.
-      // state_.JIT->removeModule(H);
-    }
-    else {
-      return false;
-    }
-  }
-
-  return true;
-}
-
-// TODO: put top-level expressions in single "top-level" function,
-//       and run that function here
-void run_module() {
-}
-
-bool compile_file(std::string filename, bool should_run_codegen) {
-  bon::init_module_and_passes();
-  parser_.parse_file(filename);
-  if (!should_run_codegen) {
-    return true;
-  }
-  if (!run_scope_analysis()) {
-    return false;
-  }
-  if (!run_type_analysis()) {
-    return false;
-  }
-  if (!run_codegen()) {
-    return false;
-  }
-  run_module();
-  return true;
-}
-
-} // namespace bon
-
 int main(int argc, char* argv[]) {
-enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION, ASM, OPT_LEVEL, REPL };
+enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION, ASM, OPT_LEVEL, FAST_MATH,
+                     TARGET_CPU, TARGET_FEATURES, REPL };
   const option::Descriptor usage[] =
   {
     {UNKNOWN, 0, "", "", option::Arg::None,
@@ -243,6 +39,18 @@ enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION, ASM, OPT_LEVEL, REPL };
     {OPT_LEVEL, 0, "O", "opt-level", option::Arg::Optional,
       " --opt-level, -O \tSet optimization level (0-3)"},
 
+    {FAST_MATH, 0, "", "fast-math", option::Arg::None,
+      "  --fast-math  \tAllow float math to be reassociated and approximated"
+      " (as if every function was declared @fast_math)." },
+
+    {TARGET_CPU, 0, "", "target-cpu", option::Arg::Optional,
+      "  --target-cpu=<cpu>  \tGenerate code for this cpu, e.g. skylake"
+      " (defaults to native, the host cpu)." },
+
+    {TARGET_FEATURES, 0, "", "target-features", option::Arg::Optional,
+      "  --target-features=<list>  \tEnable or disable cpu features, e.g."
+      " +avx2,-avx512f (defaults to native, the host's features)." },
+
     {REPL, 0, "", "repl", option::Arg::None,
       "  --repl  \tStart an interactive Bon session." },
 
@@ -275,12 +83,6 @@ enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION, ASM, OPT_LEVEL, REPL };
     return 0;
   }
 
-  VERBOSE_OUTPUT = options[VERBOSE] ? true : false;
-  DUMP_ASM = options[ASM] ? true : false;
-  OPTIMIZATION_LEVEL = options[OPT_LEVEL] ?
-                       strtoul(options[OPT_LEVEL].arg, nullptr, 10)
-                       : 3;
-
   bool unknown_options = false;
   for (option::Option* opt = options[UNKNOWN]; opt; opt = opt->next()) {
     std::cout << "Unknown option: "
@@ -288,39 +90,48 @@ enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION, ASM, OPT_LEVEL, REPL };
     unknown_options = true;
   }
 
+  std::vector<std::string> args;
   for (int i = 0; i < parse.nonOptionsCount(); ++i) {
-    s_args.push_back(std::string(parse.nonOption(i)));
+    args.push_back(std::string(parse.nonOption(i)));
   }
+  bon::set_program_args(args);
 
   if (unknown_options) {
     option::printUsage(std::cout, usage);
     return 1;
   }
 
-  if (const char* stdlib_path = std::getenv("BON_STDLIB_PATH")) {
-    BON_STDLIB_PATH = stdlib_path;
-  }
-  else {
+  const char* stdlib_path = std::getenv("BON_STDLIB_PATH");
+  if (!stdlib_path) {
     std::cout << "BON_STDLIB_PATH not set - have you run "
                  "\"source ~/.profile\" since installing?" << std::endl;
     return 1;
   }
 
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
-  InitializeNativeTargetAsmParser();
-
-  bon::state_.JIT = llvm::make_unique<BonJIT>();
+  std::string target_cpu = options[TARGET_CPU] && options[TARGET_CPU].arg ?
+                           options[TARGET_CPU].arg : "native";
+  std::string target_features =
+    options[TARGET_FEATURES] && options[TARGET_FEATURES].arg ?
+    options[TARGET_FEATURES].arg : "native";
+  bon::Compiler compiler(target_cpu, target_features);
+  auto &state = compiler.state();
+  state.stdlib_path = stdlib_path;
+  state.verbose = options[VERBOSE] ? true : false;
+  state.dump_asm = options[ASM] ? true : false;
+  state.fast_math = options[FAST_MATH] ? true : false;
+  state.opt_level = options[OPT_LEVEL] ?
+                    strtoul(options[OPT_LEVEL].arg, nullptr, 10)
+                    : 3;
 
-  bon::compile_file("prelude.bon", false);
+  compiler.compile_file("prelude.bon", false);
 
   std::string filename = parse.nonOptionsCount() > 0 ? parse.nonOption(0) : "";
 
   if (filename != "") {
-    bon::compile_file(filename, true);
+    compiler.compile_file(filename, true);
   }
   else if (options[REPL]) {
-    bon::compile_file("repl", true);
+    compiler.compile_file("repl", true);
   }
   else {
     option::printUsage(std::cout, usage);
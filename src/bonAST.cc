@@ -92,6 +92,7 @@ BinaryExprAST::BinaryExprAST(size_t line_num, size_t column_num, Token Op,
     case tok_bt_or:
     case tok_bt_xor:
     case tok_bt_and:
+    case tok_pow:
     case tok_assign:
     case tok_dot:
     case tok_concat:
@@ -140,6 +141,15 @@ WhileExprAST::WhileExprAST(size_t line_num, size_t column_num,
   type_var_ = new TypeVariable();
 }
 
+ForExprAST::ForExprAST(size_t line_num, size_t column_num,
+                       VariableExprASTPtr var,
+                       std::unique_ptr<ExprAST> generator,
+                       std::unique_ptr<ExprAST> body)
+  : ExprAST(line_num, column_num), var_(std::move(var)),
+    generator_(std::move(generator)), body_(std::move(body)) {
+  type_var_ = new TypeVariable();
+}
+
 MatchCaseExprAST::MatchCaseExprAST(size_t line_num, size_t column_num,
                                    std::unique_ptr<ExprAST> condition,
                                    std::unique_ptr<ExprAST> body)
@@ -171,9 +181,11 @@ SizeofExprAST::SizeofExprAST(size_t line_num, size_t column_num, ExprASTPtr arg)
 }
 
 PtrOffsetExprAST::PtrOffsetExprAST(size_t line_num, size_t column_num,
-                                   ExprASTPtr arg, ExprASTPtr offset)
+                                   ExprASTPtr arg, ExprASTPtr offset,
+                                   ExprASTPtr capacity)
   : ExprAST(line_num, column_num), arg_(std::move(arg)),
-    offset_(std::move(offset)), is_lvalue(false) {
+    offset_(std::move(offset)), capacity_(std::move(capacity)),
+    is_lvalue(false) {
   type_var_ = new TypeVariable();
 }
 
@@ -184,7 +196,8 @@ PrototypeAST::PrototypeAST(size_t line_num, size_t column_num,
                            std::vector<bool> arg_owned,
                            TypeVariable* ret_type)
   : Name(Name), Args(std::move(Args)), arg_owned_(arg_owned),
-    ret_type_(ret_type), line_num_(line_num), column_num_(column_num) {
+    ret_type_(ret_type), returns_slot_(false), line_num_(line_num),
+    column_num_(column_num) {
   type_var_ = build_function_type(ArgTypes, ret_type);
 }
 
@@ -197,7 +210,8 @@ FunctionAST::FunctionAST(size_t line_num, size_t column_num,
                          std::unique_ptr<ExprAST> Body, ExprAST* last_expr,
                          std::vector<CallExprAST*> &dependencies)
   : Proto(std::move(Proto)), Body(std::move(Body)),
-    last_expr_(last_expr), dependencies_(dependencies),
+    last_expr_(last_expr), dependencies_(dependencies), fast_math_(false),
+    generator_(false), async_(false),
     line_num_(line_num), column_num_(column_num) {
 }
 
@@ -324,6 +338,10 @@ void WhileExprAST::run_pass(CompilerPass* pass) {
   pass->process(this);
 }
 
+void ForExprAST::run_pass(CompilerPass* pass) {
+  pass->process(this);
+}
+
 void MatchCaseExprAST::run_pass(CompilerPass* pass) {
   pass->process(this);
 }
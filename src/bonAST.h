@@ -65,11 +65,8 @@ struct IntegerExprAST : public ExprAST {
 };
 typedef std::unique_ptr<IntegerExprAST> IntegerExprASTPtr;
 
-// TODO: primitive numeric types -
-//   int=BigInt, float=double
-//   i8, i16, i32, i64
-//   u8, u16, u32, u64
-//   f32, f64
+// literals with a type suffix (e.g. 255u8, 1.5f32) have their type_var_ set
+//  by the parser, otherwise they're int (i64) or float (f64)
 
 // // ast node for numeric literals like "1.0"
 // struct FloatExprAST : public ExprAST {
@@ -182,6 +179,18 @@ struct WhileExprAST : public ExprAST {
 };
 typedef std::unique_ptr<WhileExprAST> WhileExprASTPtr;
 
+// ast node for 'for' loop over the values a generator yields
+struct ForExprAST : public ExprAST {
+  // variable bound to each value in turn
+  VariableExprASTPtr var_;
+  ExprASTPtr generator_, body_;
+
+  ForExprAST(size_t line_num, size_t column_num, VariableExprASTPtr var,
+             ExprASTPtr generator, ExprASTPtr body);
+  void run_pass(CompilerPass* pass) override;
+};
+typedef std::unique_ptr<ForExprAST> ForExprASTPtr;
+
 struct MatchCaseExprAST : public ExprAST {
   ExprASTPtr condition_, body_;
 
@@ -230,11 +239,14 @@ typedef std::unique_ptr<SizeofExprAST> SizeofExprASTPtr;
 struct PtrOffsetExprAST : public ExprAST {
   ExprASTPtr arg_;
   ExprASTPtr offset_;
+  // optional capacity of the buffer, needed to find the columns of
+  //  objects stored with a struct-of-arrays layout (@soa classes)
+  ExprASTPtr capacity_;
   TypeEnv type_env_;
   bool is_lvalue;
 
   PtrOffsetExprAST(size_t line_num, size_t column_num, ExprASTPtr arg,
-                   ExprASTPtr offset);
+                   ExprASTPtr offset, ExprASTPtr capacity=nullptr);
   void run_pass(CompilerPass* pass) override;
 
   void set_as_lvalue() override {
@@ -254,6 +266,9 @@ struct PrototypeAST {
   std::vector<bool> arg_owned_;
   TypeVariable* type_var_;
   TypeVariable* ret_type_;
+  // result is a slot of a buffer (e.g. v[i]) rather than a new object, so
+  //  small objects are returned by reference instead of copied
+  bool returns_slot_;
   size_t line_num_;
   size_t column_num_;
 
@@ -279,6 +294,13 @@ struct FunctionAST {
 
   // typeclass that this function belongs to
   std::string typeclass;
+  // declared with @fast_math
+  bool fast_math_;
+  // has a yield in its body, calling it makes a generator
+  bool generator_;
+  // has an await in its body, calling it makes an async call that runs
+  //  once it's awaited or started
+  bool async_;
 
   ExprAST* last_expr_;
   size_t line_num_;
@@ -0,0 +1,679 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Event loop and executors for async functions
+|*
+L*----------------------------------------------------------------------------*/
+
+#include "bonAsync.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define BON_HAVE_IO_URING 1
+#endif
+#endif
+
+namespace bon {
+
+namespace {
+
+thread_local Executor* tl_executor = nullptr;
+// coroutines that reached their final suspend point during the current
+// resume, see Executor::finished()
+thread_local std::vector<std::pair<void*, AsyncState*>> tl_finished;
+
+const int s_op_pending = 0;
+const int s_op_waiting = 1;
+const int s_op_done = 2;
+
+void async_fail(const char* message) {
+  std::fprintf(stderr, "%s\n", message);
+  std::exit(-1);
+}
+
+void destroy(void* handle) {
+  static_cast<CoroutineFrame*>(handle)->destroy(handle);
+}
+
+} // namespace
+
+IoOp::IoOp(Kind op_kind, int op_fd)
+  : kind(op_kind), fd(op_fd), buffer(nullptr), length(0), offset(-1),
+    address_length(0), result(0), state(s_op_pending), waiter(nullptr),
+    executor(Executor::current()) {
+  std::memset(&address, 0, sizeof(address));
+  if (!executor) {
+    async_fail("Async i/o outside of run_async!");
+  }
+}
+
+void IoOp::complete(int64_t op_result) {
+  // the socket is the result of a connect, like it is for an accept
+  if (kind == Connect && fd >= 0) {
+    if (op_result == 0) {
+      op_result = fd;
+    }
+#ifdef __linux__
+    else {
+      close(fd);
+    }
+#endif
+  }
+  result = op_result;
+  auto owner = executor;
+  if (state.exchange(s_op_done, std::memory_order_acq_rel) == s_op_waiting) {
+    owner->schedule(waiter);
+  }
+}
+
+void IoOp::wait(void* handle) {
+  waiter = handle;
+  if (state.exchange(s_op_waiting, std::memory_order_acq_rel) == s_op_done) {
+    executor->schedule(handle);
+  }
+}
+
+#ifdef __linux__
+
+namespace {
+
+int64_t errno_result(int64_t result) {
+  return result < 0 ? -errno : result;
+}
+
+bool is_regular_file(int fd) {
+  struct stat info;
+  return fstat(fd, &info) == 0
+         && (S_ISREG(info.st_mode) || S_ISBLK(info.st_mode));
+}
+
+// readiness based fallback. sockets are made non-blocking and retried once
+// epoll says they're ready, while regular files (which are always "ready")
+// are read and written right away
+class EpollBackend : public IoBackend {
+public:
+  EpollBackend() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+      async_fail("Couldn't set up epoll!");
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+  }
+  ~EpollBackend() override {
+    close(wake_fd_);
+    close(epoll_fd_);
+  }
+
+  const char* name() const override { return "epoll"; }
+
+  void submit(IoOp* op) override {
+    bool is_file = (op->kind == IoOp::Read || op->kind == IoOp::Write)
+                   && is_regular_file(op->fd);
+    if (!is_file) {
+      auto flags = fcntl(op->fd, F_GETFL);
+      if (flags >= 0 && !(flags & O_NONBLOCK)) {
+        fcntl(op->fd, F_SETFL, flags | O_NONBLOCK);
+      }
+    }
+    auto result = attempt(op, false);
+    if (is_file || result != -EAGAIN) {
+      op->complete(result);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &waiters = fds_[op->fd];
+    (waits_for_input(op) ? waiters.readers : waiters.writers).push_back(op);
+    arm(op->fd, waiters);
+  }
+
+  void poll(bool block) override {
+    epoll_event events[64];
+    auto count = epoll_wait(epoll_fd_, events, 64, block ? -1 : 0);
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        uint64_t value;
+        while (read(wake_fd_, &value, sizeof(value)) > 0) {}
+        continue;
+      }
+      bool error = events[i].events & (EPOLLERR | EPOLLHUP);
+      std::vector<IoOp*> ready;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &waiters = fds_[fd];
+        if (error || (events[i].events & EPOLLIN)) {
+          ready.insert(ready.end(), waiters.readers.begin(),
+                       waiters.readers.end());
+          waiters.readers.clear();
+        }
+        if (error || (events[i].events & EPOLLOUT)) {
+          ready.insert(ready.end(), waiters.writers.begin(),
+                       waiters.writers.end());
+          waiters.writers.clear();
+        }
+      }
+      for (auto op : ready) {
+        auto result = attempt(op, true);
+        if (result != -EAGAIN) {
+          op->complete(result);
+          continue;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &waiters = fds_[fd];
+        (waits_for_input(op) ? waiters.readers : waiters.writers)
+          .push_back(op);
+      }
+      // epoll forgets about the fd after every event (EPOLLONESHOT), so
+      // whatever is still waiting on it is armed again
+      std::lock_guard<std::mutex> lock(mutex_);
+      arm(fd, fds_[fd]);
+    }
+  }
+
+  void wake() override {
+    uint64_t one = 1;
+    auto written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+  }
+
+private:
+  struct Waiters {
+    std::vector<IoOp*> readers;
+    std::vector<IoOp*> writers;
+    bool registered;
+    Waiters() : registered(false) {}
+  };
+
+  static bool waits_for_input(IoOp* op) {
+    return op->kind == IoOp::Read || op->kind == IoOp::Accept;
+  }
+
+  // -EAGAIN if the op has to wait for the fd to be ready. ready is set
+  // when epoll said it is
+  static int64_t attempt(IoOp* op, bool ready) {
+    switch (op->kind) {
+      case IoOp::Read:
+        if (op->offset < 0) {
+          return errno_result(read(op->fd, op->buffer, op->length));
+        }
+        return errno_result(pread(op->fd, op->buffer, op->length,
+                                  op->offset));
+      case IoOp::Write:
+        if (op->offset < 0) {
+          return errno_result(write(op->fd, op->buffer, op->length));
+        }
+        return errno_result(pwrite(op->fd, op->buffer, op->length,
+                                   op->offset));
+      case IoOp::Accept:
+        return errno_result(accept4(op->fd, nullptr, nullptr,
+                                    SOCK_CLOEXEC));
+      case IoOp::Connect: {
+        if (ready) {
+          int error = 0;
+          socklen_t length = sizeof(error);
+          getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+          return -error;
+        }
+        auto result = connect(op->fd, (sockaddr*)&op->address,
+                              op->address_length);
+        if (result < 0 && errno == EINPROGRESS) {
+          return -EAGAIN;
+        }
+        return errno_result(result);
+      }
+    }
+    return -EINVAL;
+  }
+
+  // mutex_ is held
+  void arm(int fd, Waiters &waiters) {
+    epoll_event event;
+    event.events = EPOLLONESHOT;
+    if (!waiters.readers.empty()) {
+      event.events |= EPOLLIN;
+    }
+    if (!waiters.writers.empty()) {
+      event.events |= EPOLLOUT;
+    }
+    if (event.events == EPOLLONESHOT) {
+      return;
+    }
+    event.data.fd = fd;
+    // closing an fd takes it out of epoll, and the number gets reused
+    if (!waiters.registered
+        || epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) < 0) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+      waiters.registered = true;
+    }
+  }
+
+  int epoll_fd_;
+  int wake_fd_;
+  std::mutex mutex_;
+  std::unordered_map<int, Waiters> fds_;
+};
+
+#ifdef BON_HAVE_IO_URING
+
+// completion based backend, on the rings shared with the kernel. there's no
+// liburing to lean on, so the rings are set up with the raw system calls
+class UringBackend : public IoBackend {
+public:
+  // nullptr if the kernel can't do what we need (5.6 or later)
+  static UringBackend* create() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = s_completion_entries;
+    int fd = syscall(__NR_io_uring_setup, s_submission_entries, &params);
+    if (fd < 0) {
+      return nullptr;
+    }
+    // reads and writes at the current file position came with
+    // IORING_OP_READ/WRITE, after accept and connect
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+      close(fd);
+      return nullptr;
+    }
+    auto backend = new UringBackend(fd, params);
+    if (!backend->map_rings(params)) {
+      delete backend;
+      return nullptr;
+    }
+    backend->read_wake_fd();
+    return backend;
+  }
+
+  ~UringBackend() override {
+    if (sqes_) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    close(wake_fd_);
+    close(ring_fd_);
+  }
+
+  const char* name() const override { return "io_uring"; }
+
+  void submit(IoOp* op) override {
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+    auto sqe = next_sqe();
+    switch (op->kind) {
+      case IoOp::Read:
+      case IoOp::Write:
+        sqe->opcode = op->kind == IoOp::Read ? IORING_OP_READ
+                                             : IORING_OP_WRITE;
+        sqe->addr = (uint64_t)(uintptr_t)op->buffer;
+        sqe->len = op->length;
+        sqe->off = op->offset < 0 ? uint64_t(-1) : uint64_t(op->offset);
+        break;
+      case IoOp::Accept:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        break;
+      case IoOp::Connect:
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->addr = (uint64_t)(uintptr_t)&op->address;
+        sqe->off = op->address_length;
+        break;
+    }
+    sqe->fd = op->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    flush();
+  }
+
+  void poll(bool block) override {
+    if (block) {
+      syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS,
+              nullptr, 0);
+    }
+    // only one thread polls at a time, so the head is ours
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    bool woken = false;
+    while (head != tail) {
+      auto &cqe = cqes_[head & *cq_mask_];
+      if (cqe.user_data == 0) {
+        woken = true;
+      }
+      else {
+        ((IoOp*)(uintptr_t)cqe.user_data)->complete(cqe.res);
+      }
+      ++head;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    if (woken) {
+      std::lock_guard<std::mutex> lock(submit_mutex_);
+      read_wake_fd();
+    }
+  }
+
+  void wake() override {
+    uint64_t one = 1;
+    auto written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+  }
+
+private:
+  static const unsigned s_submission_entries = 256;
+  static const unsigned s_completion_entries = 4096;
+
+  UringBackend(int fd, const io_uring_params &params)
+    : ring_fd_(fd), wake_fd_(eventfd(0, EFD_CLOEXEC)),
+      sq_ring_(nullptr), cq_ring_(nullptr), sqes_(nullptr),
+      sq_entries_(params.sq_entries), wake_value_(0) {}
+
+  bool map_rings(const io_uring_params &params) {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes
+                    + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+    if (!sq_ring_) {
+      return false;
+    }
+    cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe*)map(sqes_size_, IORING_OFF_SQES);
+    if (!cq_ring_ || !sqes_ || wake_fd_ < 0) {
+      return false;
+    }
+
+    auto sq = (char*)sq_ring_;
+    sq_head_ = (unsigned*)(sq + params.sq_off.head);
+    sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned*)(sq + params.sq_off.array);
+    auto cq = (char*)cq_ring_;
+    cq_head_ = (unsigned*)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  void* map(size_t size, off_t offset) {
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+  }
+
+  // submit_mutex_ is held
+  io_uring_sqe* next_sqe() {
+    auto tail = *sq_tail_;
+    // entries only stay in the ring if the kernel couldn't take them
+    while (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+      flush();
+      std::this_thread::yield();
+    }
+    auto index = tail & *sq_mask_;
+    auto sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+  }
+
+  // submit_mutex_ is held
+  void flush() {
+    auto pending = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    while (pending > 0
+           && syscall(__NR_io_uring_enter, ring_fd_, pending, 0, 0,
+                      nullptr, 0) < 0
+           && errno == EINTR) {}
+  }
+
+  // wake() makes this read complete, which a blocked poll() returns for.
+  // submit_mutex_ is held (or the backend isn't shared yet)
+  void read_wake_fd() {
+    auto sqe = next_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd_;
+    sqe->addr = (uint64_t)(uintptr_t)&wake_value_;
+    sqe->len = sizeof(wake_value_);
+    sqe->user_data = 0;
+    flush();
+  }
+
+  int ring_fd_;
+  int wake_fd_;
+  void* sq_ring_;
+  void* cq_ring_;
+  io_uring_sqe* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+  unsigned sq_entries_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  io_uring_cqe* cqes_;
+  uint64_t wake_value_;
+  std::mutex submit_mutex_;
+};
+
+#endif // BON_HAVE_IO_URING
+
+} // namespace
+
+IoBackend* IoBackend::create() {
+#ifdef BON_HAVE_IO_URING
+  auto forced = std::getenv("BON_IO_BACKEND");
+  if (!forced || std::strcmp(forced, "epoll") != 0) {
+    if (auto backend = UringBackend::create()) {
+      return backend;
+    }
+  }
+#endif
+  return new EpollBackend();
+}
+
+#else
+
+IoBackend* IoBackend::create() {
+  async_fail("Async i/o is only supported on Linux!");
+  return nullptr;
+}
+
+#endif // __linux__
+
+Executor::Executor(size_t num_threads)
+  : num_threads_(num_threads > 0 ? num_threads : 1),
+    io_(IoBackend::create()), sleepers_(0), polling_(false), done_(false),
+    root_(nullptr) {}
+
+Executor::~Executor() {}
+
+Executor* Executor::current() {
+  return tl_executor;
+}
+
+void Executor::run(void* root, AsyncState* state) {
+  auto outer = tl_executor;
+  tl_executor = this;
+  root_ = root;
+  async_start(root, state);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads_; ++i) {
+    threads.emplace_back([this]{
+        tl_executor = this;
+        work();
+      });
+  }
+  work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  tl_executor = outer;
+}
+
+void Executor::schedule(void* handle) {
+  bool notified = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.push_back(handle);
+    if (sleepers_ > 0) {
+      cond_.notify_one();
+      notified = true;
+    }
+  }
+  // nobody else to pick it up but the thread waiting for i/o
+  if (!notified && polling_.load()) {
+    io_->wake();
+  }
+}
+
+void Executor::finished(void* handle, AsyncState* state) {
+  tl_finished.emplace_back(handle, state);
+}
+
+void Executor::work() {
+  while (!done_.load(std::memory_order_acquire)) {
+    void* handle = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!ready_.empty()) {
+        handle = ready_.front();
+        ready_.pop_front();
+      }
+    }
+    if (handle) {
+      resume(handle);
+      continue;
+    }
+
+    bool expected = false;
+    if (polling_.compare_exchange_strong(expected, true)) {
+      // something may have been scheduled before polling_ was set, without
+      // waking anyone
+      bool idle;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle = ready_.empty();
+      }
+      if (!done_.load(std::memory_order_acquire)) {
+        io_->poll(idle);
+      }
+      polling_.store(false);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ready_.empty() && !done_.load(std::memory_order_acquire)) {
+      ++sleepers_;
+      cond_.wait(lock);
+      --sleepers_;
+    }
+  }
+}
+
+void Executor::resume(void* handle) {
+  static_cast<CoroutineFrame*>(handle)->resume(handle);
+  while (!tl_finished.empty()) {
+    auto finished = tl_finished.back();
+    tl_finished.pop_back();
+    retire(finished.first, finished.second);
+  }
+}
+
+void Executor::retire(void* handle, AsyncState* state) {
+  auto previous = state->exchange(s_async_finished,
+                                  std::memory_order_acq_rel);
+  if (handle == root_) {
+    stop();
+  }
+  else if (previous == s_async_detached) {
+    destroy(handle);
+  }
+  else if (previous > s_async_collected) {
+    state->store(s_async_collected, std::memory_order_relaxed);
+    schedule((void*)previous);
+  }
+}
+
+void Executor::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_.store(true, std::memory_order_release);
+    cond_.notify_all();
+  }
+  io_->wake();
+}
+
+void async_start(void* handle, AsyncState* state) {
+  auto executor = Executor::current();
+  if (!executor) {
+    async_fail("start_async outside of run_async!");
+  }
+  auto expected = s_async_not_started;
+  if (!state->compare_exchange_strong(expected, s_async_running)) {
+    async_fail("Started an async call twice!");
+  }
+  executor->schedule(handle);
+}
+
+void async_await(void* child, AsyncState* state, void* self) {
+  auto executor = Executor::current();
+  auto expected = s_async_not_started;
+  if (state->compare_exchange_strong(expected, (uintptr_t)self)) {
+    executor->schedule(child);
+    return;
+  }
+  if (expected == s_async_running
+      && state->compare_exchange_strong(expected, (uintptr_t)self)) {
+    return;
+  }
+  if (expected == s_async_finished
+      && state->compare_exchange_strong(expected, s_async_collected)) {
+    executor->schedule(self);
+    return;
+  }
+  async_fail("Awaited an async call twice!");
+}
+
+void async_drop(void* handle, AsyncState* state) {
+  auto expected = s_async_running;
+  if (state->compare_exchange_strong(expected, s_async_detached)) {
+    return;
+  }
+  if (expected == s_async_not_started || expected == s_async_finished
+      || expected == s_async_collected) {
+    destroy(handle);
+    return;
+  }
+  async_fail("Dropped an async call that's being awaited!");
+}
+
+} // namespace bon
@@ -0,0 +1,131 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Event loop and executors for async functions
+|*
+L*----------------------------------------------------------------------------*/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace bon {
+
+// start of a coroutine frame with llvm's switched-resume lowering, which is
+// how the compiler lowers async functions
+struct CoroutineFrame {
+  void (*resume)(void*);
+  void (*destroy)(void*);
+};
+
+// the first word of an async function's promise, shared by the runtime and
+// the generated code. it's one of the constants below, or the handle of the
+// coroutine awaiting it while it runs
+typedef std::atomic<uintptr_t> AsyncState;
+const uintptr_t s_async_not_started = 0;
+const uintptr_t s_async_running = 1;
+const uintptr_t s_async_finished = 2;
+// dropped by its owner while running, destroyed once it finishes
+const uintptr_t s_async_detached = 3;
+// finished, and its result handed to whoever awaited it
+const uintptr_t s_async_collected = 4;
+
+class Executor;
+
+// i/o started by io_read(), io_accept(), ... and awaited by a coroutine.
+// result is what the system call returned, or -errno
+struct IoOp {
+  enum Kind { Read, Write, Accept, Connect };
+
+  Kind kind;
+  int fd;
+  void* buffer;
+  size_t length;
+  // -1 for the current file position (or a socket)
+  int64_t offset;
+  sockaddr_storage address;
+  socklen_t address_length;
+
+  int64_t result;
+  // whether the op is done and/or awaited, see complete() and wait()
+  std::atomic<int> state;
+  void* waiter;
+  Executor* executor;
+
+  IoOp(Kind op_kind, int op_fd);
+  // called once by the backend
+  void complete(int64_t op_result);
+  // schedules handle once the op is done, right away if it already is
+  void wait(void* handle);
+};
+
+// submits i/o to the kernel and completes the ops once it's done.
+// submit() can be called from any thread, poll() from one at a time
+class IoBackend {
+public:
+  // io_uring, unless the kernel doesn't have it (or BON_IO_BACKEND=epoll),
+  // epoll otherwise
+  static IoBackend* create();
+  virtual ~IoBackend() {}
+
+  virtual const char* name() const = 0;
+  virtual void submit(IoOp* op) = 0;
+  // completes the ops that are done, waiting for at least one (or a
+  // wake()) if block
+  virtual void poll(bool block) = 0;
+  // makes a blocked poll() return
+  virtual void wake() = 0;
+};
+
+// resumes ready coroutines on num_threads threads, the one calling run()
+// included. a thread with nothing to resume polls for i/o, or sleeps if
+// another thread already is
+class Executor {
+public:
+  explicit Executor(size_t num_threads);
+  ~Executor();
+
+  // runs root, and whatever it starts or awaits, until root finishes
+  void run(void* root, AsyncState* state);
+  void schedule(void* handle);
+  // handle reached its final suspend point. dealt with once the resume that
+  // got it there returns, as the frame can't be touched before that
+  void finished(void* handle, AsyncState* state);
+  IoBackend &io() { return *io_; }
+
+  // executor running on this thread, nullptr outside of run()
+  static Executor* current();
+
+private:
+  void work();
+  void resume(void* handle);
+  void retire(void* handle, AsyncState* state);
+  void stop();
+
+  size_t num_threads_;
+  std::unique_ptr<IoBackend> io_;
+  std::deque<void*> ready_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  size_t sleepers_;
+  std::atomic<bool> polling_;
+  std::atomic<bool> done_;
+  void* root_;
+};
+
+// the async functions called by the generated code
+void async_start(void* handle, AsyncState* state);
+// self has to have done llvm.coro.save already, and suspends right after
+void async_await(void* child, AsyncState* state, void* self);
+// called by the owner of the handle once it's done with it
+void async_drop(void* handle, AsyncState* state);
+
+} // namespace bon
@@ -0,0 +1,558 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Channels between threads, backing the channel type of the standard library
+|*
+L*----------------------------------------------------------------------------*/
+
+#include "bonChannel.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <new>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bon {
+
+// a thread polls this many times before it goes to sleep, as items are
+// usually handed over within a few hundred cycles in a busy pipeline
+static const int s_spin_count = 64;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+uint32_t EventCount::prepare_wait() {
+  waiters_.fetch_add(1);
+  // pairs with the fence in notify(), either the waiter sees the change to
+  // the condition or the notifier sees the waiter
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return epoch_.load();
+}
+
+void EventCount::cancel_wait() {
+  waiters_.fetch_sub(1);
+}
+
+#ifdef __linux__
+
+void EventCount::wait(uint32_t key) {
+  // returns straight away if epoch_ moved on since prepare_wait()
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAIT_PRIVATE,
+          key, nullptr, nullptr, 0);
+  waiters_.fetch_sub(1);
+}
+
+void EventCount::notify(bool all) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  epoch_.fetch_add(1);
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE,
+          all ? INT_MAX : 1, nullptr, nullptr, 0);
+}
+
+#else
+
+void EventCount::wait(uint32_t key) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this, key] { return epoch_.load() != key; });
+  }
+  waiters_.fetch_sub(1);
+}
+
+void EventCount::notify(bool all) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  epoch_.fetch_add(1);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (all) {
+    cond_.notify_all();
+  }
+  else {
+    cond_.notify_one();
+  }
+}
+
+#endif
+
+namespace {
+
+size_t round_up_pow2(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size *= 2;
+  }
+  return size;
+}
+
+// lamport ring, the sender only writes tail_ and the receiver only head_.
+// each side keeps the last value it read of the other's index, so it only
+// touches the other side's cache line when the ring looks full (or empty)
+class SpscChannel : public Channel {
+public:
+  explicit SpscChannel(size_t capacity)
+    : capacity_(capacity), mask_(capacity - 1), tail_(0), cached_head_(0),
+      head_(0), cached_tail_(0) {}
+  ~SpscChannel() override { std::free(storage_.load()); }
+
+protected:
+  void allocate_storage() override {
+    storage_.store(static_cast<char*>(std::malloc(capacity_ * elem_size_)),
+                   std::memory_order_release);
+  }
+
+  void* try_claim_send() override {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == capacity_) {
+        return nullptr;
+      }
+    }
+    return slot(tail);
+  }
+
+  void publish(void*) override {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  void* try_claim_recv() override {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return nullptr;
+      }
+    }
+    return slot(head);
+  }
+
+  void release(void*) override {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+private:
+  void* slot(size_t index) {
+    return storage_.load(std::memory_order_relaxed)
+           + (index & mask_) * elem_size_;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  // sender side
+  char pad0_[64];
+  std::atomic<size_t> tail_;
+  size_t cached_head_;
+  // receiver side
+  char pad1_[64];
+  std::atomic<size_t> head_;
+  size_t cached_tail_;
+  char pad2_[64];
+};
+
+// vyukov's bounded mpmc queue. every slot has a sequence number, which says
+// whose turn it is: pos when the sender claiming position pos may write it,
+// pos + 1 once it's written, and pos + capacity once it's been received
+class MpmcChannel : public Channel {
+public:
+  explicit MpmcChannel(size_t capacity)
+    : capacity_(capacity), mask_(capacity - 1),
+      sequences_(new std::atomic<size_t>[capacity]),
+      enqueue_pos_(0), dequeue_pos_(0) {
+    for (size_t i = 0; i < capacity; ++i) {
+      sequences_[i].store(i, std::memory_order_relaxed);
+    }
+  }
+  ~MpmcChannel() override {
+    std::free(storage_.load());
+    delete[] sequences_;
+  }
+
+protected:
+  void allocate_storage() override {
+    storage_.store(static_cast<char*>(std::malloc(capacity_ * elem_size_)),
+                   std::memory_order_release);
+  }
+
+  void* try_claim_send() override {
+    auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      auto seq = sequences_[pos & mask_].load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          return slot(pos);
+        }
+      }
+      else if (diff < 0) {
+        return nullptr;
+      }
+      else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void publish(void* slot) override {
+    // nobody else touches the sequence number while the slot is claimed
+    auto &seq = sequences_[index_of(slot)];
+    seq.store(seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+  }
+
+  void* try_claim_recv() override {
+    auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      auto seq = sequences_[pos & mask_].load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          return slot(pos);
+        }
+      }
+      else if (diff < 0) {
+        return nullptr;
+      }
+      else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void release(void* slot) override {
+    auto &seq = sequences_[index_of(slot)];
+    seq.store(seq.load(std::memory_order_relaxed) + capacity_ - 1,
+              std::memory_order_release);
+  }
+
+private:
+  void* slot(size_t pos) {
+    return storage_.load(std::memory_order_relaxed)
+           + (pos & mask_) * elem_size_;
+  }
+  size_t index_of(void* slot) {
+    return (static_cast<char*>(slot) - storage_.load(std::memory_order_relaxed))
+           / elem_size_;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::atomic<size_t>* const sequences_;
+  char pad0_[64];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[64];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[64];
+};
+
+// list of fixed size blocks, so slots never move once claimed. positions
+// are claimed under a lock, items are still written and read outside it.
+// a block is freed by whoever drops the last of its s_block_size + 1
+// references: one per slot, released once the item is received, and one for
+// the receiver side moving on to the next block
+class UnboundedChannel : public Channel {
+public:
+  UnboundedChannel()
+    : stride_(0), head_block_(nullptr), head_index_(0), tail_block_(nullptr),
+      tail_index_(0) {}
+  ~UnboundedChannel() override {
+    auto block = head_block_;
+    while (block) {
+      auto next = block->next;
+      std::free(block);
+      block = next;
+    }
+  }
+
+protected:
+  void allocate_storage() override {
+    // items are 16 byte aligned, after a 16 byte slot header
+    stride_ = s_header_size + (elem_size_ + 15) / 16 * 16;
+    std::lock_guard<std::mutex> lock(mutex_);
+    head_block_ = tail_block_ = new_block();
+    storage_.store(reinterpret_cast<char*>(head_block_),
+                   std::memory_order_release);
+  }
+
+  void* try_claim_send() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tail_index_ == s_block_size) {
+      auto block = new_block();
+      tail_block_->next = block;
+      tail_block_ = block;
+      tail_index_ = 0;
+    }
+    return slot(tail_block_, tail_index_++);
+  }
+
+  void publish(void* slot) override {
+    header(slot)->ready.store(true, std::memory_order_release);
+  }
+
+  void* try_claim_recv() override {
+    if (!storage_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    Block* retired = nullptr;
+    void* claimed = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (head_block_ == tail_block_ && head_index_ == tail_index_) {
+        return nullptr;
+      }
+      if (head_index_ == s_block_size) {
+        retired = head_block_;
+        head_block_ = head_block_->next;
+        head_index_ = 0;
+      }
+      auto next = slot(head_block_, head_index_);
+      if (header(next)->ready.load(std::memory_order_acquire)) {
+        ++head_index_;
+        claimed = next;
+      }
+    }
+    if (retired) {
+      drop_reference(retired);
+    }
+    return claimed;
+  }
+
+  void release(void* slot) override {
+    drop_reference(header(slot)->block);
+  }
+
+private:
+  static const size_t s_block_size = 64;
+  static const size_t s_header_size = 16;
+
+  struct Block {
+    Block* next;
+    std::atomic<size_t> references;
+  };
+  struct SlotHeader {
+    Block* block;
+    std::atomic<bool> ready;
+  };
+
+  static size_t block_header_size() {
+    return (sizeof(Block) + 15) / 16 * 16;
+  }
+
+  Block* new_block() {
+    auto memory = static_cast<char*>(
+                    std::malloc(block_header_size()
+                                + s_block_size * stride_));
+    auto block = new (memory) Block();
+    block->next = nullptr;
+    block->references.store(s_block_size + 1, std::memory_order_relaxed);
+    for (size_t i = 0; i < s_block_size; ++i) {
+      auto slot_header = new (header(slot(block, i))) SlotHeader();
+      slot_header->block = block;
+      slot_header->ready.store(false, std::memory_order_relaxed);
+    }
+    return block;
+  }
+
+  void* slot(Block* block, size_t index) {
+    return reinterpret_cast<char*>(block) + block_header_size()
+           + index * stride_ + s_header_size;
+  }
+  static SlotHeader* header(void* slot) {
+    return reinterpret_cast<SlotHeader*>(static_cast<char*>(slot)
+                                         - s_header_size);
+  }
+
+  void drop_reference(Block* block) {
+    if (block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::free(block);
+    }
+  }
+
+  size_t stride_;
+  std::mutex mutex_;
+  Block* head_block_;
+  size_t head_index_;
+  Block* tail_block_;
+  size_t tail_index_;
+};
+
+} // namespace
+
+Channel* Channel::create(int64_t capacity, bool single) {
+  if (capacity <= 0) {
+    return new UnboundedChannel();
+  }
+  auto size = static_cast<size_t>(capacity);
+  if (single) {
+    return new SpscChannel(round_up_pow2(size));
+  }
+  // the sequence numbers need at least two slots to tell full from empty
+  return new MpmcChannel(round_up_pow2(std::max<size_t>(size, 2)));
+}
+
+void* Channel::send_slot(size_t elem_size, bool block) {
+  if (!storage_.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    if (!storage_.load(std::memory_order_relaxed)) {
+      elem_size_ = std::max<size_t>(elem_size, 1);
+      allocate_storage();
+    }
+  }
+  // counted before closed_ is checked, so a receiver that sees the channel
+  // closed also sees this send (until it's published or has failed)
+  sending_.fetch_add(1);
+  void* slot = claim_send(block);
+  if (!slot) {
+    sending_.fetch_sub(1, std::memory_order_release);
+  }
+  return slot;
+}
+
+void* Channel::claim_send(bool block) {
+  for (int spins = 0; ; ++spins) {
+    if (closed_.load()) {
+      return nullptr;
+    }
+    if (void* slot = try_claim_send()) {
+      return slot;
+    }
+    if (!block) {
+      return nullptr;
+    }
+    if (spins < s_spin_count) {
+      cpu_relax();
+      continue;
+    }
+    // receivers might still be waiting for the start of this thread's batch
+    not_empty_.notify_all();
+    auto key = not_full_.prepare_wait();
+    if (closed_.load()) {
+      not_full_.cancel_wait();
+      return nullptr;
+    }
+    if (void* slot = try_claim_send()) {
+      not_full_.cancel_wait();
+      return slot;
+    }
+    not_full_.wait(key);
+  }
+}
+
+void Channel::sent(void* slot, bool notify) {
+  publish(slot);
+  sending_.fetch_sub(1, std::memory_order_release);
+  if (notify) {
+    not_empty_.notify_one();
+  }
+}
+
+void* Channel::claim_recv(bool block) {
+  for (int spins = 0; ; ++spins) {
+    if (void* slot = try_claim_recv()) {
+      return slot;
+    }
+    if (closed_.load()) {
+      // a send that claimed its slot before close() is still writing it,
+      // which only takes as long as copying the item
+      if (sending_.load() > 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      // anything sent before close() is visible by now
+      return try_claim_recv();
+    }
+    if (!block) {
+      return nullptr;
+    }
+    if (spins < s_spin_count) {
+      cpu_relax();
+      continue;
+    }
+    not_full_.notify_all();
+    auto key = not_empty_.prepare_wait();
+    void* slot = try_claim_recv();
+    if (slot || closed_.load()) {
+      not_empty_.cancel_wait();
+      if (slot) {
+        return slot;
+      }
+      continue;
+    }
+    not_empty_.wait(key);
+  }
+}
+
+void* Channel::find_reserved(bool take) {
+  if (num_reserved_.load(std::memory_order_acquire) == 0) {
+    return nullptr;
+  }
+  auto self = std::this_thread::get_id();
+  std::lock_guard<std::mutex> lock(reserved_mutex_);
+  for (auto it = reserved_.begin(); it != reserved_.end(); ++it) {
+    if (it->first == self) {
+      void* slot = it->second;
+      if (take) {
+        reserved_.erase(it);
+        num_reserved_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+bool Channel::reserve(bool block) {
+  if (find_reserved(false)) {
+    return true;
+  }
+  void* slot = claim_recv(block);
+  if (!slot) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(reserved_mutex_);
+  reserved_.emplace_back(std::this_thread::get_id(), slot);
+  num_reserved_.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+void* Channel::recv_slot() {
+  if (void* slot = find_reserved(true)) {
+    return slot;
+  }
+  return claim_recv(true);
+}
+
+void Channel::received(void* slot, bool notify) {
+  release(slot);
+  if (notify) {
+    not_full_.notify_one();
+  }
+}
+
+void Channel::notify() {
+  not_empty_.notify_all();
+  not_full_.notify_all();
+}
+
+void Channel::close() {
+  closed_.store(true);
+  notify();
+}
+
+} // namespace bon
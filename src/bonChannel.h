@@ -0,0 +1,118 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Channels between threads, backing the channel type of the standard library
+|*
+L*----------------------------------------------------------------------------*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef __linux__
+#include <condition_variable>
+#endif
+
+namespace bon {
+
+// lets threads sleep until a condition they polled might have changed,
+// without a lock around the condition itself. a waiter calls prepare_wait(),
+// checks the condition again, then either cancel_wait() or wait(). whoever
+// changes the condition calls notify afterwards. sleeping is done on a futex
+// (a condition variable on other platforms)
+class EventCount {
+public:
+  EventCount() : epoch_(0), waiters_(0) {}
+
+  uint32_t prepare_wait();
+  void cancel_wait();
+  void wait(uint32_t key);
+  void notify_one() { notify(false); }
+  void notify_all() { notify(true); }
+
+private:
+  void notify(bool all);
+
+  std::atomic<uint32_t> epoch_;
+  std::atomic<uint32_t> waiters_;
+#ifndef __linux__
+  std::mutex mutex_;
+  std::condition_variable cond_;
+#endif
+};
+
+// items are written straight into slots owned by the channel: a sender gets
+// a slot from send_slot(), stores the item in it and hands it back with
+// sent(), a receiver gets one from recv_slot(), copies the item out and
+// hands it back with received(). storage is only allocated by the first
+// send, as that's the first time the size of the items is known
+class Channel {
+public:
+  // capacity <= 0 makes an unbounded channel. single is for a channel with
+  // one sending and one receiving thread (at a time)
+  static Channel* create(int64_t capacity, bool single);
+  // items still in the channel (or reserved and never received) are only
+  // bytes to the runtime, so objects they point to aren't freed
+  virtual ~Channel() {}
+
+  // nullptr if the channel is closed, or full and !block
+  void* send_slot(size_t elem_size, bool block);
+  // notify=false leaves waking up receivers to a later notify() (or the
+  // next time this thread has to wait), so a batch only wakes them once
+  void sent(void* slot, bool notify);
+
+  // claims the next item for the calling thread's next recv_slot(). false
+  // once the channel is closed and empty, or if it's empty and !block
+  bool reserve(bool block);
+  // the item reserved by this thread, or the next one to arrive. nullptr
+  // once the channel is closed and empty
+  void* recv_slot();
+  void received(void* slot, bool notify);
+
+  // wakes everyone waiting on the channel, after a batch
+  void notify();
+  // sends fail after this, receives fail once the rest has been received
+  void close();
+
+protected:
+  Channel()
+    : closed_(false), sending_(0), elem_size_(0), storage_(nullptr),
+      num_reserved_(0) {}
+
+  // nullptr when full
+  virtual void* try_claim_send() = 0;
+  virtual void publish(void* slot) = 0;
+  // nullptr when empty (or the next item is still being written)
+  virtual void* try_claim_recv() = 0;
+  virtual void release(void* slot) = 0;
+  // called once by the first send, before any slot is claimed
+  virtual void allocate_storage() = 0;
+
+  void* claim_send(bool block);
+  void* claim_recv(bool block);
+  // the calling thread's reservation, nullptr if it has none. take removes
+  // it
+  void* find_reserved(bool take);
+
+  std::atomic<bool> closed_;
+  // sends between send_slot() and sent(). receivers don't report the channel
+  // closed until these are published, as a send that claimed its slot just
+  // before close() would otherwise be lost
+  std::atomic<size_t> sending_;
+  size_t elem_size_;
+  std::atomic<char*> storage_;
+  std::mutex storage_mutex_;
+  EventCount not_empty_;
+  EventCount not_full_;
+  // items claimed by reserve(), by the thread they're set aside for.
+  // num_reserved_ lets receivers skip the lock when there are none
+  std::mutex reserved_mutex_;
+  std::vector<std::pair<std::thread::id, void*>> reserved_;
+  std::atomic<size_t> num_reserved_;
+};
+
+} // namespace bon
@@ -9,6 +9,8 @@ L*----------------------------------------------------------------------------*/
 #include "bonLLVM.h"
 #include "auto_scope.h"
 
+#include <algorithm>
+
 namespace bon {
 
 // sentinel value for non-branching paths
@@ -24,6 +26,7 @@ std::unique_ptr<PrototypeAST> copy_proto(PrototypeAST &proto,
                                                    proto.arg_owned_,
                                                    proto.ret_type_);
   new_proto->type_var_ = proto.type_var_;
+  new_proto->returns_slot_ = proto.returns_slot_;
   return new_proto;
 }
 
@@ -49,25 +52,39 @@ Function* CodeGenPass::get_function(std::string name) {
 
 // NumberExprAST
 void CodeGenPass::process(NumberExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
-  returns (node, ConstantFP::get(state_.llvm_context, APFloat(node->Val)));
+  logger_.set_line_column(node->line_num_, node->column_num_);
+  if (resolve_variable(node->type_var_) == FloatType) {
+    returns (node, ConstantFP::get(state_.llvm_context, APFloat(node->Val)));
+  }
+  else {
+    returns (node, ConstantFP::get(get_numeric_type(node->type_var_),
+                                   node->Val));
+  }
 }
 
 // IntegerExprAST
 void CodeGenPass::process(IntegerExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
-  returns (node, ConstantInt::get(state_.llvm_context, APInt(64, node->Val, true)));
+  logger_.set_line_column(node->line_num_, node->column_num_);
+  if (resolve_variable(node->type_var_) == IntType) {
+    returns (node, ConstantInt::get(state_.llvm_context,
+                                    APInt(64, node->Val, true)));
+  }
+  else {
+    // truncates to the literal's type
+    returns (node, ConstantInt::get(get_numeric_type(node->type_var_),
+                                    node->Val, true));
+  }
 }
 
 // StringExprAST
 void CodeGenPass::process(StringExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   returns (node, state_.builder.CreateGlobalStringPtr(node->Val.c_str()));
 }
 
 // BoolExprAST
 void CodeGenPass::process(BoolExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   auto val = node->Val ? 1 : 0;
   returns (node, ConstantInt::get(state_.llvm_context,
            APInt(/*nbits*/1, val, /*is_signed*/false)));
@@ -75,7 +92,7 @@ void CodeGenPass::process(BoolExprAST* node) {
 
 // UnitExprAST
 void CodeGenPass::process(UnitExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   auto ret_val = ConstantInt::get(state_.llvm_context,
                                    APInt(/*nbits*/32, 0,
@@ -85,17 +102,17 @@ void CodeGenPass::process(UnitExprAST* node) {
 
 // VariableExprAST
 void CodeGenPass::process(VariableExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   // Look this variable up in the function.
   Value* var_value = state_.named_values[node->Name];
   if (!var_value)
   {
     std::ostringstream msg;
-    logger.error("syntax error", msg << "variable " << node->Name
-                                     << " is not defined in this scope");
+    logger_.error("syntax error", msg << "variable " << node->Name
+                                      << " is not defined in this scope");
     if (moved_vars_.find(node->Name) != moved_vars_.end()) {
-      logger.set_line_column(moved_vars_[node->Name]);
-      logger.info("note", "ownership was previously transferred:");
+      logger_.set_line_column(moved_vars_[node->Name]);
+      logger_.info("note", "ownership was previously transferred:");
     }
     returns (node, nullptr);
     return;
@@ -108,17 +125,69 @@ void CodeGenPass::process(VariableExprAST* node) {
 void CodeGenPass::process(ValueConstructorExprAST* node) {
   node->push_type_environment();
 
+  // enum values are just the constructor index, so there's nothing to
+  //  allocate (even with new)
+  if (is_enum_type(node->type_var_)) {
+    node->pop_type_environment();
+    auto tcon_enum = get_constructor_value(node->constructor_);
+    returns (node, ConstantInt::get(state_.llvm_context,
+                                    APInt(/*nbits*/32, tcon_enum,
+                                          /*is_signed*/false)));
+    return;
+  }
+
+  // None is a null pointer, and Some(x) is just x, so nothing is allocated
+  //  for either
+  if (auto payload = nullable_payload_type(node->type_var_)) {
+    auto payload_type = cast<PointerType>(get_value_type(payload, true));
+    if (node->tcon_args_.empty()) {
+      node->pop_type_environment();
+      returns (node, ConstantPointerNull::get(payload_type));
+      return;
+    }
+    bool in_constructor = in_constructor_;
+    in_constructor_ = true;
+    node->tcon_args_[0]->run_pass(this);
+    in_constructor_ = in_constructor;
+    node->pop_type_environment();
+    auto object = result();
+    if (!object) {
+      returns (node, nullptr);
+      return;
+    }
+    // with new, the object is what Some would have owned, so it's owned
+    //  the same way the Some would have been
+    if (node->heap_alloc_ && !in_constructor
+        && child_mem_list_.erase(object) > 0) {
+      free_list_.insert(object);
+    }
+    returns (node, state_.builder.CreateBitOrPointerCast(
+                                            object, payload_type,
+                                            object->getName() + ".bitcast"));
+    return;
+  }
+
   bool in_constructor = in_constructor_;
   in_constructor_ = true;
 
+  // field types, the constructor tag is added by get_object_layout
   std::vector<Type*> members;
   std::vector<Value*> member_values;
-  members.push_back(Type::getInt32Ty(state_.llvm_context));
   for (auto &arg : node->tcon_args_) {
     try {
       members.push_back(get_value_type_dispatch(arg.get()));
       arg->run_pass(this);
       auto arg_result = result();
+      // a small object that isn't a new allocation of its own can be a slot
+      //  of a vector's buffer (e.g. from vec's at), so the new object owns a
+      //  copy of it instead
+      if (node->heap_alloc_ && arg_result && is_inline_type(arg->type_var_)
+          && !is_soa_type(arg->type_var_)
+          && arg_result->getType()->isPointerTy()
+          && child_mem_list_.count(arg_result) == 0) {
+        arg_result = copy_inline_object(arg_result);
+        child_mem_list_.insert(arg_result);
+      }
       member_values.push_back(arg_result);
     } catch(std::exception &ex) {
       std::cout << node->constructor_ << " failed with arg "
@@ -131,14 +200,32 @@ void CodeGenPass::process(ValueConstructorExprAST* node) {
     in_constructor_ = false;
   }
 
-  auto tname = node->type_var_->get_name();
-  StructType* structReg = state_.struct_map[tname];
-  if (true) {//!structReg) {
-    structReg = StructType::create(state_.llvm_context, members,
-                                   "struct." + tname);
-    state_.struct_map[tname] = structReg;
+  if (is_soa_type(node->type_var_)) {
+    if (node->heap_alloc_) {
+      logger_.error("codegen error", "objects of @soa class " +
+                    node->constructor_ + " can't be heap allocated");
+    }
+    auto obj_ref = alloc_soa_object(node->type_var_, node->constructor_);
+    auto storage_type = get_soa_storage_type(node->type_var_);
+    for (size_t i = 0; i < member_values.size(); ++i) {
+      auto field_type = storage_type->getElementType(i);
+      auto field_ptr = get_soa_field_ptr(obj_ref, i, field_type);
+      auto val_bitcast =
+        state_.builder.CreateBitOrPointerCast(member_values[i], field_type,
+                                              member_values[i]->getName()
+                                              + ".bitcast");
+      state_.builder.CreateStore(val_bitcast, field_ptr);
+    }
+    node->pop_type_environment();
+    returns (node, obj_ref);
+    return;
   }
 
+  auto tname = node->type_var_->get_name();
+  auto &layout = get_object_layout(node->constructor_, members, tname);
+  StructType* structReg = layout.type;
+  state_.struct_map[tname] = structReg;
+
   assert(!structReg->isPointerTy());
   auto structRegPtr = PointerType::get(structReg, 0);
   // structReg->dump();
@@ -173,26 +260,26 @@ void CodeGenPass::process(ValueConstructorExprAST* node) {
 
   MDNode* metadata = MDNode::get(state_.llvm_context,
                                 MDString::get(state_.llvm_context,
-                                logger.get_context()));
+                                logger_.get_context()));
   val_alloc->setMetadata("context", metadata);
 
   Value* ArgValuePtr =
-        state_.builder.CreateStructGEP(structReg, val_alloc, 0,
-                                       val_alloc->getName() + ".at(0)");
+        state_.builder.CreateStructGEP(structReg, val_alloc, layout.tag_index,
+                                       val_alloc->getName() + ".tag");
 
   auto tcon_enum = get_constructor_value(node->constructor_);
   auto tcon_val = ConstantInt::get(state_.llvm_context,
                                    APInt(/*nbits*/32, tcon_enum,
                                          /*is_signed*/false));
   auto result = state_.builder.CreateStore(tcon_val, ArgValuePtr);
-  size_t offset = 1;
-  for (auto &val : member_values) {
-    // structReg->dump();
+  for (size_t i = 0; i < member_values.size(); ++i) {
+    auto &val = member_values[i];
+    auto offset = layout.field_indices[i];
     auto val_name = val_alloc->getName();
     auto val_ptr =
       state_.builder.CreateStructGEP(structReg, val_alloc, offset,
                                      val_name + ".at("
-                                              + std::to_string(offset)
+                                              + std::to_string(i + 1)
                                               + ")");
     // trust type checker and cast to generic pointer type for e.g. variant args
     auto val_bitcast =
@@ -201,7 +288,6 @@ void CodeGenPass::process(ValueConstructorExprAST* node) {
                                         structReg->getStructElementType(offset),
                                         val->getName() + ".bitcast");
     state_.builder.CreateStore(val_bitcast, val_ptr);
-    ++offset;
   }
 
   returns (node, val_alloc);
@@ -216,7 +302,7 @@ void CodeGenPass::process(UnaryExprAST* node) {
 
   node->Operand->run_pass(this);
   Value* operand_value = result();
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   if (!operand_value) {
     returns (node, nullptr);
     return;
@@ -256,9 +342,9 @@ void CodeGenPass::process(UnaryExprAST* node) {
   if (state_.method_to_typeclass.find(callee) !=
       state_.method_to_typeclass.end()) {
     if (!is_concrete_type(node->Operand->type_var_)) {
-      logger.error("error",
-                   "unable to infer type of operand for unary operator "
-                   + callee);
+      logger_.error("error",
+                    "unable to infer type of operand for unary operator "
+                    + callee);
       returns (node, nullptr);
       return;
     }
@@ -271,8 +357,8 @@ void CodeGenPass::process(UnaryExprAST* node) {
                                                       func_type_var);
   if (func == nullptr) {
     std::ostringstream msg;
-    logger.error("syntax error", msg << "undefined unary operator "
-                                     << node->Opcode);
+    logger_.error("syntax error", msg << "undefined unary operator "
+                                      << node->Opcode);
     returns (node, nullptr);
     return;
   }
@@ -288,19 +374,20 @@ void CodeGenPass::process(UnaryExprAST* node) {
     F = get_function(mangled_name);
     if (!F) {
       std::ostringstream msg;
-      logger.error("syntax error", msg << "undefined unary operator "
-                                       << node->Opcode);
+      logger_.error("syntax error", msg << "undefined unary operator "
+                                        << node->Opcode);
       returns (node, nullptr);
       return;
     }
   }
 
-  returns (node, state_.builder.CreateCall(F, operand_value, "unaryop"));
+  auto ret_val = state_.builder.CreateCall(F, operand_value, "unaryop");
+  returns (node, spill_returned_value(ret_val));
 }
 
 // BinaryExprAST
 void CodeGenPass::process(BinaryExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   push_environment(node->Env);
   AutoScope pop_env([this, node]{
     pop_environment();
@@ -330,9 +417,36 @@ void CodeGenPass::process(BinaryExprAST* node) {
   Value* variable = nullptr;
   Function* function = nullptr;
 
+  if (node->Op != tok_assign && node->Op != tok_dot
+      && is_simd_type(node->LHS->type_var_)) {
+    returns (node, simd_binary_op(node, l_value, r_value));
+    return;
+  }
+
   switch (node->Op) {
   case tok_assign:
     {
+    // whether a variable's object was moved into the object stored to
+    bool rhs_moved = false;
+    // reading an object stored by value out of a buffer into a variable:
+    //  take a copy, so later writes to the slot (e.g. in swap) don't
+    //  change the value seen through the variable
+    if (!l_value && is_inline_element(node->RHS.get())
+        && is_soa_type(node->RHS->type_var_)) {
+      auto copy = alloc_soa_object(node->RHS->type_var_,
+                                   node->LHS->getName() + ".copy");
+      copy_soa_object(copy, r_value, node->RHS->type_var_);
+      r_value = copy;
+    }
+    else if (!l_value && is_inline_element(node->RHS.get())) {
+      function = state_.builder.GetInsertBlock()->getParent();
+      IRBuilder<> TmpB(&function->getEntryBlock(),
+                       function->getEntryBlock().begin());
+      auto copy = TmpB.CreateAlloca(r_value->getType()->getPointerElementType(),
+                                    0, node->LHS->getName() + ".copy");
+      state_.builder.CreateStore(state_.builder.CreateLoad(r_value), copy);
+      r_value = copy;
+    }
     // Look up the name.
     if (l_value) {
       variable = l_value;
@@ -385,11 +499,35 @@ void CodeGenPass::process(BinaryExprAST* node) {
     else if (tracked_allocs_.find(node->RHS->getName())
         != tracked_allocs_.end()) {
       // storing into object, so we're transferring ownership into it
-      free_list_.erase(tracked_allocs_[node->RHS->getName()]);
+      rhs_moved = free_list_.erase(tracked_allocs_[node->RHS->getName()]) > 0;
+    }
+
+    // writing into a slot of a buffer that stores objects by value:
+    //  copy the object's fields into the slot instead of storing a pointer.
+    //  the slot only keeps the copy, so an object moved into it is freed
+    if (l_value && is_inline_element(node->LHS.get())) {
+      if (is_soa_type(node->LHS->type_var_)) {
+        copy_soa_object(l_value, r_value, node->LHS->type_var_);
+      }
+      else {
+        auto src = state_.builder.CreateBitOrPointerCast(
+                                              r_value,
+                                              l_value->getType(),
+                                              r_value->getName() + ".bitcast");
+        state_.builder.CreateStore(state_.builder.CreateLoad(src), l_value);
+      }
+      if (rhs_moved) {
+        free_obj(tracked_allocs_[node->RHS->getName()], false);
+      }
+      returns (node, r_value);
+      return;
     }
 
     // Store the initial value into the alloca.
-    state_.builder.CreateStore(r_value, variable);
+    auto store = state_.builder.CreateStore(r_value, variable);
+    if (l_value && is_typed_access(node->LHS.get())) {
+      set_tbaa(store, r_value->getType());
+    }
     // named_values_[LHS->getName()] = r_value;
     returns (node, r_value);
     return;
@@ -403,11 +541,25 @@ void CodeGenPass::process(BinaryExprAST* node) {
       std::string constructor = get_constructor_from_type(node->LHS->type_var_);
       std::string field = node->RHS->getName();
       auto field_index = get_constructor_field_index(constructor, field);
+      // @soa objects keep each field in its own column
+      if (is_soa_type(node->LHS->type_var_)) {
+        auto storage_type = get_soa_storage_type(node->LHS->type_var_);
+        auto field_ptr =
+          get_soa_field_ptr(l_value, field_index,
+                            storage_type->getElementType(field_index));
+        if (node->is_lvalue) {
+          returns (node, field_ptr);
+        }
+        else {
+          returns (node, state_.builder.CreateLoad(field_ptr));
+        }
+        return;
+      }
       auto tname = node->LHS->type_var_->get_name(false);
       Type* structReg = state_.struct_map[tname];
       if (!structReg) {
         structReg = get_value_type_dispatch(node->LHS.get())->getArrayElementType();
-        // bon::logger.error("internal error",
+        // logger_.error("internal error",
         //                   "struct type not found for type: " + tname);
       }
       // get constants for our indices
@@ -415,11 +567,12 @@ void CodeGenPass::process(BinaryExprAST* node) {
                                       APInt(/*nbits*/32, 0, /*is_signed*/false));
       auto el_idx1 = ConstantInt::get(state_.llvm_context,
                                       APInt(/*nbits*/32,
-                                            field_index+1,
+                                            get_field_index(structReg,
+                                                            field_index),
                                             /*is_signed*/false));
 
       // first index (0) dereferences pointer to struct,
-      // second index (field_index+1) points at constructor field
+      // second index points at constructor field
       //  (e.g. x in Point2D(x:int, y:int))
       std::vector<Value*> indices;
       indices.push_back(el_idx0);
@@ -433,7 +586,9 @@ void CodeGenPass::process(BinaryExprAST* node) {
       // only load if not an lvalue
       if (!node->is_lvalue) {
         // load field
-        patt_type_val = state_.builder.CreateLoad(patt_type_ptr);
+        auto load = state_.builder.CreateLoad(patt_type_ptr);
+        set_tbaa(load, load->getType());
+        patt_type_val = load;
       }
       else {
         auto obj_node = dynamic_cast<VariableExprAST*>(node->LHS.get());
@@ -448,6 +603,12 @@ void CodeGenPass::process(BinaryExprAST* node) {
       returns (node, patt_type_val);
     }
     return;
+  case tok_pow:
+    if (is_float_type(node->LHS->type_var_)) {
+      returns (node, build_pow(l_value, r_value));
+      return;
+    }
+    break;
   case tok_and:
     // TODO: this is wrong (need to support lazy eval)
     returns (node, state_.builder.CreateAnd(l_value, r_value, "andtmp"));
@@ -460,7 +621,12 @@ void CodeGenPass::process(BinaryExprAST* node) {
     returns (node, state_.builder.CreateShl(l_value, r_value, "shltmp"));
     return;
   case tok_rshift:
-    returns (node, state_.builder.CreateAShr(l_value, r_value, "shrtmp"));
+    if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateLShr(l_value, r_value, "shrtmp"));
+    }
+    else {
+      returns (node, state_.builder.CreateAShr(l_value, r_value, "shrtmp"));
+    }
     return;
   case tok_bt_xor:
     returns (node, state_.builder.CreateXor(l_value, r_value, "bt_xortmp"));
@@ -472,115 +638,138 @@ void CodeGenPass::process(BinaryExprAST* node) {
     returns (node, state_.builder.CreateOr(l_value, r_value, "bt_ortmp"));
     return;
   case tok_rem:
-    if (resolve_variable(node->LHS->type_var_) == IntType) {
+    if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateURem(l_value, r_value, "remtmp"));
+    }
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateSRem(l_value, r_value, "remtmp"));
     }
-    else if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    else if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFRem(l_value, r_value, "remtmp"));
     }
     else {
       std::ostringstream msg;
-      logger.error("codegen error", msg << "remainder operator % "
-                                        << "not defined for type "
-                                        << node->LHS->type_var_->get_name());
+      logger_.error("codegen error", msg << "remainder operator % "
+                                         << "not defined for type "
+                                         << node->LHS->type_var_->get_name());
       returns (node, nullptr);
       return;
     }
     return;
   case tok_add:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFAdd(l_value, r_value, "addtmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateAdd(l_value, r_value, "addtmp"));
       return;
     }
     else {
       std::ostringstream msg;
-      logger.error("codegen error", msg << "operator + not defined for type "
-                                        << node->LHS->type_var_->get_name());
+      logger_.error("codegen error", msg << "operator + not defined for type "
+                                         << node->LHS->type_var_->get_name());
       returns (node, nullptr);
       return;
     }
   case tok_sub:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFSub(l_value, r_value, "subtmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateSub(l_value, r_value, "subtmp"));
       return;
     }
   case tok_mul:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFMul(l_value, r_value, "multmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateMul(l_value, r_value, "multmp"));
       return;
     }
   case tok_div:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFDiv(l_value, r_value, "divtmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateUDiv(l_value, r_value, "divtmp"));
+      return;
+    }
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateSDiv(l_value, r_value, "divtmp"));
       return;
     }
   case tok_gt:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFCmpUGT(l_value, r_value, "cmptmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateICmpUGT(l_value, r_value, "cmptmp"));
+      return;
+    }
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateICmpSGT(l_value, r_value, "cmptmp"));
       return;
     }
   case tok_lt:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFCmpULT(l_value, r_value, "cmptmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateICmpULT(l_value, r_value, "cmptmp"));
+      return;
+    }
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateICmpSLT(l_value, r_value, "cmptmp"));
       return;
     }
   case tok_gteq:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFCmpUGE(l_value, r_value, "cmptmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateICmpUGE(l_value, r_value, "cmptmp"));
+      return;
+    }
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateICmpSGE(l_value, r_value, "cmptmp"));
       return;
     }
   case tok_lteq:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFCmpULE(l_value, r_value, "cmptmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_unsigned_type(node->LHS->type_var_)) {
+      returns (node, state_.builder.CreateICmpULE(l_value, r_value, "cmptmp"));
+      return;
+    }
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateICmpSLE(l_value, r_value, "cmptmp"));
       return;
     }
   case tok_eq:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFCmpUEQ(l_value, r_value, "cmptmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateICmpEQ(l_value, r_value, "cmptmp"));
       return;
     }
   case tok_neq:
-    if (resolve_variable(node->LHS->type_var_) == FloatType) {
+    if (is_float_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateFCmpUNE(l_value, r_value, "cmptmp"));
       return;
     }
-    else if (resolve_variable(node->LHS->type_var_) == IntType) {
+    else if (is_integer_type(node->LHS->type_var_)) {
       returns (node, state_.builder.CreateICmpNE(l_value, r_value, "cmptmp"));
       return;
     }
@@ -600,9 +789,9 @@ void CodeGenPass::process(BinaryExprAST* node) {
       state_.method_to_typeclass.end()) {
     if (!is_concrete_type(node->LHS->type_var_) ||
         !is_concrete_type(node->RHS->type_var_)) {
-      logger.error("error",
-                   "unable to infer type of operand for binary operator "
-                   + Callee);
+      logger_.error("error",
+                    "unable to infer type of operand for binary operator "
+                    + Callee);
       returns (node, nullptr);
       return;
     }
@@ -615,8 +804,8 @@ void CodeGenPass::process(BinaryExprAST* node) {
                                                                func_type_var);
   if (function_node == nullptr) {
     std::ostringstream msg;
-    logger.error("syntax error", msg << "undefined binary operator "
-                                     << Tokenizer::token_type(node->Op));
+    logger_.error("syntax error", msg << "undefined binary operator "
+                                      << Tokenizer::token_type(node->Op));
     returns (node, nullptr);
     return;
   }
@@ -632,8 +821,8 @@ void CodeGenPass::process(BinaryExprAST* node) {
     F = get_function(mangled_name);
     if (!F) {
       std::ostringstream msg;
-      logger.error("syntax error", msg << "undefined binary operator "
-                                       << Tokenizer::token_type(node->Op));
+      logger_.error("syntax error", msg << "undefined binary operator "
+                                        << Tokenizer::token_type(node->Op));
       returns (node, nullptr);
       return;
     }
@@ -643,12 +832,13 @@ void CodeGenPass::process(BinaryExprAST* node) {
   call_args.push_back(l_value);
   call_args.push_back(r_value);
 
-  returns (node, state_.builder.CreateCall(F, call_args, "binop"));
+  auto ret_val = state_.builder.CreateCall(F, call_args, "binop");
+  returns (node, spill_returned_value(ret_val));
 }
 
 // IfExprAST
 void CodeGenPass::process(IfExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   node->Cond->run_pass(this);
   Value* CondV = result();
   if (!CondV) {
@@ -723,7 +913,7 @@ void CodeGenPass::process(IfExprAST* node) {
 
 // WhileExprAST
 void CodeGenPass::process(WhileExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   Function* function = state_.builder.GetInsertBlock()->getParent();
   BasicBlock* precond_block = state_.builder.GetInsertBlock();
@@ -779,6 +969,86 @@ void CodeGenPass::process(WhileExprAST* node) {
   returns (node, ret_val);
 }
 
+// ForExprAST
+void CodeGenPass::process(ForExprAST* node) {
+  logger_.set_line_column(node->line_num_, node->column_num_);
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto module = state_.current_module.get();
+
+  node->generator_->run_pass(this);
+  Value* handle = result();
+  if (!handle) {
+    returns (node, nullptr);
+    return;
+  }
+  // a generator made just for this loop (rather than one held in a
+  //  variable) is destroyed as soon as the loop is done with it, which lets
+  //  its frame live on the stack once the generator is inlined
+  bool owned = free_list_.erase(handle) > 0;
+
+  auto item_type = get_generator_item_type(node->var_->type_var_);
+  if (!item_type) {
+    logger_.error("codegen error", "a generator has to yield values");
+    returns (node, nullptr);
+    return;
+  }
+
+  Function* function = builder.GetInsertBlock()->getParent();
+  BasicBlock* loop_block = BasicBlock::Create(context, "loop", function);
+  BasicBlock* loop_start_block = BasicBlock::Create(context, "loopStart",
+                                                    function);
+  BasicBlock* after_block = BasicBlock::Create(context, "afterFor", function);
+
+  builder.CreateBr(loop_block);
+
+  // run the generator up to its next yield, or the end of its body
+  builder.SetInsertPoint(loop_block);
+  builder.CreateCall(Intrinsic::getDeclaration(module, Intrinsic::coro_resume),
+                     handle);
+  auto done = builder.CreateCall(
+                      Intrinsic::getDeclaration(module, Intrinsic::coro_done),
+                      handle, "done");
+  builder.CreateCondBr(done, after_block, loop_start_block);
+
+  builder.SetInsertPoint(loop_start_block);
+  auto promise = builder.CreateCall(
+                  Intrinsic::getDeclaration(module, Intrinsic::coro_promise),
+                  {handle, builder.getInt32(get_promise_alignment(item_type)),
+                   builder.getFalse()},
+                  "promise");
+  auto item_ptr = builder.CreateBitCast(promise, item_type->getPointerTo());
+  // objects are borrowed from the generator until it moves on, small
+  //  ones are copied out
+  Value* item = spill_returned_value(
+                      builder.CreateLoad(item_ptr, node->var_->Name.c_str()));
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                   function->getEntryBlock().begin());
+  auto variable = TmpB.CreateAlloca(item->getType(), 0,
+                                    node->var_->Name.c_str());
+  builder.CreateStore(item, variable);
+  state_.named_values[node->var_->Name] = variable;
+  borrowed_list_.insert(variable);
+
+  node->body_->run_pass(this);
+  if (!result()) {
+    returns (node, nullptr);
+    return;
+  }
+  builder.CreateBr(loop_block);
+
+  builder.SetInsertPoint(after_block);
+  if (owned) {
+    builder.CreateCall(
+            Intrinsic::getDeclaration(module, Intrinsic::coro_destroy),
+            handle);
+  }
+
+  auto ret_val = ConstantInt::get(context, APInt(/*nbits*/32, 0,
+                                                 /*is_signed*/false));
+  returns (node, ret_val);
+}
+
 // MatchCaseExprAST
 void CodeGenPass::process(MatchCaseExprAST* node) {
   CaseState case_state = pop_case();
@@ -825,7 +1095,7 @@ void CodeGenPass::process(MatchCaseExprAST* node) {
 
 // MatchExprAST
 void CodeGenPass::process(MatchExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   node->pattern_->run_pass(this);
   Value* pattern = result();
@@ -930,9 +1200,7 @@ TypeVariable* CodeGenPass::fn_type_from_call(CallExprAST* node) {
   return func_type_var;
 }
 
-// CallExprAST
-void CodeGenPass::process(CallExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+Function* CodeGenPass::get_callee(CallExprAST* node) {
   // push_environment(node->Env);
   // AutoScope pop_env([node]{ node->Env = pop_environment(); });
 
@@ -972,55 +1240,180 @@ void CodeGenPass::process(CallExprAST* node) {
 
   if (!CalleeF) {
     std::cout << "mangled name: " << mangled_name << std::endl;
-    logger.error("syntax error", "undefined function referenced");
-    returns (node, nullptr);
-    return;
+    logger_.error("syntax error", "undefined function referenced");
   }
+  return CalleeF;
+}
 
+bool CodeGenPass::gen_call_args(CallExprAST* node, Function* callee,
+                                std::vector<Value*> &arg_values) {
   // check if number of args matches function prototype
-  if (CalleeF->arg_size() != node->Args.size()) {
+  if (callee->arg_size() != node->Args.size()) {
     std::ostringstream msg;
-    logger.error("error", msg << "function " << node->Callee << " takes "
-                              << CalleeF->arg_size() << " argument(s), but "
-                              << node->Args.size() << " were given");
-    returns (node, nullptr);
-    return;
+    logger_.error("error", msg << "function " << node->Callee << " takes "
+                               << callee->arg_size() << " argument(s), but "
+                               << node->Args.size() << " were given");
+    return false;
   }
 
   std::vector<Type*> arg_types;
-  for (auto &a : CalleeF->args()) {
+  for (auto &a : callee->args()) {
     arg_types.push_back(a.getType());
   }
 
-  std::vector<Value*> arg_values;
   for (unsigned i = 0, e = node->Args.size(); i != e; ++i) {
     auto &arg_node = node->Args[i];
     arg_node->run_pass(this);
     auto arg = result();
+    if (!arg) {
+      return false;
+    }
     // trust type checker and cast to generic pointer type for e.g. variant args
     auto arg_bitcast =
       state_.builder.CreateBitOrPointerCast(arg, arg_types[i],
                                             arg->getName() + ".bitcast");
-
     arg_values.push_back(arg_bitcast);
-    if (!arg_values.back()) {
+  }
+  return true;
+}
+
+// CallExprAST
+void CodeGenPass::process(CallExprAST* node) {
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  // numeric conversion, e.g. i32(x) or x.f64()
+  if (auto target = sized_numeric_type(node->Callee)) {
+    auto &arg = node->Args[0];
+    arg->run_pass(this);
+    auto value = result();
+    if (!value) {
+      returns (node, nullptr);
+      return;
+    }
+    if (!is_numeric_type(arg->type_var_)) {
+      std::ostringstream msg;
+      logger_.error("codegen error", msg << "can't convert "
+                                         << arg->type_var_->get_name()
+                                         << " to " << node->Callee);
       returns (node, nullptr);
       return;
     }
+    returns (node, convert_numeric(value, arg->type_var_, target));
+    return;
+  }
+
+  if (simd_type(node->Callee) || is_simd_builtin(node->Callee)) {
+    returns (node, simd_builtin(node));
+    return;
+  }
+
+  // only looks at the type of its argument, which isn't evaluated
+  if (node->Callee == "is_soa") {
+    auto soa = is_soa_type(node->Args[0]->type_var_);
+    returns (node, ConstantInt::get(state_.llvm_context,
+                                    APInt(/*nbits*/1, soa ? 1 : 0,
+                                          /*is_signed*/false)));
+    return;
+  }
+
+  if (node->Callee == "array"
+      || (is_array_method(node->Callee) && !node->Args.empty()
+          && is_array_type(node->Args[0]->type_var_))) {
+    returns (node, array_builtin(node));
+    return;
+  }
+  if (node->Callee == "spawn" || node->Callee == "join") {
+    returns (node, task_builtin(node));
+    return;
+  }
+
+  if (is_parallel_builtin(node->Callee)) {
+    returns (node, parallel_builtin(node));
+    return;
+  }
+
+  if (is_atomic_builtin(node->Callee)) {
+    returns (node, atomic_builtin(node));
+    return;
+  }
+
+  if (node->Callee == "await") {
+    returns (node, await_builtin(node));
+    return;
+  }
+
+  if (is_async_builtin(node->Callee)) {
+    returns (node, async_builtin(node));
+    return;
+  }
+
+  if (node->Callee == "yield") {
+    returns (node, yield_builtin(node));
+    return;
+  }
+
+  Function* CalleeF = get_callee(node);
+  std::vector<Value*> arg_values;
+  if (!CalleeF || !gen_call_args(node, CalleeF, arg_values)) {
+    returns (node, nullptr);
+    return;
+  }
+
+  // libm functions declared with cdef become llvm intrinsics, so they can
+  //  be constant folded and vectorized
+  if (auto intrinsic = get_math_intrinsic(CalleeF)) {
+    returns (node, state_.builder.CreateCall(intrinsic, arg_values,
+                                             "calltmp"));
+    return;
   }
 
   auto ret_val = state_.builder.CreateCall(CalleeF, arg_values, "calltmp");
-  if (ret_val->getType()->isPointerTy()) {
+  if (is_inline_type(node->type_var_) && returns_slot(CalleeF)) {
+    // a slot of a buffer (e.g. v[i]), which still belongs to the buffer
+    returns (node, ret_val);
+    return;
+  }
+  if (returns_by_value(CalleeF) || returns_soa_copy(CalleeF)) {
+    // small objects come back in registers, and then live on the stack
+    //  like any other local object, so there's nothing to free
+    returns (node, spill_returned_value(ret_val));
+    return;
+  }
+  // i/o belongs to the runtime until it's awaited
+  if (ret_val->getType()->isPointerTy()
+      && resolve_variable(node->type_var_) != IoType) {
     // take ownership of memory of returned object
     free_list_.insert(ret_val);
+    if (nullable_payload_type(node->type_var_)) {
+      // it may be None, which free_obj has to check for
+      alloc_types_[ret_val] = node->type_var_;
+    }
+    if (is_generator_type(node->type_var_)) {
+      generator_handles_.insert(ret_val);
+    }
+    else if (is_async_type(node->type_var_)) {
+      async_handles_[ret_val] =
+              get_async_promise_type(async_result_type(node->type_var_));
+    }
+    else if (is_task_type(node->type_var_)) {
+      task_handles_[ret_val] =
+              resolve_variable(node->type_var_)->type_operator_->types_[0];
+    }
   }
   returns (node, ret_val);
 }
 
 // SizeofExprAST
 void CodeGenPass::process(SizeofExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   auto val_type = get_value_type_dispatch(node->arg_.get());
+  if (is_soa_type(node->arg_->type_var_)) {
+    val_type = get_soa_storage_type(node->arg_->type_var_);
+  }
+  // objects stored by value take up their full size, not a pointer's
+  if (is_inline_type(node->arg_->type_var_) && val_type->isPointerTy()) {
+    val_type = val_type->getPointerElementType();
+  }
   auto data_layout = new DataLayout(state_.current_module.get());
   auto alloc_size = data_layout->getTypeAllocSize(val_type);
   returns (node, ConstantInt::get(state_.llvm_context,
@@ -1029,7 +1422,7 @@ void CodeGenPass::process(SizeofExprAST* node) {
 
 // PtrOffsetExprAST
 void CodeGenPass::process(PtrOffsetExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   // get constants for our indices
   auto el_idx0 = ConstantInt::get(state_.llvm_context,
@@ -1053,7 +1446,42 @@ void CodeGenPass::process(PtrOffsetExprAST* node) {
   indices.push_back(offset);
 
   push_environment(node->type_env_);
+  if (is_soa_type(node->type_var_)) {
+    pop_environment();
+    if (!node->capacity_) {
+      logger_.error("codegen error", "buffer of @soa objects indexed without "
+                                     "its capacity, expected "
+                                     "ptr_offset(data, index, capacity)");
+      returns (node, nullptr);
+      return;
+    }
+    node->capacity_->run_pass(this);
+    Value* capacity = result();
+    if (!capacity) {
+      return;
+    }
+    // columns are capacity cells long, and element i is the i-th cell
+    //  of each column
+    auto cell_type = Type::getInt64Ty(state_.llvm_context);
+    l_value = state_.builder.CreateBitOrPointerCast(
+                                      l_value,
+                                      cell_type->getPointerTo(),
+                                      l_value->getName() + ".bitcast");
+    Value* elem_ptr = state_.builder.CreateGEP(cell_type, l_value, indices);
+    auto cell_size = ConstantInt::get(state_.llvm_context,
+                                      APInt(/*nbits*/64, 8,
+                                            /*is_signed*/false));
+    auto stride = state_.builder.CreateMul(capacity, cell_size, "soa.stride");
+    returns (node, build_soa_ref(elem_ptr, stride));
+    return;
+  }
   auto arg_type = get_value_type_dispatch(node);
+  // small classes are stored by value in the buffer, so index over the
+  //  objects themselves, and use the element's address as the reference
+  bool inline_element = is_inline_type(node->type_var_);
+  if (inline_element && arg_type->isPointerTy()) {
+    arg_type = arg_type->getPointerElementType();
+  }
   pop_environment();
   l_value = state_.builder.CreateBitOrPointerCast(
                                     l_value,
@@ -1066,16 +1494,84 @@ void CodeGenPass::process(PtrOffsetExprAST* node) {
 
   auto offset_val = offset_ptr;
   // if rvalue, dereference pointer to load obj->field[index]
-  if (!node->is_lvalue) {
-    offset_val = state_.builder.CreateLoad(offset_ptr);
+  if (!node->is_lvalue && !inline_element) {
+    auto load = state_.builder.CreateLoad(offset_ptr);
+    set_tbaa(load, load->getType());
+    offset_val = load;
   }
 
   returns (node, offset_val);
 }
 
+Type* CodeGenPass::get_return_type(TypeVariable* ret_type) {
+  Type* return_type = nullptr;
+  ret_type = resolve_variable(ret_type);
+  if (ret_type == FloatType) {
+    return_type = Type::getDoubleTy(state_.llvm_context);
+  }
+  else if (ret_type == IntType) {
+    return_type = Type::getInt64Ty(state_.llvm_context);
+  }
+  else if (is_numeric_type(ret_type) || is_simd_type(ret_type)
+           || is_array_type(ret_type)) {
+    return_type = get_numeric_type(ret_type);
+  }
+  else if (ret_type == BoolType) {
+    return_type = Type::getInt1Ty(state_.llvm_context);
+  }
+  else if (is_enum_type(ret_type)) {
+    return_type = Type::getInt32Ty(state_.llvm_context);
+  }
+  else if (ret_type == StringType) {
+    return_type = Type::getInt8PtrTy(state_.llvm_context);
+  }
+  else if (ret_type == UnitType) {
+    return_type = Type::getVoidTy(state_.llvm_context);
+    // return_type = get_value_type(ret_type, is_boxed_type(ret_type));
+  }
+  else if (is_pointer_type(ret_type)) {
+    auto ptr_type = get_type_of_pointer(ret_type);
+    return_type = get_element_type(ptr_type);
+    if (!return_type) {
+      return_type = Type::getVoidTy(state_.llvm_context);
+    }
+    return_type = PointerType::get(return_type, 0);
+  }
+  else if (ret_type == CPointerType) {
+    auto ptr_type = Type::getVoidTy(state_.llvm_context);
+    auto storage_type = PointerType::get(ptr_type, 0);
+    return_type = storage_type;
+  }
+  else if (is_task_type(ret_type) || is_generator_type(ret_type)
+           || is_async_type(ret_type) || ret_type == IoType) {
+    return_type = Type::getInt8PtrTy(state_.llvm_context);
+  }
+  else if (is_atomic_type(ret_type)) {
+    return_type = get_atomic_cell_type(ret_type)->getPointerTo();
+  }
+  else if (is_soa_type(ret_type)) {
+    return_type = get_soa_ref_type();
+  }
+  else if (is_inline_type(ret_type)) {
+    // small objects are returned by value rather than heap allocated
+    return_type = get_value_type(ret_type, false);
+  }
+  else if (auto arg_type = get_value_type(ret_type, is_boxed_type(ret_type))) {
+    if (!arg_type->isPointerTy()) {
+      arg_type = PointerType::get(arg_type, 0);
+    }
+    return_type = arg_type;
+  }
+  else {
+    // TODO: this can happen with top-level expressions
+    return_type = Type::getVoidTy(state_.llvm_context);
+  }
+  return return_type;
+}
+
 // PrototypeAST
 void CodeGenPass::process(PrototypeAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   FunctionType* function_type = nullptr;
 
   std::vector<TypeVariable*> arg_vars = get_function_arg_types(node->type_var_);
@@ -1088,15 +1584,22 @@ void CodeGenPass::process(PrototypeAST* node) {
     else if (type == IntType) {
       arg_types.push_back(Type::getInt64Ty(state_.llvm_context));
     }
+    else if (is_numeric_type(type) || is_simd_type(type)
+             || is_array_type(type)) {
+      arg_types.push_back(get_numeric_type(type));
+    }
     else if (type == BoolType) {
       arg_types.push_back(Type::getInt1Ty(state_.llvm_context));
     }
+    else if (is_enum_type(type)) {
+      arg_types.push_back(Type::getInt32Ty(state_.llvm_context));
+    }
     else if (type == StringType) {
       arg_types.push_back(Type::getInt8PtrTy(state_.llvm_context));
     }
     else if (is_pointer_type(type)) {
       auto ptr_type = get_type_of_pointer(type);
-      auto storage_type = get_value_type(ptr_type, is_boxed_type(ptr_type));
+      auto storage_type = get_element_type(ptr_type);
       storage_type = PointerType::get(storage_type, 0);
       arg_types.push_back(storage_type);
     }
@@ -1105,6 +1608,16 @@ void CodeGenPass::process(PrototypeAST* node) {
       auto storage_type = PointerType::get(ptr_type, 0);
       arg_types.push_back(storage_type);
     }
+    else if (is_task_type(type) || is_generator_type(type)
+             || is_async_type(type) || type == IoType) {
+      arg_types.push_back(Type::getInt8PtrTy(state_.llvm_context));
+    }
+    else if (is_atomic_type(type)) {
+      arg_types.push_back(get_atomic_cell_type(type)->getPointerTo());
+    }
+    else if (is_soa_type(type)) {
+      arg_types.push_back(get_soa_ref_type());
+    }
     else if (auto arg_type = get_value_type(type, is_boxed_type(type))) {
       if (!arg_type->isPointerTy()) {
         arg_type = PointerType::get(arg_type, 0);
@@ -1113,57 +1626,35 @@ void CodeGenPass::process(PrototypeAST* node) {
     }
     else {
       std::ostringstream msg;
-      logger.error("codegen error", msg << "unknown type " << type->get_name()
-                                        << " in prototype for function "
-                                        << node->Name);
-    }
-  }
-  Type* return_type = nullptr;
-  auto ret_type = resolve_variable(get_function_return_type(node->type_var_));
-  if (ret_type == FloatType) {
-    return_type = Type::getDoubleTy(state_.llvm_context);
-  }
-  else if (ret_type == IntType) {
-    return_type = Type::getInt64Ty(state_.llvm_context);
-  }
-  else if (ret_type == BoolType) {
-    return_type = Type::getInt1Ty(state_.llvm_context);
-  }
-  else if (ret_type == StringType) {
-    return_type = Type::getInt8PtrTy(state_.llvm_context);
-  }
-  else if (ret_type == UnitType) {
-    return_type = Type::getVoidTy(state_.llvm_context);
-    // return_type = get_value_type(ret_type, is_boxed_type(ret_type));
-  }
-  else if (is_pointer_type(ret_type)) {
-    auto ptr_type = get_type_of_pointer(ret_type);
-    return_type = get_value_type(ptr_type, is_boxed_type(ptr_type));
-    if (!return_type) {
-      return_type = Type::getVoidTy(state_.llvm_context);
+      logger_.error("codegen error", msg << "unknown type " << type->get_name()
+                                         << " in prototype for function "
+                                         << node->Name);
     }
-    return_type = PointerType::get(return_type, 0);
-  }
-  else if (ret_type == CPointerType) {
-    auto ptr_type = Type::getVoidTy(state_.llvm_context);
-    auto storage_type = PointerType::get(ptr_type, 0);
-    return_type = storage_type;
   }
-  else if (auto arg_type = get_value_type(ret_type, is_boxed_type(ret_type))) {
-    if (!arg_type->isPointerTy()) {
-      arg_type = PointerType::get(arg_type, 0);
-    }
-    return_type = arg_type;
+  auto ret_type = get_function_return_type(node->type_var_);
+  auto return_type = get_return_type(ret_type);
+  // slots of a buffer (e.g. v[i]) are returned as the slot's address, so
+  //  writes through the result reach the buffer. only new objects are
+  //  returned by value
+  auto struct_type = dyn_cast<StructType>(return_type);
+  if (node->returns_slot_ && struct_type && !struct_type->isLiteral()) {
+    return_type = struct_type->getPointerTo();
   }
-  else {
-    // TODO: this can happen with top-level expressions
-    return_type = Type::getVoidTy(state_.llvm_context);
+  // a reference to an @soa object that isn't in a buffer points into the
+  //  callee's frame, so the fields themselves are returned instead
+  if (!node->returns_slot_ && is_soa_type(ret_type)) {
+    return_type = get_soa_storage_type(ret_type);
   }
   function_type = FunctionType::get(return_type, arg_types, false);
 
   Function* function =
       Function::Create(function_type, Function::ExternalLinkage, node->Name,
                        state_.current_module.get());
+  // memory from malloc (e.g. a vec's new buffer) can't alias anything
+  //  that already exists
+  if (node->Name == "malloc") {
+    function->addAttribute(AttributeSet::ReturnIndex, Attribute::NoAlias);
+  }
 
   // set names for all arguments
   unsigned Idx = 0;
@@ -1176,7 +1667,7 @@ void CodeGenPass::process(PrototypeAST* node) {
 
 // FunctionAST
 void CodeGenPass::process(FunctionAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   moved_vars_.clear();
   child_mem_list_.clear();
 
@@ -1186,6 +1677,10 @@ void CodeGenPass::process(FunctionAST* node) {
       // TODO: this can get stomped on when processing dependencies
       //       causing a memory leak in some cases
       free_list_.clear();
+      generator_handles_.clear();
+      async_handles_.clear();
+      task_handles_.clear();
+      borrowing_tasks_.clear();
     });
 
   if (state_.function_envs.find(node->Proto->getName()) !=
@@ -1263,8 +1758,8 @@ void CodeGenPass::process(FunctionAST* node) {
       Function* function = get_function(mangled_name);
       if (!function) {
         std::ostringstream msg;
-        logger.error("codegen error", msg << "could't find function matching "
-                                          << mangled_name);
+        logger_.error("codegen error", msg << "could't find function matching "
+                                           << mangled_name);
         returns (nullptr, nullptr);
         return;
       }
@@ -1276,6 +1771,8 @@ void CodeGenPass::process(FunctionAST* node) {
       BasicBlock *BB = BasicBlock::Create(state_.llvm_context,
                                           "entry", function);
       state_.builder.SetInsertPoint(BB);
+      IRBuilder<>::FastMathFlagGuard fast_math_guard(state_.builder);
+      set_fast_math(function, node->fast_math_);
 
       // Record the function arguments in the named_values_ map.
       state_.named_values.clear();
@@ -1297,13 +1794,46 @@ void CodeGenPass::process(FunctionAST* node) {
         // named_values_[arg.getName()] = &arg;
       }
 
-      node->Body->run_pass(this);
-      if (Value* return_val = result()) {
-        // Finish off the function.
+      auto outer_coroutine = coroutine_;
+      coroutine_ = CoroutineState();
+      AutoScope restore_coroutine([this, outer_coroutine]{
+          coroutine_ = outer_coroutine;
+        });
+      if (node->generator_) {
         auto ret_var = get_function_return_type(node->type_var());
-        if (ret_var == UnitType) {
+        if (!begin_generator(function, generator_item_type(ret_var))) {
+          returns (nullptr, nullptr);
+          return;
+        }
+      }
+      else if (node->async_) {
+        auto ret_var = get_function_return_type(node->type_var());
+        begin_async(function, async_result_type(ret_var));
+      }
+
+      node->Body->run_pass(this);
+      if (Value* return_val = result()) {
+        // Finish off the function.
+        auto ret_var = get_function_return_type(node->type_var());
+        if (node->generator_) {
+          end_coroutine();
+        }
+        else if (node->async_) {
+          end_async(return_val);
+        }
+        else if (ret_var == UnitType) {
           state_.builder.CreateRetVoid();
         }
+        else if (returns_soa_copy(function)) {
+          state_.builder.CreateRet(load_soa_object(return_val, ret_var));
+        }
+        else if (returns_by_value(function)) {
+          auto ret_ptr = state_.builder.CreateBitOrPointerCast(
+                                  return_val,
+                                  function->getReturnType()->getPointerTo(),
+                                  "retval.bitcast");
+          state_.builder.CreateRet(state_.builder.CreateLoad(ret_ptr));
+        }
         else {
           state_.builder.CreateRet(return_val);
         }
@@ -1311,7 +1841,7 @@ void CodeGenPass::process(FunctionAST* node) {
         // Validate the generated code, checking for consistency.
         // if (verifyFunction(*function, &errs())) {
         //   state_.current_module->dump();
-          // logger.error("error", "code generation for function failed");
+          // logger_.error("error", "code generation for function failed");
           // returns (nullptr, nullptr);
           // return;
         // }
@@ -1353,8 +1883,8 @@ void CodeGenPass::process(FunctionAST* node) {
         func_result = function;
       }
       if (func_result == nullptr) {
-        logger.error("internal error",
-                     "encountered unhandled error during code generation");
+        logger_.error("internal error",
+                      "encountered unhandled error during code generation");
         returns (nullptr, nullptr);
         return;
       }
@@ -1410,8 +1940,8 @@ void CodeGenPass::process(FunctionAST* node) {
   Function* function = get_function(mangled_name);
   if (!function) {
     std::ostringstream msg;
-    logger.error("codegen error", msg << "could't find function matching "
-                                      << mangled_name);
+    logger_.error("codegen error", msg << "could't find function matching "
+                                       << mangled_name);
     returns (nullptr, nullptr);
     return;
   }
@@ -1419,6 +1949,8 @@ void CodeGenPass::process(FunctionAST* node) {
   // create entry block for the function
   BasicBlock *BB = BasicBlock::Create(state_.llvm_context, "entry", function);
   state_.builder.SetInsertPoint(BB);
+  IRBuilder<>::FastMathFlagGuard fast_math_guard(state_.builder);
+  set_fast_math(function, node->fast_math_);
 
   // store the function arguments in this map
   // TODO: this should be a stack of scopes
@@ -1514,8 +2046,9 @@ void CodeGenPass::process(TypeclassImplAST* node) {
 }
 
 CodeGenPass::CodeGenPass(ModuleState &state)
-  : state_(state), case_gen_pass_(this, state), last_value_(nullptr),
-    case_state_push_count(0), in_destructor_(false), in_constructor_(false)
+  : state_(state), logger_(state.logger), case_gen_pass_(this, state),
+    last_value_(nullptr), case_state_push_count(0), in_destructor_(false),
+    in_constructor_(false)
 {
 }
 
@@ -1543,6 +2076,50 @@ void CodeGenPass::free_obj(Value* obj_ptr, bool is_child_obj) {
     return;
   }
 
+  // None is a null pointer, and Some(x) is x, so it's x that's freed
+  auto alloc_type = alloc_types_.find(obj_ptr);
+  if (alloc_type != alloc_types_.end()) {
+    if (auto payload = nullable_payload_type(alloc_type->second)) {
+      auto nullable_type = alloc_type->second;
+      alloc_type->second = payload;
+      free_obj_if_not_null(obj_ptr);
+      alloc_types_[obj_ptr] = nullable_type;
+      return;
+    }
+  }
+
+  // the generator frees its own frame
+  if (generator_handles_.count(obj_ptr) > 0) {
+    auto destroy = Intrinsic::getDeclaration(state_.current_module.get(),
+                                             Intrinsic::coro_destroy);
+    state_.builder.CreateCall(destroy, obj_ptr);
+    return;
+  }
+  // an async call may still be running, the runtime destroys it once it's
+  //  done
+  auto async_handle = async_handles_.find(obj_ptr);
+  if (async_handle != async_handles_.end()) {
+    auto byte_ptr = Type::getInt8PtrTy(state_.llvm_context);
+    auto drop = get_async_runtime_function(
+                        "bon_async_drop", Type::getVoidTy(state_.llvm_context),
+                        {byte_ptr, byte_ptr});
+    state_.builder.CreateCall(drop, {obj_ptr,
+                                     get_async_state(obj_ptr,
+                                                     async_handle->second)});
+    return;
+  }
+  // the task may still be running, so it's joined, which frees its env.
+  //  nothing else has the result, so that's freed as well
+  auto task_handle = task_handles_.find(obj_ptr);
+  if (task_handle != task_handles_.end()) {
+    auto task_result = join_task(obj_ptr, task_handle->second);
+    if (task_result->getType()->isPointerTy()) {
+      alloc_types_[task_result] = task_handle->second;
+      free_obj(task_result, true);
+    }
+    return;
+  }
+
   if (alloc_types_.find(obj_ptr) != alloc_types_.end()) {
     // capture type environment for generating polymorphic destructors
     TypeEnv type_env;
@@ -1639,26 +2216,80 @@ void CodeGenPass::free_obj(Value* obj_ptr, bool is_child_obj) {
       Value* patt_type_ptr = state_.builder.CreateGEP(struct_type, obj_ptr,
                                                       indices);
       patt_type_ptr = state_.builder.CreateLoad(patt_type_ptr);
-      // make sure to free any fields this object might have
-      free_obj(patt_type_ptr, true);
+      // make sure to free any fields this object might have. fields that
+      //  are None are null
+      free_obj_if_not_null(patt_type_ptr);
     }
   }
 
   if (struct_type->isStructTy()) {
+    // freeing the fields may have branched
+    bb = state_.builder.GetInsertBlock();
     auto free_inst = CallInst::CreateFree(obj_ptr, bb);
     state_.builder.Insert(free_inst);
   }
 }
 
+void CodeGenPass::free_obj_if_not_null(Value* obj_ptr) {
+  auto function = state_.builder.GetInsertBlock()->getParent();
+  BasicBlock* free_block = BasicBlock::Create(state_.llvm_context, "freeObj",
+                                              function);
+  BasicBlock* after_block = BasicBlock::Create(state_.llvm_context,
+                                               "afterFreeObj", function);
+  state_.builder.CreateCondBr(state_.builder.CreateIsNull(obj_ptr),
+                              after_block, free_block);
+  state_.builder.SetInsertPoint(free_block);
+  free_obj(obj_ptr, true);
+  state_.builder.CreateBr(after_block);
+  state_.builder.SetInsertPoint(after_block);
+}
+
 // we need a way to retrieve the output of the last instruction
 // so we cache the result to use as a return value
 void CodeGenPass::returns(ExprAST* node, Value* value) {
   assert(last_value_ == nullptr);
   last_value_ = value;
   if (node && node->ends_scope_) {
-    bon::logger.set_line_column(node->line_num_, node->column_num_);
+    logger_.set_line_column(node->line_num_, node->column_num_);
     auto var = dynamic_cast<VariableExprAST*>(node);
-    for (auto& ptr : free_list_) {
+    auto function = state_.builder.GetInsertBlock()->getParent();
+    if (value && value->getType()->isPointerTy()
+        && returns_by_value(function)) {
+      // the function returns a copy of the object, so the original can be
+      //  freed along with everything else. the copy is shallow, which only
+      //  works because is_inline_type allows nothing but scalar fields
+      auto ret_type = cast<StructType>(function->getReturnType());
+      if (std::any_of(ret_type->element_begin(), ret_type->element_end(),
+                      [](Type* field_type) {
+                        return field_type->isPointerTy();
+                      })) {
+        logger_.error("codegen error", "objects returned by value can't "
+                                       "hold pointers");
+        last_value_ = nullptr;
+        return;
+      }
+      IRBuilder<> TmpB(&function->getEntryBlock(),
+                       function->getEntryBlock().begin());
+      auto copy = TmpB.CreateAlloca(ret_type, 0, "retval.copy");
+      auto obj_ptr = state_.builder.CreateBitOrPointerCast(
+                                            value, ret_type->getPointerTo(),
+                                            value->getName() + ".bitcast");
+      state_.builder.CreateStore(state_.builder.CreateLoad(obj_ptr), copy);
+      for (auto ptr : scope_objects()) {
+        free_obj(ptr, false);
+      }
+      last_value_ = copy;
+      return;
+    }
+    for (auto ptr : scope_objects()) {
+      if (borrowing_tasks_.count(ptr) > 0
+          && (ptr == value
+              || (var != nullptr && ptr == tracked_allocs_[var->Name]))) {
+        logger_.error("codegen error", "a task sharing channels or atomics "
+                                       "with this function can't be "
+                                       "returned from it");
+        continue;
+      }
       if (ptr != value) {
         if (var != nullptr) {
           if (ptr != tracked_allocs_[var->Name]) {
@@ -1674,6 +2305,21 @@ void CodeGenPass::returns(ExprAST* node, Value* value) {
   last_value_ = value;
 }
 
+std::vector<Value*> CodeGenPass::scope_objects() {
+  std::vector<Value*> objects;
+  for (auto ptr : free_list_) {
+    if (task_handles_.count(ptr) > 0) {
+      objects.push_back(ptr);
+    }
+  }
+  for (auto ptr : free_list_) {
+    if (task_handles_.count(ptr) == 0) {
+      objects.push_back(ptr);
+    }
+  }
+  return objects;
+}
+
 // returns the cached return value
 Value* CodeGenPass::result() {
   auto result = last_value_;
@@ -1690,15 +2336,22 @@ Type* CodeGenPass::get_value_type(TypeVariable* type_var, bool ptr_type) {
     else if (type_var == IntType) {
       return Type::getInt64Ty(state_.llvm_context);
     }
+    else if (is_numeric_type(type_var) || is_simd_type(type_var)
+             || is_array_type(type_var)) {
+      return get_numeric_type(type_var);
+    }
     else if (type_var == BoolType) {
       return Type::getInt1Ty(state_.llvm_context);
     }
+    else if (is_enum_type(type_var)) {
+      return Type::getInt32Ty(state_.llvm_context);
+    }
     else if (type_var == StringType) {
       return Type::getInt8PtrTy(state_.llvm_context);
     }
     else if (is_pointer_type(type_var)) {
       auto ptr_type = get_type_of_pointer(type_var);
-      auto ret_type = get_value_type(ptr_type, is_boxed_type(ptr_type));
+      auto ret_type = get_element_type(ptr_type);
       if (!ret_type) {
         ret_type = Type::getVoidTy(state_.llvm_context);
       }
@@ -1709,6 +2362,16 @@ Type* CodeGenPass::get_value_type(TypeVariable* type_var, bool ptr_type) {
       auto storage_type = PointerType::get(ptr_type, 0);
       return storage_type;
     }
+    else if (is_task_type(type_var) || is_generator_type(type_var)
+             || is_async_type(type_var) || type_var == IoType) {
+      return Type::getInt8PtrTy(state_.llvm_context);
+    }
+    else if (is_atomic_type(type_var)) {
+      return get_atomic_cell_type(type_var)->getPointerTo();
+    }
+    else if (is_soa_type(type_var)) {
+      return get_soa_ref_type();
+    }
     else if (auto val_type = get_value_type(tcon_operator, type_var)) {
       auto tname = type_var->get_name();
       // Type* val_type = state_.struct_map[tname];
@@ -1728,207 +2391,2109 @@ Type* CodeGenPass::get_value_type(TypeVariable* type_var, bool ptr_type) {
     }
 }
 
-Type* CodeGenPass::get_value_type(TypeOperator* type_op,
-                                  TypeVariable* type_var) {
-  if (!type_op) {
-    return nullptr;
+Type* CodeGenPass::get_numeric_type(TypeVariable* type_var) {
+  if (is_array_type(type_var)) {
+    return ArrayType::get(get_numeric_type(array_element_type(type_var)),
+                          array_length(type_var));
   }
-
-  auto tname = type_var->get_name();
-  StructType* structReg = state_.struct_map[tname];
-  if (!structReg) {
-    std::vector<Type*> members;
-    // constructor enum
-    members.push_back(Type::getInt32Ty(state_.llvm_context));
-    // don't create members for generic variant
-    if (type_op->type_constructor_ != " | ") {
-      for (auto type_var : type_op->types_) {
-        // if product type, add individual members
-        if (type_var->type_operator_
-            && type_var->type_operator_->type_constructor_ == " * ") {
-          for (auto member : type_var->type_operator_->types_) {
-            if (auto val_type = get_value_type(member, is_boxed_type(member))) {
-              members.push_back(val_type);
-            }
-            else {
-              std::ostringstream msg;
-              logger.error("codegen error", msg << "failed to allocate type " <<
-                           member->get_name() << " for constructor " <<
-                           type_op->type_constructor_);
-              return nullptr;
-            }
-          }
-          continue;
-        }
-        if (auto val_type = get_value_type(type_var, is_boxed_type(type_var))) {
-          members.push_back(val_type);
-        }
-        else {
-          std::ostringstream msg;
-          logger.error("codegen error", msg << "failed to allocate type " <<
-                       type_var->get_name() << " for constructor " <<
-                       type_op->type_constructor_);
-          return nullptr;
-        }
-      }
+  if (is_simd_type(type_var)) {
+    return VectorType::get(get_numeric_type(simd_element_type(type_var)),
+                           simd_lanes(type_var));
+  }
+  // lanes of a mask
+  if (resolve_variable(type_var) == BoolType) {
+    return Type::getInt1Ty(state_.llvm_context);
+  }
+  if (is_float_type(type_var)) {
+    if (numeric_type_bits(type_var) == 32) {
+      return Type::getFloatTy(state_.llvm_context);
     }
-    auto variant_struct = StructType::create(state_.llvm_context, members,
-                                             "struct." + tname);
-    state_.struct_map[tname] = variant_struct;
-    return variant_struct;
+    return Type::getDoubleTy(state_.llvm_context);
   }
-  return structReg;
+  return Type::getIntNTy(state_.llvm_context, numeric_type_bits(type_var));
 }
 
-// CreateEntryBlockAlloca - Create an alloca instruction in the entry block of
-// the function.  This is used for mutable variables etc.
-AllocaInst* CodeGenPass::create_entry_block_alloca(Function* function,
-                                                   const std::string &VarName,
-                                                   TypeVariable* var_type,
-                                                   ExprAST* var_expr,
-                                                   bool use_ptr) {
-  IRBuilder<> TmpB(&function->getEntryBlock(),
-                 function->getEntryBlock().begin());
-  auto type_var = resolve_variable(var_type);
-  auto tcon_operator = type_var->type_operator_;
-  if (type_var == FloatType) {
-    return TmpB.CreateAlloca(Type::getDoubleTy(state_.llvm_context), 0,
-                            VarName.c_str());
+Value* CodeGenPass::convert_numeric(Value* value, TypeVariable* from,
+                                    TypeVariable* to) {
+  Type* to_type = get_numeric_type(to);
+  // vectors convert lane by lane
+  if (is_simd_type(from)) {
+    from = simd_element_type(from);
+    to = simd_element_type(to);
   }
-  else if (type_var == IntType) {
-    return TmpB.CreateAlloca(Type::getInt64Ty(state_.llvm_context), 0,
-                            VarName.c_str());
+  if (is_integer_type(from) && is_integer_type(to)) {
+    // sign extend signed sources, zero extend unsigned ones
+    return state_.builder.CreateIntCast(value, to_type, !is_unsigned_type(from),
+                                        "convtmp");
   }
-  else if (type_var == BoolType) {
-    return TmpB.CreateAlloca(Type::getInt1Ty(state_.llvm_context), 0,
-                            VarName.c_str());
+  if (is_integer_type(from)) {
+    if (is_unsigned_type(from)) {
+      return state_.builder.CreateUIToFP(value, to_type, "convtmp");
+    }
+    return state_.builder.CreateSIToFP(value, to_type, "convtmp");
   }
-  else if (type_var == StringType) {
-    return TmpB.CreateAlloca(Type::getInt8PtrTy(state_.llvm_context), 0,
-                            VarName.c_str());
+  if (is_integer_type(to)) {
+    if (is_unsigned_type(to)) {
+      return state_.builder.CreateFPToUI(value, to_type, "convtmp");
+    }
+    return state_.builder.CreateFPToSI(value, to_type, "convtmp");
   }
-  else if (is_pointer_type(type_var)) {
-    auto ptr_type = get_type_of_pointer(type_var);
-    auto storage_type = get_value_type(ptr_type, is_boxed_type(ptr_type));
-    storage_type = PointerType::get(storage_type, 0);
-    return TmpB.CreateAlloca(storage_type, 0, VarName.c_str());
+  return state_.builder.CreateFPCast(value, to_type, "convtmp");
+}
+
+void CodeGenPass::set_fast_math(Function* function, bool fast_math) {
+  FastMathFlags flags;
+  if (fast_math || state_.fast_math) {
+    flags.setUnsafeAlgebra();
+    function->addFnAttr("unsafe-fp-math", "true");
+    function->addFnAttr("no-nans-fp-math", "true");
+    function->addFnAttr("no-infs-fp-math", "true");
   }
-  else if (type_var == CPointerType) {
-    auto ptr_type = Type::getVoidTy(state_.llvm_context);
-    auto storage_type = PointerType::get(ptr_type, 0);
-    return TmpB.CreateAlloca(storage_type, 0, VarName.c_str());
+  state_.builder.setFastMathFlags(flags);
+}
+
+bool CodeGenPass::is_fast_math() {
+  return state_.builder.getFastMathFlags().unsafeAlgebra();
+}
+
+Function* CodeGenPass::get_math_intrinsic(Function* callee) {
+  static std::map<std::string, Intrinsic::ID> math_intrinsics = {
+    {"sqrt", Intrinsic::sqrt}, {"pow", Intrinsic::pow},
+    {"sin", Intrinsic::sin}, {"cos", Intrinsic::cos},
+    {"exp", Intrinsic::exp}, {"log", Intrinsic::log},
+    {"fabs", Intrinsic::fabs}, {"floor", Intrinsic::floor},
+    {"ceil", Intrinsic::ceil},
+  };
+  if (!callee->isDeclaration() || !callee->getReturnType()->isDoubleTy()) {
+    return nullptr;
   }
-  else if (var_expr) {
-    auto val_type = get_value_type_dispatch(var_expr);
-    if (use_ptr && !val_type->isPointerTy()) {
-      val_type = PointerType::get(val_type, 0);
-      return TmpB.CreateAlloca(val_type, 0, VarName.c_str());
-    }
-    else {
-      return TmpB.CreateAlloca(val_type, 0, VarName.c_str());
-    }
+  auto intrinsic = math_intrinsics.find(callee->getName());
+  if (intrinsic == math_intrinsics.end()) {
+    return nullptr;
   }
-  else if (auto val_type = get_value_type(tcon_operator, type_var)) {
-    if (use_ptr && !val_type->isPointerTy()) {
-      val_type = PointerType::get(val_type, 0);
+  for (auto &arg : callee->args()) {
+    if (!arg.getType()->isDoubleTy()) {
+      return nullptr;
     }
-    return TmpB.CreateAlloca(val_type, 0, VarName.c_str());
   }
-  else {
-    std::ostringstream msg;
-    logger.error("codegen error", msg <<
-                 "requested stack allocation for variable " << VarName <<
-                 " with unknown type " << type_var->get_name());
+  // llvm.sqrt is undefined for negative inputs (libm sqrt returns nan), so
+  //  it's only used under fast-math. the libcall still doesn't touch memory
+  //  as far as we're concerned (errno is never read), which lets llvm
+  //  hoist and combine it
+  if (intrinsic->second == Intrinsic::sqrt && !is_fast_math()) {
+    callee->setDoesNotAccessMemory();
     return nullptr;
   }
+  std::vector<Type*> overload_types = {callee->getReturnType()};
+  return Intrinsic::getDeclaration(state_.current_module.get(),
+                                   intrinsic->second, overload_types);
 }
 
-void CodeGenPass::push_case(CaseState state) {
-  assert(case_state_push_count++ == 0);
-  priv_case_state_ = state;
-}
-
-CodeGenPass::CaseState CodeGenPass::pop_case() {
-  assert(--case_state_push_count == 0);
-  return priv_case_state_;
+Value* CodeGenPass::build_pow(Value* base, Value* exponent) {
+  auto &builder = state_.builder;
+  auto float_type = base->getType();
+  // small constant exponents are replaced with multiplies. x*x is exactly
+  //  pow(x, 2), other exponents round differently so need fast-math
+  if (auto constant = dyn_cast<ConstantFP>(exponent)) {
+    auto &value = constant->getValueAPF();
+    if (value.isExactlyValue(1.0)) {
+      return base;
+    }
+    if (value.isExactlyValue(2.0)) {
+      return builder.CreateFMul(base, base, "powtmp");
+    }
+    if (is_fast_math() && value.isExactlyValue(0.5)) {
+      std::vector<Type*> overload_types = {float_type};
+      auto sqrt_fn = Intrinsic::getDeclaration(state_.current_module.get(),
+                                               Intrinsic::sqrt,
+                                               overload_types);
+      return builder.CreateCall(sqrt_fn, base, "powtmp");
+    }
+    double n = value.convertToDouble();
+    if (is_fast_math() && n == (int)n && n != 0 && n >= -8 && n <= 8) {
+      // square and multiply
+      unsigned remaining = n < 0 ? -n : n;
+      Value* result = nullptr;
+      Value* square = base;
+      while (remaining > 0) {
+        if (remaining & 1) {
+          result = result ? builder.CreateFMul(result, square, "powtmp")
+                          : square;
+        }
+        remaining >>= 1;
+        if (remaining > 0) {
+          square = builder.CreateFMul(square, square, "powtmp");
+        }
+      }
+      if (n < 0) {
+        result = builder.CreateFDiv(ConstantFP::get(float_type, 1.0), result,
+                                    "powtmp");
+      }
+      return result;
+    }
+  }
+  std::vector<Type*> overload_types = {float_type};
+  auto pow_fn = Intrinsic::getDeclaration(state_.current_module.get(),
+                                          Intrinsic::pow, overload_types);
+  std::vector<Value*> args = {base, exponent};
+  return builder.CreateCall(pow_fn, args, "powtmp");
 }
 
-Type* CodeGenPass::get_value_type(ExprAST* node) {
-  return get_value_type(node->type_var_, node->is_boxed());
-}
+Value* CodeGenPass::simd_binary_op(BinaryExprAST* node, Value* l_value,
+                                   Value* r_value) {
+  auto &builder = state_.builder;
+  auto element = simd_element_type(node->LHS->type_var_);
+  bool is_mask = element == BoolType;
+  bool is_float = is_float_type(element);
 
-Type* CodeGenPass::get_value_type(NumberExprAST* node) {
-  return Type::getDoubleTy(state_.llvm_context);
-}
+  switch (node->Op) {
+  case tok_bt_and:
+    if (!is_float) {
+      return builder.CreateAnd(l_value, r_value, "bt_andtmp");
+    }
+    break;
+  case tok_bt_or:
+    if (!is_float) {
+      return builder.CreateOr(l_value, r_value, "bt_ortmp");
+    }
+    break;
+  case tok_bt_xor:
+    if (!is_float) {
+      return builder.CreateXor(l_value, r_value, "bt_xortmp");
+    }
+    break;
+  case tok_lshift:
+    if (!is_float && !is_mask) {
+      return builder.CreateShl(l_value, r_value, "shltmp");
+    }
+    break;
+  case tok_rshift:
+    if (!is_float && !is_mask) {
+      return builder.CreateAShr(l_value, r_value, "shrtmp");
+    }
+    break;
+  case tok_add:
+    if (!is_mask) {
+      return is_float ? builder.CreateFAdd(l_value, r_value, "addtmp")
+                      : builder.CreateAdd(l_value, r_value, "addtmp");
+    }
+    break;
+  case tok_sub:
+    if (!is_mask) {
+      return is_float ? builder.CreateFSub(l_value, r_value, "subtmp")
+                      : builder.CreateSub(l_value, r_value, "subtmp");
+    }
+    break;
+  case tok_mul:
+    if (!is_mask) {
+      return is_float ? builder.CreateFMul(l_value, r_value, "multmp")
+                      : builder.CreateMul(l_value, r_value, "multmp");
+    }
+    break;
+  case tok_div:
+    if (!is_mask) {
+      return is_float ? builder.CreateFDiv(l_value, r_value, "divtmp")
+                      : builder.CreateSDiv(l_value, r_value, "divtmp");
+    }
+    break;
+  case tok_rem:
+    if (!is_mask) {
+      return is_float ? builder.CreateFRem(l_value, r_value, "remtmp")
+                      : builder.CreateSRem(l_value, r_value, "remtmp");
+    }
+    break;
+  case tok_eq:
+  case tok_neq:
+  case tok_lt:
+  case tok_gt:
+  case tok_lteq:
+  case tok_gteq:
+    // comparison operators always produce a single bool
+    logger_.error("codegen error", "comparison operators aren't defined for "
+                                   "simd vectors, use simd_eq, simd_lt, etc. "
+                                   "to get a mask");
+    return nullptr;
+  default:
+    break;
+  }
 
-Type* CodeGenPass::get_value_type(IntegerExprAST* node) {
-  return Type::getInt64Ty(state_.llvm_context);
+  std::ostringstream msg;
+  logger_.error("codegen error", msg << "operator "
+                                     << Tokenizer::token_type(node->Op)
+                                     << " not defined for type "
+                                     << node->LHS->type_var_->get_name());
+  return nullptr;
 }
 
-Type* CodeGenPass::get_value_type(BoolExprAST* node) {
-  return Type::getInt1Ty(state_.llvm_context);
+Value* CodeGenPass::simd_compare(const std::string &op, Value* l_value,
+                                 Value* r_value, TypeVariable* element) {
+  auto &builder = state_.builder;
+  // same predicates as the scalar comparison operators
+  if (is_float_type(element)) {
+    if (op == "eq") return builder.CreateFCmpUEQ(l_value, r_value, "cmptmp");
+    if (op == "ne") return builder.CreateFCmpUNE(l_value, r_value, "cmptmp");
+    if (op == "lt") return builder.CreateFCmpULT(l_value, r_value, "cmptmp");
+    if (op == "le") return builder.CreateFCmpULE(l_value, r_value, "cmptmp");
+    if (op == "gt") return builder.CreateFCmpUGT(l_value, r_value, "cmptmp");
+    return builder.CreateFCmpUGE(l_value, r_value, "cmptmp");
+  }
+  if (op == "eq") return builder.CreateICmpEQ(l_value, r_value, "cmptmp");
+  if (op == "ne") return builder.CreateICmpNE(l_value, r_value, "cmptmp");
+  if (op == "lt") return builder.CreateICmpSLT(l_value, r_value, "cmptmp");
+  if (op == "le") return builder.CreateICmpSLE(l_value, r_value, "cmptmp");
+  if (op == "gt") return builder.CreateICmpSGT(l_value, r_value, "cmptmp");
+  return builder.CreateICmpSGE(l_value, r_value, "cmptmp");
 }
 
-Type* CodeGenPass::get_value_type(UnitExprAST* node) {
-  auto tname = node->type_var_->get_name();
-  StructType* structReg = state_.struct_map[tname];
-  if (!structReg) {
-    std::cout << "Unit type '()' unexpectedly not defined yet" << std::endl;
+Value* CodeGenPass::simd_reduce(Value* vector, unsigned lanes,
+                              const std::function<Value*(Value*, Value*)> &op) {
+  auto &builder = state_.builder;
+  auto undef = UndefValue::get(vector->getType());
+  // combine the low and high halves each step, so n lanes take log2(n)
+  //  operations, each on a whole register
+  while (lanes > 1) {
+    lanes /= 2;
+    std::vector<Constant*> low_lanes;
+    std::vector<Constant*> high_lanes;
+    for (unsigned i = 0; i < lanes; ++i) {
+      low_lanes.push_back(builder.getInt32(i));
+      high_lanes.push_back(builder.getInt32(i + lanes));
+    }
+    auto low = builder.CreateShuffleVector(vector, undef,
+                                           ConstantVector::get(low_lanes),
+                                           "reduce.low");
+    auto high = builder.CreateShuffleVector(vector, undef,
+                                            ConstantVector::get(high_lanes),
+                                            "reduce.high");
+    vector = op(low, high);
+    undef = UndefValue::get(vector->getType());
   }
-  return structReg;
+  return builder.CreateExtractElement(vector, builder.getInt32(0),
+                                      "reducetmp");
 }
 
-Type* CodeGenPass::get_value_type_dispatch(ExprAST* node) {
-  // TODO: this ugliness is from a refactor, need to rethink
-  NumberExprAST* num_expr = dynamic_cast<NumberExprAST*>(node);
-  IntegerExprAST* int_expr = dynamic_cast<IntegerExprAST*>(node);
-  BoolExprAST* bool_expr = dynamic_cast<BoolExprAST*>(node);
-  UnitExprAST* unit_expr = dynamic_cast<UnitExprAST*>(node);
-  ValueConstructorExprAST* val_constructor_expr =
-    dynamic_cast<ValueConstructorExprAST*>(node);
-
-  Type* node_type = nullptr;
-  if (num_expr) {
-    node_type = get_value_type(num_expr);
+Value* CodeGenPass::simd_builtin(CallExprAST* node) {
+  auto &builder = state_.builder;
+  auto &name = node->Callee;
+  auto &args = node->Args;
+
+  // swizzle indices are constants, and read straight from the ast
+  size_t value_count = name == "simd_swizzle" ? 1 : args.size();
+  std::vector<Value*> values;
+  for (size_t i = 0; i < value_count; ++i) {
+    args[i]->run_pass(this);
+    auto value = result();
+    if (!value) {
+      return nullptr;
+    }
+    values.push_back(value);
   }
-  else if (int_expr) {
-    node_type = get_value_type(int_expr);
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  // address of lanes starting at ptr[index], vec buffers are only aligned
+  //  to the element size so loads and stores are unaligned
+  auto lanes_ptr = [this, &builder](Value* ptr, Value* index,
+                                    TypeVariable* vector_type) {
+    auto element_type = get_numeric_type(simd_element_type(vector_type));
+    auto base = builder.CreateBitOrPointerCast(ptr,
+                                               element_type->getPointerTo(),
+                                               "simd.base");
+    auto element_ptr = builder.CreateGEP(element_type, base, index,
+                                         "simd.element");
+    return builder.CreateBitOrPointerCast(
+                                element_ptr,
+                                get_numeric_type(vector_type)->getPointerTo(),
+                                "simd.ptr");
+  };
+  auto element_align = [this](TypeVariable* vector_type) {
+    auto element_type = get_numeric_type(simd_element_type(vector_type));
+    auto &data_layout = state_.current_module->getDataLayout();
+    return (unsigned)data_layout.getTypeAllocSize(element_type);
+  };
+
+  if (auto vector_type = simd_type(name)) {
+    auto lanes = simd_lanes(vector_type);
+    if (args.size() == 1 && is_simd_type(args[0]->type_var_)) {
+      auto from_type = args[0]->type_var_;
+      if (simd_lanes(from_type) != lanes || is_mask_type(from_type)
+          || is_mask_type(vector_type)) {
+        std::ostringstream msg;
+        logger_.error("codegen error", msg << "can't convert "
+                                           << from_type->get_name()
+                                           << " to " << name);
+        return nullptr;
+      }
+      return convert_numeric(values[0], from_type, vector_type);
+    }
+    if (args.size() == 1) {
+      return builder.CreateVectorSplat(lanes, values[0], "splattmp");
+    }
+    if (args.size() == 2 && is_pointer_type(args[0]->type_var_)) {
+      return builder.CreateAlignedLoad(lanes_ptr(values[0], values[1],
+                                                 vector_type),
+                                       element_align(vector_type),
+                                       "simd.load");
+    }
+    Value* vector = UndefValue::get(get_numeric_type(vector_type));
+    for (size_t i = 0; i < values.size(); ++i) {
+      vector = builder.CreateInsertElement(vector, values[i],
+                                           builder.getInt32(i), "vectmp");
+    }
+    return vector;
   }
-  else if (bool_expr) {
-    node_type = get_value_type(bool_expr);
+
+  size_t vector_arg = name == "simd_store" ? 2
+                      : name == "simd_select" ? 1 : 0;
+  auto vector_type = args[vector_arg]->type_var_;
+  if (!is_simd_type(vector_type)) {
+    logger_.error("codegen error", name + " expects a simd vector argument");
+    return nullptr;
   }
-  else if (unit_expr) {
-    node_type = get_value_type(unit_expr);
+  auto lanes = simd_lanes(vector_type);
+  auto element = simd_element_type(vector_type);
+  bool is_mask = is_mask_type(vector_type);
+  bool is_float = is_float_type(element);
+
+  if (name == "simd_store") {
+    builder.CreateAlignedStore(values[2], lanes_ptr(values[0], values[1],
+                                                    vector_type),
+                               element_align(vector_type));
+    return ConstantInt::get(state_.llvm_context,
+                            APInt(/*nbits*/32, 0, /*is_signed*/false));
   }
-  else if (val_constructor_expr) {
-    node_type = get_value_type(val_constructor_expr);
+  if (name == "simd_lane") {
+    return builder.CreateExtractElement(values[0], values[1], "lanetmp");
   }
-  else {
-    node_type = get_value_type(node);
+  if (name == "simd_with_lane") {
+    return builder.CreateInsertElement(values[0], values[2], values[1],
+                                       "lanetmp");
+  }
+  if (name == "simd_select") {
+    return builder.CreateSelect(values[0], values[1], values[2], "selecttmp");
+  }
+  if (name == "simd_swizzle") {
+    if (args.size() - 1 != lanes) {
+      std::ostringstream msg;
+      logger_.error("codegen error", msg << "simd_swizzle needs one index for "
+                                         << "each of the " << lanes
+                                         << " lanes");
+      return nullptr;
+    }
+    std::vector<Constant*> indices;
+    for (size_t i = 1; i < args.size(); ++i) {
+      auto index = dynamic_cast<IntegerExprAST*>(args[i].get());
+      if (!index || index->Val < 0 || index->Val >= lanes) {
+        std::ostringstream msg;
+        logger_.error("codegen error", msg << "simd_swizzle indices must be "
+                                           << "integer constants less than "
+                                           << lanes);
+        return nullptr;
+      }
+      indices.push_back(builder.getInt32(index->Val));
+    }
+    return builder.CreateShuffleVector(values[0],
+                                       UndefValue::get(values[0]->getType()),
+                                       ConstantVector::get(indices),
+                                       "swizzletmp");
+  }
+  if (name == "simd_any" || name == "simd_all") {
+    if (!is_mask) {
+      logger_.error("codegen error", name + " expects a mask");
+      return nullptr;
+    }
+    bool is_any = name == "simd_any";
+    return simd_reduce(values[0], lanes, [&builder, is_any](Value* a,
+                                                            Value* b) {
+      return is_any ? builder.CreateOr(a, b, "ortmp")
+                    : builder.CreateAnd(a, b, "andtmp");
+    });
+  }
+
+  // the rest are arithmetic
+  if (is_mask) {
+    logger_.error("codegen error", name + " isn't defined for masks");
+    return nullptr;
+  }
+  if (name == "simd_sqrt") {
+    if (!is_float) {
+      logger_.error("codegen error", "simd_sqrt expects a float vector");
+      return nullptr;
+    }
+    std::vector<Type*> overload_types = {get_numeric_type(vector_type)};
+    auto sqrt_fn = Intrinsic::getDeclaration(state_.current_module.get(),
+                                             Intrinsic::sqrt,
+                                             overload_types);
+    return builder.CreateCall(sqrt_fn, values[0], "sqrttmp");
+  }
+  auto min_max = [this, &builder, element](bool is_min) {
+    return [this, &builder, element, is_min](Value* a, Value* b) {
+      auto a_wins = simd_compare(is_min ? "lt" : "gt", a, b, element);
+      return builder.CreateSelect(a_wins, a, b, "selecttmp");
+    };
+  };
+  if (name == "simd_min" || name == "simd_max") {
+    return min_max(name == "simd_min")(values[0], values[1]);
+  }
+  if (name == "simd_reduce_min" || name == "simd_reduce_max") {
+    return simd_reduce(values[0], lanes, min_max(name == "simd_reduce_min"));
+  }
+  if (name == "simd_reduce_add") {
+    return simd_reduce(values[0], lanes, [&builder, is_float](Value* a,
+                                                              Value* b) {
+      return is_float ? builder.CreateFAdd(a, b, "addtmp")
+                      : builder.CreateAdd(a, b, "addtmp");
+    });
+  }
+  if (name == "simd_reduce_mul") {
+    return simd_reduce(values[0], lanes, [&builder, is_float](Value* a,
+                                                              Value* b) {
+      return is_float ? builder.CreateFMul(a, b, "multmp")
+                      : builder.CreateMul(a, b, "multmp");
+    });
+  }
+  // simd_eq, simd_lt, ...
+  return simd_compare(name.substr(5), values[0], values[1], element);
+}
+
+Value* CodeGenPass::array_builtin(CallExprAST* node) {
+  auto &builder = state_.builder;
+  auto &name = node->Callee;
+  auto &args = node->Args;
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  if (name == "array") {
+    args[1]->run_pass(this);
+    auto value = result();
+    if (!value) {
+      return nullptr;
+    }
+    Value* array = UndefValue::get(get_numeric_type(node->type_var_));
+    for (unsigned i = 0; i < array_length(node->type_var_); ++i) {
+      array = builder.CreateInsertValue(array, value, i, "arraytmp");
+    }
+    return array;
+  }
+
+  auto array_type = args[0]->type_var_;
+  auto length = array_length(array_type);
+  if (name == "len") {
+    return ConstantInt::get(state_.llvm_context,
+                            APInt(/*nbits*/64, length, /*is_signed*/true));
+  }
+
+  // elements are accessed in place in a variable's stack slot, anything else
+  //  is copied to a temporary one first. slots only accessed at constant
+  //  indices end up in registers
+  Value* storage = nullptr;
+  if (auto variable = dynamic_cast<VariableExprAST*>(args[0].get())) {
+    storage = state_.named_values[variable->Name];
+  }
+  if (!storage && name == "set") {
+    logger_.error("codegen error", "set can only change an array stored in a "
+                                   "variable");
+    return nullptr;
+  }
+  if (!storage) {
+    args[0]->run_pass(this);
+    auto value = result();
+    if (!value) {
+      return nullptr;
+    }
+    auto function = builder.GetInsertBlock()->getParent();
+    storage = create_entry_block_alloca(function, "array.tmp", array_type,
+                                        nullptr);
+    builder.CreateStore(value, storage);
+  }
+
+  args[1]->run_pass(this);
+  auto index = result();
+  Value* value = nullptr;
+  if (name == "set") {
+    args[2]->run_pass(this);
+    value = result();
+  }
+  if (!index || (name == "set" && !value)) {
+    return nullptr;
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto element_ptr = [this, &builder, &array_type, storage](Value* index) {
+    std::vector<Value*> indices = {
+      ConstantInt::get(state_.llvm_context,
+                       APInt(/*nbits*/64, 0, /*is_signed*/false)),
+      index
+    };
+    return builder.CreateGEP(get_numeric_type(array_type), storage, indices,
+                             "array.element");
+  };
+  auto unit = ConstantInt::get(state_.llvm_context,
+                               APInt(/*nbits*/32, 0, /*is_signed*/false));
+
+  // constant indices are checked here, so they don't need a bounds check
+  if (auto constant = dyn_cast<ConstantInt>(index)) {
+    auto i = constant->getSExtValue();
+    if (i < 0 || (uint64_t)i >= length) {
+      std::ostringstream msg;
+      logger_.error("codegen error", msg << "index " << i << " is out of "
+                                         << "range for "
+                                         << array_type->get_name());
+      return nullptr;
+    }
+    if (name == "set") {
+      builder.CreateStore(value, element_ptr(index));
+      return unit;
+    }
+    return builder.CreateLoad(element_ptr(index), "arrayelem");
+  }
+
+  // out of range reads give zero and writes are ignored, like for vec. the
+  //  access goes to element 0 instead, so there's no branch
+  auto in_range = builder.CreateICmpULT(index,
+                                        ConstantInt::get(index->getType(),
+                                                         length),
+                                        "inrange");
+  auto safe_index = builder.CreateSelect(in_range, index,
+                                         ConstantInt::get(index->getType(), 0),
+                                         "safeindex");
+  auto ptr = element_ptr(safe_index);
+  auto element = builder.CreateLoad(ptr, "arrayelem");
+  if (name == "set") {
+    builder.CreateStore(builder.CreateSelect(in_range, value, element), ptr);
+    return unit;
+  }
+  return builder.CreateSelect(in_range, element,
+                              Constant::getNullValue(element->getType()),
+                              "arrayelem");
+}
+
+Value* CodeGenPass::task_builtin(CallExprAST* node) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto byte_ptr = Type::getInt8PtrTy(context);
+
+  if (node->Callee == "spawn") {
+    // the arguments are evaluated here and copied into a heap allocated env,
+    //  which the thunk unpacks on whichever thread runs the task
+    auto call = static_cast<CallExprAST*>(node->Args[0].get());
+    logger_.set_line_column(call->line_num_, call->column_num_);
+    // the task may run until it's joined, so objects it's given have to be
+    //  moved into it, and belong to it from then on. only objects this
+    //  function owns can be moved, a borrowed one could be freed by its
+    //  owner while the task is still using it
+    std::vector<bool> moved(call->Args.size(), false);
+    for (size_t i = 0; i < call->Args.size(); ++i) {
+      auto arg = call->Args[i].get();
+      auto unary = dynamic_cast<UnaryExprAST*>(arg);
+      if (is_task_shareable_type(arg->type_var_)) {
+        continue;
+      }
+      if (!unary || unary->Opcode != tok_mul) {
+        logger_.error("codegen error", "only numbers, bools, atomics and "
+                                       "channels can be shared with a task, "
+                                       "move other arguments into it with '*'");
+        return nullptr;
+      }
+      moved[i] = true;
+      auto var = dynamic_cast<VariableExprAST*>(unary->Operand.get());
+      if (var) {
+        auto alloc = tracked_allocs_.find(var->getName());
+        if (alloc == tracked_allocs_.end()
+            || free_list_.count(alloc->second) == 0) {
+          logger_.error("codegen error", "only objects made with new, or "
+                                         "returned by calls, can be moved "
+                                         "into a task");
+          return nullptr;
+        }
+      }
+    }
+    auto callee = get_callee(call);
+    std::vector<Value*> arg_values;
+    if (!callee || !gen_call_args(call, callee, arg_values)) {
+      return nullptr;
+    }
+    bool borrows = false;
+    for (size_t i = 0; i < arg_values.size(); ++i) {
+      auto arg = call->Args[i].get();
+      if (!moved[i]) {
+        // channels and atomics are shared with the task
+        borrows = borrows || arg_values[i]->getType()->isPointerTy();
+      }
+      else if (!dynamic_cast<VariableExprAST*>(
+                        static_cast<UnaryExprAST*>(arg)->Operand.get())
+               && free_list_.erase(arg_values[i]->stripPointerCasts()) == 0) {
+        logger_.set_line_column(call->line_num_, call->column_num_);
+        logger_.error("codegen error", "only objects made with new, or "
+                                       "returned by calls, can be moved "
+                                       "into a task");
+        return nullptr;
+      }
+    }
+    auto env_type = get_task_env_type(callee);
+    Type* ITy = Type::getInt64Ty(context);
+    Constant* env_size = ConstantExpr::getSizeOf(env_type);
+    env_size = ConstantExpr::getTruncOrBitCast(env_size, ITy);
+    auto env = CallInst::CreateMalloc(builder.GetInsertBlock(), ITy, env_type,
+                                      env_size, nullptr, nullptr, "task.env");
+    builder.Insert(env);
+    for (unsigned i = 0; i < arg_values.size(); ++i) {
+      builder.CreateStore(arg_values[i],
+                          builder.CreateStructGEP(env_type, env, i + 1));
+    }
+    auto thunk = get_task_thunk(callee);
+    auto spawn_type = FunctionType::get(byte_ptr,
+                                        {thunk->getType(), byte_ptr}, false);
+    auto spawn = state_.current_module->getOrInsertFunction("bon_spawn",
+                                                            spawn_type);
+    auto task = builder.CreateCall(spawn,
+                                   {thunk,
+                                    builder.CreateBitCast(env, byte_ptr)},
+                                   "task");
+    // a task that isn't joined is joined at the end of its scope
+    free_list_.insert(task);
+    task_handles_[task] = call->type_var_;
+    if (borrows) {
+      borrowing_tasks_.insert(task);
+    }
+    return task;
+  }
+
+  // join
+  if (node->Args.size() != 1) {
+    logger_.error("codegen error", "join takes a single task");
+    return nullptr;
+  }
+  node->Args[0]->run_pass(this);
+  auto task = result();
+  if (!task) {
+    return nullptr;
+  }
+  // joining consumes the task, so it isn't joined again at the end of its
+  //  scope
+  auto var = dynamic_cast<VariableExprAST*>(node->Args[0].get());
+  if (var && tracked_allocs_.count(var->getName()) > 0) {
+    free_list_.erase(tracked_allocs_[var->getName()]);
+    state_.named_values.erase(var->getName());
+    moved_vars_[var->getName()] = DocPosition(var->line_num_,
+                                              var->column_num_);
+  }
+  else {
+    free_list_.erase(task);
+  }
+  auto task_result = join_task(task, node->type_var_);
+  auto result_type = task_result->getType();
+
+  if (result_type->isStructTy()) {
+    return spill_returned_value(task_result);
+  }
+  if (result_type->isPointerTy()) {
+    // the joining thread owns the result, like the result of a call
+    free_list_.insert(task_result);
+  }
+  return task_result;
+}
+
+Value* CodeGenPass::join_task(Value* task, TypeVariable* result_type) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto byte_ptr = Type::getInt8PtrTy(context);
+  auto join_type = FunctionType::get(byte_ptr, {byte_ptr}, false);
+  auto join = state_.current_module->getOrInsertFunction("bon_join",
+                                                         join_type);
+  Value* env = builder.CreateCall(join, {task}, "task.env");
+  // the result slot is the first member of the env
+  auto ret_type = get_return_type(result_type);
+  Value* task_result = nullptr;
+  if (ret_type->isVoidTy()) {
+    task_result = ConstantInt::get(context, APInt(32, 0, false));
+  }
+  else {
+    auto slot = builder.CreateBitCast(env, ret_type->getPointerTo());
+    task_result = builder.CreateLoad(slot, "task.result");
+  }
+  builder.Insert(CallInst::CreateFree(env, builder.GetInsertBlock()));
+  return task_result;
+}
+
+StructType* CodeGenPass::get_task_env_type(Function* callee) {
+  auto &context = state_.llvm_context;
+  std::vector<Type*> members;
+  auto result_type = callee->getReturnType();
+  if (result_type->isVoidTy()) {
+    // unused slot, so the arguments always start at member 1
+    result_type = Type::getInt64Ty(context);
+  }
+  members.push_back(result_type);
+  for (auto &arg : callee->args()) {
+    members.push_back(arg.getType());
+  }
+  return StructType::get(context, members);
+}
+
+Function* CodeGenPass::get_task_thunk(Function* callee) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto name = callee->getName().str() + ".task";
+  if (auto thunk = state_.current_module->getFunction(name)) {
+    return thunk;
+  }
+
+  auto thunk_type = FunctionType::get(Type::getVoidTy(context),
+                                      {Type::getInt8PtrTy(context)}, false);
+  auto thunk = Function::Create(thunk_type, Function::InternalLinkage, name,
+                                state_.current_module.get());
+  auto saved_insert_point = builder.saveIP();
+  builder.SetInsertPoint(BasicBlock::Create(context, "entry", thunk));
+
+  auto env_type = get_task_env_type(callee);
+  auto env = builder.CreateBitCast(&*thunk->arg_begin(),
+                                   env_type->getPointerTo(), "env");
+  std::vector<Value*> args;
+  for (unsigned i = 1; i < env_type->getNumElements(); ++i) {
+    args.push_back(builder.CreateLoad(builder.CreateStructGEP(env_type, env,
+                                                              i)));
+  }
+  auto ret_val = builder.CreateCall(callee, args);
+  if (!callee->getReturnType()->isVoidTy()) {
+    builder.CreateStore(ret_val, builder.CreateStructGEP(env_type, env, 0));
+  }
+  builder.CreateRetVoid();
+
+  builder.restoreIP(saved_insert_point);
+  return thunk;
+}
+
+AllocaInst* CodeGenPass::bind_placeholder(const std::string &name,
+                                          Value* value) {
+  auto function = state_.builder.GetInsertBlock()->getParent();
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                   function->getEntryBlock().begin());
+  auto slot = TmpB.CreateAlloca(value->getType(), 0, name);
+  state_.builder.CreateStore(value, slot);
+  state_.named_values[name] = slot;
+  return slot;
+}
+
+Value* CodeGenPass::parallel_builtin(CallExprAST* node) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto &args = node->Args;
+  auto is_reduce = node->Callee == "par_reduce";
+  auto int_type = Type::getInt64Ty(context);
+  auto byte_ptr = Type::getInt8PtrTy(context);
+  auto function = builder.GetInsertBlock()->getParent();
+
+  // lo, hi, grain and init come first, then the captured arguments, with
+  //  the body (and combine) last
+  size_t first_captured = is_reduce ? 4 : 3;
+  size_t body_index = args.size() - (is_reduce ? 2 : 1);
+
+  // placeholders hidden by ours, when nested in another parallel builtin's
+  //  captured arguments
+  std::vector<std::pair<std::string, AllocaInst*>> hidden;
+  AutoScope restore_placeholders([this, &hidden]{
+      for (auto &binding : hidden) {
+        if (binding.second) {
+          state_.named_values[binding.first] = binding.second;
+        }
+        else {
+          state_.named_values.erase(binding.first);
+        }
+      }
+    });
+
+  // the captured arguments go first, since the range of par_map depends on
+  //  them
+  std::vector<Value*> captured;
+  for (size_t i = first_captured; i < body_index; ++i) {
+    args[i]->run_pass(this);
+    auto value = result();
+    if (!value) {
+      return nullptr;
+    }
+    auto name = "par arg" + std::to_string(i - first_captured);
+    auto previous = state_.named_values.find(name);
+    hidden.push_back(std::make_pair(name,
+                                    previous != state_.named_values.end()
+                                    ? previous->second : nullptr));
+    bind_placeholder(name, value);
+    captured.push_back(value);
+  }
+  std::vector<Value*> range;
+  for (size_t i = 0; i < first_captured; ++i) {
+    args[i]->run_pass(this);
+    auto value = result();
+    if (!value) {
+      return nullptr;
+    }
+    range.push_back(value);
+  }
+
+  Type* result_type = nullptr;
+  Function* combine = nullptr;
+  if (is_reduce) {
+    result_type = range[3]->getType();
+    if (!result_type->isIntegerTy() && !result_type->isFloatingPointTy()
+        && !result_type->isVectorTy()) {
+      logger_.error("codegen error", "par_reduce only works on numbers, "
+                                     "bools and simd vectors");
+      return nullptr;
+    }
+    combine = gen_parallel_combine(args.back().get(), result_type);
+    if (!combine) {
+      return nullptr;
+    }
+  }
+
+  // the call doesn't return until every iteration is done, so the captured
+  //  arguments can be passed in a struct on the stack
+  std::vector<Type*> env_members;
+  for (auto value : captured) {
+    env_members.push_back(value->getType());
+  }
+  auto env_type = StructType::get(context, env_members);
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                   function->getEntryBlock().begin());
+  auto env = TmpB.CreateAlloca(env_type, 0, "par.env");
+  for (unsigned i = 0; i < captured.size(); ++i) {
+    builder.CreateStore(captured[i], builder.CreateStructGEP(env_type, env, i));
+  }
+  auto body = gen_parallel_body(args[body_index].get(), env_type, combine,
+                                result_type);
+  if (!body) {
+    return nullptr;
+  }
+  auto env_ptr = builder.CreateBitCast(env, byte_ptr);
+
+  if (!is_reduce) {
+    auto for_type = FunctionType::get(Type::getVoidTy(context),
+                                      {int_type, int_type, int_type,
+                                       body->getType(), byte_ptr}, false);
+    auto parallel_for =
+      state_.current_module->getOrInsertFunction("bon_parallel_for",
+                                                 for_type);
+    builder.CreateCall(parallel_for,
+                       {range[0], range[1], range[2], body, env_ptr});
+    if (node->Callee == "par_map") {
+      // the output vector, captured last
+      return captured.back();
+    }
+    return ConstantInt::get(context, APInt(32, 0, false));
+  }
+
+  auto result_slot = TmpB.CreateAlloca(result_type, 0, "par.result");
+  builder.CreateStore(range[3], result_slot);
+  auto &data_layout = state_.current_module->getDataLayout();
+  auto result_size = ConstantInt::get(int_type,
+                                      data_layout.getTypeAllocSize(
+                                                                result_type));
+  auto reduce_type = FunctionType::get(Type::getVoidTy(context),
+                                       {int_type, int_type, int_type,
+                                        body->getType(), byte_ptr,
+                                        combine->getType(), byte_ptr,
+                                        int_type}, false);
+  auto parallel_reduce =
+    state_.current_module->getOrInsertFunction("bon_parallel_reduce",
+                                               reduce_type);
+  builder.CreateCall(parallel_reduce,
+                     {range[0], range[1], range[2], body, env_ptr, combine,
+                      builder.CreateBitCast(result_slot, byte_ptr),
+                      result_size});
+  return builder.CreateLoad(result_slot, "par.result");
+}
+
+Function* CodeGenPass::gen_parallel_body(ExprAST* body, StructType* env_type,
+                                         Function* combine,
+                                         Type* result_type) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto int_type = Type::getInt64Ty(context);
+  auto byte_ptr = Type::getInt8PtrTy(context);
+
+  auto thunk_type = FunctionType::get(Type::getVoidTy(context),
+                                      {byte_ptr, int_type, int_type, byte_ptr},
+                                      false);
+  auto thunk = Function::Create(thunk_type, Function::InternalLinkage,
+                                "par.body", state_.current_module.get());
+
+  // the body is generated as if it were the whole of the thunk, then the
+  //  state of the enclosing function is put back
+  auto saved_insert_point = builder.saveIP();
+  std::map<std::string, AllocaInst*> saved_values;
+  std::set<Value*> saved_free_list;
+  saved_values.swap(state_.named_values);
+  saved_free_list.swap(free_list_);
+  AutoScope restore_state([&]{
+      builder.restoreIP(saved_insert_point);
+      state_.named_values.swap(saved_values);
+      free_list_.swap(saved_free_list);
+    });
+
+  auto thunk_args = thunk->arg_begin();
+  Value* env_arg = &*thunk_args++;
+  Value* begin = &*thunk_args++;
+  Value* end = &*thunk_args++;
+  Value* out = &*thunk_args;
+  builder.SetInsertPoint(BasicBlock::Create(context, "entry", thunk));
+  auto env = builder.CreateBitCast(env_arg, env_type->getPointerTo(), "env");
+  for (unsigned i = 0; i < env_type->getNumElements(); ++i) {
+    bind_placeholder("par arg" + std::to_string(i),
+                     builder.CreateLoad(builder.CreateStructGEP(env_type, env,
+                                                                i)));
+  }
+  auto index_slot = bind_placeholder("par index", begin);
+
+  auto cond_block = BasicBlock::Create(context, "par.cond", thunk);
+  auto loop_block = BasicBlock::Create(context, "par.loop", thunk);
+  auto exit_block = BasicBlock::Create(context, "par.exit", thunk);
+  builder.CreateBr(cond_block);
+  builder.SetInsertPoint(cond_block);
+  auto index = builder.CreateLoad(index_slot, "index");
+  builder.CreateCondBr(builder.CreateICmpSLT(index, end, "inrange"),
+                       loop_block, exit_block);
+
+  builder.SetInsertPoint(loop_block);
+  // anything the iteration allocates is freed at the end of it
+  body->ends_scope_ = true;
+  body->run_pass(this);
+  auto value = result();
+  if (!value) {
+    thunk->eraseFromParent();
+    return nullptr;
+  }
+  if (combine) {
+    IRBuilder<> TmpB(&thunk->getEntryBlock(),
+                     thunk->getEntryBlock().begin());
+    auto value_slot = TmpB.CreateAlloca(result_type, 0, "par.value");
+    builder.CreateStore(value, value_slot);
+    builder.CreateCall(combine,
+                       {out, builder.CreateBitCast(value_slot, byte_ptr)});
+  }
+  index = builder.CreateLoad(index_slot, "index");
+  builder.CreateStore(builder.CreateAdd(index, ConstantInt::get(int_type, 1),
+                                        "nextindex"),
+                      index_slot);
+  builder.CreateBr(cond_block);
+
+  builder.SetInsertPoint(exit_block);
+  builder.CreateRetVoid();
+  return thunk;
+}
+
+Function* CodeGenPass::gen_parallel_combine(ExprAST* combine,
+                                            Type* result_type) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto byte_ptr = Type::getInt8PtrTy(context);
+
+  auto combine_type = FunctionType::get(Type::getVoidTy(context),
+                                        {byte_ptr, byte_ptr}, false);
+  auto function = Function::Create(combine_type, Function::InternalLinkage,
+                                   "par.combine",
+                                   state_.current_module.get());
+
+  auto saved_insert_point = builder.saveIP();
+  std::map<std::string, AllocaInst*> saved_values;
+  std::set<Value*> saved_free_list;
+  saved_values.swap(state_.named_values);
+  saved_free_list.swap(free_list_);
+  AutoScope restore_state([&]{
+      builder.restoreIP(saved_insert_point);
+      state_.named_values.swap(saved_values);
+      free_list_.swap(saved_free_list);
+    });
+
+  builder.SetInsertPoint(BasicBlock::Create(context, "entry", function));
+  auto function_args = function->arg_begin();
+  auto lhs = builder.CreateBitCast(&*function_args++,
+                                   result_type->getPointerTo(), "lhs");
+  auto rhs = builder.CreateBitCast(&*function_args,
+                                   result_type->getPointerTo(), "rhs");
+  bind_placeholder("par acc0", builder.CreateLoad(lhs));
+  bind_placeholder("par acc1", builder.CreateLoad(rhs));
+  combine->ends_scope_ = true;
+  combine->run_pass(this);
+  auto value = result();
+  if (!value) {
+    function->eraseFromParent();
+    return nullptr;
+  }
+  builder.CreateStore(value, lhs);
+  builder.CreateRetVoid();
+  return function;
+}
+
+Type* CodeGenPass::get_atomic_cell_type(TypeVariable* type_var) {
+  if (resolve_variable(atomic_value_type(type_var)) == BoolType) {
+    return Type::getInt8Ty(state_.llvm_context);
+  }
+  return Type::getInt64Ty(state_.llvm_context);
+}
+
+bool CodeGenPass::get_atomic_ordering(CallExprAST* node, size_t index,
+                                      AtomicOrdering &ordering) {
+  static const std::map<std::string, AtomicOrdering> s_orderings = {
+    {"Relaxed", AtomicOrdering::Monotonic},
+    {"Acquire", AtomicOrdering::Acquire},
+    {"Release", AtomicOrdering::Release},
+    {"AcqRel", AtomicOrdering::AcquireRelease},
+    {"SeqCst", AtomicOrdering::SequentiallyConsistent},
+  };
+  ordering = AtomicOrdering::SequentiallyConsistent;
+  if (node->Args.size() <= index) {
+    return true;
+  }
+  // the ordering is part of the instruction, so it has to be known here
+  auto order =
+    dynamic_cast<ValueConstructorExprAST*>(node->Args[index].get());
+  if (order && s_orderings.count(order->constructor_) > 0) {
+    ordering = s_orderings.at(order->constructor_);
+    return true;
+  }
+  logger_.error("codegen error", node->Callee + " takes the memory order "
+                                 "written out, one of Relaxed, Acquire, "
+                                 "Release, AcqRel or SeqCst");
+  return false;
+}
+
+Value* CodeGenPass::atomic_builtin(CallExprAST* node) {
+  auto &builder = state_.builder;
+  auto &context = state_.llvm_context;
+  auto &args = node->Args;
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  std::vector<Value*> values;
+  // the memory order isn't evaluated, see get_atomic_ordering
+  size_t operands = node->Callee == "load" ? 1
+                    : node->Callee.compare(0, 16, "compare_exchange") == 0 ? 3
+                    : 2;
+  for (size_t i = 0; i < operands && i < args.size(); ++i) {
+    args[i]->run_pass(this);
+    auto value = result();
+    if (!value) {
+      return nullptr;
+    }
+    values.push_back(value);
+  }
+  if (values.empty()) {
+    return nullptr;
+  }
+
+  auto atomic = node->Callee.compare(0, 7, "atomic_") == 0
+                || node->Callee.compare(0, 7, "padded_") == 0
+                ? node->type_var_ : args[0]->type_var_;
+  auto value_type = resolve_variable(atomic_value_type(atomic));
+  auto cell_type = get_atomic_cell_type(atomic);
+  auto alignment = cell_type->getPrimitiveSizeInBits() / 8;
+  // bools are kept in a byte and pointers as integers, as atomicrmw only
+  //  works on integers
+  auto to_cell = [&](Value* value) -> Value* {
+    if (value_type == BoolType) {
+      return builder.CreateZExt(value, cell_type, "atomic.cell");
+    }
+    if (is_pointer_type(value_type)) {
+      return builder.CreatePtrToInt(value, cell_type, "atomic.cell");
+    }
+    return value;
+  };
+  auto from_cell = [&](Value* value) -> Value* {
+    if (value_type == BoolType) {
+      return builder.CreateICmpNE(value, ConstantInt::get(cell_type, 0),
+                                  "atomic.bool");
+    }
+    if (is_pointer_type(value_type)) {
+      return builder.CreateIntToPtr(value, get_value_type(value_type, false),
+                                    "atomic.ptr");
+    }
+    return value;
+  };
+
+  if (node->Callee.compare(0, 7, "atomic_") == 0
+      || node->Callee.compare(0, 7, "padded_") == 0) {
+    auto ITy = Type::getInt64Ty(context);
+    Value* cell = nullptr;
+    if (node->Callee.compare(0, 7, "padded_") == 0) {
+      // a cache line to itself, so that atomics updated by different
+      //  threads (e.g. per thread counters) don't slow each other down
+      auto byte_ptr = Type::getInt8PtrTy(context);
+      auto alloc_type = FunctionType::get(byte_ptr, {ITy, ITy}, false);
+      auto aligned_alloc =
+        state_.current_module->getOrInsertFunction("aligned_alloc",
+                                                   alloc_type);
+      auto line_size = ConstantInt::get(ITy, 64);
+      cell = builder.CreateCall(aligned_alloc, {line_size, line_size},
+                                "atomic");
+      cell = builder.CreateBitCast(cell, cell_type->getPointerTo());
+    }
+    else {
+      auto cell_size = ConstantInt::get(ITy, alignment);
+      auto malloc_cell = CallInst::CreateMalloc(builder.GetInsertBlock(), ITy,
+                                                cell_type, cell_size, nullptr,
+                                                nullptr, "atomic");
+      cell = builder.Insert(malloc_cell);
+    }
+    // nobody else can see the cell yet
+    builder.CreateStore(to_cell(values[0]), cell);
+    free_list_.insert(cell);
+    return cell;
+  }
+
+  AtomicOrdering ordering;
+  if (!get_atomic_ordering(node, operands, ordering)) {
+    return nullptr;
+  }
+  auto cell = builder.CreateBitCast(values[0], cell_type->getPointerTo());
+  auto &name = node->Callee;
+
+  if (name == "load") {
+    if (ordering == AtomicOrdering::Release
+        || ordering == AtomicOrdering::AcquireRelease) {
+      logger_.error("codegen error", "load can't be Release or AcqRel");
+      return nullptr;
+    }
+    auto load = builder.CreateLoad(cell, "atomic.load");
+    load->setAtomic(ordering);
+    load->setAlignment(alignment);
+    return from_cell(load);
+  }
+  if (name == "store") {
+    if (ordering == AtomicOrdering::Acquire
+        || ordering == AtomicOrdering::AcquireRelease) {
+      logger_.error("codegen error", "store can't be Acquire or AcqRel");
+      return nullptr;
+    }
+    auto store = builder.CreateStore(to_cell(values[1]), cell);
+    store->setAtomic(ordering);
+    store->setAlignment(alignment);
+    return ConstantInt::get(context,
+                            APInt(/*nbits*/32, 0, /*is_signed*/false));
+  }
+  if (name.compare(0, 16, "compare_exchange") == 0) {
+    auto failure_ordering =
+      AtomicCmpXchgInst::getStrongestFailureOrdering(ordering);
+    auto cmpxchg = builder.CreateAtomicCmpXchg(cell, to_cell(values[1]),
+                                               to_cell(values[2]), ordering,
+                                               failure_ordering);
+    cmpxchg->setWeak(name == "compare_exchange_weak");
+    return builder.CreateExtractValue(cmpxchg, 1, "atomic.success");
+  }
+
+  static const std::map<std::string, AtomicRMWInst::BinOp> s_rmw_ops = {
+    {"exchange", AtomicRMWInst::Xchg},
+    {"fetch_add", AtomicRMWInst::Add},
+    {"fetch_sub", AtomicRMWInst::Sub},
+    {"fetch_and", AtomicRMWInst::And},
+    {"fetch_or", AtomicRMWInst::Or},
+    {"fetch_xor", AtomicRMWInst::Xor},
+    {"fetch_max", AtomicRMWInst::Max},
+    {"fetch_min", AtomicRMWInst::Min},
+  };
+  auto op = s_rmw_ops.at(name);
+  bool bitwise = op == AtomicRMWInst::And || op == AtomicRMWInst::Or
+                 || op == AtomicRMWInst::Xor;
+  if ((is_pointer_type(value_type) && op != AtomicRMWInst::Xchg)
+      || (value_type == BoolType && op != AtomicRMWInst::Xchg && !bitwise)) {
+    std::ostringstream msg;
+    logger_.error("codegen error", msg << name << " doesn't work on atomic "
+                                       << value_type->get_name());
+    return nullptr;
+  }
+  auto old_value = builder.CreateAtomicRMW(op, cell, to_cell(values[1]),
+                                           ordering);
+  return from_cell(old_value);
+}
+
+Type* CodeGenPass::get_generator_item_type(TypeVariable* item) {
+  auto item_type = get_return_type(item);
+  if (item_type->isVoidTy()) {
+    return nullptr;
+  }
+  return item_type;
+}
+
+unsigned CodeGenPass::get_promise_alignment(Type* item_type) {
+  auto &data_layout = state_.current_module->getDataLayout();
+  return data_layout.getPrefTypeAlignment(item_type);
+}
+
+// generators are lowered to llvm's switched-resume coroutines: calling the
+//  function only sets up the frame and returns its handle, and a for loop
+//  resumes it for every value. once the coroutine passes have inlined a
+//  generator into a loop that destroys it, the frame is elided (coro.alloc
+//  is false) and the loop ends up as if the body had been written inline
+bool CodeGenPass::begin_generator(Function* function, TypeVariable* item) {
+  auto &builder = state_.builder;
+
+  auto item_type = get_generator_item_type(item);
+  if (!item_type) {
+    logger_.error("codegen error", "a generator has to yield values");
+    return false;
+  }
+  coroutine_.item_type = item_type;
+  begin_coroutine(function, item_type);
+
+  // nothing runs until the first value is asked for
+  BasicBlock* body_block = BasicBlock::Create(state_.llvm_context, "body",
+                                              function);
+  gen_suspend(body_block, false);
+  builder.SetInsertPoint(body_block);
+  return true;
+}
+
+// async functions are lowered the same way, but it's the runtime
+//  (bonAsync.cc) that resumes them: when they're started or awaited, and
+//  whenever what they await is done
+void CodeGenPass::begin_async(Function* function, TypeVariable* result) {
+  auto &builder = state_.builder;
+
+  auto promise_type = get_async_promise_type(result);
+  coroutine_.is_async = true;
+  if (promise_type->getNumElements() > 1) {
+    coroutine_.item_type = promise_type->getElementType(1);
+  }
+  begin_coroutine(function, promise_type);
+  // not started yet, see bon::async_start
+  builder.CreateStore(builder.getInt64(0),
+                      builder.CreateStructGEP(promise_type,
+                                              coroutine_.promise, 0));
+
+  BasicBlock* body_block = BasicBlock::Create(state_.llvm_context, "body",
+                                              function);
+  gen_suspend(body_block, false);
+  builder.SetInsertPoint(body_block);
+}
+
+void CodeGenPass::begin_coroutine(Function* function, Type* promise_type) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto module = state_.current_module.get();
+
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                   function->getEntryBlock().begin());
+  coroutine_.promise = TmpB.CreateAlloca(promise_type, 0, "promise");
+  coroutine_.promise->setAlignment(get_promise_alignment(promise_type));
+
+  auto byte_ptr = Type::getInt8PtrTy(context);
+  auto null_ptr = ConstantPointerNull::get(byte_ptr);
+  auto promise = builder.CreateBitCast(coroutine_.promise, byte_ptr);
+  coroutine_.id = builder.CreateCall(
+                      Intrinsic::getDeclaration(module, Intrinsic::coro_id),
+                      {builder.getInt32(0), promise, null_ptr, null_ptr},
+                      "id");
+
+  BasicBlock* entry_block = builder.GetInsertBlock();
+  BasicBlock* alloc_block = BasicBlock::Create(context, "frame.alloc",
+                                               function);
+  BasicBlock* begin_block = BasicBlock::Create(context, "frame.begin",
+                                               function);
+  auto need_alloc = builder.CreateCall(
+                    Intrinsic::getDeclaration(module, Intrinsic::coro_alloc),
+                    coroutine_.id, "need.alloc");
+  builder.CreateCondBr(need_alloc, alloc_block, begin_block);
+
+  builder.SetInsertPoint(alloc_block);
+  auto ITy = Type::getInt64Ty(context);
+  auto frame_size = builder.CreateCall(
+              Intrinsic::getDeclaration(module, Intrinsic::coro_size, ITy),
+              {}, "frame.size");
+  auto malloc_frame = CallInst::CreateMalloc(alloc_block, ITy,
+                                             Type::getInt8Ty(context),
+                                             frame_size, nullptr, nullptr,
+                                             "frame.mem");
+  auto frame_mem = builder.Insert(malloc_frame);
+  builder.CreateBr(begin_block);
+
+  builder.SetInsertPoint(begin_block);
+  auto frame = builder.CreatePHI(byte_ptr, 2, "frame");
+  frame->addIncoming(null_ptr, entry_block);
+  frame->addIncoming(frame_mem, alloc_block);
+  coroutine_.handle = builder.CreateCall(
+                    Intrinsic::getDeclaration(module, Intrinsic::coro_begin),
+                    {coroutine_.id, frame}, "handle");
+
+  coroutine_.cleanup_block = BasicBlock::Create(context, "frame.free",
+                                                function);
+  coroutine_.suspend_block = BasicBlock::Create(context, "suspend", function);
+}
+
+void CodeGenPass::end_coroutine() {
+  auto &builder = state_.builder;
+  auto module = state_.current_module.get();
+
+  // the consumer sees the generator is done with llvm.coro.done
+  gen_suspend(nullptr, true);
+
+  builder.SetInsertPoint(coroutine_.cleanup_block);
+  // null when the frame was elided
+  auto frame_mem = builder.CreateCall(
+                      Intrinsic::getDeclaration(module, Intrinsic::coro_free),
+                      {coroutine_.id, coroutine_.handle}, "frame.mem");
+  auto free_inst = CallInst::CreateFree(frame_mem, coroutine_.cleanup_block);
+  builder.Insert(free_inst);
+  builder.CreateBr(coroutine_.suspend_block);
+
+  builder.SetInsertPoint(coroutine_.suspend_block);
+  builder.CreateCall(Intrinsic::getDeclaration(module, Intrinsic::coro_end),
+                     {coroutine_.handle, builder.getFalse()});
+  builder.CreateRet(coroutine_.handle);
+}
+
+void CodeGenPass::end_async(Value* result) {
+  auto &builder = state_.builder;
+  auto byte_ptr = Type::getInt8PtrTy(state_.llvm_context);
+
+  if (coroutine_.item_type) {
+    auto promise_type = coroutine_.promise->getAllocatedType();
+    builder.CreateStore(as_promise_item(result),
+                        builder.CreateStructGEP(promise_type,
+                                                coroutine_.promise, 1));
+  }
+  // whoever awaits it is resumed once this resume returns
+  auto finished = get_async_runtime_function(
+                          "bon_async_finished",
+                          Type::getVoidTy(state_.llvm_context),
+                          {byte_ptr, byte_ptr});
+  builder.CreateCall(finished, {coroutine_.handle,
+                                builder.CreateBitCast(coroutine_.promise,
+                                                      byte_ptr)});
+  end_coroutine();
+}
+
+void CodeGenPass::gen_suspend(BasicBlock* resume_block, bool final,
+                              Value* save) {
+  auto &builder = state_.builder;
+  if (!save) {
+    save = ConstantTokenNone::get(state_.llvm_context);
+  }
+  auto suspend = builder.CreateCall(
+                      Intrinsic::getDeclaration(state_.current_module.get(),
+                                                Intrinsic::coro_suspend),
+                      {save, builder.getInt1(final)},
+                      "suspend");
+  // -1 when suspending, 0 when resumed and 1 when destroyed
+  auto cases = builder.CreateSwitch(suspend, coroutine_.suspend_block, 2);
+  if (resume_block) {
+    cases->addCase(builder.getInt8(0), resume_block);
+  }
+  cases->addCase(builder.getInt8(1), coroutine_.cleanup_block);
+}
+
+Value* CodeGenPass::yield_builtin(CallExprAST* node) {
+  auto &builder = state_.builder;
+  if (!coroutine_.promise || coroutine_.is_async) {
+    logger_.error("codegen error", "yield outside of a generator");
+    return nullptr;
+  }
+
+  node->Args[0]->run_pass(this);
+  auto value = result();
+  if (!value) {
+    return nullptr;
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  builder.CreateStore(as_promise_item(value), coroutine_.promise);
+
+  Function* function = builder.GetInsertBlock()->getParent();
+  BasicBlock* resume_block = BasicBlock::Create(state_.llvm_context,
+                                                "resume", function);
+  gen_suspend(resume_block, false);
+  builder.SetInsertPoint(resume_block);
+
+  return ConstantInt::get(state_.llvm_context,
+                          APInt(/*nbits*/32, 0, /*is_signed*/false));
+}
+
+Value* CodeGenPass::as_promise_item(Value* value) {
+  auto &builder = state_.builder;
+  // small objects are copied into the promise, like when they're returned
+  auto item_type = coroutine_.item_type;
+  if (item_type->isStructTy() && value->getType()->isPointerTy()) {
+    auto item_ptr = builder.CreateBitOrPointerCast(value,
+                                                   item_type->getPointerTo(),
+                                                   "item.bitcast");
+    return builder.CreateLoad(item_ptr);
+  }
+  if (value->getType() != item_type) {
+    return builder.CreateBitOrPointerCast(value, item_type);
+  }
+  return value;
+}
+
+StructType* CodeGenPass::get_async_promise_type(TypeVariable* result) {
+  auto &context = state_.llvm_context;
+  std::vector<Type*> members = {Type::getInt64Ty(context)};
+  auto result_type = get_return_type(result);
+  if (!result_type->isVoidTy()) {
+    members.push_back(result_type);
+  }
+  return StructType::get(context, members);
+}
+
+Value* CodeGenPass::get_async_state(Value* handle, StructType* promise_type) {
+  auto &builder = state_.builder;
+  return builder.CreateCall(
+              Intrinsic::getDeclaration(state_.current_module.get(),
+                                        Intrinsic::coro_promise),
+              {handle, builder.getInt32(get_promise_alignment(promise_type)),
+               builder.getFalse()},
+              "async.state");
+}
+
+Value* CodeGenPass::take_async_result(Value* handle, StructType* promise_type,
+                                      bool owned) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto byte_ptr = Type::getInt8PtrTy(context);
+
+  auto state = get_async_state(handle, promise_type);
+  Value* async_result = nullptr;
+  if (promise_type->getNumElements() == 1) {
+    async_result = ConstantInt::get(context, APInt(32, 0, false));
+  }
+  else {
+    auto promise = builder.CreateBitCast(state,
+                                         promise_type->getPointerTo());
+    async_result = builder.CreateLoad(
+                            builder.CreateStructGEP(promise_type, promise, 1),
+                            "async.result");
+  }
+  if (owned) {
+    auto drop = get_async_runtime_function("bon_async_drop",
+                                           Type::getVoidTy(context),
+                                           {byte_ptr, byte_ptr});
+    builder.CreateCall(drop, {handle, state});
+  }
+
+  if (async_result->getType()->isStructTy()) {
+    return spill_returned_value(async_result);
+  }
+  if (async_result->getType()->isPointerTy()) {
+    // whoever awaits the call owns its result, like the result of a call
+    free_list_.insert(async_result);
+  }
+  return async_result;
+}
+
+Value* CodeGenPass::await_builtin(CallExprAST* node) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto module = state_.current_module.get();
+  if (!coroutine_.is_async) {
+    logger_.error("codegen error", "await outside of an async function");
+    return nullptr;
+  }
+
+  node->Args[0]->run_pass(this);
+  auto awaited = result();
+  if (!awaited) {
+    return nullptr;
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto byte_ptr = Type::getInt8PtrTy(context);
+  auto void_type = Type::getVoidTy(context);
+  Function* function = builder.GetInsertBlock()->getParent();
+  BasicBlock* resume_block = BasicBlock::Create(context, "resume", function);
+  // another thread can resume the coroutine as soon as the runtime knows
+  //  about it, even before it's done suspending
+  auto save = builder.CreateCall(
+                      Intrinsic::getDeclaration(module, Intrinsic::coro_save),
+                      coroutine_.handle, "save");
+
+  if (resolve_variable(node->Args[0]->type_var_) == IoType) {
+    auto wait = get_async_runtime_function("bon_async_wait", void_type,
+                                           {byte_ptr, byte_ptr});
+    builder.CreateCall(wait, {awaited, coroutine_.handle});
+    gen_suspend(resume_block, false, save);
+    builder.SetInsertPoint(resume_block);
+    auto io_result = get_async_runtime_function("bon_async_result",
+                                                Type::getInt64Ty(context),
+                                                {byte_ptr});
+    return builder.CreateCall(io_result, awaited, "io.result");
+  }
+
+  // an async call made just to be awaited is dropped as soon as its result
+  //  is read
+  bool owned = free_list_.erase(awaited) > 0;
+  auto promise_type = get_async_promise_type(node->type_var_);
+  auto await_call = get_async_runtime_function("bon_async_await", void_type,
+                                               {byte_ptr, byte_ptr,
+                                                byte_ptr});
+  builder.CreateCall(await_call, {awaited,
+                                  get_async_state(awaited, promise_type),
+                                  coroutine_.handle});
+  gen_suspend(resume_block, false, save);
+  builder.SetInsertPoint(resume_block);
+  return take_async_result(awaited, promise_type, owned);
+}
+
+Value* CodeGenPass::async_builtin(CallExprAST* node) {
+  auto &context = state_.llvm_context;
+  auto &builder = state_.builder;
+  auto byte_ptr = Type::getInt8PtrTy(context);
+  auto void_type = Type::getVoidTy(context);
+
+  node->Args[0]->run_pass(this);
+  auto handle = result();
+  if (!handle) {
+    return nullptr;
+  }
+  Value* num_threads = builder.getInt64(1);
+  if (node->Callee == "run_async_threads") {
+    node->Args[1]->run_pass(this);
+    num_threads = result();
+    if (!num_threads) {
+      return nullptr;
+    }
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto promise_type = get_async_promise_type(
+                              async_result_type(node->Args[0]->type_var_));
+  if (node->Callee == "start_async") {
+    // the caller still owns the call, dropping it doesn't stop it
+    auto start = get_async_runtime_function("bon_async_start", void_type,
+                                            {byte_ptr, byte_ptr});
+    builder.CreateCall(start, {handle, get_async_state(handle,
+                                                       promise_type)});
+    return handle;
+  }
+
+  bool owned = free_list_.erase(handle) > 0;
+  auto run = get_async_runtime_function("bon_async_run", void_type,
+                                        {byte_ptr, byte_ptr,
+                                         Type::getInt64Ty(context)});
+  builder.CreateCall(run, {handle, get_async_state(handle, promise_type),
+                           num_threads});
+  return take_async_result(handle, promise_type, owned);
+}
+
+Constant* CodeGenPass::get_async_runtime_function(const std::string &name,
+                                                  Type* result_type,
+                                                  ArrayRef<Type*> arg_types) {
+  auto function_type = FunctionType::get(result_type, arg_types, false);
+  return state_.current_module->getOrInsertFunction(name, function_type);
+}
+
+Type* CodeGenPass::get_element_type(TypeVariable* elem_type) {
+  // @soa objects are spread over columns of 8 byte cells
+  if (is_soa_type(elem_type)) {
+    return Type::getInt64Ty(state_.llvm_context);
+  }
+  // small classes live directly in the buffer, anything else boxed
+  //  is stored as a pointer to the object
+  if (is_inline_type(elem_type)) {
+    return get_value_type(elem_type, false);
+  }
+  return get_value_type(elem_type, is_boxed_type(elem_type));
+}
+
+bool CodeGenPass::is_inline_element(ExprAST* node) {
+  return dynamic_cast<PtrOffsetExprAST*>(node) != nullptr
+         && is_inline_type(node->type_var_);
+}
+
+MDNode* CodeGenPass::get_tbaa_tag(Type* type) {
+  if (!type->isIntegerTy() && !type->isFloatingPointTy()
+      && !type->isPointerTy()) {
+    return nullptr;
+  }
+  // all pointers share one type, the same field or slot can be read
+  //  through differently typed pointers (e.g. variant args are stored
+  //  bitcast to a generic pointer)
+  if (type->isPointerTy()) {
+    type = Type::getInt8PtrTy(state_.llvm_context);
+  }
+  auto &tag = state_.tbaa_tags[type];
+  if (!tag) {
+    MDBuilder md_builder(state_.llvm_context);
+    if (!state_.tbaa_root) {
+      state_.tbaa_root = md_builder.createTBAARoot("bon tbaa");
+    }
+    std::string type_name;
+    raw_string_ostream name_stream(type_name);
+    type->print(name_stream);
+    auto scalar = md_builder.createTBAAScalarTypeNode(name_stream.str(),
+                                                      state_.tbaa_root);
+    tag = md_builder.createTBAAStructTagNode(scalar, scalar, 0);
+  }
+  return tag;
+}
+
+void CodeGenPass::set_tbaa(Instruction* inst, Type* type) {
+  if (auto tag = get_tbaa_tag(type)) {
+    inst->setMetadata(LLVMContext::MD_tbaa, tag);
+  }
+}
+
+bool CodeGenPass::is_typed_access(ExprAST* node) {
+  // @soa columns are moved around as 8 byte cells, whatever the field type
+  if (auto field = dynamic_cast<BinaryExprAST*>(node)) {
+    return field->Op == tok_dot && !is_soa_type(field->LHS->type_var_);
+  }
+  return dynamic_cast<PtrOffsetExprAST*>(node) != nullptr
+         && !is_inline_type(node->type_var_);
+}
+
+bool CodeGenPass::returns_by_value(Function* function) {
+  // @soa references are literal structs, and are returned as they are
+  auto ret_type = dyn_cast<StructType>(function->getReturnType());
+  return ret_type != nullptr && !ret_type->isLiteral();
+}
+
+bool CodeGenPass::returns_slot(Function* function) {
+  auto proto = state_.function_protos.find(function->getName().str());
+  return proto != state_.function_protos.end()
+         && proto->second->returns_slot_;
+}
+
+bool CodeGenPass::returns_soa_copy(Function* function) {
+  // the only other literal struct returned is an @soa reference
+  auto ret_type = dyn_cast<StructType>(function->getReturnType());
+  return ret_type != nullptr && ret_type->isLiteral()
+         && ret_type != get_soa_ref_type();
+}
+
+Value* CodeGenPass::spill_returned_value(Value* ret_val) {
+  auto ret_type = dyn_cast<StructType>(ret_val->getType());
+  if (ret_type == nullptr || ret_type == get_soa_ref_type()) {
+    return ret_val;
+  }
+  Function* function = state_.builder.GetInsertBlock()->getParent();
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                   function->getEntryBlock().begin());
+  auto slot = TmpB.CreateAlloca(ret_type, 0, "retval.slot");
+  state_.builder.CreateStore(ret_val, slot);
+  if (ret_type->isLiteral()) {
+    // the fields of an @soa object, packed together like any local one
+    auto stride = ConstantInt::get(state_.llvm_context,
+                                   APInt(/*nbits*/64, 8, /*is_signed*/false));
+    return build_soa_ref(slot, stride);
+  }
+  return slot;
+}
+
+Value* CodeGenPass::copy_inline_object(Value* obj_ptr) {
+  auto obj_type = obj_ptr->getType()->getPointerElementType();
+  Type* ITy = Type::getInt64Ty(state_.llvm_context);
+  Constant* AllocSize = ConstantExpr::getSizeOf(obj_type);
+  AllocSize = ConstantExpr::getTruncOrBitCast(AllocSize, ITy);
+  auto copy = CallInst::CreateMalloc(state_.builder.GetInsertBlock(),
+                                     ITy, obj_type, AllocSize,
+                                     nullptr, nullptr, "mallocVal");
+  state_.builder.Insert(copy, obj_ptr->getName() + ".copy");
+  state_.builder.CreateStore(state_.builder.CreateLoad(obj_ptr), copy);
+  return copy;
+}
+
+StructType* CodeGenPass::get_soa_ref_type() {
+  std::vector<Type*> members;
+  // address of the object's first field
+  members.push_back(Type::getInt8PtrTy(state_.llvm_context));
+  // distance in bytes between fields (i.e. the column size)
+  members.push_back(Type::getInt64Ty(state_.llvm_context));
+  return StructType::get(state_.llvm_context, members);
+}
+
+StructType* CodeGenPass::get_soa_storage_type(TypeVariable* type_var) {
+  std::vector<Type*> members;
+  for (auto field : get_constructor_fields(type_var)) {
+    members.push_back(get_value_type(field));
+  }
+  return StructType::get(state_.llvm_context, members);
+}
+
+Value* CodeGenPass::build_soa_ref(Value* base, Value* stride) {
+  auto base_ptr =
+    state_.builder.CreateBitOrPointerCast(base,
+                                          Type::getInt8PtrTy(
+                                                      state_.llvm_context),
+                                          base->getName() + ".bitcast");
+  Value* obj_ref = UndefValue::get(get_soa_ref_type());
+  obj_ref = state_.builder.CreateInsertValue(obj_ref, base_ptr, 0);
+  obj_ref = state_.builder.CreateInsertValue(obj_ref, stride, 1, "soa.ref");
+  return obj_ref;
+}
+
+Value* CodeGenPass::alloc_soa_object(TypeVariable* type_var,
+                                     const std::string &name) {
+  auto function = state_.builder.GetInsertBlock()->getParent();
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                   function->getEntryBlock().begin());
+  auto storage = TmpB.CreateAlloca(get_soa_storage_type(type_var), 0, name);
+  // outside of a buffer the fields are packed together, one cell apart
+  auto stride = ConstantInt::get(state_.llvm_context,
+                                 APInt(/*nbits*/64, 8, /*is_signed*/false));
+  return build_soa_ref(storage, stride);
+}
+
+Value* CodeGenPass::get_soa_field_ptr(Value* obj_ref, size_t field_index,
+                                      Type* field_type) {
+  auto base = state_.builder.CreateExtractValue(obj_ref, 0, "soa.base");
+  auto stride = state_.builder.CreateExtractValue(obj_ref, 1, "soa.stride");
+  auto field_idx = ConstantInt::get(state_.llvm_context,
+                                    APInt(/*nbits*/64, field_index,
+                                          /*is_signed*/false));
+  auto offset = state_.builder.CreateMul(stride, field_idx, "soa.offset");
+  Value* field_ptr =
+    state_.builder.CreateGEP(Type::getInt8Ty(state_.llvm_context), base,
+                             offset);
+  return state_.builder.CreateBitOrPointerCast(field_ptr,
+                                               field_type->getPointerTo(),
+                                               "soa.field");
+}
+
+void CodeGenPass::copy_soa_object(Value* dst_ref, Value* src_ref,
+                                  TypeVariable* type_var) {
+  auto storage_type = get_soa_storage_type(type_var);
+  for (size_t i = 0; i < storage_type->getNumElements(); ++i) {
+    auto field_type = storage_type->getElementType(i);
+    auto src_ptr = get_soa_field_ptr(src_ref, i, field_type);
+    auto dst_ptr = get_soa_field_ptr(dst_ref, i, field_type);
+    state_.builder.CreateStore(state_.builder.CreateLoad(src_ptr), dst_ptr);
+  }
+}
+
+Value* CodeGenPass::load_soa_object(Value* obj_ref, TypeVariable* type_var) {
+  auto storage_type = get_soa_storage_type(type_var);
+  Value* fields = UndefValue::get(storage_type);
+  for (unsigned i = 0; i < storage_type->getNumElements(); ++i) {
+    auto field_type = storage_type->getElementType(i);
+    auto field_ptr = get_soa_field_ptr(obj_ref, i, field_type);
+    fields = state_.builder.CreateInsertValue(
+                                    fields,
+                                    state_.builder.CreateLoad(field_ptr), i);
+  }
+  return fields;
+}
+
+const ObjectLayout &CodeGenPass::get_object_layout(
+                                            const std::string &constructor,
+                                            const std::vector<Type*> &fields,
+                                            const std::string &type_name) {
+  auto key = std::make_pair(constructor, fields);
+  auto found = state_.object_layouts.find(key);
+  if (found != state_.object_layouts.end()) {
+    return found->second;
+  }
+
+  // the tag can only move for classes with a single constructor, with more
+  //  than one, code holding the class type has to read the tag before it
+  //  knows which constructor's layout applies
+  bool tag_first = true;
+  if (isupper(constructor[0])) {
+    if (auto class_type = get_type_from_constructor(constructor)) {
+      auto class_op = resolve_variable(class_type)->type_operator_;
+      tag_first = class_op == nullptr
+                  || class_op->type_constructor_ != constructor;
+    }
+  }
+
+  auto &data_layout = state_.current_module->getDataLayout();
+  auto tag_type = Type::getInt32Ty(state_.llvm_context);
+  // fields.size() stands for the tag
+  std::vector<unsigned> pending;
+  for (unsigned i = 0; i < fields.size(); ++i) {
+    pending.push_back(i);
+  }
+  if (!tag_first) {
+    pending.push_back(fields.size());
+  }
+  auto type_of = [&](unsigned i) {
+    return i == fields.size() ? tag_type : fields[i];
+  };
+  auto align_of = [&](unsigned i) {
+    return data_layout.getABITypeAlignment(type_of(i));
+  };
+  // most aligned first, which leaves no gaps between fields. ties keep
+  //  declaration order, and the tag goes after fields aligned like it
+  std::stable_sort(pending.begin(), pending.end(),
+                   [&](unsigned a, unsigned b) {
+                     return align_of(a) > align_of(b);
+                   });
+
+  ObjectLayout layout;
+  layout.field_indices.resize(fields.size());
+  std::vector<Type*> members;
+  uint64_t offset = 0;
+  auto place = [&](unsigned i) {
+    auto align = align_of(i);
+    offset = (offset + align - 1) / align * align
+             + data_layout.getTypeAllocSize(type_of(i));
+    if (i == fields.size()) {
+      layout.tag_index = members.size();
+    }
+    else {
+      layout.field_indices[i] = members.size();
+    }
+    members.push_back(type_of(i));
+  };
+  if (tag_first) {
+    place(fields.size());
+  }
+  while (!pending.empty()) {
+    // fill any gap left by the tag with the largest field that fits it
+    auto next = pending.begin();
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+      if (offset % align_of(*it) == 0) {
+        next = it;
+        break;
+      }
+    }
+    place(*next);
+    pending.erase(next);
+  }
+
+  layout.type = StructType::create(state_.llvm_context, members,
+                                   "struct." + type_name);
+  auto &entry = state_.object_layouts[key];
+  entry = layout;
+  state_.struct_layouts[layout.type] = &entry;
+  return entry;
+}
+
+unsigned CodeGenPass::get_field_index(Type* struct_type, unsigned field) {
+  auto found = state_.struct_layouts.find(dyn_cast<StructType>(struct_type));
+  if (found == state_.struct_layouts.end()) {
+    return field + 1;
+  }
+  return found->second->field_indices[field];
+}
+
+Type* CodeGenPass::get_value_type(TypeOperator* type_op,
+                                  TypeVariable* type_var) {
+  if (!type_op) {
+    return nullptr;
+  }
+  // None is a null pointer and Some(x) is x, so there's no struct
+  if (auto payload = nullable_payload_type(type_var)) {
+    return get_value_type(payload, true);
+  }
+
+  auto tname = type_var->get_name();
+  StructType* structReg = state_.struct_map[tname];
+  if (!structReg) {
+    // fields, the constructor tag is added by get_object_layout
+    std::vector<Type*> members;
+    // don't create members for generic variant
+    if (type_op->type_constructor_ != " | ") {
+      for (auto type_var : type_op->types_) {
+        // if product type, add individual members
+        if (type_var->type_operator_
+            && type_var->type_operator_->type_constructor_ == " * ") {
+          for (auto member : type_var->type_operator_->types_) {
+            if (auto val_type = get_value_type(member, is_boxed_type(member))) {
+              members.push_back(val_type);
+            }
+            else {
+              std::ostringstream msg;
+              logger_.error("codegen error",
+                            msg << "failed to allocate type " <<
+                            member->get_name() << " for constructor " <<
+                            type_op->type_constructor_);
+              return nullptr;
+            }
+          }
+          continue;
+        }
+        if (auto val_type = get_value_type(type_var, is_boxed_type(type_var))) {
+          members.push_back(val_type);
+        }
+        else {
+          std::ostringstream msg;
+          logger_.error("codegen error", msg << "failed to allocate type " <<
+                        type_var->get_name() << " for constructor " <<
+                        type_op->type_constructor_);
+          return nullptr;
+        }
+      }
+    }
+    auto variant_struct =
+      get_object_layout(type_op->type_constructor_, members, tname).type;
+    state_.struct_map[tname] = variant_struct;
+    return variant_struct;
+  }
+  return structReg;
+}
+
+// CreateEntryBlockAlloca - Create an alloca instruction in the entry block of
+// the function.  This is used for mutable variables etc.
+AllocaInst* CodeGenPass::create_entry_block_alloca(Function* function,
+                                                   const std::string &VarName,
+                                                   TypeVariable* var_type,
+                                                   ExprAST* var_expr,
+                                                   bool use_ptr) {
+  IRBuilder<> TmpB(&function->getEntryBlock(),
+                 function->getEntryBlock().begin());
+  auto type_var = resolve_variable(var_type);
+  auto tcon_operator = type_var->type_operator_;
+  if (type_var == FloatType) {
+    return TmpB.CreateAlloca(Type::getDoubleTy(state_.llvm_context), 0,
+                            VarName.c_str());
+  }
+  else if (type_var == IntType) {
+    return TmpB.CreateAlloca(Type::getInt64Ty(state_.llvm_context), 0,
+                            VarName.c_str());
+  }
+  else if (is_numeric_type(type_var) || is_simd_type(type_var)
+           || is_array_type(type_var)) {
+    return TmpB.CreateAlloca(get_numeric_type(type_var), 0, VarName.c_str());
+  }
+  else if (type_var == BoolType) {
+    return TmpB.CreateAlloca(Type::getInt1Ty(state_.llvm_context), 0,
+                            VarName.c_str());
+  }
+  else if (is_enum_type(type_var)) {
+    return TmpB.CreateAlloca(Type::getInt32Ty(state_.llvm_context), 0,
+                            VarName.c_str());
+  }
+  else if (type_var == StringType) {
+    return TmpB.CreateAlloca(Type::getInt8PtrTy(state_.llvm_context), 0,
+                            VarName.c_str());
+  }
+  else if (is_pointer_type(type_var)) {
+    auto ptr_type = get_type_of_pointer(type_var);
+    auto storage_type = get_element_type(ptr_type);
+    storage_type = PointerType::get(storage_type, 0);
+    return TmpB.CreateAlloca(storage_type, 0, VarName.c_str());
+  }
+  else if (type_var == CPointerType) {
+    auto ptr_type = Type::getVoidTy(state_.llvm_context);
+    auto storage_type = PointerType::get(ptr_type, 0);
+    return TmpB.CreateAlloca(storage_type, 0, VarName.c_str());
+  }
+  else if (is_task_type(type_var) || is_generator_type(type_var)
+           || is_async_type(type_var) || type_var == IoType) {
+    return TmpB.CreateAlloca(Type::getInt8PtrTy(state_.llvm_context), 0,
+                             VarName.c_str());
+  }
+  else if (is_atomic_type(type_var)) {
+    return TmpB.CreateAlloca(get_atomic_cell_type(type_var)->getPointerTo(), 0,
+                             VarName.c_str());
+  }
+  else if (is_soa_type(type_var)) {
+    return TmpB.CreateAlloca(get_soa_ref_type(), 0, VarName.c_str());
+  }
+  else if (var_expr) {
+    auto val_type = get_value_type_dispatch(var_expr);
+    if (use_ptr && !val_type->isPointerTy()) {
+      val_type = PointerType::get(val_type, 0);
+      return TmpB.CreateAlloca(val_type, 0, VarName.c_str());
+    }
+    else {
+      return TmpB.CreateAlloca(val_type, 0, VarName.c_str());
+    }
+  }
+  else if (auto val_type = get_value_type(tcon_operator, type_var)) {
+    if (use_ptr && !val_type->isPointerTy()) {
+      val_type = PointerType::get(val_type, 0);
+    }
+    return TmpB.CreateAlloca(val_type, 0, VarName.c_str());
+  }
+  else {
+    std::ostringstream msg;
+    logger_.error("codegen error", msg <<
+                  "requested stack allocation for variable " << VarName <<
+                  " with unknown type " << type_var->get_name());
+    return nullptr;
+  }
+}
+
+void CodeGenPass::push_case(CaseState state) {
+  assert(case_state_push_count++ == 0);
+  priv_case_state_ = state;
+}
+
+CodeGenPass::CaseState CodeGenPass::pop_case() {
+  assert(--case_state_push_count == 0);
+  return priv_case_state_;
+}
+
+Type* CodeGenPass::get_value_type(ExprAST* node) {
+  return get_value_type(node->type_var_, node->is_boxed());
+}
+
+Type* CodeGenPass::get_value_type(NumberExprAST* node) {
+  return Type::getDoubleTy(state_.llvm_context);
+}
+
+Type* CodeGenPass::get_value_type(IntegerExprAST* node) {
+  return Type::getInt64Ty(state_.llvm_context);
+}
+
+Type* CodeGenPass::get_value_type(BoolExprAST* node) {
+  return Type::getInt1Ty(state_.llvm_context);
+}
+
+Type* CodeGenPass::get_value_type(UnitExprAST* node) {
+  auto tname = node->type_var_->get_name();
+  StructType* structReg = state_.struct_map[tname];
+  if (!structReg) {
+    std::cout << "Unit type '()' unexpectedly not defined yet" << std::endl;
+  }
+  return structReg;
+}
+
+Type* CodeGenPass::get_value_type_dispatch(ExprAST* node) {
+  // TODO: this ugliness is from a refactor, need to rethink
+  NumberExprAST* num_expr = dynamic_cast<NumberExprAST*>(node);
+  IntegerExprAST* int_expr = dynamic_cast<IntegerExprAST*>(node);
+  BoolExprAST* bool_expr = dynamic_cast<BoolExprAST*>(node);
+  UnitExprAST* unit_expr = dynamic_cast<UnitExprAST*>(node);
+  ValueConstructorExprAST* val_constructor_expr =
+    dynamic_cast<ValueConstructorExprAST*>(node);
+
+  Type* node_type = nullptr;
+  if (num_expr) {
+    node_type = get_value_type(num_expr);
+  }
+  else if (int_expr) {
+    node_type = get_value_type(int_expr);
+  }
+  else if (bool_expr) {
+    node_type = get_value_type(bool_expr);
+  }
+  else if (unit_expr) {
+    node_type = get_value_type(unit_expr);
+  }
+  else if (val_constructor_expr) {
+    node_type = get_value_type(val_constructor_expr);
+  }
+  else {
+    node_type = get_value_type(node);
   }
   return node_type;
 }
 
 Type* CodeGenPass::get_value_type(ValueConstructorExprAST* node) {
   node->push_type_environment();
+  if (is_soa_type(node->type_var_)) {
+    node->pop_type_environment();
+    return get_soa_ref_type();
+  }
+  if (is_enum_type(node->type_var_)) {
+    node->pop_type_environment();
+    return Type::getInt32Ty(state_.llvm_context);
+  }
+  if (auto payload = nullable_payload_type(node->type_var_)) {
+    auto payload_type = get_value_type(payload, true);
+    node->pop_type_environment();
+    return payload_type;
+  }
 
   auto tname = node->type_var_->get_name();
-  StructType* structReg = state_.struct_map[tname];
-  if (true) {//!structReg) {
-    std::vector<Type*> members;
-    members.push_back(Type::getInt32Ty(state_.llvm_context));
-    for (auto &arg : node->tcon_args_) {
-      try {
-        members.push_back(get_value_type_dispatch(arg.get()));
-      } catch(...) {
-        std::cout << node->constructor_ << " failed with arg "
-                  << arg->type_var_->get_name() << std::endl;
-      }
+  std::vector<Type*> members;
+  for (auto &arg : node->tcon_args_) {
+    try {
+      members.push_back(get_value_type_dispatch(arg.get()));
+    } catch(...) {
+      std::cout << node->constructor_ << " failed with arg "
+                << arg->type_var_->get_name() << std::endl;
     }
-    structReg = StructType::create(state_.llvm_context, members,
-                                   "struct." + tname);
-    state_.struct_map[tname] = structReg;
   }
+  StructType* structReg =
+    get_object_layout(node->constructor_, members, tname).type;
+  state_.struct_map[tname] = structReg;
   node->pop_type_environment();
 
   // structReg->dump();
@@ -1967,7 +4532,7 @@ void CaseGenPass::process(StringExprAST* node) {
   auto string_cmp = codegen_->get_function("cstreq");
   if (!string_cmp) {
     std::ostringstream msg;
-    logger.error("internal error", msg << "missing cstreq implementation");
+    logger_.error("internal error", msg << "missing cstreq implementation");
     returns (nullptr);
     return;
   }
@@ -2013,18 +4578,33 @@ void CaseGenPass::process(VariableExprAST* node) {
 
 // ValueConstructorExprAST
 void CaseGenPass::process(ValueConstructorExprAST* node) {
+  if (is_soa_type(node->type_var_)) {
+    logger_.error("error",
+                  "pattern match on @soa objects not currently supported.");
+    returns (nullptr);
+    return;
+  }
+  if (is_enum_type(node->type_var_)) {
+    // the pattern is the constructor index itself
+    auto tcon_enum = get_constructor_value(node->constructor_);
+    auto case_type_val =
+      ConstantInt::get(state_.llvm_context,
+                       APInt(/*nbits*/32, tcon_enum, /*is_signed*/false));
+    returns (state_.builder.CreateICmpEQ(case_type_val, pattern_, "cmpenum"));
+    return;
+  }
   node->push_type_environment();
   // AutoScope pop_env([this]{ pop_environment(); });
 
   auto entry_block = state_.builder.GetInsertBlock();
   Function* function = entry_block->getParent();
 
-  auto tname = node->type_var_->get_name();
-  StructType* variant_struct = state_.struct_map[tname];
-  if (true) {//!variant_struct) {
-    // if type wasn't already registered, build here
+  // None is a null pointer, and Some(x) is x itself
+  bool is_nullable = nullable_payload_type(node->type_var_) != nullptr;
+  ObjectLayout layout;
+  if (!is_nullable) {
+    auto tname = node->type_var_->get_name();
     std::vector<Type*> members;
-    members.push_back(Type::getInt32Ty(state_.llvm_context));
     for (auto &arg : node->tcon_args_) {
       try {
         members.push_back(codegen_->get_value_type_dispatch(arg.get()));
@@ -2034,37 +4614,48 @@ void CaseGenPass::process(ValueConstructorExprAST* node) {
         std::cout << ex.what() << std::endl;
       }
     }
-    variant_struct = StructType::create(state_.llvm_context, members,
-                                        "struct." + tname);
-    state_.struct_map[tname] = variant_struct;
+    layout = codegen_->get_object_layout(node->constructor_, members, tname);
+    state_.struct_map[tname] = layout.type;
   }
+  StructType* variant_struct = layout.type;
   node->pop_type_environment();
 
-  // look up constructor index for this match case
-  auto tcon_enum = get_constructor_value(node->constructor_);
-  auto case_type_val =
-    ConstantInt::get(state_.llvm_context,
-                     APInt(/*nbits*/32, tcon_enum, /*is_signed*/false));
-
   // get constants for our indices
   auto el_idx0 = ConstantInt::get(state_.llvm_context,
                                   APInt(/*nbits*/32, 0, /*is_signed*/false));
-
-  // first index (0) dereferences pointer to struct,
-  // second index (0) points at constructor index
-  //  (differentiating e.g. Some constructor vs. None)
   std::vector<Value*> indices;
-  indices.push_back(el_idx0);
-  indices.push_back(el_idx0);
-
-  // grab pointer to constructor index for variant we're matching against
-  Value* patt_type_ptr = state_.builder.CreateGEP(variant_struct, pattern_,
-                                                  indices);
-  // load constructor index for match input
-  auto patt_type_val = state_.builder.CreateLoad(patt_type_ptr);
-  // compare constructor index against our match case
-  auto condition = state_.builder.CreateICmpEQ(case_type_val, patt_type_val,
-                                               "cmpvcon");
+  Value* condition = nullptr;
+  if (is_nullable) {
+    condition = node->tcon_args_.empty()
+                ? state_.builder.CreateIsNull(pattern_, "cmpnone")
+                : state_.builder.CreateIsNotNull(pattern_, "cmpsome");
+  }
+  else {
+    // look up constructor index for this match case
+    auto tcon_enum = get_constructor_value(node->constructor_);
+    auto case_type_val =
+      ConstantInt::get(state_.llvm_context,
+                       APInt(/*nbits*/32, tcon_enum, /*is_signed*/false));
+
+    auto tag_idx = ConstantInt::get(state_.llvm_context,
+                                    APInt(/*nbits*/32, layout.tag_index,
+                                          /*is_signed*/false));
+
+    // first index (0) dereferences pointer to struct,
+    // second index points at constructor index
+    //  (differentiating e.g. Some constructor vs. None)
+    indices.push_back(el_idx0);
+    indices.push_back(tag_idx);
+
+    // grab pointer to constructor index for variant we're matching against
+    Value* patt_type_ptr = state_.builder.CreateGEP(variant_struct, pattern_,
+                                                    indices);
+    // load constructor index for match input
+    auto patt_type_val = state_.builder.CreateLoad(patt_type_ptr);
+    // compare constructor index against our match case
+    condition = state_.builder.CreateICmpEQ(case_type_val, patt_type_val,
+                                            "cmpvcon");
+  }
 
   // if constructor is simple enum with no args (e.g. type bool = True | False)
   // return whether the constructor index matched
@@ -2100,19 +4691,23 @@ void CaseGenPass::process(ValueConstructorExprAST* node) {
 
   std::vector<std::pair<Value*, BasicBlock*>> branches;
   for (size_t i = 0; i < node->tcon_args_.size(); ++i) {
-    // first index (0) dereferences pointer to struct,
-    // second index (1) points at first constructor arg (e.g. "n" in Some(n))
-    indices.clear();
-    indices.push_back(el_idx0);
-    auto el_idx1 = ConstantInt::get(state_.llvm_context,
-                                    APInt(/*nbits*/32, i+1,
-                                          /*is_signed*/false));
-    indices.push_back(el_idx1);
-    // grab pointer to first constructor arg in match input
-    Value* patt_arg_ptr = state_.builder.CreateGEP(variant_struct,
-                                                   pattern_, indices);
-    // load first constructor arg
-    auto patt_arg_val = state_.builder.CreateLoad(patt_arg_ptr);
+    Value* patt_arg_val = pattern_;
+    if (!is_nullable) {
+      // first index (0) dereferences pointer to struct,
+      // second index points at the constructor arg (e.g. "n" in Some(n))
+      indices.clear();
+      indices.push_back(el_idx0);
+      auto el_idx1 = ConstantInt::get(state_.llvm_context,
+                                      APInt(/*nbits*/32,
+                                            layout.field_indices[i],
+                                            /*is_signed*/false));
+      indices.push_back(el_idx1);
+      // grab pointer to first constructor arg in match input
+      Value* patt_arg_ptr = state_.builder.CreateGEP(variant_struct,
+                                                     pattern_, indices);
+      // load first constructor arg
+      patt_arg_val = state_.builder.CreateLoad(patt_arg_ptr);
+    }
     // recurse - handle as independent case, and return resulting condition
     node->push_type_environment();
     Value* arg_condition = nullptr;
@@ -2188,6 +4783,10 @@ void CaseGenPass::process(IfExprAST* node) {
 void CaseGenPass::process(WhileExprAST* node) {
 }
 
+// ForExprAST
+void CaseGenPass::process(ForExprAST* node) {
+}
+
 // MatchCaseExprAST
 void CaseGenPass::process(MatchCaseExprAST* node) {
 }
@@ -2211,8 +4810,8 @@ void CaseGenPass::process(SizeofExprAST* node) {
 void CaseGenPass::process(PtrOffsetExprAST* node) {
   // TODO: this will depend on the type being pointed to.
   //       need an Eq typeclass
-  bon::logger.error("error",
-                    "pattern match on array index not currently supported.");
+  logger_.error("error",
+                "pattern match on array index not currently supported.");
   // node->run_pass(codegen_);
   // Value* value = codegen_->result();
   // returns (state_.builder.CreateICmpEQ(value, pattern_, "cmptmp"));
@@ -8,6 +8,7 @@ L*----------------------------------------------------------------------------*/
 #include "bonCompilerPass.h"
 #include "bonModuleState.h"
 
+#include <functional>
 #include <string>
 #include <map>
 
@@ -29,6 +30,7 @@ public:
   void process(BinaryExprAST* node) override;
   void process(IfExprAST* node) override;
   void process(WhileExprAST* node) override;
+  void process(ForExprAST* node) override;
   void process(MatchCaseExprAST* node) override;
   void process(MatchExprAST* node) override;
   void process(CallExprAST* node) override;
@@ -41,7 +43,7 @@ public:
   void process(TypeclassImplAST* node) override;
 
   CaseGenPass(CodeGenPass* codegen, ModuleState &state)
-    : codegen_(codegen), state_(state) {}
+    : codegen_(codegen), state_(state), logger_(state.logger) {}
 
   void set_pattern(Value* pattern) {pattern_ = pattern;}
 
@@ -49,6 +51,7 @@ private:
   friend CodeGenPass;
   CodeGenPass* codegen_;
   ModuleState &state_;
+  Logger &logger_;
   Value* pattern_;
 
   // we need a way to retrieve the output of the last instruction
@@ -73,6 +76,7 @@ public:
   void process(BinaryExprAST* node) override;
   void process(IfExprAST* node) override;
   void process(WhileExprAST* node) override;
+  void process(ForExprAST* node) override;
   void process(MatchCaseExprAST* node) override;
   void process(MatchExprAST* node) override;
   void process(CallExprAST* node) override;
@@ -89,6 +93,7 @@ public:
 private:
   friend CaseGenPass;
   ModuleState &state_;
+  Logger &logger_;
   CaseGenPass case_gen_pass_;
   // variable name to line number it was moved on
   std::map<std::string, DocPosition> moved_vars_;
@@ -99,6 +104,17 @@ private:
   std::set<Value*> child_mem_list_;
   // polymorphic destructors to generate
   std::map<std::string, std::vector<TypeVariable*>> destructor_list_;
+  // handles of generators made by calls in this function, destroyed
+  //  rather than freed at the end of their scope
+  std::set<Value*> generator_handles_;
+  // handles of async calls made in this function, to the type of their
+  //  promise. dropped rather than freed, see bon::async_drop
+  std::map<Value*, StructType*> async_handles_;
+  // handles of tasks spawned in this function, to the type of their
+  //  result. joined rather than freed at the end of their scope
+  std::map<Value*, TypeVariable*> task_handles_;
+  // tasks given channels or atomics, which can't outlive the function
+  std::set<Value*> borrowing_tasks_;
   // if we're generating destructors, make sure not to recurse
   bool in_destructor_;
   // inside codegen for a constructor?
@@ -123,6 +139,27 @@ private:
         is_last_case(_is_last_case) {}
   };
 
+  // coroutine of the generator or async function being generated
+  struct CoroutineState {
+    // token from llvm.coro.id
+    Value* id;
+    Value* handle;
+    // holds the value last yielded, or the state and result of an async
+    //  function (see get_async_promise_type)
+    AllocaInst* promise;
+    // type of the values yielded, or of the result (nullptr for ())
+    Type* item_type;
+    bool is_async;
+    // frees the frame once the coroutine is destroyed
+    BasicBlock* cleanup_block;
+    // returns to whoever started or resumed the coroutine
+    BasicBlock* suspend_block;
+    CoroutineState()
+      : id(nullptr), handle(nullptr), promise(nullptr), item_type(nullptr),
+        is_async(false), cleanup_block(nullptr), suspend_block(nullptr) {}
+  };
+  CoroutineState coroutine_;
+
   // not to be directly used
   CaseState priv_case_state_;
   // sanity check
@@ -134,6 +171,25 @@ private:
   Function* get_function(std::string name);
 
   TypeVariable* fn_type_from_call(CallExprAST* node);
+  // llvm function a call resolves to, nullptr (after logging an error) if
+  //  there isn't one
+  Function* get_callee(CallExprAST* node);
+  // evaluates the arguments of a call to callee, false on error
+  bool gen_call_args(CallExprAST* node, Function* callee,
+                     std::vector<Value*> &arg_values);
+  // llvm type a function returning values of ret_type is declared with
+  Type* get_return_type(TypeVariable* ret_type);
+
+  // canonical layout for objects built by constructor from fields of the
+  //  given types. fields are ordered to minimize padding, and the tag goes
+  //  into padding too unless other constructors of the class need to find
+  //  it at the start of the object
+  const ObjectLayout &get_object_layout(const std::string &constructor,
+                                        const std::vector<Type*> &fields,
+                                        const std::string &type_name);
+  // struct element of a field, for struct types that weren't built by
+  //  get_object_layout this is the declaration order, after the tag
+  unsigned get_field_index(Type* struct_type, unsigned field);
 
   Type* get_value_type_dispatch(ExprAST* node);
   Type* get_value_type(TypeOperator* type_op, TypeVariable* type_var);
@@ -144,6 +200,154 @@ private:
   Type* get_value_type(BoolExprAST* node);
   Type* get_value_type(UnitExprAST* node);
   Type* get_value_type(ValueConstructorExprAST* node);
+  // llvm type for int, float, the sized numeric types (i32, u8, f32, ...),
+  //  simd vectors of them and fixed length arrays
+  Type* get_numeric_type(TypeVariable* type_var);
+  // casts value between numeric types (or simd vectors with the same number
+  //  of lanes), following the signedness of from/to
+  Value* convert_numeric(Value* value, TypeVariable* from, TypeVariable* to);
+
+  // sets the builder's fast-math flags for code generated in function
+  void set_fast_math(Function* function, bool fast_math);
+  bool is_fast_math();
+  // llvm intrinsic replacing a call to a libm function (sqrt, pow, ...)
+  //  declared with cdef, or nullptr
+  Function* get_math_intrinsic(Function* callee);
+  // x ** y for floats
+  Value* build_pow(Value* base, Value* exponent);
+
+  // simd constructors (f64x4(x), ...) and the simd_* operations
+  Value* simd_builtin(CallExprAST* node);
+  // array(n, x), and indexing, set and len on fixed length arrays
+  Value* array_builtin(CallExprAST* node);
+  // spawn(f(a, b)) and join(task)
+  Value* task_builtin(CallExprAST* node);
+  // waits for task and frees its env, giving back the result
+  Value* join_task(Value* task, TypeVariable* result_type);
+  // struct passed to a spawned task, the result of callee followed by its
+  //  arguments
+  StructType* get_task_env_type(Function* callee);
+  // void(i8* env) function that calls callee with the arguments in env and
+  //  stores the result back into it
+  Function* get_task_thunk(Function* callee);
+  // parallel_for, par_map and par_reduce, see Parser::parse_parallel_builtin
+  //  for the arguments
+  Value* parallel_builtin(CallExprAST* node);
+  // void(i8* env, i64 begin, i64 end, i8* out) running body for the indices
+  //  [begin, end), with the captured arguments in env. for a reduction the
+  //  result of each iteration is combined into out
+  Function* gen_parallel_body(ExprAST* body, StructType* env_type,
+                              Function* combine, Type* result_type);
+  // void(i8* x, i8* y) setting x to combine(x, y)
+  Function* gen_parallel_combine(ExprAST* combine, Type* result_type);
+  // stack slot holding value, for the placeholder variable name
+  AllocaInst* bind_placeholder(const std::string &name, Value* value);
+  // atomic_int(x), ... and load, store, fetch_add, ... on them
+  Value* atomic_builtin(CallExprAST* node);
+  // memory order written out as argument index of node, SeqCst if there
+  //  isn't one. false (after reporting it) for anything else
+  bool get_atomic_ordering(CallExprAST* node, size_t index,
+                           AtomicOrdering &ordering);
+  // memory an atomic points at, i8 for bools and i64 for ints and pointers
+  Type* get_atomic_cell_type(TypeVariable* type_var);
+  // llvm type of the values a generator yields, as they're kept in its
+  //  promise (small objects by value), nullptr for ()
+  Type* get_generator_item_type(TypeVariable* item);
+  // alignment of a generator's promise, which llvm.coro.promise needs to
+  //  find it from the handle
+  unsigned get_promise_alignment(Type* item_type);
+  // sets up the coroutine of a generator function after its arguments are
+  //  stored, and suspends it until it's first resumed. false on error
+  bool begin_generator(Function* function, TypeVariable* item);
+  // same for an async function, result being the type it ends with
+  void begin_async(Function* function, TypeVariable* result);
+  // the frame and handle of a coroutine with a promise of promise_type
+  void begin_coroutine(Function* function, Type* promise_type);
+  // final suspend point once the body is done, and the code freeing the
+  //  frame and returning the handle
+  void end_coroutine();
+  // hands result over to the runtime, then ends the coroutine
+  void end_async(Value* result);
+  // llvm.coro.suspend, carrying on at resume_block when resumed (nullptr
+  //  for the final suspend, which is never resumed). save is the token of
+  //  an llvm.coro.save, for coroutines that can be resumed by someone else
+  //  as soon as the runtime knows about them
+  void gen_suspend(BasicBlock* resume_block, bool final,
+                   Value* save = nullptr);
+  // yield x, in a generator function
+  Value* yield_builtin(CallExprAST* node);
+  // value as it's stored in the promise of the coroutine being generated
+  Value* as_promise_item(Value* value);
+  // {state, result} promise of an async function, the state (see
+  //  bon::AsyncState) first so that the runtime finds it at the address
+  //  llvm.coro.promise gives
+  StructType* get_async_promise_type(TypeVariable* result);
+  // promise of an async call, as an i8* for the runtime
+  Value* get_async_state(Value* handle, StructType* promise_type);
+  // reads the result of a finished async call. owned calls (not held in a
+  //  variable) are dropped straight after
+  Value* take_async_result(Value* handle, StructType* promise_type,
+                           bool owned);
+  // await x, in an async function
+  Value* await_builtin(CallExprAST* node);
+  // run_async(x), run_async_threads(x, n) and start_async(x)
+  Value* async_builtin(CallExprAST* node);
+  // declaration of one of the bon_async_* runtime functions
+  Constant* get_async_runtime_function(const std::string &name,
+                                       Type* result_type,
+                                       ArrayRef<Type*> arg_types);
+  // element-wise arithmetic and bitwise operators on simd vectors
+  Value* simd_binary_op(BinaryExprAST* node, Value* l_value, Value* r_value);
+  // lane by lane comparison, op is one of eq, ne, lt, le, gt, ge
+  Value* simd_compare(const std::string &op, Value* l_value, Value* r_value,
+                      TypeVariable* element);
+  // combines the lanes of a vector pairwise until one is left
+  Value* simd_reduce(Value* vector, unsigned lanes,
+                     const std::function<Value*(Value*, Value*)> &op);
+  // storage type for the elements of a buffer (e.g. the data of a vec)
+  Type* get_element_type(TypeVariable* elem_type);
+  // true if node is a buffer slot holding an object by value
+  bool is_inline_element(ExprAST* node);
+  // tbaa access tag for loads and stores of a scalar type (ints, floats
+  //  and pointers), nullptr for aggregates and simd vectors, whose accesses
+  //  are then left to alias everything
+  MDNode* get_tbaa_tag(Type* type);
+  // tags inst, a load or store, with the tbaa type of the value accessed
+  void set_tbaa(Instruction* inst, Type* type);
+  // true for field accesses and buffer slots, whose memory is only ever
+  //  read and written as the one llvm type
+  bool is_typed_access(ExprAST* node);
+  // true if function returns a small object as a struct value instead of
+  //  a pointer to the heap
+  bool returns_by_value(Function* function);
+  // true if function returns a slot of a buffer (e.g. v[i]), which the
+  //  caller borrows rather than owns
+  bool returns_slot(Function* function);
+  // true if function returns the fields of an @soa object rather than a
+  //  reference to it
+  bool returns_soa_copy(Function* function);
+  // stores an object returned by value in a stack slot of the current
+  //  function (referenced like any local @soa object, for those), other
+  //  values are passed through
+  Value* spill_returned_value(Value* ret_val);
+  // heap allocated copy of a small object, e.g. a slot of a vector's buffer
+  //  that a new object takes as a field
+  Value* copy_inline_object(Value* obj_ptr);
+
+  // @soa objects are passed around as {i8* first field, i64 field stride},
+  //  so the same code can access them inside or outside of a buffer
+  StructType* get_soa_ref_type();
+  // fields of an @soa object, packed together
+  StructType* get_soa_storage_type(TypeVariable* type_var);
+  Value* build_soa_ref(Value* base, Value* stride);
+  // stack allocates a standalone @soa object
+  Value* alloc_soa_object(TypeVariable* type_var, const std::string &name);
+  Value* get_soa_field_ptr(Value* obj_ref, size_t field_index,
+                           Type* field_type);
+  void copy_soa_object(Value* dst_ref, Value* src_ref,
+                       TypeVariable* type_var);
+  // the object's fields as a get_soa_storage_type value
+  Value* load_soa_object(Value* obj_ref, TypeVariable* type_var);
 
   // creates an alloca instruction in the entry block of
   // the function for variables living on the stack
@@ -155,6 +359,11 @@ private:
 
   // free memory associated with constructed object
   void free_obj(Value* obj_ptr, bool is_child_obj);
+  // same, for objects that might be null (e.g. the object in an Option)
+  void free_obj_if_not_null(Value* obj_ptr);
+  // free_list_ in the order it's freed at the end of a scope: tasks are
+  //  joined first, as they may still be using the other objects
+  std::vector<Value*> scope_objects();
   std::map<std::string, Value*> tracked_allocs_;
   std::map<Value*, TypeVariable*> alloc_types_;
   // we need a way to retrieve the output of the last instruction
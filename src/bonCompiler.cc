@@ -0,0 +1,295 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Compiler - runs the compile passes over a source file, and the JIT
+|*
+L*----------------------------------------------------------------------------*/
+#include "bonCompiler.h"
+#include "bonLogger.h"
+#include "bonScopeAnalysisPass.h"
+#include "bonTypeAnalysisPass.h"
+#include "bonCodeGenPass.h"
+#include "bonLLVM.h"
+#include "auto_scope.h"
+
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Coroutines.h"
+#include "llvm/IR/LegacyPassManagers.h"
+
+#include <mutex>
+
+namespace bon {
+
+void initialize_native_target() {
+  static std::once_flag initialized;
+  std::call_once(initialized, []{
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+  });
+}
+
+Compiler::Compiler(const std::string &target_cpu,
+                   const std::string &target_features)
+  : parser_(state_) {
+  initialize_native_target();
+  state_.JIT = llvm::make_unique<BonJIT>(target_cpu, target_features);
+}
+
+void Compiler::init_module_and_passes() {
+  // create new module for current file
+  state_.current_module = llvm::make_unique<Module>("bon", state_.llvm_context);
+  auto &target_machine = state_.JIT->getTargetMachine();
+  state_.current_module->setDataLayout(target_machine.createDataLayout());
+  state_.current_module->setTargetTriple(
+                                  target_machine.getTargetTriple().str());
+  state_.current_module->setSourceFileName(state_.logger.get_current_file());
+
+  // add pass manager to module for optimizations
+  state_.function_pass_manager =
+    llvm::make_unique<legacy::FunctionPassManager>(state_.current_module.get());
+  state_.module_pass_manager =
+    llvm::make_unique<legacy::PassManager>();
+
+  // without these, the optimizer's cost models assume a target with no
+  //  vector registers, whatever cpu the JIT is generating code for
+  state_.function_pass_manager->add(
+    createTargetTransformInfoWrapperPass(target_machine.getTargetIRAnalysis()));
+  state_.module_pass_manager->add(
+    createTargetTransformInfoWrapperPass(target_machine.getTargetIRAnalysis()));
+
+  // add standard optimization passes
+  PassManagerBuilder Builder;
+  Builder.SizeLevel = 0;
+  Builder.OptLevel = state_.opt_level;
+  Builder.LoopVectorize = state_.opt_level > 1;
+  Builder.SLPVectorize = state_.opt_level > 1;
+  Builder.Inliner = createFunctionInliningPass(state_.opt_level, 0);
+  // generators are coroutines, which have to be split up before codegen
+  //  (at any optimization level). at -O1 and up their frames are also
+  //  elided once inlined into the loop consuming them
+  addCoroutinePassesToExtensionPoints(Builder);
+  Builder.populateFunctionPassManager(*state_.function_pass_manager);
+  Builder.populateModulePassManager(*state_.module_pass_manager);
+  // Builder.populateLTOPassManager(*state_.module_pass_manager);
+
+  // add additional useful passes
+  if (state_.opt_level == 0) {
+    state_.function_pass_manager->add(createInstructionCombiningPass());
+  }
+  else {
+    state_.function_pass_manager->add(createSpeculativeExecutionPass());
+    state_.function_pass_manager->add(createJumpThreadingPass());
+
+    state_.function_pass_manager->add(createTailCallEliminationPass());
+
+    state_.function_pass_manager->add(createLoopSimplifyPass());
+    state_.function_pass_manager->add(createLoopRotatePass());
+    state_.function_pass_manager->add(createLoopUnswitchPass());
+    state_.function_pass_manager->add(createLoopUnrollPass());
+    state_.function_pass_manager->add(createLoopSinkPass());
+
+    state_.function_pass_manager->add(createInstructionCombiningPass());
+  }
+
+  state_.function_pass_manager->doInitialization();
+}
+
+void Compiler::add_module() {
+  if (state_.dump_asm ||
+      (state_.verbose && verifyModule(*state_.current_module, &errs()))) {
+    state_.current_module->dump();
+  }
+  state_.function_pass_manager->doFinalization();
+  state_.module_pass_manager->run(*state_.current_module);
+  state_.JIT->addModule(std::move(state_.current_module));
+  init_module_and_passes();
+}
+
+bool Compiler::run_scope_analysis() {
+  // typeclass type analysis
+  ScopeAnalysisPass scope_analysis_pass(state_);
+  for (auto &tclass_entry : state_.typeclasses) {
+    auto &tclass = tclass_entry.second;
+    tclass->run_pass(&scope_analysis_pass);
+  }
+
+  // function type analysis
+  for (auto func_name : state_.function_names) {
+    auto &funcAST = state_.all_functions[func_name];
+    funcAST->run_pass(&scope_analysis_pass);
+  }
+
+  // top-level type analysis
+  for (auto &funcAST : state_.toplevel_expressions) {
+    funcAST->run_pass(&scope_analysis_pass);
+  }
+
+  if (state_.logger.had_errors()) {
+    state_.logger.finalize();
+    return false;
+  }
+
+  return true;
+}
+
+bool Compiler::run_type_analysis() {
+  TypeAnalysisPass type_analysis_pass(state_);
+  for (auto func : state_.ordered_functions) {
+    func->run_pass(&type_analysis_pass);
+  }
+
+  // top-level type analysis
+  for (auto &funcAST : state_.toplevel_expressions) {
+    funcAST->run_pass(&type_analysis_pass);
+  }
+
+  if (state_.logger.had_errors()) {
+    state_.logger.finalize();
+    return false;
+  }
+
+  return true;
+}
+
+bool Compiler::run_codegen() {
+  // DebugASTPass debug_ast_pass;
+  // for (auto &tclass_entry : state_.typeclasses) {
+  //   auto &tclass = tclass_entry.second;
+  //   tclass->run_pass(&debug_ast_pass);
+  //   for (auto &impl : tclass->impls) {
+  //     impl->run_pass(&debug_ast_pass);
+  //   }
+  // }
+
+  CodeGenPass code_gen_pass(state_);
+
+  for (auto func : state_.ordered_functions) {
+    func->run_pass(&code_gen_pass);
+    add_module();
+  }
+
+  if (state_.logger.had_errors()) {
+    state_.logger.finalize();
+    return false;
+  }
+
+  state_.logger.finalize();
+
+  // top-level expression code gen
+  for (auto &funcAST : state_.toplevel_expressions) {
+    funcAST->run_pass(&code_gen_pass);
+    if (auto* function_ir = code_gen_pass.result()) {
+      add_module();
+
+      // search the JIT for the top-level function we just generated
+      auto func_symbol = state_.JIT->findSymbol("top-level = () -> ()");
+      assert(func_symbol && "Function not found");
+
+      // get the symbol's address and cast it to the right type (takes no
+      // arguments, returns a double) so we can call it as a native function.
+      double (*FP)() = (double (*)())(intptr_t)func_symbol.getAddress();
+      FP();
+      // delete top-level expression module from the JIT.
+      // state_.JIT->removeModule(H);
+    }
+    else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// TODO: put top-level expressions in single "top-level" function,
+//       and run that function here
+void Compiler::run_module() {
+}
+
+bool Compiler::compile_file(std::string filename, bool should_run_codegen) {
+  // the typing functions work on the types of whichever compilation is
+  //  running on the calling thread
+  auto outer_types = set_type_context(&state_.types);
+  AutoScope restore_types([outer_types]{
+    set_type_context(outer_types);
+  });
+
+  init_module_and_passes();
+  parser_.parse_file(filename);
+  if (!should_run_codegen) {
+    return true;
+  }
+  if (!run_scope_analysis()) {
+    return false;
+  }
+  if (!run_type_analysis()) {
+    return false;
+  }
+  if (!run_codegen()) {
+    return false;
+  }
+  run_module();
+  return true;
+}
+
+void Compiler::add_source(const std::string &filename,
+                          const std::string &text) {
+  parser_.add_source(filename, text);
+}
+
+void Compiler::add_host_function(const std::string &name, void* address) {
+  state_.JIT->addHostSymbol(name, address);
+}
+
+std::string Compiler::get_function_type(const std::string &name) {
+  auto outer_types = set_type_context(&state_.types);
+  AutoScope restore_types([outer_types]{
+    set_type_context(outer_types);
+  });
+
+  auto function_entry = state_.all_functions.find(name);
+  if (function_entry == state_.all_functions.end()) {
+    return "";
+  }
+  // names aren't stored, so asking doesn't change the types
+  return function_entry->second->type_var()->get_name(false);
+}
+
+void* Compiler::get_function_address(const std::string &name) {
+  auto outer_types = set_type_context(&state_.types);
+  AutoScope restore_types([outer_types]{
+    set_type_context(outer_types);
+  });
+
+  auto function_entry = state_.all_functions.find(name);
+  if (function_entry == state_.all_functions.end()) {
+    return nullptr;
+  }
+  auto function_ast = function_entry->second.get();
+  if (!is_concrete_type(function_ast->Proto->type_var_)) {
+    return nullptr;
+  }
+
+  std::string mangled_name = name + " = "
+                             + function_ast->type_var()->get_name();
+  auto func_symbol = state_.JIT->findSymbol(mangled_name);
+  if (!func_symbol) {
+    // functions are only generated for the calls made to them, so one
+    //  nothing calls is generated as though it was called with its own type
+    state_.function_envs[name].push_back(std::make_pair(mangled_name,
+                                                        TypeEnv()));
+    CodeGenPass code_gen_pass(state_);
+    function_ast->run_pass(&code_gen_pass);
+    if (!code_gen_pass.result() || state_.logger.had_errors()) {
+      return nullptr;
+    }
+    add_module();
+    func_symbol = state_.JIT->findSymbol(mangled_name);
+    if (!func_symbol) {
+      return nullptr;
+    }
+  }
+  return (void*)(intptr_t)func_symbol.getAddress();
+}
+
+} // namespace bon
@@ -0,0 +1,65 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Compiler - runs the compile passes over a source file, and the JIT
+|*
+L*----------------------------------------------------------------------------*/
+#pragma once
+#include "bonModuleState.h"
+#include "bonParser.h"
+
+#include <string>
+#include <vector>
+
+namespace bon {
+
+// sets up llvm's native target, which compilers need. can be called any
+//  number of times, from any thread
+void initialize_native_target();
+
+// arguments compiled programs see through get_arg (the first is the source
+//  file). shared by every compiler in the process, so set it before any of
+//  them runs code
+void set_program_args(const std::vector<std::string> &args);
+
+// one compilation and the JIT it adds its code to. compilers share no state,
+//  so each can be used from a different thread
+class Compiler {
+public:
+  // target_cpu and target_features are passed on to BonJIT
+  Compiler(const std::string &target_cpu="native",
+           const std::string &target_features="native");
+
+  // parses filename ("repl" reads stdin), and unless should_run_codegen is
+  //  false compiles it and runs its top-level expressions. later files see
+  //  the functions and types of earlier ones (prelude.bon first).
+  //  returns false on errors
+  bool compile_file(std::string filename, bool should_run_codegen);
+  // text is compiled (or imported) in place of the file filename
+  void add_source(const std::string &filename, const std::string &text);
+  // cdefs named name call address, rather than the process's function of
+  //  that name. has to be called before anything calling it is compiled
+  void add_host_function(const std::string &name, void* address);
+  // type of the function name once compiled, e.g. "int * int -> int", or ""
+  //  if there's no such function
+  std::string get_function_type(const std::string &name);
+  // address of the compiled function name, generated now if nothing called
+  //  it. nullptr if there's no such function, its type isn't concrete (as it
+  //  is once its parameters are annotated), or it can't be generated
+  void* get_function_address(const std::string &name);
+
+  ModuleState &state() { return state_; }
+
+private:
+  void init_module_and_passes();
+  // hands the module generated so far to the JIT, and starts a new one
+  void add_module();
+  bool run_scope_analysis();
+  bool run_type_analysis();
+  bool run_codegen();
+  void run_module();
+
+  ModuleState state_;
+  Parser parser_;
+};
+
+} // namespace bon
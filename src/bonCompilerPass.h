@@ -21,6 +21,7 @@ public:
   virtual void process(BinaryExprAST* node) = 0;
   virtual void process(IfExprAST* node) = 0;
   virtual void process(WhileExprAST* node) = 0;
+  virtual void process(ForExprAST* node) = 0;
   virtual void process(MatchCaseExprAST* node) = 0;
   virtual void process(MatchExprAST* node) = 0;
   virtual void process(CallExprAST* node) = 0;
@@ -73,6 +73,14 @@ void DebugASTPass::process(WhileExprAST* node) {
   node->body_->run_pass(this);
 }
 
+// ForExprAST
+void DebugASTPass::process(ForExprAST* node) {
+  std::cout << "got a for loop" << std::endl;
+  node->var_->run_pass(this);
+  node->generator_->run_pass(this);
+  node->body_->run_pass(this);
+}
+
 // MatchCaseExprAST
 void DebugASTPass::process(MatchCaseExprAST* node) {
   std::cout << "got a match case" << std::endl;
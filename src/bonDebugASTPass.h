@@ -22,6 +22,7 @@ public:
   void process(BinaryExprAST* node) override;
   void process(IfExprAST* node) override;
   void process(WhileExprAST* node) override;
+  void process(ForExprAST* node) override;
   void process(MatchCaseExprAST* node) override;
   void process(MatchExprAST* node) override;
   void process(CallExprAST* node) override;
@@ -7,6 +7,8 @@ L*----------------------------------------------------------------------------*/
 
 #include "llvm/ADT/iterator_range.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
@@ -19,6 +21,7 @@ L*----------------------------------------------------------------------------*/
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include <algorithm>
@@ -35,8 +38,16 @@ public:
   typedef IRCompileLayer<ObjLayerT> CompileLayerT;
   typedef CompileLayerT::ModuleSetHandleT ModuleHandleT;
 
-  BonJIT()
-      : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
+  // CPU is a name like "skylake", Features a comma separated list like
+  // "+avx2,-avx512f". "native" uses the host's, so that code can use
+  // whatever vector units the machine running it has.
+  BonJIT(const std::string &CPU = "native",
+         const std::string &Features = "native")
+      : TM(EngineBuilder()
+               .setMCPU(resolveCPU(CPU))
+               .setMAttrs(resolveFeatures(Features))
+               .selectTarget()),
+        DL(TM->createDataLayout()),
         CompileLayer(ObjectLayer, SimpleCompiler(*TM)) {
     llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
   }
@@ -71,7 +82,37 @@ public:
     return findMangledSymbol(mangle(Name));
   }
 
+  // Resolves Name (e.g. a cdef) to Address, ahead of the JIT's modules and
+  // the host process, so hosts can supply functions they don't export.
+  void addHostSymbol(const std::string &Name, void *Address) {
+    HostSymbols[mangle(Name)] =
+        static_cast<JITTargetAddress>(reinterpret_cast<uintptr_t>(Address));
+  }
+
 private:
+  static std::string resolveCPU(const std::string &CPU) {
+    return CPU == "native" ? sys::getHostCPUName().str() : CPU;
+  }
+
+  static std::vector<std::string> resolveFeatures(const std::string &Features) {
+    std::vector<std::string> Attrs;
+    if (Features == "native") {
+      StringMap<bool> HostFeatures;
+      if (sys::getHostCPUFeatures(HostFeatures)) {
+        for (auto &Feature : HostFeatures) {
+          Attrs.push_back((Feature.second ? "+" : "-") + Feature.first().str());
+        }
+      }
+      return Attrs;
+    }
+    SmallVector<StringRef, 8> Parts;
+    StringRef(Features).split(Parts, ',', -1, false);
+    for (auto Part : Parts) {
+      Attrs.push_back(Part.trim().str());
+    }
+    return Attrs;
+  }
+
   std::string mangle(const std::string &Name) {
     std::string MangledName;
     {
@@ -88,6 +129,10 @@ private:
   }
 
   JITSymbol findMangledSymbol(const std::string &Name) {
+    auto HostSymbol = HostSymbols.find(Name);
+    if (HostSymbol != HostSymbols.end())
+      return JITSymbol(HostSymbol->second, JITSymbolFlags::Exported);
+
     // Search modules in reverse order: from last added to first added.
     // This is the opposite of the usual search order for dlsym, but makes more
     // sense in a REPL where we want to bind to the newest available definition.
@@ -107,6 +152,7 @@ private:
   ObjLayerT ObjectLayer;
   CompileLayerT CompileLayer;
   std::vector<ModuleHandleT> ModuleHandles;
+  StringMap<JITTargetAddress> HostSymbols;
 };
 
 } // end namespace orc
@@ -10,8 +10,6 @@ L*----------------------------------------------------------------------------*/
 
 namespace bon {
 
-Logger logger;
-
 Logger::Logger(uint32_t max_errors, uint32_t max_warnings,
                bool always_display_final_msg)
 : current_file_(""), line_num_(0), column_num_(0),
@@ -106,16 +104,31 @@ void Logger::error(std::string type, std::string message) {
     }
 }
 
+void Logger::add_source(std::string file, std::string text) {
+    sources_[file] = text;
+}
+
 std::string Logger::get_context() {
     // TODO: this is obviously not good.
     //       need to buffer lines in lexer, and set them in logger
-    std::ifstream fin(file_prefix_ + current_file_);
-    if (fin.fail()) {
-        std::cout << "File not found: " << file_prefix_ + current_file_ << std::endl;
-        return "";
+    std::ifstream file;
+    std::istringstream text;
+    std::istream* fin = &file;
+    auto source = sources_.find(current_file_);
+    if (file_prefix_ == "" && source != sources_.end()) {
+        text.str(source->second);
+        fin = &text;
+    }
+    else {
+        file.open(file_prefix_ + current_file_);
+        if (file.fail()) {
+            std::cout << "File not found: " << file_prefix_ + current_file_
+                      << std::endl;
+            return "";
+        }
     }
     size_t i = 0;
-    for (std::string line; getline(fin, line); ) {
+    for (std::string line; getline(*fin, line); ) {
         ++i;
         if (i >= line_num_) {
             return line;
@@ -6,6 +6,7 @@ L*----------------------------------------------------------------------------*/
 
 #pragma once
 #include <cstdint>
+#include <map>
 #include <sstream>
 #include <exception>
 
@@ -33,6 +34,8 @@ private:
   uint32_t warn_count_;
   uint32_t error_count_;
   bool always_display_final_msg_;
+  // files that were given as text rather than read from disk
+  std::map<std::string, std::string> sources_;
 
 public:
   Logger(uint32_t max_errors=20, uint32_t max_warnings=100,
@@ -44,6 +47,8 @@ public:
     file_prefix_ = file_prefix;
   }
   std::string get_current_file();
+  // the context of messages about file is taken from text
+  void add_source(std::string file, std::string text);
   void set_line_column(DocPosition pos);
   void set_line_column(size_t line_num, size_t column_num);
   void config(uint32_t max_errors=20, uint32_t max_warnings=100,
@@ -67,6 +72,4 @@ private:
                       std::string message);
 };
 
-extern Logger logger;
-
 } // namespace bon
@@ -6,57 +6,132 @@ L*----------------------------------------------------------------------------*/
 #include "bonModuleState.h"
 #include "auto_scope.h"
 
+#include <algorithm>
+#include <iterator>
+
 namespace bon {
 
+TypeclassMethodIndex*
+  ModuleState::get_method_index(const std::string &method_name) {
+  auto typeclass_entry = method_to_typeclass.find(method_name);
+  if (typeclass_entry == method_to_typeclass.end()) {
+    return nullptr;
+  }
+  auto &impls = typeclasses[typeclass_entry->second]->impls;
+  auto &index = typeclass_method_indices[method_name];
+  if (index.impl_count == impls.size()) {
+    return &index;
+  }
+
+  index = TypeclassMethodIndex();
+  index.impl_count = impls.size();
+  TypeEnv no_env;
+  for (auto &impl : impls) {
+    auto method_entry = impl->methods_.find(method_name);
+    if (method_entry == impl->methods_.end() || !method_entry->second) {
+      continue;
+    }
+    auto method = method_entry->second.get();
+    size_t position = index.methods.size();
+    index.methods.push_back(method);
+    index.closed.push_back(
+            closed_type_name(method->type_var(), method->type_env_) != "");
+
+    auto key = dispatch_key(method->type_var(), method->type_env_);
+    if (key == "") {
+      index.unkeyed.push_back(position);
+    }
+    else {
+      index.by_key[key].push_back(position);
+    }
+
+    if (closed_type_name(method->type_var(), no_env) != "") {
+      index.closed_names.insert(method_name + " = "
+                                + method->type_var()->get_name());
+    }
+    else {
+      index.open.push_back(position);
+    }
+  }
+  return &index;
+}
+
 FunctionAST*
   ModuleState::get_typeclass_impl_function_node(std::string method_name,
                                                 TypeVariable* func_type_var) {
-  if (method_to_typeclass.find(method_name) == method_to_typeclass.end()) {
+  auto index = get_method_index(method_name);
+  if (!index || !func_type_var->type_operator_) {
     return nullptr;
   }
-  std::string typeclass_name = method_to_typeclass[method_name];
-  auto &typeclass = typeclasses[typeclass_name];
-  for (auto &impl : typeclass->impls) {
-    auto &method = impl->methods_[method_name];
-    if (!method) {
-      continue;
+
+  // only impls taking the same kind of first argument can match (or those
+  //  that take any), and the result for a call type with no type variables
+  //  in it doesn't change, as long as the impls it was checked against had
+  //  none either
+  TypeEnv no_env;
+  std::string call_key;
+  std::string call_type;
+  if (!func_type_var->parent_) {
+    call_key = dispatch_key(func_type_var, no_env);
+    call_type = closed_type_name(func_type_var, no_env);
+  }
+  if (call_type != "") {
+    auto resolved = index->resolved.find(call_type);
+    if (resolved != index->resolved.end()) {
+      return resolved->second;
+    }
+  }
+
+  std::vector<size_t> candidates;
+  if (call_key == "") {
+    for (size_t position = 0; position < index->methods.size(); ++position) {
+      candidates.push_back(position);
     }
+  }
+  else {
+    auto &keyed = index->by_key[call_key];
+    std::merge(keyed.begin(), keyed.end(),
+               index->unkeyed.begin(), index->unkeyed.end(),
+               std::back_inserter(candidates));
+  }
+
+  bool cacheable = call_type != "";
+  FunctionAST* result = nullptr;
+  for (auto position : candidates) {
+    auto method = index->methods[position];
+    cacheable = cacheable && index->closed[position];
     push_environment(method->type_env_);
-    AutoScope pop_env([this, &method]{
+    AutoScope pop_env([]{
       pop_environment();
     });
     auto method_type_var = resolve_variable(method->type_var(), false);
-    if (method_type_var->type_operator_ && func_type_var->type_operator_) {
-      if (can_unify(method_type_var->type_operator_,
-                               func_type_var->type_operator_)) {
-        return method.get();
-      }
+    if (method_type_var->type_operator_ &&
+        can_unify(method_type_var->type_operator_,
+                  func_type_var->type_operator_)) {
+      result = method;
+      break;
     }
   }
-  return nullptr;
+  if (cacheable) {
+    index->resolved[call_type] = result;
+  }
+  return result;
 }
 
 Function* ModuleState::get_typeclass_impl_function(std::string func_name,
                                                    std::string mangled_name) {
-  auto typeclass_entry = method_to_typeclass.find(func_name);
-  if (typeclass_entry != method_to_typeclass.end()) {
-    std::string typeclass_name = typeclass_entry->second;
-    for (auto &impl : typeclasses[typeclass_name]->impls) {
-      auto &method = impl->methods_[func_name];
-      if (!method) {
-        continue;
-      }
-      std::string impl_name = func_name + " = "
-                              + method->type_var()->get_name();
-      if (impl_name == mangled_name) {
-        if (auto* func = current_module->getFunction(impl_name)) {
-          return func;
-        }
-        return nullptr; // impl->method_funcs_[func_name];
-      }
-    }
+  auto index = get_method_index(func_name);
+  if (!index) {
+    return nullptr;
+  }
+  bool found = index->closed_names.count(mangled_name) > 0;
+  for (size_t i = 0; !found && i < index->open.size(); ++i) {
+    auto method = index->methods[index->open[i]];
+    found = func_name + " = " + method->type_var()->get_name() == mangled_name;
+  }
+  if (found) {
+    return current_module->getFunction(mangled_name);
   }
-
   return nullptr;
 }
 
@@ -77,7 +152,8 @@ Function* ModuleState::get_function(std::string func_name) {
 
 
 ModuleState::ModuleState()
- : builder(llvm_context)
+ : types(logger), builder(llvm_context), tbaa_root(nullptr),
+   fast_math(false), opt_level(3), dump_asm(false), verbose(false)
 {
 }
 
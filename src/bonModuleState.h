@@ -7,23 +7,65 @@ L*----------------------------------------------------------------------------*/
 #pragma once
 #include "bonTypesystem.h"
 #include "bonAST.h"
+#include "bonLogger.h"
 #include "llvm/IR/IRBuilder.h"
 #include "bonJIT.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <memory>
 
 namespace bon {
 
+// where an object's constructor tag and fields live in its struct type
+struct ObjectLayout {
+  StructType* type = nullptr;
+  unsigned tag_index = 0;
+  // struct element holding each constructor field, in declaration order
+  std::vector<unsigned> field_indices;
+};
+
+// the impls of one typeclass method, indexed for get_typeclass_impl_function
+//  and get_typeclass_impl_function_node, which would otherwise have to try
+//  every impl for every call
+struct TypeclassMethodIndex {
+  // impls of the typeclass when the index was built, it's rebuilt when
+  //  that changes
+  size_t impl_count = 0;
+  // the method of each impl that has one, in the typeclass's impl order
+  std::vector<FunctionAST*> methods;
+  // whether each method's type is known without looking at the environment
+  //  (see closed_type_name), which is what lookups can be cached for
+  std::vector<bool> closed;
+  // positions in methods by dispatch_key, and of those without one
+  std::map<std::string, std::vector<size_t>> by_key;
+  std::vector<size_t> unkeyed;
+  // method (or nullptr) found for a call type, by its closed_type_name
+  std::map<std::string, FunctionAST*> resolved;
+  // mangled names of the methods with no type variables, and positions of
+  //  the others, whose names can still change
+  std::set<std::string> closed_names;
+  std::vector<size_t> open;
+};
+
+// everything a compilation works with, passed to each pass. nothing in the
+//  compiler is shared between ModuleStates, so separate compilations can run
+//  on separate threads (each setting its types, see set_type_context)
 struct ModuleState {
+  Logger logger;
+  TypeContext types;
   typedef std::pair<std::string, TypeEnv> FuncTypeEnv;
-  std::map<std::string, std::vector<FuncTypeEnv>> function_envs;
+  // the tables of functions, prototypes and typeclasses are keyed by their
+  //  interned (and for impls and instances, mangled) names. the ones passes
+  //  can iterate over are ordered, so code is generated in the same order
+  //  on every run
+  OrderedSymbolMap<std::vector<FuncTypeEnv>> function_envs;
   std::string filename;
-  std::map<std::string, std::string> method_to_typeclass;
-  std::map<std::string, TypeclassASTPtr> typeclasses;
-  std::map<std::string, FunctionASTPtr> all_functions;
-  std::map<std::string, PrototypeASTPtr> function_protos;
+  SymbolMap<std::string> method_to_typeclass;
+  OrderedSymbolMap<TypeclassASTPtr> typeclasses;
+  OrderedSymbolMap<FunctionASTPtr> all_functions;
+  SymbolMap<PrototypeASTPtr> function_protos;
   std::vector<std::string> function_names;
   std::vector<std::unique_ptr<FunctionAST>> toplevel_expressions;
   // array of all functions (including impl functions)
@@ -39,6 +81,25 @@ struct ModuleState {
   std::unique_ptr<legacy::PassManager> module_pass_manager;
   std::unique_ptr<BonJIT> JIT;
   std::map<std::string, StructType*> struct_map;
+  // one struct type per constructor and field types, so every object of a
+  //  concrete type shares it (see CodeGenPass::get_object_layout)
+  std::map<std::pair<std::string, std::vector<Type*>>, ObjectLayout>
+                                                          object_layouts;
+  std::map<StructType*, ObjectLayout*> struct_layouts;
+  // type based alias analysis nodes, see CodeGenPass::get_tbaa_tag
+  MDNode* tbaa_root;
+  std::map<Type*, MDNode*> tbaa_tags;
+  // --fast-math: every function is compiled as if declared @fast_math
+  bool fast_math;
+  // optimization level (0-3)
+  unsigned opt_level;
+  // --asm and --verbose
+  bool dump_asm;
+  bool verbose;
+  // where imports not found relative to the working directory are looked for
+  std::string stdlib_path;
+  // by method name, see get_method_index
+  SymbolMap<TypeclassMethodIndex> typeclass_method_indices;
 
   ModuleState();
   FunctionAST* get_typeclass_impl_function_node(std::string method_name,
@@ -46,6 +107,9 @@ struct ModuleState {
   Function* get_typeclass_impl_function(std::string func_name,
                                         std::string mangled_name);
   Function* get_function(std::string func_name);
+  // index of the impls of method_name, built or brought up to date for the
+  //  typeclass's impls. nullptr if method_name isn't a typeclass method
+  TypeclassMethodIndex* get_method_index(const std::string &method_name);
 };
 
 } // namespace bon
@@ -11,7 +11,20 @@ L*----------------------------------------------------------------------------*/
 
 namespace bon {
 
-Parser::Parser(ModuleState &state) : state_(state) {
+// parallel_for_grain -> parallel_for, ...
+static std::string without_grain_suffix(const std::string &ident) {
+  const std::string suffix = "_grain";
+  if (ident.size() > suffix.size()
+      && ident.compare(ident.size() - suffix.size(), suffix.size(),
+                       suffix) == 0) {
+    return ident.substr(0, ident.size() - suffix.size());
+  }
+  return ident;
+}
+
+Parser::Parser(ModuleState &state)
+  : has_yield_(false), has_await_(false), tokenizer_(state.logger),
+    state_(state), logger_(state.logger) {
   // set precedence for binary operators
   binop_precedence_[tok_assign] =  1;
   binop_precedence_[tok_or] = 3;
@@ -38,6 +51,13 @@ Parser::Parser(ModuleState &state) : state_(state) {
   binop_precedence_[tok_dot] = 70;
 }
 
+void Parser::add_function(std::unique_ptr<FunctionAST> function_ast) {
+  auto func_name = function_ast->Proto->getName();
+  state_.ordered_functions.push_back(function_ast.get());
+  state_.all_functions[func_name] = std::move(function_ast);
+  state_.function_names.push_back(func_name);
+}
+
 void Parser::parse() {
   // prime first token
   tokenizer_.consume();
@@ -52,10 +72,7 @@ void Parser::parse() {
       break;
     case tok_def:
       if (auto function_ast = parse_definition()) {
-        auto func_name = function_ast->Proto->getName();
-        state_.ordered_functions.push_back(function_ast.get());
-        state_.all_functions[func_name] = std::move(function_ast);
-        state_.function_names.push_back(func_name);
+        add_function(std::move(function_ast));
       }
       break;
     case tok_typeclass:
@@ -67,7 +84,7 @@ void Parser::parse() {
         state_.typeclasses[tclass->name_] = std::move(tclass);
       }
       else {
-        // logger.error("failed", "could not parse typeclass");
+        // logger_.error("failed", "could not parse typeclass");
       }
       break;
     case tok_impl:
@@ -79,12 +96,31 @@ void Parser::parse() {
         // impls.push_back(std::move(tcls_impl));
       }
       else {
-        // logger.error("failed", "could not parse type impl");
+        // logger_.error("failed", "could not parse type impl");
       }
       break;
     case tok_class:
       if (!parse_type()) {
-        logger.error("failed", "could not parse type");
+        logger_.error("failed", "could not parse type");
+      }
+      break;
+    case tok_attribute:
+      {
+        auto attribute = parse_attribute();
+        if (attribute == "") {
+          logger_.error("failed", "could not parse attribute");
+        }
+        else if (tokenizer_.peak() == tok_def) {
+          if (auto function_ast = parse_definition_with_attribute(attribute)) {
+            add_function(std::move(function_ast));
+          }
+          else {
+            logger_.error("failed", "could not parse function");
+          }
+        }
+        else if (!parse_type_with_attribute(attribute)) {
+          logger_.error("failed", "could not parse type");
+        }
       }
       break;
     case tok_extern:
@@ -97,7 +133,7 @@ void Parser::parse() {
       break;
     case tok_import:
       state_.filename = parse_import(state_.filename);
-      logger.set_current_file(state_.filename);
+      logger_.set_current_file(state_.filename);
       break;
     default:
       // parse top-level expression into an anonymous function
@@ -113,29 +149,50 @@ void Parser::parse_file(std::string filename) {
   reset_tokenizer();
 
   state_.filename = filename;
-  logger.config(20, 100);
-  logger.set_current_file(state_.filename);
-
-  if (filename != "repl" && !file_to_stdin(state_.filename)) {
-    return;
-  }
+  logger_.config(20, 100);
+  logger_.set_current_file(state_.filename);
 
   if (filename == "repl") {
-    restore_stdin();
+    tokenizer_.set_input(&std::cin);
+  }
+  else if (!open_input(filename)) {
+    return;
   }
 
   try {
     parse();
   } catch (max_warnings_exception& ex) {
     std::cout << "Max warning count exceeded. Aborting." << std::endl;
-    logger.finalize();
+    logger_.finalize();
   } catch (max_errors_exception& ex) {
     std::cout << "Max error count exceeded. Aborting." << std::endl;
-    logger.finalize();
+    logger_.finalize();
   } catch (std::exception& ex) {
     std::cout << "Internal compiler error. Aborting." << std::endl;
-    logger.finalize();
+    logger_.finalize();
+  }
+}
+
+void Parser::add_source(const std::string &filename,
+                        const std::string &text) {
+  sources_[filename] = text;
+  logger_.add_source(filename, text);
+}
+
+bool Parser::open_input(const std::string &filename) {
+  auto source = sources_.find(filename);
+  if (source != sources_.end()) {
+    logger_.set_file_prefix("");
+    source_text_.str(source->second);
+    source_text_.clear();
+    tokenizer_.set_input(&source_text_);
+    return true;
+  }
+  if (!open_source_file(source_, filename, state_.stdlib_path, logger_)) {
+    return false;
   }
+  tokenizer_.set_input(&source_);
+  return true;
 }
 
 void Parser::reset_tokenizer() { tokenizer_.reset(); }
@@ -145,7 +202,7 @@ size_t Parser::column() { return tokenizer_.column(); }
 void Parser::update_tok_position() {
   size_t line_num = tokenizer_.line_number();
   size_t col_num = tokenizer_.column();
-  bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+  logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
 }
 
 int Parser::get_operator_precedence() {
@@ -171,24 +228,29 @@ std::string Parser::parse_import(std::string current_filename) {
   tokenizer_.consume();
 
   if (tokenizer_.peak() != bon::tok_identifier) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error", "expected file name after 'import'");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected file name after 'import'");
   }
 
   std::string filename = tokenizer_.identifier() + ".bon";
   // eat module name
   tokenizer_.consume();
 
+  // e.g. a program importing both simd and numeric, which imports simd too
+  if (!imported_modules_.insert(filename).second) {
+    return current_filename;
+  }
+
   parse_file(filename);
 
-  bon::logger.set_current_file(orig_file);
-  bon::logger.set_line_column(last_line, last_col);
+  logger_.set_current_file(orig_file);
+  logger_.set_line_column(last_line, last_col);
 
   tokenizer_.reset();
 
-  if (!file_to_stdin(orig_file)) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("error", "'import' file not found: " + orig_file);
+  if (!open_input(orig_file)) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("error", "'import' file not found: " + orig_file);
     return current_filename;
   }
 
@@ -207,8 +269,8 @@ std::string Parser::parse_import(std::string current_filename) {
     tokenizer_.consume();
   }
 
-  bon::logger.set_current_file(orig_file);
-  bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+  logger_.set_current_file(orig_file);
+  logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
 
   // needed to reset current file, since the callback can change it
   return current_filename;
@@ -219,6 +281,19 @@ std::unique_ptr<ExprAST> Parser::parse_number_expr() {
   auto expr_node = llvm::make_unique<NumberExprAST>(tokenizer_.line_number(),
                                                     tokenizer_.column(),
                                                     tokenizer_.number_value());
+  auto suffix = tokenizer_.number_suffix();
+  if (suffix != "") {
+    // unknown suffixes (e.g. 2.0foo) have no type at all
+    auto type_var = sized_numeric_type(suffix);
+    if (!type_var || !is_float_type(type_var)) {
+      logger_.set_line_column(tokenizer_.line_number(),
+                              tokenizer_.column());
+      logger_.error("syntax error", "invalid suffix '" + suffix
+                                    + "' for floating point literal");
+      return nullptr;
+    }
+    expr_node->type_var_ = type_var;
+  }
   // eat float
   tokenizer_.consume();
   return std::move(expr_node);
@@ -226,9 +301,35 @@ std::unique_ptr<ExprAST> Parser::parse_number_expr() {
 
 // literal integer number
 std::unique_ptr<ExprAST> Parser::parse_integer_expr() {
+  auto suffix = tokenizer_.number_suffix();
+  TypeVariable* type_var = nullptr;
+  if (suffix != "") {
+    type_var = sized_numeric_type(suffix);
+    if (!type_var) {
+      logger_.set_line_column(tokenizer_.line_number(),
+                              tokenizer_.column());
+      logger_.error("syntax error", "invalid suffix '" + suffix
+                                    + "' for integer literal");
+      return nullptr;
+    }
+  }
+  // e.g. 1f32
+  if (type_var && is_float_type(type_var)) {
+    auto expr_node = llvm::make_unique<NumberExprAST>(
+                                                  tokenizer_.line_number(),
+                                                  tokenizer_.column(),
+                                                  tokenizer_.integer_value());
+    expr_node->type_var_ = type_var;
+    // eat integer
+    tokenizer_.consume();
+    return std::move(expr_node);
+  }
   auto expr_node = llvm::make_unique<IntegerExprAST>(tokenizer_.line_number(),
                                                      tokenizer_.column(),
                                                      tokenizer_.integer_value());
+  if (type_var) {
+    expr_node->type_var_ = type_var;
+  }
   // eat integer
   tokenizer_.consume();
   return std::move(expr_node);
@@ -285,8 +386,8 @@ std::unique_ptr<ExprAST> Parser::parse_paren_expr() {
     }
 
     if (tokenizer_.peak() != tok_rparen) {
-      bon::logger.set_line_column(line_num, col_num);
-      bon::logger.error("syntax error", "expected matching ')'");
+      logger_.set_line_column(line_num, col_num);
+      logger_.error("syntax error", "expected matching ')'");
       return nullptr;
     }
     // eat ')'
@@ -306,8 +407,8 @@ std::unique_ptr<ExprAST> Parser::parse_paren_expr() {
   }
 
   if (tokenizer_.peak() != tok_rparen) {
-    bon::logger.set_line_column(line_num, col_num);
-    bon::logger.error("syntax error", "expected matching ')'");
+    logger_.set_line_column(line_num, col_num);
+    logger_.error("syntax error", "expected matching ')'");
     return nullptr;
   }
   // eat ')'
@@ -374,9 +475,9 @@ std::unique_ptr<ExprAST> Parser::parse_identifier_expr() {
       args.push_back(std::move(arg));
     }
     else {
-      bon::logger.set_line_column(line_num, tokenizer_.column());
-      bon::logger.error("syntax error",
-                        "expected Seq index");
+      logger_.set_line_column(line_num, tokenizer_.column());
+      logger_.error("syntax error",
+                    "expected Seq index");
       return nullptr;
     }
     // eat ']'
@@ -426,10 +527,10 @@ std::unique_ptr<ExprAST> Parser::parse_identifier_expr() {
           }
 
           if (tokenizer_.peak() != tok_comma) {
-            bon::logger.set_line_column(line_num, tokenizer_.column());
+            logger_.set_line_column(line_num, tokenizer_.column());
             std::cout << "for ident: " << ident << std::endl;
-            bon::logger.error("syntax error",
-                              "expected ')' or ',' in argument list");
+            logger_.error("syntax error",
+                          "expected ')' or ',' in argument list");
             // eat bad token
             tokenizer_.consume();
             return nullptr;
@@ -438,7 +539,7 @@ std::unique_ptr<ExprAST> Parser::parse_identifier_expr() {
           tokenizer_.consume();
           if (tokenizer_.peak() == tok_indent) {
             if (indented) {
-              bon::logger.error("syntax error", "misaligned indentation");
+              logger_.error("syntax error", "misaligned indentation");
             }
             indented = true;
             // eat tok_indent
@@ -461,10 +562,53 @@ std::unique_ptr<ExprAST> Parser::parse_identifier_expr() {
                                                         std::move(args),
                                                         heap_alloc);
     }
+    else if (ident == "spawn") {
+      // spawn(f, a, b) is kept as spawn(f(a, b)), with the call to run as a
+      //  task for its only argument
+      auto fn_var = args.empty()
+                    ? nullptr : dynamic_cast<VariableExprAST*>(args[0].get());
+      if (!fn_var) {
+        logger_.set_line_column(line_num, col_num);
+        logger_.error("syntax error",
+                      "expected a function name as the first argument "
+                      "of spawn");
+        return nullptr;
+      }
+      // the function name was parsed as a variable reference
+      auto fn_name = fn_var->Name;
+      if (vars_in_scope_.count(fn_name) > 0
+          && vars_in_scope_[fn_name] == fn_var) {
+        vars_in_scope_.erase(fn_name);
+      }
+      std::vector<std::unique_ptr<ExprAST>> call_args;
+      for (size_t i = 1; i < args.size(); ++i) {
+        call_args.push_back(std::move(args[i]));
+      }
+      auto task_call = llvm::make_unique<CallExprAST>(line_num, col_num,
+                                                      fn_name,
+                                                      std::move(call_args));
+      called_functions_.push_back(task_call.get());
+      std::vector<std::unique_ptr<ExprAST>> spawn_args;
+      spawn_args.push_back(std::move(task_call));
+      return llvm::make_unique<CallExprAST>(line_num, col_num, ident,
+                                            std::move(spawn_args));
+    }
+    else if (is_parallel_builtin(without_grain_suffix(ident))) {
+      return parse_parallel_builtin(ident, std::move(args), line_num,
+                                    col_num);
+    }
     else {
       auto call_expr = llvm::make_unique<CallExprAST>(line_num, col_num, ident,
                                                       std::move(args));
-      called_functions_.push_back(call_expr.get());
+      // numeric conversions like i32(x), simd constructors like f64x4(x),
+      //  the simd_* operations, array(n, x), join(task), atomics,
+      //  run_async and co. and is_soa(x) are builtins, not functions
+      if (!sized_numeric_type(ident) && !simd_type(ident)
+          && !is_simd_builtin(ident) && ident != "array" && ident != "join"
+          && !is_atomic_builtin(ident) && !is_async_builtin(ident)
+          && ident != "is_soa") {
+        called_functions_.push_back(call_expr.get());
+      }
       return call_expr;
     }
   }
@@ -479,9 +623,9 @@ std::unique_ptr<ExprAST> Parser::parse_sizeof_expr() {
 
   if (tokenizer_.peak() != tok_lparen) {
     auto line_num = tokenizer_.line_number();
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected '('");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected '('");
     // eat bad token
     tokenizer_.consume();
     return nullptr;
@@ -492,9 +636,9 @@ std::unique_ptr<ExprAST> Parser::parse_sizeof_expr() {
   auto arg = parse_expression();
   if (tokenizer_.peak() != tok_rparen) {
     auto line_num = tokenizer_.line_number();
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ')'");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ')'");
     // eat bad token
     tokenizer_.consume();
     return nullptr;
@@ -517,9 +661,9 @@ std::unique_ptr<ExprAST> Parser::parse_ptr_offset_expr() {
 
   if (tokenizer_.peak() != tok_lparen) {
     auto line_num = tokenizer_.line_number();
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected '('");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected '('");
     // eat bad token
     tokenizer_.consume();
     return nullptr;
@@ -531,9 +675,9 @@ std::unique_ptr<ExprAST> Parser::parse_ptr_offset_expr() {
   auto arg = parse_expression();
 
   if (tokenizer_.peak() != tok_comma) {
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ')' or ',' in argument list");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ')' or ',' in argument list");
     // eat bad token
     tokenizer_.consume();
     return nullptr;
@@ -547,11 +691,22 @@ std::unique_ptr<ExprAST> Parser::parse_ptr_offset_expr() {
     return nullptr;
   }
 
+  // optional buffer capacity, e.g. ptr_offset(v.data, i, v.capacity)
+  std::unique_ptr<ExprAST> capacity;
+  if (tokenizer_.peak() == tok_comma) {
+    // eat ','
+    tokenizer_.consume();
+    capacity = parse_expression();
+    if (!capacity) {
+      return nullptr;
+    }
+  }
+
   if (tokenizer_.peak() != tok_rparen) {
     auto line_num = tokenizer_.line_number();
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ')'");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ')'");
     // eat bad token
     tokenizer_.consume();
     return nullptr;
@@ -563,7 +718,8 @@ std::unique_ptr<ExprAST> Parser::parse_ptr_offset_expr() {
   return llvm::make_unique<PtrOffsetExprAST>(tokenizer_.line_number(),
                                              tokenizer_.column(),
                                              std::move(arg),
-                                             std::move(offset));
+                                             std::move(offset),
+                                             std::move(capacity));
 }
 
 std::unique_ptr<ExprAST> Parser::parse_match_expr() {
@@ -575,15 +731,15 @@ std::unique_ptr<ExprAST> Parser::parse_match_expr() {
   // pattern to match against
   auto pattern = parse_expression();
   if (!pattern) {
-    bon::logger.set_line_column(line_num, col_num);
-    bon::logger.error("syntax error", "bad match condition");
+    logger_.set_line_column(line_num, col_num);
+    logger_.error("syntax error", "bad match condition");
     return nullptr;
   }
 
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after 'match'");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after 'match'");
     return nullptr;
   }
   // eat ':'
@@ -594,8 +750,8 @@ std::unique_ptr<ExprAST> Parser::parse_match_expr() {
     tokenizer_.consume();
   }
   else {
-    bon::logger.set_line_column(line_num, col_num);
-    bon::logger.error("syntax error", "expected indent after match condition");
+    logger_.set_line_column(line_num, col_num);
+    logger_.error("syntax error", "expected indent after match condition");
     return nullptr;
   }
 
@@ -603,8 +759,8 @@ std::unique_ptr<ExprAST> Parser::parse_match_expr() {
   auto match_case = parse_expression();
   while (true) {
     if (tokenizer_.peak() != bon::tok_double_arrow) {
-      bon::logger.set_line_column(line_num, col_num);
-      bon::logger.error("syntax error", "expected '=>' after match case");
+      logger_.set_line_column(line_num, col_num);
+      logger_.error("syntax error", "expected '=>' after match case");
       return nullptr;
     }
     // eat '=>'
@@ -644,8 +800,8 @@ std::unique_ptr<ExprAST> Parser::parse_match_expr() {
       // eat unindentation
       tokenizer_.consume();
       // if (tokenizer_.peak() != bon::tok_end) {
-      //   bon::logger.set_line_column(line_num, col_num);
-      //   bon::logger.error("syntax error",
+      //   logger_.set_line_column(line_num, col_num);
+      //   logger_.error("syntax error",
       //                     "expected 'end' after match case block");
       //   return nullptr;
       // }
@@ -673,16 +829,16 @@ std::unique_ptr<ExprAST> Parser::parse_match_expr() {
     }
   }
   if (tokenizer_.peak() != bon::tok_dedent) {
-    bon::logger.set_line_column(line_num, col_num);
-    bon::logger.error("syntax error",
-                      "expected unindent after match expression");
+    logger_.set_line_column(line_num, col_num);
+    logger_.error("syntax error",
+                  "expected unindent after match expression");
     return nullptr;
   }
   // eat unindentation
   tokenizer_.consume();
   // if (tokenizer_.peak() != bon::tok_end) {
-  //   bon::logger.set_line_column(line_num, col_num);
-  //   bon::logger.error("syntax error", "expected 'end' after match expression");
+  //   logger_.set_line_column(line_num, col_num);
+  //   logger_.error("syntax error", "expected 'end' after match expression");
   //   return nullptr;
   // }
   // // eat 'end'
@@ -713,9 +869,9 @@ std::unique_ptr<ExprAST> Parser::parse_if_expr() {
   //   tokenizer_.consume();
   // }
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after 'if' condition");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after 'if' condition");
     return nullptr;
   }
   // eat ':'
@@ -730,8 +886,8 @@ std::unique_ptr<ExprAST> Parser::parse_if_expr() {
     started_with_indent = true;
   }
   // else if (!started_with_then) {
-  //   bon::logger.set_line_column(line_num, col_num);
-  //   bon::logger.error("syntax error",
+  //   logger_.set_line_column(line_num, col_num);
+  //   logger_.error("syntax error",
   //                     "expected 'then' after single-line if condition");
   //   return nullptr;
   // }
@@ -772,9 +928,9 @@ std::unique_ptr<ExprAST> Parser::parse_if_expr() {
     tokenizer_.consume();
 
     if (tokenizer_.peak() != tok_colon) {
-      bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-      bon::logger.error("syntax error",
-                        "expected ':' after 'else'");
+      logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+      logger_.error("syntax error",
+                    "expected ':' after 'else'");
       return nullptr;
     }
     // eat ':'
@@ -785,10 +941,10 @@ std::unique_ptr<ExprAST> Parser::parse_if_expr() {
         tokenizer_.consume();
       }
       else {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error",
-                          "expected newline with indent after 'else'");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error",
+                      "expected newline with indent after 'else'");
         return nullptr;
       }
     }
@@ -825,8 +981,8 @@ std::unique_ptr<ExprAST> Parser::parse_if_expr() {
 
   // if (started_with_indent) {
   //   if (tokenizer_.peak() != bon::tok_end) {
-  //     bon::logger.set_line_column(line_num, col_num);
-  //     bon::logger.error("syntax error", "expected 'end' after if expression");
+  //     logger_.set_line_column(line_num, col_num);
+  //     logger_.error("syntax error", "expected 'end' after if expression");
   //     return nullptr;
   //   }
   //   // eat 'end'
@@ -867,9 +1023,9 @@ std::unique_ptr<ExprAST> Parser::parse_while_loop() {
   // }
 
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after 'while' condition");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after 'while' condition");
     return nullptr;
   }
   // eat ':'
@@ -884,8 +1040,8 @@ std::unique_ptr<ExprAST> Parser::parse_while_loop() {
     started_with_indent = true;
   }
   // else if (!started_with_do) {
-  //   bon::logger.set_line_column(line_num, col_num);
-  //   bon::logger.error("syntax error",
+  //   logger_.set_line_column(line_num, col_num);
+  //   logger_.error("syntax error",
   //                     "expected 'do' after single-line while loop");
   //   return nullptr;
   // }
@@ -922,8 +1078,8 @@ std::unique_ptr<ExprAST> Parser::parse_while_loop() {
     // eat unindentation
     tokenizer_.consume();
     // if (tokenizer_.peak() != bon::tok_end) {
-    //   bon::logger.set_line_column(line_num, col_num);
-    //   bon::logger.error("syntax error", "expected 'end' after while expression");
+    //   logger_.set_line_column(line_num, col_num);
+    //   logger_.error("syntax error", "expected 'end' after while expression");
     //   return nullptr;
     // }
     // // eat 'end'
@@ -941,6 +1097,142 @@ std::unique_ptr<ExprAST> Parser::parse_while_loop() {
                                       std::move(do_node));
 }
 
+// 'for' loop
+std::unique_ptr<ExprAST> Parser::parse_for_loop() {
+  auto line_num = tokenizer_.line_number();
+  size_t col_num = tokenizer_.column();
+  // eat 'for'
+  tokenizer_.consume();
+
+  if (tokenizer_.peak() != tok_identifier) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected a variable name after 'for'");
+    return nullptr;
+  }
+  std::string ident = tokenizer_.identifier();
+  auto var_expr = llvm::make_unique<VariableExprAST>(tokenizer_.line_number(),
+                                                     tokenizer_.column(),
+                                                     ident);
+  if (vars_in_scope_.count(ident) > 0) {
+    delete var_expr->type_var_;
+    var_expr->type_var_ = vars_in_scope_[ident]->type_var_;
+  }
+  else {
+    vars_in_scope_[ident] = var_expr.get();
+  }
+  // eat identifier
+  tokenizer_.consume();
+
+  if (tokenizer_.peak() != tok_in) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected 'in' after 'for' variable");
+    return nullptr;
+  }
+  // eat 'in'
+  tokenizer_.consume();
+
+  auto generator_node = parse_expression();
+  if (!generator_node) {
+    return nullptr;
+  }
+
+  if (tokenizer_.peak() != tok_colon) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after 'for' generator");
+    return nullptr;
+  }
+  // eat ':'
+  tokenizer_.consume();
+
+  // track whether this is multi-line
+  bool started_with_indent = false;
+  if (tokenizer_.peak() == bon::tok_indent) {
+    // eat expected indentation
+    tokenizer_.consume();
+    started_with_indent = true;
+  }
+
+  auto body_node = parse_expression();
+  if (!body_node) {
+    return nullptr;
+  }
+
+  if (started_with_indent) {
+    while (tokenizer_.peak() != bon::tok_dedent) {
+      // eat optional ';'
+      if (tokenizer_.peak() == tok_sep) {
+        tokenizer_.consume();
+        continue;
+      }
+      size_t line_num = tokenizer_.line_number();
+      size_t col_num = tokenizer_.column();
+      auto next_expr = parse_expression();
+      if (!next_expr) {
+        return nullptr;
+      }
+      // build expression sequence
+      body_node = llvm::make_unique<BinaryExprAST>(line_num,
+                                                   col_num,
+                                                   tok_sep,
+                                                   std::move(body_node),
+                                                   std::move(next_expr));
+    }
+    // eat unindentation
+    tokenizer_.consume();
+  }
+
+  return llvm::make_unique<ForExprAST>(line_num, col_num,
+                                       std::move(var_expr),
+                                       std::move(generator_node),
+                                       std::move(body_node));
+}
+
+// 'yield', kept as a call to the yield builtin
+std::unique_ptr<ExprAST> Parser::parse_yield_expr() {
+  auto line_num = tokenizer_.line_number();
+  size_t col_num = tokenizer_.column();
+  // eat 'yield'
+  tokenizer_.consume();
+
+  auto value = parse_expression();
+  if (!value) {
+    return nullptr;
+  }
+  has_yield_ = true;
+
+  std::vector<std::unique_ptr<ExprAST>> args;
+  args.push_back(std::move(value));
+  return llvm::make_unique<CallExprAST>(line_num, col_num, "yield",
+                                        std::move(args));
+}
+
+// 'await', kept as a call to the await builtin. binds like a method call,
+//  so 'await s.read(n) ++ x' awaits the read
+std::unique_ptr<ExprAST> Parser::parse_await_expr() {
+  auto line_num = tokenizer_.line_number();
+  size_t col_num = tokenizer_.column();
+  // eat 'await'
+  tokenizer_.consume();
+
+  auto value = parse_unary();
+  if (!value) {
+    return nullptr;
+  }
+  value = parse_binop(binop_precedence_[tok_dot], std::move(value));
+  if (!value) {
+    return nullptr;
+  }
+  has_await_ = true;
+
+  std::vector<std::unique_ptr<ExprAST>> args;
+  args.push_back(std::move(value));
+  return llvm::make_unique<CallExprAST>(line_num, col_num, "await",
+                                        std::move(args));
+}
+
 std::unique_ptr<ExprAST> Parser::parse_list_item(std::unique_ptr<ExprAST> head) {
   auto line_num = tokenizer_.line_number();
 
@@ -967,9 +1259,9 @@ std::unique_ptr<ExprAST> Parser::parse_list_item(std::unique_ptr<ExprAST> head)
   }
 
   if (tokenizer_.peak() != tok_comma) {
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ')' or ',' in list constructor");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ')' or ',' in list constructor");
     // eat bad token
     tokenizer_.consume();
     return nullptr;
@@ -1020,9 +1312,9 @@ std::unique_ptr<ExprAST> Parser::parse_list_constructor() {
   }
 
   if (tokenizer_.peak() != tok_rbracket) {
-    bon::logger.set_line_column(line_num, tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ')' or ',' in list constructor");
+    logger_.set_line_column(line_num, tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ')' or ',' in list constructor");
     return nullptr;
   }
   // eat ']'
@@ -1062,6 +1354,12 @@ std::unique_ptr<ExprAST> Parser::parse_primary() {
       return parse_if_expr();
     case bon::tok_while:
       return parse_while_loop();
+    case bon::tok_for:
+      return parse_for_loop();
+    case bon::tok_yield:
+      return parse_yield_expr();
+    case bon::tok_await:
+      return parse_await_expr();
     case bon::tok_match:
       return parse_match_expr();
     case tok_lbracket:
@@ -1070,12 +1368,12 @@ std::unique_ptr<ExprAST> Parser::parse_primary() {
       break;
   }
 
-  bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+  logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
   std::ostringstream msg;
   auto token = tokenizer_.peak();
-  bon::logger.error("syntax error", msg << "unknown token "
-                                        << tokenizer_.token_type(token)
-                                        << " when expecting an expression");
+  logger_.error("syntax error", msg << "unknown token "
+                                    << tokenizer_.token_type(token)
+                                    << " when expecting an expression");
   return nullptr;
 }
 
@@ -1084,6 +1382,181 @@ bool Parser::is_unary_op(Token op) {
          || tokenizer_.peak() == tok_mul;
 }
 
+std::unique_ptr<VariableExprAST> Parser::make_placeholder(
+                                              size_t line_num, size_t col_num,
+                                              const std::string &name,
+                                              TypeVariable* type_var) {
+  auto placeholder = llvm::make_unique<VariableExprAST>(line_num, col_num,
+                                                        name);
+  delete placeholder->type_var_;
+  placeholder->type_var_ = type_var;
+  return placeholder;
+}
+
+// parallel_for(lo, hi, f, a, b)        - f(i, a, b) for i in [lo, hi)
+// par_reduce(lo, hi, init, f, c, a, b) - f(i, a, b) for i in [lo, hi),
+//                                        combined with c(x, y)
+// par_map(xs, f, a, b)                 - vec of f(xs[i], a, b)
+// and the _grain variants, which take the grain size after the range (or
+//  after xs). all of them are kept as
+//  name(lo, hi, grain, [init,] a, b, ..., body[, combine])
+//  where a, b, ... are evaluated once and passed on to body, which is the
+//  call made for each index
+std::unique_ptr<ExprAST> Parser::parse_parallel_builtin(
+                                std::string ident,
+                                std::vector<std::unique_ptr<ExprAST>> args,
+                                size_t line_num, size_t col_num) {
+  logger_.set_line_column(line_num, col_num);
+  auto with_grain = !is_parallel_builtin(ident);
+  ident = without_grain_suffix(ident);
+  auto is_map = ident == "par_map";
+  auto is_reduce = ident == "par_reduce";
+
+  // arguments before the function names, and how many functions there are
+  size_t leading = (is_map ? 1 : is_reduce ? 3 : 2) + (with_grain ? 1 : 0);
+  size_t fn_count = is_reduce ? 2 : 1;
+  if (args.size() < leading + fn_count) {
+    logger_.error("syntax error", "missing arguments for " + ident);
+    return nullptr;
+  }
+  std::vector<std::string> fn_names;
+  for (size_t i = leading; i < leading + fn_count; ++i) {
+    auto fn_var = dynamic_cast<VariableExprAST*>(args[i].get());
+    if (!fn_var) {
+      logger_.error("syntax error",
+                    "expected a function name as argument "
+                    + std::to_string(i + 1) + " of " + ident);
+      return nullptr;
+    }
+    // the function name was parsed as a variable reference
+    if (vars_in_scope_.count(fn_var->Name) > 0
+        && vars_in_scope_[fn_var->Name] == fn_var) {
+      vars_in_scope_.erase(fn_var->Name);
+    }
+    fn_names.push_back(fn_var->Name);
+  }
+
+  std::vector<std::unique_ptr<ExprAST>> captured;
+  std::unique_ptr<ExprAST> lo;
+  std::unique_ptr<ExprAST> hi;
+  size_t next = 0;
+  if (is_map) {
+    captured.push_back(std::move(args[next++]));
+    lo = llvm::make_unique<IntegerExprAST>(line_num, col_num, 0);
+  }
+  else {
+    lo = std::move(args[next++]);
+    hi = std::move(args[next++]);
+  }
+  std::unique_ptr<ExprAST> grain;
+  if (with_grain) {
+    grain = std::move(args[next++]);
+  }
+  else {
+    // picked by the runtime
+    grain = llvm::make_unique<IntegerExprAST>(line_num, col_num, 0);
+  }
+  std::unique_ptr<ExprAST> init;
+  if (is_reduce) {
+    init = std::move(args[next++]);
+  }
+  next += fn_count;
+  for (; next < args.size(); ++next) {
+    captured.push_back(std::move(args[next]));
+  }
+
+  auto make_call = [this, line_num, col_num](
+                                const std::string &fn_name,
+                                std::vector<std::unique_ptr<ExprAST>> call_args) {
+    auto call_expr = llvm::make_unique<CallExprAST>(line_num, col_num, fn_name,
+                                                    std::move(call_args));
+    called_functions_.push_back(call_expr.get());
+    return call_expr;
+  };
+  auto make_arg = [this, line_num, col_num, &captured](size_t index) {
+    return make_placeholder(line_num, col_num,
+                            "par arg" + std::to_string(index),
+                            captured[index]->type_var_);
+  };
+  auto make_index = [this, line_num, col_num, &lo]() {
+    return make_placeholder(line_num, col_num, "par index", lo->type_var_);
+  };
+  // fn(first, captured[from], ..., captured[to-1])
+  auto make_fn_call = [&](std::unique_ptr<ExprAST> first, size_t from,
+                          size_t to) {
+    std::vector<std::unique_ptr<ExprAST>> call_args;
+    call_args.push_back(std::move(first));
+    for (size_t i = from; i < to; ++i) {
+      call_args.push_back(make_arg(i));
+    }
+    return make_call(fn_names[0], std::move(call_args));
+  };
+
+  std::unique_ptr<ExprAST> body;
+  if (is_map) {
+    // xs is captured first, the output vector last, with room for elements
+    //  of whatever type fn returns:
+    //   set(out, i, fn(unsafe_at(xs, i), a, b))
+    auto element_at = [&](std::unique_ptr<ExprAST> index) {
+      std::vector<std::unique_ptr<ExprAST>> at_args;
+      at_args.push_back(make_arg(0));
+      at_args.push_back(std::move(index));
+      return make_call("unsafe_at", std::move(at_args));
+    };
+    std::vector<std::unique_ptr<ExprAST>> len_args;
+    len_args.push_back(make_arg(0));
+    hi = make_call("len", std::move(len_args));
+
+    // sizeof only looks at the type of the call, it isn't made
+    auto fn_args_end = captured.size();
+    auto zero = llvm::make_unique<IntegerExprAST>(line_num, col_num, 0);
+    auto element_size = llvm::make_unique<SizeofExprAST>(
+                          line_num, col_num,
+                          make_fn_call(element_at(std::move(zero)), 1,
+                                       fn_args_end));
+    std::vector<std::unique_ptr<ExprAST>> out_args;
+    len_args.clear();
+    len_args.push_back(make_arg(0));
+    out_args.push_back(make_call("len", std::move(len_args)));
+    out_args.push_back(std::move(element_size));
+    captured.push_back(make_call("uninit_vec", std::move(out_args)));
+
+    std::vector<std::unique_ptr<ExprAST>> set_args;
+    set_args.push_back(make_arg(fn_args_end));
+    set_args.push_back(make_index());
+    set_args.push_back(make_fn_call(element_at(make_index()), 1,
+                                    fn_args_end));
+    body = make_call("set", std::move(set_args));
+  }
+  else {
+    body = make_fn_call(make_index(), 0, captured.size());
+  }
+
+  std::vector<std::unique_ptr<ExprAST>> builtin_args;
+  builtin_args.push_back(std::move(lo));
+  builtin_args.push_back(std::move(hi));
+  builtin_args.push_back(std::move(grain));
+  if (is_reduce) {
+    builtin_args.push_back(std::move(init));
+  }
+  for (auto &arg : captured) {
+    builtin_args.push_back(std::move(arg));
+  }
+  builtin_args.push_back(std::move(body));
+  if (is_reduce) {
+    // combine(x, y), for partial results x and y
+    auto init_type = builtin_args[3]->type_var_;
+    std::vector<std::unique_ptr<ExprAST>> combine_args;
+    combine_args.push_back(make_placeholder(line_num, col_num, "par acc0",
+                                            init_type));
+    combine_args.push_back(make_placeholder(line_num, col_num, "par acc1",
+                                            init_type));
+    builtin_args.push_back(make_call(fn_names[1], std::move(combine_args)));
+  }
+  return llvm::make_unique<CallExprAST>(line_num, col_num, ident,
+                                        std::move(builtin_args));
+}
+
 bool Parser::is_type_constructor(std::string ident) {
   return type_constructors_.find(ident) != type_constructors_.end();
 }
@@ -1220,10 +1693,10 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
     case bon::tok_unary:
       tokenizer_.consume();
       if (!is_unary_op(tokenizer_.peak())) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error",
-                          "expected unary operator in prototype");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error",
+                      "expected unary operator in prototype");
         return nullptr;
       }
       func_name = "unary";
@@ -1241,17 +1714,17 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
       tokenizer_.consume();
       break;
     default:
-      bon::logger.set_line_column(tokenizer_.line_number(),
-                                  tokenizer_.column());
-      bon::logger.error("syntax error",
-                        "expected function name in prototype");
+      logger_.set_line_column(tokenizer_.line_number(),
+                              tokenizer_.column());
+      logger_.error("syntax error",
+                    "expected function name in prototype");
       return nullptr;
   }
 
   if (tokenizer_.peak() != tok_lparen && tokenizer_.peak() != bon::tok_unit) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected '(' after function name in prototype");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected '(' after function name in prototype");
     return nullptr;
   }
 
@@ -1269,7 +1742,7 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
       // eat '*'
       tokenizer_.consume();
       if (tokenizer_.peak() != bon::tok_identifier) {
-        bon::logger.error("syntax error", "expected arg name after '*'");
+        logger_.error("syntax error", "expected arg name after '*'");
       }
     }
     else {
@@ -1280,17 +1753,21 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
     tokenizer_.consume();
     if (tokenizer_.peak() == tok_colon) {
       tokenizer_.consume();
-      bon::logger.set_line_column(tokenizer_.line_number(),
-                                  tokenizer_.column());
+      logger_.set_line_column(tokenizer_.line_number(),
+                              tokenizer_.column());
       auto type_var =
             bon::type_variable_from_identifier(tokenizer_.identifier());
       if (type_var == nullptr) {
         // propagate error
         return nullptr;
       }
-      arg_types.push_back(type_var);
       // eat type identifier
       tokenizer_.consume();
+      type_var = parse_array_suffix(type_var);
+      if (type_var == nullptr) {
+        return nullptr;
+      }
+      arg_types.push_back(type_var);
     }
     else {
       arg_types.push_back(new bon::TypeVariable());
@@ -1304,9 +1781,9 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
 
   if (expecting_close_paren) {
     if (tokenizer_.peak() != tok_rparen) {
-      bon::logger.set_line_column(tokenizer_.line_number(),
-                                  tokenizer_.column());
-      bon::logger.error("syntax error", "expected ')' in prototype");
+      logger_.set_line_column(tokenizer_.line_number(),
+                              tokenizer_.column());
+      logger_.error("syntax error", "expected ')' in prototype");
       return nullptr;
     }
     // eat ')'
@@ -1317,7 +1794,7 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
   if (tokenizer_.peak() == bon::tok_arrow) {
     // eat '->'
     tokenizer_.consume();
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
     ret_type = bon::type_variable_from_identifier(tokenizer_.identifier());
     if (ret_type == nullptr) {
       // propagate error
@@ -1325,6 +1802,10 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
     }
     // eat type identifier
     tokenizer_.consume();
+    ret_type = parse_array_suffix(ret_type);
+    if (ret_type == nullptr) {
+      return nullptr;
+    }
   }
   else {
     ret_type = new bon::TypeVariable();
@@ -1342,10 +1823,41 @@ std::unique_ptr<PrototypeAST> Parser::parse_prototype() {
   return protoAST;
 }
 
+bon::TypeVariable* Parser::parse_array_suffix(bon::TypeVariable* element) {
+  if (tokenizer_.peak() != tok_lbracket) {
+    return element;
+  }
+  // eat '['
+  tokenizer_.consume();
+  if (tokenizer_.peak() != bon::tok_integer
+      || tokenizer_.number_suffix() != "" || tokenizer_.integer_value() <= 0) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected a positive integer constant "
+                                  "as the length of an array type");
+    return nullptr;
+  }
+  size_t length = tokenizer_.integer_value();
+  // eat length
+  tokenizer_.consume();
+  if (tokenizer_.peak() != tok_rbracket) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected ']' after array length");
+    return nullptr;
+  }
+  // eat ']'
+  tokenizer_.consume();
+  if (!is_array_element_type(element)) {
+    logger_.error("type error", "arrays can only hold numbers, bools "
+                                "and simd vectors");
+    return nullptr;
+  }
+  return array_type(element, length);
+}
+
 std::unique_ptr<TypeAST> Parser::parse_type() {
   size_t line_num = tokenizer_.line_number();
   size_t col_num = tokenizer_.column();
-  bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+  logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
 
   // bon::TypeEnv local_env;
   // bon::push_environment(local_env);
@@ -1361,9 +1873,9 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
     tokenizer_.consume();
     while (tokenizer_.peak() != tok_gt) {
       if (tokenizer_.peak() != bon::tok_identifier) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error", "expected type name");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error", "expected type name");
         return nullptr;
       }
 
@@ -1371,10 +1883,10 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
       tokenizer_.consume();
 
       if (tokenizer_.peak() != tok_comma && tokenizer_.peak() != tok_gt) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error",
-                          "expected ',' or '>' in type parameter list");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error",
+                      "expected ',' or '>' in type parameter list");
         return nullptr;
       }
       if (tokenizer_.peak() == tok_comma) {
@@ -1387,8 +1899,8 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
   }
 
   if (tokenizer_.peak() != bon::tok_identifier) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error", "expected class name");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected class name");
     return nullptr;
   }
 
@@ -1398,7 +1910,7 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
   auto variant_tvar = new bon::TypeVariable();
   variant_tvar->variant_name_ = type_name;
   // TODO: per token file position tracking
-  bon::logger.set_line_column(tokenizer_.line_number(), error_column);
+  logger_.set_line_column(tokenizer_.line_number(), error_column);
   // register type before parsing body to allow for recurrent type definitions
   bon::register_type(type_name, variant_tvar);
 
@@ -1421,19 +1933,19 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
     tokenizer_.consume();
     while (tokenizer_.peak() != tok_rparen) {
       if (tokenizer_.peak() != bon::tok_identifier) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error", "expected typeclass name");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error", "expected typeclass name");
         return nullptr;
       }
       auto new_tvar = new bon::TypeVariable();
       typeclasses.push_back(tokenizer_.identifier());
       tokenizer_.consume();
       if (tokenizer_.peak() != tok_comma && tokenizer_.peak() != tok_rparen) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error",
-                          "expected ',' or ')' in typeclass list");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error",
+                      "expected ',' or ')' in typeclass list");
         return nullptr;
       }
       if (tokenizer_.peak() == tok_comma) {
@@ -1446,17 +1958,17 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
   }
 
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after type definition");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after type definition");
     return nullptr;
   }
   // eat ':'
   tokenizer_.consume();
 
   if (tokenizer_.peak() != bon::tok_indent) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error", "expected indent after type declaration");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected indent after type declaration");
     return nullptr;
   }
 
@@ -1488,9 +2000,9 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
       continue;
     }
     if (tokenizer_.peak() != bon::tok_identifier) {
-      bon::logger.set_line_column(tokenizer_.line_number(),
-                                  tokenizer_.column());
-      bon::logger.error("syntax error", "expected type constructor");
+      logger_.set_line_column(tokenizer_.line_number(),
+                              tokenizer_.column());
+      logger_.error("syntax error", "expected type constructor");
       return nullptr;
     }
 
@@ -1500,7 +2012,7 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
     type_constructors_.insert(tcon_name);
     tokenizer_.consume();
     // TODO: per token file position tracking
-    bon::logger.set_line_column(tokenizer_.line_number()+1, token_column);
+    logger_.set_line_column(tokenizer_.line_number()+1, token_column);
 
     // parse constructor params
     std::vector<bon::TypeVariable*> tcon_params;
@@ -1516,9 +2028,9 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
     bool indented = false;
     while (tokenizer_.peak() != tok_rparen) {
       if (tokenizer_.peak() != bon::tok_identifier) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error", "expected type name");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error", "expected type name");
         return nullptr;
       }
       std::string tparam_name = tokenizer_.identifier();
@@ -1542,20 +2054,23 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
         // must be a concrete type name or type constructor
         auto tvar = bon::type_variable_from_identifier(tparam_name);
         if (!tvar) {
-          bon::logger.set_line_column(tokenizer_.line_number(),
-                                      tokenizer_.column());
-          bon::logger.error("type error", "unknown type referenced");
+          logger_.set_line_column(tokenizer_.line_number(),
+                                  tokenizer_.column());
+          logger_.error("type error", "unknown type referenced");
           // return nullptr;
         }
+        else {
+          tvar = parse_array_suffix(tvar);
+        }
         tcon_params.push_back(tvar);
       }
 
       if (tokenizer_.peak() != tok_comma && tokenizer_.peak() != tok_rparen) {
-        bon::logger.set_line_column(tokenizer_.line_number(),
-                                    tokenizer_.column());
-        bon::logger.error("syntax error",
-                          "expected ',' or ')' "
-                          "in type constructor parameter list");
+        logger_.set_line_column(tokenizer_.line_number(),
+                                tokenizer_.column());
+        logger_.error("syntax error",
+                      "expected ',' or ')' "
+                      "in type constructor parameter list");
         return nullptr;
       }
       if (tokenizer_.peak() == tok_comma) {
@@ -1564,7 +2079,7 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
       }
       if (tokenizer_.peak() == tok_indent) {
         if (indented) {
-          bon::logger.error("syntax error", "misaligned indentation");
+          logger_.error("syntax error", "misaligned indentation");
         }
         indented = true;
         // eat tok_indent
@@ -1577,7 +2092,7 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
     type_constructors[tcon_name] = tuple_type;
     if (indented) {
       if (tokenizer_.peak() != tok_dedent) {
-        bon::logger.error("syntax error", "missing expected unindent");
+        logger_.error("syntax error", "missing expected unindent");
       }
       else {
         // eat tok_dedent
@@ -1597,8 +2112,8 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
   bon::AutoScope pop_env([]{ bon::pop_environment(); });
 
   if (tokenizer_.peak() != bon::tok_dedent) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error", "expected unindent after type body");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected unindent after type body");
     return nullptr;
   }
   // eat unindent
@@ -1625,8 +2140,8 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
   }
 
   // if (tokenizer_.peak() != bon::tok_end) {
-  //   bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-  //   bon::logger.error("syntax error", "expected 'end' after type declaration");
+  //   logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+  //   logger_.error("syntax error", "expected 'end' after type declaration");
   //   return nullptr;
   // }
   // // eat 'end'
@@ -1635,6 +2150,77 @@ std::unique_ptr<TypeAST> Parser::parse_type() {
   return llvm::make_unique<TypeAST>(type_name, line_num, col_num, variant_tvar);
 }
 
+std::string Parser::parse_attribute() {
+  // eat '@'
+  tokenizer_.consume();
+
+  if (tokenizer_.peak() != bon::tok_identifier) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected attribute name after '@'");
+    return "";
+  }
+  std::string attribute = tokenizer_.identifier();
+  if (attribute != "soa" && attribute != "fast_math") {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "unknown attribute '@" + attribute + "'");
+    return "";
+  }
+  // eat attribute name
+  tokenizer_.consume();
+  return attribute;
+}
+
+std::unique_ptr<FunctionAST> Parser::parse_definition_with_attribute(
+                                                const std::string &attribute) {
+  if (attribute != "fast_math") {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "'@" + attribute + "' can't be used "
+                                  "on a function");
+    return nullptr;
+  }
+  auto function_ast = parse_definition();
+  if (!function_ast) {
+    return nullptr;
+  }
+  // @fast_math: float math in this function may be reassociated and
+  //  approximated, as with --fast-math
+  function_ast->fast_math_ = true;
+  return function_ast;
+}
+
+std::unique_ptr<TypeAST> Parser::parse_type_with_attribute(
+                                                const std::string &attribute) {
+  if (attribute != "soa") {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "'@" + attribute + "' can't be used "
+                                  "on a class");
+    return nullptr;
+  }
+
+  if (tokenizer_.peak() != tok_class) {
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error", "expected class definition after '@"
+                                  + attribute + "'");
+    return nullptr;
+  }
+
+  auto type_ast = parse_type();
+  if (!type_ast) {
+    return nullptr;
+  }
+
+  // @soa: objects of this class are stored one column per field in buffers
+  if (!bon::set_soa_layout(type_ast->type_var_)) {
+    logger_.set_line_column(type_ast->line_num_, type_ast->column_num_);
+    logger_.error("type error", "@soa class " + type_ast->name_ +
+                  " must have a single constructor, with only int and"
+                  " float fields");
+    return nullptr;
+  }
+
+  return type_ast;
+}
+
 // parse function definition
 std::unique_ptr<FunctionAST> Parser::parse_definition() {
   size_t line_num = tokenizer_.line_number();
@@ -1646,9 +2232,9 @@ std::unique_ptr<FunctionAST> Parser::parse_definition() {
     return nullptr;
 
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after function prototype");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after function prototype");
     return nullptr;
   }
   // eat ':'
@@ -1670,6 +2256,8 @@ std::unique_ptr<FunctionAST> Parser::parse_definition() {
   // TODO: this should be a stack for nested scoping
   vars_in_scope_.clear();
   called_functions_.clear();
+  has_yield_ = false;
+  has_await_ = false;
 
   ExprAST* last_expr = nullptr;
   if (auto E = parse_expression()) {
@@ -1682,9 +2270,9 @@ std::unique_ptr<FunctionAST> Parser::parse_definition() {
           continue;
         }
         if (expecting_return) {
-          bon::logger.set_line_column(tokenizer_.line_number(),
-                                      tokenizer_.column());
-          bon::logger.error("syntax error", "expected unindent after 'return'");
+          logger_.set_line_column(tokenizer_.line_number(),
+                                  tokenizer_.column());
+          logger_.error("syntax error", "expected unindent after 'return'");
           return nullptr;
         }
         bool got_return = tokenizer_.peak() == bon::tok_return;
@@ -1712,8 +2300,8 @@ std::unique_ptr<FunctionAST> Parser::parse_definition() {
       // eat unindentation
       tokenizer_.consume();
       // if (tokenizer_.peak() != bon::tok_end) {
-      //   bon::logger.set_line_column(line_num, col_num);
-      //   bon::logger.error("syntax error", "expected 'end' after function body");
+      //   logger_.set_line_column(line_num, col_num);
+      //   logger_.error("syntax error", "expected 'end' after function body");
       //   return nullptr;
       // }
       // // eat 'end'
@@ -1730,6 +2318,8 @@ std::unique_ptr<FunctionAST> Parser::parse_definition() {
                                                std::move(proto_node),
                                                std::move(E), last_expr,
                                                called_functions_);
+    func->generator_ = has_yield_;
+    func->async_ = has_await_;
     for (auto arg : func->Proto->Args) {
       // // TODO: Should this just be a warning? Or ignored completely?
       // if (vars_in_scope_.count(arg) == 0) {
@@ -1762,7 +2352,7 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
   tokenizer_.consume();
 
   if (tokenizer_.peak() != tok_identifier) {
-    logger.error("syntax error", "expected class name after 'typeclass'");
+    logger_.error("syntax error", "expected class name after 'typeclass'");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1772,8 +2362,8 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
   tokenizer_.consume();
 
   if (tokenizer_.peak() != tok_lparen) {
-    logger.error("syntax error",
-                 "expected '(' after 'class " + class_name + "'");
+    logger_.error("syntax error",
+                  "expected '(' after 'class " + class_name + "'");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1788,7 +2378,7 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
 
   while (tokenizer_.peak() != tok_rparen) {
     if (tokenizer_.peak() != tok_identifier) {
-      logger.error("syntax error", "expected type variable");
+      logger_.error("syntax error", "expected type variable");
       // eat bad token, but continue to avoid too many errors
       tokenizer_.consume();
     }
@@ -1801,7 +2391,8 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
       tokenizer_.consume();
     }
     if (tokenizer_.peak() != tok_comma && tokenizer_.peak() != tok_rparen) {
-      logger.error("syntax error", "expected ',' or ')' in type variable list");
+      logger_.error("syntax error",
+                    "expected ',' or ')' in type variable list");
       break;
     }
 
@@ -1817,9 +2408,9 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
   }
 
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after 'typeclass'");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after 'typeclass'");
     return nullptr;
   }
   // eat ':'
@@ -1831,7 +2422,7 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
   }
   else {
     update_tok_position();
-    bon::logger.error("syntax error", "expected indent after typeclass prototype");
+    logger_.error("syntax error", "expected indent after typeclass prototype");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1856,7 +2447,7 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
   }
   else {
     update_tok_position();
-    bon::logger.error("syntax error", "expected unindent after typeclass members");
+    logger_.error("syntax error", "expected unindent after typeclass members");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1868,13 +2459,13 @@ std::unique_ptr<TypeclassAST> Parser::parse_typeclass() {
 std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
   size_t line_num = tokenizer_.line_number();
   size_t col_num = tokenizer_.column();
-  bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+  logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
 
   // eat 'impl'
   tokenizer_.consume();
 
   if (tokenizer_.peak() != tok_identifier) {
-    logger.error("syntax error", "expected typeclass name after 'impl'");
+    logger_.error("syntax error", "expected typeclass name after 'impl'");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1884,8 +2475,8 @@ std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
   tokenizer_.consume();
 
   if (tokenizer_.peak() != tok_lparen) {
-    logger.error("syntax error",
-                 "expected '(' after 'impl " + class_name + "'");
+    logger_.error("syntax error",
+                  "expected '(' after 'impl " + class_name + "'");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1898,7 +2489,7 @@ std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
 
   while (tokenizer_.peak() != tok_rparen) {
     if (tokenizer_.peak() != tok_identifier) {
-      logger.error("syntax error", "expected concrete type name");
+      logger_.error("syntax error", "expected concrete type name");
       // eat bad token, but continue to avoid too many errors
       tokenizer_.consume();
     }
@@ -1910,7 +2501,7 @@ std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
       tokenizer_.consume();
     }
     if (tokenizer_.peak() != tok_comma && tokenizer_.peak() != tok_rparen) {
-      logger.error("syntax error", "expected ',' or ')' in type list");
+      logger_.error("syntax error", "expected ',' or ')' in type list");
     }
 
     if (tokenizer_.peak() == tok_comma) {
@@ -1925,9 +2516,9 @@ std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
   }
 
   if (tokenizer_.peak() != tok_colon) {
-    bon::logger.set_line_column(tokenizer_.line_number(), tokenizer_.column());
-    bon::logger.error("syntax error",
-                      "expected ':' after 'impl' " + class_name + "(...)");
+    logger_.set_line_column(tokenizer_.line_number(), tokenizer_.column());
+    logger_.error("syntax error",
+                  "expected ':' after 'impl' " + class_name + "(...)");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1940,7 +2531,7 @@ std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
   }
   else {
     update_tok_position();
-    bon::logger.error("syntax error", "expected indent after impl start");
+    logger_.error("syntax error", "expected indent after impl start");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
@@ -1960,7 +2551,7 @@ std::unique_ptr<TypeclassImplAST> Parser::parse_typeclass_impl() {
   }
   else {
     update_tok_position();
-    bon::logger.error("syntax error", "expected unindent after impl end");
+    logger_.error("syntax error", "expected unindent after impl end");
     // intentionally continue to try to reduce number of errors
     // return nullptr;
   }
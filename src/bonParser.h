@@ -9,6 +9,8 @@ L*----------------------------------------------------------------------------*/
 #include "bonTokenizer.h"
 #include "bonModuleState.h"
 
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <map>
 #include <set>
@@ -24,20 +26,49 @@ private:
   std::map<std::string, VariableExprAST*> vars_in_scope_;
   std::set<std::string> type_constructors_;
   std::vector<CallExprAST*> called_functions_;
+  // set once a yield is parsed, makes the function being parsed a generator
+  bool has_yield_;
+  // likewise for await and async functions
+  bool has_await_;
+  // modules are only parsed the first time they're imported
+  std::set<std::string> imported_modules_;
   Tokenizer tokenizer_;
+  // file being parsed, unless reading from stdin for the repl
+  std::ifstream source_;
+  // sources added with add_source, read instead of the files of those names
+  std::map<std::string, std::string> sources_;
+  std::istringstream source_text_;
   ModuleState &state_;
+  Logger &logger_;
   // stack of scopes for name mangling
   std::vector<std::string> scope_stack_;
   void update_tok_position();
   bool is_unary_op(Token op);
   bool is_type_constructor(std::string ident);
+  // placeholder for a value supplied by a parallel builtin (the loop index,
+  //  an argument passed on to every iteration, ...), typed as type_var
+  std::unique_ptr<VariableExprAST> make_placeholder(size_t line_num,
+                                                    size_t col_num,
+                                                    const std::string &name,
+                                                    TypeVariable* type_var);
+  // parallel_for, par_map and par_reduce (and their _grain variants)
+  std::unique_ptr<ExprAST> parse_parallel_builtin(
+                                std::string ident,
+                                std::vector<std::unique_ptr<ExprAST>> args,
+                                size_t line_num, size_t col_num);
   // main parse loop
   void parse();
+  // points the tokenizer at filename (or the source added in its place),
+  //  returns false if there's no such file
+  bool open_input(const std::string &filename);
 
 public:
   Parser(ModuleState &state);
 
   void parse_file(std::string filename);
+  // text is parsed in place of the file filename from then on, whether it's
+  //  parsed with parse_file or imported (filename "name.bon" for import name)
+  void add_source(const std::string &filename, const std::string &text);
 
   int get_operator_precedence();
 
@@ -72,6 +103,12 @@ public:
   // 'if' expression 'then' expression 'else' expression
   std::unique_ptr<ExprAST> parse_if_expr();
   std::unique_ptr<ExprAST> parse_while_loop();
+  // 'for' variable 'in' generator
+  std::unique_ptr<ExprAST> parse_for_loop();
+  // 'yield' expression, in a generator function
+  std::unique_ptr<ExprAST> parse_yield_expr();
+  // 'await' expression, in an async function
+  std::unique_ptr<ExprAST> parse_await_expr();
   // list literal e.g. [1,2,3]
   std::unique_ptr<ExprAST> parse_list_item(std::unique_ptr<ExprAST> head);
   std::unique_ptr<ExprAST> parse_list_constructor();
@@ -83,8 +120,22 @@ public:
                                        std::unique_ptr<ExprAST> LHS);
   // parse function prototype
   std::unique_ptr<PrototypeAST> parse_prototype();
+  // parse the optional "[length]" after the type name in an annotation,
+  //  returns the array type (or element if there isn't one), nullptr on error
+  bon::TypeVariable* parse_array_suffix(bon::TypeVariable* element);
   // parse type definition
   std::unique_ptr<TypeAST> parse_type();
+  // parse '@' and the attribute name following it, returns the name
+  //  or "" on error
+  std::string parse_attribute();
+  // parse type definition after an attribute e.g. "@soa"
+  std::unique_ptr<TypeAST> parse_type_with_attribute(
+                                                const std::string &attribute);
+  // parse function definition after an attribute e.g. "@fast_math"
+  std::unique_ptr<FunctionAST> parse_definition_with_attribute(
+                                                const std::string &attribute);
+  // register a top-level function
+  void add_function(std::unique_ptr<FunctionAST> function_ast);
   // parse typeclass definition
   std::unique_ptr<TypeclassAST> parse_typeclass();
   // parse typeclass implementation
@@ -4,52 +4,62 @@
 |*
 L*----------------------------------------------------------------------------*/
 #include "bonScopeAnalysisPass.h"
+#include <algorithm>
 
 namespace bon {
 
 ScopeAnalysisPass::ScopeAnalysisPass(ModuleState &state)
-  : state_(state)
+  : state_(state), current_proto_(nullptr), has_slot_result_(false),
+    has_other_result_(false)
 {
 }
 
 // NumberExprAST
 void ScopeAnalysisPass::process(NumberExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // IntegerExprAST
 void ScopeAnalysisPass::process(IntegerExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // StringExprAST
 void ScopeAnalysisPass::process(StringExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // BoolExprAST
 void ScopeAnalysisPass::process(BoolExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // UnitExprAST
 void ScopeAnalysisPass::process(UnitExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // VariableExprAST
 void ScopeAnalysisPass::process(VariableExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // ValueConstructorExprAST
 void ScopeAnalysisPass::process(ValueConstructorExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // UnaryExprAST
 void ScopeAnalysisPass::process(UnaryExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // BinaryExprAST
@@ -60,6 +70,7 @@ void ScopeAnalysisPass::process(BinaryExprAST* node) {
   }
   else {
     node->ends_scope_ = true;
+    tail_result(false);
   }
 }
 
@@ -69,11 +80,21 @@ void ScopeAnalysisPass::process(IfExprAST* node) {
   if (node->Else) {
     node->Else->run_pass(this);
   }
+  else {
+    tail_result(false);
+  }
 }
 
 // WhileExprAST
 void ScopeAnalysisPass::process(WhileExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
+}
+
+// ForExprAST
+void ScopeAnalysisPass::process(ForExprAST* node) {
+  node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // MatchCaseExprAST
@@ -91,16 +112,27 @@ void ScopeAnalysisPass::process(MatchExprAST* node) {
 // CallExprAST
 void ScopeAnalysisPass::process(CallExprAST* node) {
   node->ends_scope_ = true;
+  // v[i] is sugar for unsafe_at(v, i), which hands back the slot itself
+  if (node->Callee == "unsafe_at" && !node->Args.empty()) {
+    tail_result(is_borrowed_param(node->Args[0].get()));
+  }
+  // only reports the error (unsafe_at's out of bounds branch), the value
+  //  it returns is a placeholder
+  else if (node->Callee != "out_of_bounds") {
+    tail_result(false);
+  }
 }
 
 // SizeofExprAST
 void ScopeAnalysisPass::process(SizeofExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(false);
 }
 
 // PtrOffsetExprAST
 void ScopeAnalysisPass::process(PtrOffsetExprAST* node) {
   node->ends_scope_ = true;
+  tail_result(is_borrowed_param(node->arg_.get()));
 }
 
 // PrototypeAST
@@ -109,7 +141,14 @@ void ScopeAnalysisPass::process(PrototypeAST* node) {
 
 // FunctionAST
 void ScopeAnalysisPass::process(FunctionAST* node) {
+  current_proto_ = node->Proto.get();
+  has_slot_result_ = false;
+  has_other_result_ = false;
   node->Body->run_pass(this);
+  // a slot is only returned in place if every result is one, otherwise
+  //  the caller would have to free some results but not others
+  current_proto_->returns_slot_ = has_slot_result_ && !has_other_result_;
+  current_proto_ = nullptr;
 }
 
 // TypeAST
@@ -131,4 +170,33 @@ void ScopeAnalysisPass::process(TypeclassImplAST* node) {
   }
 }
 
+void ScopeAnalysisPass::tail_result(bool is_slot) {
+  if (is_slot) {
+    has_slot_result_ = true;
+  }
+  else {
+    has_other_result_ = true;
+  }
+}
+
+bool ScopeAnalysisPass::is_borrowed_param(ExprAST* expr) {
+  // field of a borrowed object, e.g. v.data
+  if (auto binop = dynamic_cast<BinaryExprAST*>(expr)) {
+    return binop->Op == tok_dot && is_borrowed_param(binop->LHS.get());
+  }
+  auto var = dynamic_cast<VariableExprAST*>(expr);
+  if (!var || !current_proto_) {
+    return false;
+  }
+  auto &args = current_proto_->Args;
+  auto arg = std::find(args.begin(), args.end(), var->Name);
+  if (arg == args.end()) {
+    return false;
+  }
+  // an argument moved into the function is freed when it returns
+  auto index = arg - args.begin();
+  return index >= (long)current_proto_->arg_owned_.size()
+         || !current_proto_->arg_owned_[index];
+}
+
 } // namespace bon
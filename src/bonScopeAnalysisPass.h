@@ -23,6 +23,7 @@ public:
   void process(BinaryExprAST* node) override;
   void process(IfExprAST* node) override;
   void process(WhileExprAST* node) override;
+  void process(ForExprAST* node) override;
   void process(MatchCaseExprAST* node) override;
   void process(MatchExprAST* node) override;
   void process(CallExprAST* node) override;
@@ -37,7 +38,21 @@ public:
   ScopeAnalysisPass(ModuleState &state);
 
 private:
+  // records the result of one of the function's tail positions, is_slot if
+  //  it's a slot of a buffer the caller owns rather than a new object
+  void tail_result(bool is_slot);
+  // whether expr is a (field of a) parameter the function only borrows, so
+  //  its buffer outlives the call
+  bool is_borrowed_param(ExprAST* expr);
+
   ModuleState &state_;
+  // prototype of the function whose body is being walked
+  PrototypeAST* current_proto_;
+  // some tail position is a slot of a borrowed buffer
+  bool has_slot_result_;
+  // some tail position is anything else (e.g. a new object, or a slot of a
+  //  local buffer that's freed on return)
+  bool has_other_result_;
 };
 
 } // namespace bon
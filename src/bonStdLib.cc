@@ -11,6 +11,20 @@ L*----------------------------------------------------------------------------*/
 #include <chrono>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "bonAsync.h"
+#include "bonChannel.h"
+#include "bonThreadPool.h"
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 extern "C" int64_t get_time() {
   using namespace std::chrono;
@@ -24,10 +38,22 @@ extern "C" void* null_ptr() {
   return nullptr;
 }
 
+// zeroed memory for vec to read the template of an out of bounds element
+// from, big enough for any inline element type
+extern "C" void* zeroed_slot() {
+  alignas(64) static char slot[4096] = {};
+  return slot;
+}
+
 extern "C" bool is_nullptr(void* ptr) {
   return ptr == nullptr;
 }
 
+// same as is_nullptr, for typed pointers
+extern "C" bool is_null(void* ptr) {
+  return ptr == nullptr;
+}
+
 extern "C" void* open_file(char* filename, char* mode) {
   std::FILE* file = fopen(filename, mode);
   return file;
@@ -46,7 +72,18 @@ extern "C" char* get_line_internal(void* file_ptr) {
   return line;
 }
 
-extern std::vector<std::string> s_args;
+// arguments the program was given, for get_arg. set once, before anything
+//  runs, by the bon executable or a libbon host
+static std::vector<std::string> s_args;
+
+namespace bon {
+
+void set_program_args(const std::vector<std::string> &args) {
+  s_args = args;
+}
+
+} // namespace bon
+
 extern "C" char* get_arg(int64_t index) {
   if (index < s_args.size()) {
     auto arg = s_args[index];
@@ -215,6 +252,19 @@ extern "C" char* int_to_string(int64_t val) {
   return new_str;
 }
 
+extern "C" char* uint_to_string(uint64_t val) {
+  std::ostringstream val_stream;
+  val_stream << val;
+  std::string result = val_stream.str();
+  char* new_str = new char[result.size()+1];
+  size_t idx = 0;
+  for (auto &chr : result) {
+    new_str[idx++] = chr;
+  }
+  new_str[result.size()] = 0;
+  return new_str;
+}
+
 extern "C" char* float_to_string(double val) {
   std::ostringstream val_stream;
   val_stream.precision(15);
@@ -237,6 +287,13 @@ extern "C" double int_to_float(int64_t val) {
   return static_cast<double>(val);
 }
 
+// raw bits of val, e.g. for radix sorting floats
+extern "C" int64_t float_bits(double val) {
+  int64_t bits;
+  std::memcpy(&bits, &val, sizeof(bits));
+  return bits;
+}
+
 extern "C" int64_t cstr_ord(char* str) {
   return static_cast<int64_t>(str[0]);
 }
@@ -248,3 +305,748 @@ extern "C" int64_t string_to_int(char* str) {
 extern "C" double string_to_float(char* str) {
   return strtod(str, nullptr);
 }
+
+namespace {
+
+// below this many elements, sorting on one thread is faster
+const size_t s_par_sort_threshold = 1 << 16;
+
+// number of elements taken from a for the first k elements of the stable
+// merge of a and b
+template <typename T, typename Less>
+size_t merge_split(const T* a, size_t a_size, const T* b, size_t b_size,
+                   size_t k, Less less) {
+  size_t low = k > b_size ? k - b_size : 0;
+  size_t high = std::min(k, a_size);
+  while (low < high) {
+    size_t i = low + (high - low) / 2;
+    if (!less(b[k - i - 1], a[i])) {
+      low = i + 1;
+    }
+    else {
+      high = i;
+    }
+  }
+  return low;
+}
+
+// stable parallel merge sort. every thread sorts one chunk, then chunks are
+// merged pairwise, and each merge is split up between the threads so the
+// last rounds don't end up on a single core
+template <typename T, typename Less>
+void parallel_sort(T* data, size_t n, Less less) {
+  auto pool = bon::runtime_thread_pool();
+  size_t threads = pool->size();
+  if (n < s_par_sort_threshold || threads == 1) {
+    std::stable_sort(data, data + n, less);
+    return;
+  }
+
+  size_t chunks = threads;
+  std::vector<size_t> bounds(chunks + 1);
+  for (size_t i = 0; i <= chunks; ++i) {
+    bounds[i] = n * i / chunks;
+  }
+  pool->run(chunks, [&](size_t i) {
+    std::stable_sort(data + bounds[i], data + bounds[i+1], less);
+  });
+
+  std::unique_ptr<T[]> buffer(new T[n]);
+  T* src = data;
+  T* dst = buffer.get();
+  for (size_t width = 1; width < chunks; width *= 2) {
+    size_t merges = (chunks + 2 * width - 1) / (2 * width);
+    size_t parts = std::max<size_t>(1, threads / merges);
+    pool->run(merges * parts, [&](size_t task) {
+      size_t merge = task / parts;
+      size_t part = task % parts;
+      size_t low = bounds[std::min(2 * width * merge, chunks)];
+      size_t mid = bounds[std::min(2 * width * merge + width, chunks)];
+      size_t high = bounds[std::min(2 * width * (merge + 1), chunks)];
+      const T* a = src + low;
+      const T* b = src + mid;
+      size_t a_size = mid - low;
+      size_t b_size = high - mid;
+      size_t k_begin = (high - low) * part / parts;
+      size_t k_end = (high - low) * (part + 1) / parts;
+      size_t a_begin = merge_split(a, a_size, b, b_size, k_begin, less);
+      size_t a_end = merge_split(a, a_size, b, b_size, k_end, less);
+      std::merge(a + a_begin, a + a_end,
+                 b + (k_begin - a_begin), b + (k_end - a_end),
+                 dst + low + k_begin, less);
+    });
+    std::swap(src, dst);
+  }
+
+  if (src != data) {
+    pool->run(chunks, [&](size_t i) {
+      std::copy(src + bounds[i], src + bounds[i+1], data + bounds[i]);
+    });
+  }
+}
+
+template <typename K>
+struct KeyIndex {
+  K key;
+  int64_t index;
+};
+
+// sorts keys, and sets perm[i] to the original index of the i-th key
+template <typename K>
+void parallel_sort_perm(K* keys, int64_t* perm, size_t n) {
+  std::unique_ptr<KeyIndex<K>[]> entries(new KeyIndex<K>[n]);
+  for (size_t i = 0; i < n; ++i) {
+    entries[i].key = keys[i];
+    entries[i].index = i;
+  }
+  parallel_sort(entries.get(), n,
+                [](const KeyIndex<K> &a, const KeyIndex<K> &b) {
+                  return a.key < b.key;
+                });
+  for (size_t i = 0; i < n; ++i) {
+    keys[i] = entries[i].key;
+    perm[i] = entries[i].index;
+  }
+}
+
+} // namespace
+
+extern "C" void par_sort_ints(int64_t* data, int64_t n) {
+  parallel_sort(data, n, std::less<int64_t>());
+}
+
+extern "C" void par_sort_floats(double* data, int64_t n) {
+  parallel_sort(data, n, std::less<double>());
+}
+
+extern "C" void par_sort_perm_ints(int64_t* keys, int64_t* perm, int64_t n) {
+  parallel_sort_perm(keys, perm, n);
+}
+
+extern "C" void par_sort_perm_floats(double* keys, int64_t* perm, int64_t n) {
+  parallel_sort_perm(keys, perm, n);
+}
+
+extern "C" void set_num_threads(int64_t num_threads) {
+  bon::set_runtime_thread_count(num_threads);
+}
+
+extern "C" int64_t num_threads() {
+  return bon::runtime_thread_pool()->size();
+}
+
+namespace {
+
+// task started by spawn. thunk is generated by the compiler, it unpacks the
+// arguments from env, makes the call and stores the result at the start of
+// env
+struct SpawnedTask : bon::Job {
+  void (*thunk)(void*);
+  void* env;
+  // joined on the pool it was spawned on, even if that's been replaced
+  std::shared_ptr<bon::ThreadPool> pool;
+
+  SpawnedTask(void (*thunk_fn)(void*), void* task_env)
+    : bon::Job(&SpawnedTask::run), thunk(thunk_fn), env(task_env),
+      pool(bon::runtime_thread_pool()) {}
+  static void run(bon::Job* job) {
+    auto task = static_cast<SpawnedTask*>(job);
+    task->thunk(task->env);
+  }
+};
+
+} // namespace
+
+extern "C" void* bon_spawn(void (*thunk)(void*), void* env) {
+  auto task = new SpawnedTask(thunk, env);
+  task->pool->submit(task);
+  return task;
+}
+
+// waits for the task, and gives back its env for the caller to read the
+// result from and free
+extern "C" void* bon_join(void* handle) {
+  auto task = static_cast<SpawnedTask*>(handle);
+  task->pool->wait(task);
+  auto env = task->env;
+  delete task;
+  return env;
+}
+
+namespace {
+
+// results of par_reduce are numbers, bools or simd vectors
+const size_t s_max_reduce_size = 64;
+
+// a parallel_for or par_reduce call. body is generated by the compiler, it
+// runs the iterations [begin, end) with the arguments in env, folding their
+// results into out for a reduction. combine(a, b) sets a to the combination
+// of a and b
+struct RangeLoop {
+  void (*body)(void*, int64_t, int64_t, void*);
+  void* env;
+  void (*combine)(void*, void*);
+  // starting value of every partial result
+  const char* identity;
+  size_t result_size;
+  int64_t grain;
+  size_t num_threads;
+};
+
+void run_range(const RangeLoop &loop, int64_t begin, int64_t end,
+               size_t splits, bool stolen, void* out);
+
+struct RangeJob : bon::Job {
+  const RangeLoop* loop;
+  int64_t begin;
+  int64_t end;
+  size_t splits;
+  std::thread::id origin;
+  alignas(64) char result[s_max_reduce_size];
+
+  RangeJob(const RangeLoop* range_loop, int64_t range_begin,
+           int64_t range_end, size_t split_budget)
+    : bon::Job(&RangeJob::run), loop(range_loop), begin(range_begin),
+      end(range_end), splits(split_budget),
+      origin(std::this_thread::get_id()) {
+    if (loop->result_size > 0) {
+      memcpy(result, loop->identity, loop->result_size);
+    }
+  }
+  static void run(bon::Job* job) {
+    auto self = static_cast<RangeJob*>(job);
+    auto stolen = self->origin != std::this_thread::get_id();
+    run_range(*self->loop, self->begin, self->end, self->splits, stolen,
+              self->result);
+  }
+};
+
+// ranges are split in half, with the right half offered to other threads,
+// until they're down to the grain size or out of splits. the split budget
+// starts at the number of threads and halves with every split, so an idle
+// pool gets a couple of pieces per thread. a piece that gets stolen was
+// needed elsewhere, so it gets a fresh budget to keep the thief's
+// neighbours busy too. nested loops share the same pool, so they never
+// start more threads than it has
+void run_range(const RangeLoop &loop, int64_t begin, int64_t end,
+               size_t splits, bool stolen, void* out) {
+  if (end - begin <= loop.grain || (!stolen && splits == 0)) {
+    loop.body(loop.env, begin, end, out);
+    return;
+  }
+  splits = stolen ? std::max(loop.num_threads, splits / 2) : splits / 2;
+  auto mid = begin + (end - begin) / 2;
+  RangeJob right(&loop, mid, end, splits);
+  auto pool = bon::runtime_thread_pool();
+  pool->submit(&right);
+  run_range(loop, begin, mid, splits, false, out);
+  pool->wait(&right);
+  // left before right, so the combiner only needs to be associative
+  if (loop.combine) {
+    loop.combine(out, right.result);
+  }
+}
+
+void parallel_range(RangeLoop &loop, int64_t lo, int64_t hi, void* out) {
+  if (lo >= hi) {
+    return;
+  }
+  auto pool = bon::runtime_thread_pool();
+  loop.num_threads = pool->size();
+  if (loop.num_threads == 1) {
+    loop.body(loop.env, lo, hi, out);
+    return;
+  }
+  if (loop.grain <= 0) {
+    // enough pieces for stealing to even out uneven iterations, without
+    // splitting cheap ones down to a few iterations each
+    loop.grain = std::max<int64_t>(1, (hi - lo) / (loop.num_threads * 32));
+  }
+  run_range(loop, lo, hi, loop.num_threads, false, out);
+}
+
+} // namespace
+
+extern "C" void bon_parallel_for(int64_t lo, int64_t hi, int64_t grain,
+                                 void (*body)(void*, int64_t, int64_t, void*),
+                                 void* env) {
+  RangeLoop loop = {body, env, nullptr, nullptr, 0, grain, 1};
+  parallel_range(loop, lo, hi, nullptr);
+}
+
+// result holds the initial value, which every piece of the range starts
+// from, and receives the combined result
+extern "C" void bon_parallel_reduce(int64_t lo, int64_t hi, int64_t grain,
+                                    void (*body)(void*, int64_t, int64_t,
+                                                 void*),
+                                    void* env,
+                                    void (*combine)(void*, void*),
+                                    void* result, int64_t result_size) {
+  alignas(64) char identity[s_max_reduce_size];
+  memcpy(identity, result, result_size);
+  RangeLoop loop = {body, env, combine, identity, (size_t)result_size, grain,
+                    1};
+  parallel_range(loop, lo, hi, result);
+}
+
+// channels. the like argument of the slot functions is a null pointer of
+// the element type, only there so that the bon side gets back a pointer to
+// the right type of element
+extern "C" void* chan_new(int64_t capacity, bool single) {
+  return bon::Channel::create(capacity, single);
+}
+
+extern "C" void chan_delete(void* chan) {
+  delete static_cast<bon::Channel*>(chan);
+}
+
+extern "C" void* chan_send_slot(void* chan, void* /*like*/,
+                                int64_t elem_size, bool block) {
+  return static_cast<bon::Channel*>(chan)->send_slot(elem_size, block);
+}
+
+extern "C" void chan_sent(void* chan, void* slot, bool notify) {
+  static_cast<bon::Channel*>(chan)->sent(slot, notify);
+}
+
+extern "C" bool chan_reserve(void* chan, bool block) {
+  return static_cast<bon::Channel*>(chan)->reserve(block);
+}
+
+extern "C" void* chan_recv_slot(void* chan, void* /*like*/) {
+  return static_cast<bon::Channel*>(chan)->recv_slot();
+}
+
+extern "C" void chan_received(void* chan, void* slot, bool notify) {
+  static_cast<bon::Channel*>(chan)->received(slot, notify);
+}
+
+extern "C" void chan_notify(void* chan) {
+  static_cast<bon::Channel*>(chan)->notify();
+}
+
+extern "C" void chan_close(void* chan) {
+  static_cast<bon::Channel*>(chan)->close();
+}
+
+// async functions. state is the start of the coroutine's promise, where
+// the compiler keeps the bon::AsyncState
+extern "C" void bon_async_run(void* handle, void* state, int64_t threads) {
+  bon::Executor executor(threads > 1 ? threads : 1);
+  executor.run(handle, static_cast<bon::AsyncState*>(state));
+}
+
+extern "C" void bon_async_start(void* handle, void* state) {
+  bon::async_start(handle, static_cast<bon::AsyncState*>(state));
+}
+
+extern "C" void bon_async_await(void* child, void* state, void* self) {
+  bon::async_await(child, static_cast<bon::AsyncState*>(state), self);
+}
+
+extern "C" void bon_async_finished(void* handle, void* state) {
+  bon::Executor::current()->finished(handle,
+                                     static_cast<bon::AsyncState*>(state));
+}
+
+extern "C" void bon_async_drop(void* handle, void* state) {
+  bon::async_drop(handle, static_cast<bon::AsyncState*>(state));
+}
+
+extern "C" void bon_async_wait(void* op, void* handle) {
+  static_cast<bon::IoOp*>(op)->wait(handle);
+}
+
+// the op belongs to the runtime until it's awaited, and is freed here
+extern "C" int64_t bon_async_result(void* op) {
+  auto io_op = static_cast<bon::IoOp*>(op);
+  auto result = io_op->result;
+  delete io_op;
+  return result;
+}
+
+// async i/o, awaited by async functions. the ops give back what the system
+// call would, or -errno
+#ifdef __linux__
+namespace {
+
+void* submit_io(bon::IoOp* op) {
+  bon::Executor::current()->io().submit(op);
+  return op;
+}
+
+bool tcp_address(const char* host, int64_t port, sockaddr_in &address) {
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(uint16_t(port));
+  return inet_pton(AF_INET, host, &address.sin_addr) == 1;
+}
+
+bool unix_address(const char* path, sockaddr_un &address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    return false;
+  }
+  strcpy(address.sun_path, path);
+  return true;
+}
+
+int64_t listen_on(int fd, const sockaddr* address, socklen_t length) {
+  if (fd < 0) {
+    return -errno;
+  }
+  if (bind(fd, address, length) < 0 || listen(fd, SOMAXCONN) < 0) {
+    auto error = -errno;
+    close(fd);
+    return error;
+  }
+  return fd;
+}
+
+void* connect_op(int fd, const void* address, socklen_t length) {
+  auto op = new bon::IoOp(bon::IoOp::Connect, fd);
+  memcpy(&op->address, address, length);
+  op->address_length = length;
+  if (fd < 0) {
+    // no socket to connect, the op is done already
+    op->complete(-errno);
+    return op;
+  }
+  return submit_io(op);
+}
+
+} // namespace
+
+// reads at most n bytes into buffer, from index start on
+extern "C" void* io_read(int64_t fd, char* buffer, int64_t start, int64_t n) {
+  auto op = new bon::IoOp(bon::IoOp::Read, fd);
+  op->buffer = buffer + start;
+  op->length = n;
+  return submit_io(op);
+}
+
+// writes at most n bytes of data, from index start on
+extern "C" void* io_write(int64_t fd, char* data, int64_t start, int64_t n) {
+  auto op = new bon::IoOp(bon::IoOp::Write, fd);
+  op->buffer = data + start;
+  op->length = n;
+  return submit_io(op);
+}
+
+// the result is the connected socket
+extern "C" void* io_accept(int64_t fd) {
+  return submit_io(new bon::IoOp(bon::IoOp::Accept, fd));
+}
+
+// the result is the connected socket. host is an ipv4 address
+extern "C" void* io_connect_tcp(char* host, int64_t port) {
+  sockaddr_in address;
+  if (!tcp_address(host, port, address)) {
+    errno = EINVAL;
+    return connect_op(-1, &address, sizeof(address));
+  }
+  return connect_op(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0),
+                    &address, sizeof(address));
+}
+
+extern "C" void* io_connect_unix(char* path) {
+  sockaddr_un address;
+  if (!unix_address(path, address)) {
+    errno = ENAMETOOLONG;
+    return connect_op(-1, &address, sizeof(address));
+  }
+  return connect_op(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0),
+                    &address, sizeof(address));
+}
+
+// listening sockets and files for async i/o are set up synchronously,
+// giving back an fd or -errno. port 0 picks a free port, see tcp_port
+extern "C" int64_t tcp_listen(char* host, int64_t port) {
+  sockaddr_in address;
+  if (!tcp_address(host, port, address)) {
+    return -EINVAL;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int reuse = 1;
+  if (fd >= 0) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  }
+  return listen_on(fd, (sockaddr*)&address, sizeof(address));
+}
+
+extern "C" int64_t tcp_port(int64_t fd) {
+  sockaddr_in address;
+  socklen_t length = sizeof(address);
+  if (getsockname(fd, (sockaddr*)&address, &length) < 0) {
+    return -errno;
+  }
+  return ntohs(address.sin_port);
+}
+
+// replaces whatever is at path
+extern "C" int64_t unix_listen(char* path) {
+  sockaddr_un address;
+  if (!unix_address(path, address)) {
+    return -ENAMETOOLONG;
+  }
+  unlink(path);
+  return listen_on(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0),
+                   (sockaddr*)&address, sizeof(address));
+}
+
+// mode is "r", "w" (truncating) or "a"
+extern "C" int64_t open_fd(char* path, char* mode) {
+  int flags = O_RDONLY;
+  if (mode[0] == 'w') {
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  }
+  else if (mode[0] == 'a') {
+    flags = O_WRONLY | O_CREAT | O_APPEND;
+  }
+  int fd = open(path, flags | O_CLOEXEC, 0644);
+  return fd < 0 ? -errno : fd;
+}
+
+extern "C" void close_fd(int64_t fd) {
+  close(fd);
+}
+#endif // __linux__
+
+// zeroed, for size bytes to be read into
+extern "C" char* string_buffer(int64_t size) {
+  auto buffer = new char[size + 1];
+  memset(buffer, 0, size + 1);
+  return buffer;
+}
+
+// message for a -errno result
+extern "C" char* io_error(int64_t result) {
+  std::string message = strerror(-result);
+  char* new_str = new char[message.size()+1];
+  strcpy(new_str, message.c_str());
+  return new_str;
+}
+
+namespace {
+
+// matmul works on blocks of kc rows of b, nc columns wide, and mc rows of a
+// at a time. both blocks are packed into buffers the micro kernel reads
+// front to back: a kc x 8 panel of b stays in L1 while a 4 x kc panel of a
+// streams through, and the packed mc x kc block of a stays in L2
+const size_t s_matmul_mr = 4;
+const size_t s_matmul_nr = 8;
+const size_t s_matmul_kc = 256;
+const size_t s_matmul_mc = 96;
+const size_t s_matmul_nc = 2048;
+// below this many multiply-adds par_matmul stays on the calling thread
+const size_t s_par_matmul_threshold = 128 * 128 * 128;
+
+// unaligned, so rows of b and c can be loaded from anywhere
+typedef double double4 __attribute__((vector_size(32), aligned(8)));
+
+struct MatmulArgs {
+  const double* a;
+  size_t lda;
+  const double* b;
+  size_t ldb;
+  double* c;
+  size_t ldc;
+  size_t m;
+  size_t n;
+  size_t k;
+};
+
+// rows [row, row+rows) of a, columns [col, col+cols), packed 4 rows at a
+// time, one column of each panel after the other. short panels are padded
+// with zeros
+inline __attribute__((always_inline))
+void pack_a(const MatmulArgs &args, size_t row, size_t rows, size_t col,
+            size_t cols, double* packed) {
+  for (size_t i = 0; i < rows; i += s_matmul_mr) {
+    for (size_t p = 0; p < cols; ++p) {
+      for (size_t r = 0; r < s_matmul_mr; ++r) {
+        *packed++ = i + r < rows
+                    ? args.a[(row + i + r) * args.lda + col + p] : 0.0;
+      }
+    }
+  }
+}
+
+// same for b, 8 columns at a time, one row of each panel after the other
+inline __attribute__((always_inline))
+void pack_b(const MatmulArgs &args, size_t row, size_t rows, size_t col,
+            size_t cols, double* packed) {
+  for (size_t j = 0; j < cols; j += s_matmul_nr) {
+    for (size_t p = 0; p < rows; ++p) {
+      const double* src = args.b + (row + p) * args.ldb + col + j;
+      for (size_t c = 0; c < s_matmul_nr; ++c) {
+        *packed++ = j + c < cols ? src[c] : 0.0;
+      }
+    }
+  }
+}
+
+// adds a 4 x kc panel of a times a kc x 8 panel of b to the 4 x 8 tile at
+// c. the tile is kept in 8 vector registers for the whole loop
+inline __attribute__((always_inline))
+void matmul_micro_kernel(size_t kc, const double* a, const double* b,
+                         double* c, size_t ldc) {
+  double4 c00 = {}, c01 = {}, c10 = {}, c11 = {};
+  double4 c20 = {}, c21 = {}, c30 = {}, c31 = {};
+  for (size_t p = 0; p < kc; ++p) {
+    double4 b0 = *reinterpret_cast<const double4*>(b);
+    double4 b1 = *reinterpret_cast<const double4*>(b + 4);
+    c00 += a[0] * b0;
+    c01 += a[0] * b1;
+    c10 += a[1] * b0;
+    c11 += a[1] * b1;
+    c20 += a[2] * b0;
+    c21 += a[2] * b1;
+    c30 += a[3] * b0;
+    c31 += a[3] * b1;
+    a += s_matmul_mr;
+    b += s_matmul_nr;
+  }
+  double4* row0 = reinterpret_cast<double4*>(c);
+  double4* row1 = reinterpret_cast<double4*>(c + ldc);
+  double4* row2 = reinterpret_cast<double4*>(c + 2 * ldc);
+  double4* row3 = reinterpret_cast<double4*>(c + 3 * ldc);
+  row0[0] += c00;
+  row0[1] += c01;
+  row1[0] += c10;
+  row1[1] += c11;
+  row2[0] += c20;
+  row2[1] += c21;
+  row3[0] += c30;
+  row3[1] += c31;
+}
+
+// c[row:row+rows, col:col+cols] += packed a * packed b. tiles hanging over
+// the edge of c go through a scratch tile
+inline __attribute__((always_inline))
+void matmul_macro_kernel(const MatmulArgs &args, size_t row, size_t rows,
+                         size_t col, size_t cols, size_t kc,
+                         const double* packed_a, const double* packed_b) {
+  double edge[s_matmul_mr * s_matmul_nr];
+  for (size_t j = 0; j < cols; j += s_matmul_nr) {
+    const double* b_panel = packed_b + j * kc;
+    for (size_t i = 0; i < rows; i += s_matmul_mr) {
+      const double* a_panel = packed_a + i * kc;
+      double* c = args.c + (row + i) * args.ldc + col + j;
+      if (i + s_matmul_mr <= rows && j + s_matmul_nr <= cols) {
+        matmul_micro_kernel(kc, a_panel, b_panel, c, args.ldc);
+        continue;
+      }
+      std::fill(edge, edge + s_matmul_mr * s_matmul_nr, 0.0);
+      matmul_micro_kernel(kc, a_panel, b_panel, edge, s_matmul_nr);
+      size_t tile_rows = std::min(s_matmul_mr, rows - i);
+      size_t tile_cols = std::min(s_matmul_nr, cols - j);
+      for (size_t r = 0; r < tile_rows; ++r) {
+        for (size_t col_i = 0; col_i < tile_cols; ++col_i) {
+          c[r * args.ldc + col_i] += edge[r * s_matmul_nr + col_i];
+        }
+      }
+    }
+  }
+}
+
+// one mc block of rows of a against the packed block of b
+inline __attribute__((always_inline))
+void matmul_row_block(const MatmulArgs &args, size_t row, size_t col,
+                      size_t cols, size_t depth, size_t kc,
+                      const double* packed_b, double* packed_a) {
+  size_t rows = std::min(s_matmul_mc, args.m - row);
+  pack_a(args, row, rows, depth, kc, packed_a);
+  matmul_macro_kernel(args, row, rows, col, cols, kc, packed_a, packed_b);
+}
+
+void matmul_row_block_generic(const MatmulArgs &args, size_t row, size_t col,
+                              size_t cols, size_t depth, size_t kc,
+                              const double* packed_b, double* packed_a) {
+  matmul_row_block(args, row, col, cols, depth, kc, packed_b, packed_a);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// the runtime is built for the baseline x86-64 target, so the kernel is
+// compiled a second time with avx2 and fma and picked at run time
+#define BON_MATMUL_AVX2
+__attribute__((target("avx2,fma")))
+void matmul_row_block_avx2(const MatmulArgs &args, size_t row, size_t col,
+                           size_t cols, size_t depth, size_t kc,
+                           const double* packed_b, double* packed_a) {
+  matmul_row_block(args, row, col, cols, depth, kc, packed_b, packed_a);
+}
+#endif
+
+typedef void (*MatmulRowBlockFn)(const MatmulArgs&, size_t, size_t, size_t,
+                                 size_t, size_t, const double*, double*);
+
+MatmulRowBlockFn select_matmul_row_block() {
+#ifdef BON_MATMUL_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return matmul_row_block_avx2;
+  }
+#endif
+  return matmul_row_block_generic;
+}
+
+// c = a * b, with the rows of a split between the threads of the runtime
+// pool when parallel is set
+void matmul(const MatmulArgs &args, bool parallel) {
+  static const MatmulRowBlockFn row_block = select_matmul_row_block();
+
+  for (size_t i = 0; i < args.m; ++i) {
+    std::fill(args.c + i * args.ldc, args.c + i * args.ldc + args.n, 0.0);
+  }
+
+  auto pool = bon::runtime_thread_pool();
+  parallel = parallel && pool->size() > 1
+             && args.m * args.n * args.k >= s_par_matmul_threshold;
+  size_t row_blocks = (args.m + s_matmul_mc - 1) / s_matmul_mc;
+  size_t buffers = parallel ? row_blocks : 1;
+  size_t a_size = s_matmul_mc * s_matmul_kc;
+  size_t b_size = s_matmul_kc * s_matmul_nc;
+  std::unique_ptr<double[]> packed_a(new double[a_size * buffers]);
+  std::unique_ptr<double[]> packed_b(new double[b_size]);
+
+  for (size_t col = 0; col < args.n; col += s_matmul_nc) {
+    size_t cols = std::min(s_matmul_nc, args.n - col);
+    for (size_t depth = 0; depth < args.k; depth += s_matmul_kc) {
+      size_t kc = std::min(s_matmul_kc, args.k - depth);
+      pack_b(args, depth, kc, col, cols, packed_b.get());
+      if (parallel) {
+        pool->run(row_blocks, [&](size_t block) {
+          row_block(args, block * s_matmul_mc, col, cols, depth, kc,
+                    packed_b.get(), packed_a.get() + block * a_size);
+        });
+      }
+      else {
+        for (size_t block = 0; block < row_blocks; ++block) {
+          row_block(args, block * s_matmul_mc, col, cols, depth, kc,
+                    packed_b.get(), packed_a.get());
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+// c = a * b for row major matrices of floats. a is m x k, b is k x n and c
+// is m x n. each matrix starts offset elements into its data, and each of
+// its rows stride elements after the previous one
+extern "C" void matmul_floats(double* a, int64_t a_offset, int64_t a_stride,
+                              double* b, int64_t b_offset, int64_t b_stride,
+                              double* c, int64_t c_offset, int64_t c_stride,
+                              int64_t m, int64_t n, int64_t k, bool parallel) {
+  if (m <= 0 || n <= 0) {
+    return;
+  }
+  MatmulArgs args = {a + a_offset, size_t(a_stride),
+                     b + b_offset, size_t(b_stride),
+                     c + c_offset, size_t(c_stride),
+                     size_t(m), size_t(n), size_t(k > 0 ? k : 0)};
+  matmul(args, parallel);
+}
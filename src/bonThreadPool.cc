@@ -0,0 +1,327 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Worker threads for the parallel parts of the runtime library
+|*
+L*----------------------------------------------------------------------------*/
+
+#include "bonThreadPool.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace bon {
+
+WorkDeque::WorkDeque() : top_(0), bottom_(0) {
+  buffers_.emplace_back(new Buffer(64));
+  buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+}
+
+WorkDeque::Buffer* WorkDeque::grow(Buffer* buffer, int64_t bottom,
+                                   int64_t top) {
+  buffers_.emplace_back(new Buffer(buffer->capacity * 2));
+  auto bigger = buffers_.back().get();
+  for (auto i = top; i < bottom; ++i) {
+    bigger->put(i, buffer->get(i));
+  }
+  buffer_.store(bigger, std::memory_order_release);
+  return bigger;
+}
+
+void WorkDeque::push(Job* job) {
+  auto bottom = bottom_.load(std::memory_order_relaxed);
+  auto top = top_.load(std::memory_order_acquire);
+  auto buffer = buffer_.load(std::memory_order_relaxed);
+  if (bottom - top > buffer->capacity - 1) {
+    buffer = grow(buffer, bottom, top);
+  }
+  buffer->put(bottom, job);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom_.store(bottom + 1, std::memory_order_relaxed);
+}
+
+Job* WorkDeque::pop() {
+  auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+  auto buffer = buffer_.load(std::memory_order_relaxed);
+  bottom_.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto top = top_.load(std::memory_order_relaxed);
+  if (top > bottom) {
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Job* job = buffer->get(bottom);
+  if (top == bottom) {
+    // last job, race the thieves for it
+    if (!top_.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      job = nullptr;
+    }
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+Job* WorkDeque::steal() {
+  auto top = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto bottom = bottom_.load(std::memory_order_acquire);
+  if (top >= bottom) {
+    return nullptr;
+  }
+  auto buffer = buffer_.load(std::memory_order_acquire);
+  Job* job = buffer->get(top);
+  if (!top_.compare_exchange_strong(top, top + 1,
+                                    std::memory_order_seq_cst,
+                                    std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return job;
+}
+
+// worker (and pool) of the calling thread
+static thread_local ThreadPool* tl_pool = nullptr;
+static thread_local void* tl_worker = nullptr;
+
+// a different xorshift seed for every thread, so thieves don't all probe
+// the same victim first. odd multiples of a nonzero count are never zero
+static uint32_t next_steal_seed() {
+  static std::atomic<uint32_t> s_thread_count(0);
+  return (++s_thread_count) * 0x9e3779b9u;
+}
+
+ThreadPool::ThreadPool(size_t num_threads)
+  : injected_count_(0), epoch_(0), sleepers_(0), waiters_(0), in_flight_(0),
+    stopping_(false) {
+  for (size_t i = 1; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker());
+  }
+  // workers steal from each other, so they only start once all the deques
+  // exist
+  for (auto &worker : workers_) {
+    auto self = worker.get();
+    worker->thread = std::thread([this, self] { worker_loop(self); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  for (auto &worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+ThreadPool::Worker* ThreadPool::current_worker() {
+  return tl_pool == this ? static_cast<Worker*>(tl_worker) : nullptr;
+}
+
+void ThreadPool::worker_loop(Worker* self) {
+  tl_pool = this;
+  tl_worker = self;
+  while (true) {
+    auto epoch = epoch_.load();
+    if (Job* job = find_job(self)) {
+      execute(job);
+      continue;
+    }
+    if (stopping_) {
+      return;
+    }
+    // sleepers_ goes up before epoch_ is checked again, and submit bumps
+    // epoch_ before checking sleepers_, so a job queued after find_job
+    // looked is either seen here or wakes us
+    ++sleepers_;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this, epoch] {
+        return stopping_ || epoch_.load() != epoch;
+      });
+    }
+    --sleepers_;
+  }
+}
+
+Job* ThreadPool::find_job(Worker* self) {
+  if (self) {
+    if (Job* job = self->deque.pop()) {
+      return job;
+    }
+  }
+  if (injected_count_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!injected_.empty()) {
+      Job* job = injected_.front();
+      injected_.pop_front();
+      --injected_count_;
+      return job;
+    }
+  }
+  // start at a random victim, so thieves spread out over the workers
+  static thread_local uint32_t seed = next_steal_seed();
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  auto count = workers_.size();
+  for (size_t i = 0; i < count; ++i) {
+    auto victim = workers_[(seed + i) % count].get();
+    if (victim == self) {
+      continue;
+    }
+    if (Job* job = victim->deque.steal()) {
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+void ThreadPool::execute(Job* job) {
+  job->execute(job);
+  --in_flight_;
+  job->done.store(true);
+  if (waiters_.load() > 0) {
+    // take the lock so the wakeup can't slip in between a waiting thread
+    // checking done and going to sleep
+    std::lock_guard<std::mutex> lock(mutex_);
+    cond_.notify_all();
+  }
+}
+
+void ThreadPool::notify_submitted() {
+  ++epoch_;
+  if (sleepers_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cond_.notify_one();
+  }
+}
+
+void ThreadPool::submit(Job* job) {
+  ++in_flight_;
+  if (workers_.empty()) {
+    execute(job);
+    return;
+  }
+  if (Worker* self = current_worker()) {
+    self->deque.push(job);
+  }
+  else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    injected_.push_back(job);
+    ++injected_count_;
+  }
+  notify_submitted();
+}
+
+void ThreadPool::wait(Job* job) {
+  auto self = current_worker();
+  while (!job->done.load(std::memory_order_acquire)) {
+    auto epoch = epoch_.load();
+    if (Job* other = find_job(self)) {
+      execute(other);
+      continue;
+    }
+    // nothing to help with, sleep until job is done or more work shows up
+    ++waiters_;
+    ++sleepers_;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this, job, epoch] {
+        return job->done.load() || epoch_.load() != epoch;
+      });
+    }
+    --sleepers_;
+    --waiters_;
+  }
+}
+
+namespace {
+
+struct RunJob : Job {
+  const std::function<void(size_t)>* task;
+  size_t index;
+
+  RunJob() : Job(&RunJob::run), task(nullptr), index(0) {}
+  static void run(Job* job) {
+    auto self = static_cast<RunJob*>(job);
+    (*self->task)(self->index);
+  }
+};
+
+} // namespace
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)> &task) {
+  if (count == 0) {
+    return;
+  }
+  if (workers_.empty() || count == 1) {
+    for (size_t i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  std::vector<RunJob> jobs(count);
+  for (size_t i = 1; i < count; ++i) {
+    jobs[i].task = &task;
+    jobs[i].index = i;
+    submit(&jobs[i]);
+  }
+  task(0);
+  // newest first, so on a worker the jobs nobody stole come straight back
+  // off the bottom of its own deque
+  for (size_t i = count - 1; i > 0; --i) {
+    wait(&jobs[i]);
+  }
+}
+
+// only accessed through std::atomic_load/atomic_store, so a caller always
+// gets a reference that keeps the pool it got alive
+static std::shared_ptr<ThreadPool> s_runtime_pool;
+static std::mutex s_runtime_pool_mutex;
+
+static size_t default_thread_count() {
+  if (const char* num_threads = std::getenv("BON_NUM_THREADS")) {
+    auto count = strtoul(num_threads, nullptr, 10);
+    if (count > 0) {
+      return count;
+    }
+  }
+  auto cores = std::thread::hardware_concurrency();
+  return cores > 0 ? cores : 1;
+}
+
+std::shared_ptr<ThreadPool> runtime_thread_pool() {
+  // every spawn goes through here, so skip the mutex once the pool exists
+  if (auto pool = std::atomic_load(&s_runtime_pool)) {
+    return pool;
+  }
+  std::lock_guard<std::mutex> lock(s_runtime_pool_mutex);
+  auto pool = std::atomic_load(&s_runtime_pool);
+  if (!pool) {
+    pool = std::make_shared<ThreadPool>(default_thread_count());
+    std::atomic_store(&s_runtime_pool, pool);
+  }
+  return pool;
+}
+
+void set_runtime_thread_count(size_t num_threads) {
+  std::lock_guard<std::mutex> lock(s_runtime_pool_mutex);
+  // a task still queued on the old pool may never run once its workers
+  //  are gone, and a task changing the count would wait on itself
+  auto old_pool = std::atomic_load(&s_runtime_pool);
+  if (old_pool && old_pool->jobs_in_flight() > 0) {
+    std::fprintf(stderr, "The thread count can't change while tasks are "
+                         "running!\n");
+    std::exit(-1);
+  }
+  std::atomic_store(&s_runtime_pool,
+                    std::make_shared<ThreadPool>(num_threads > 0 ?
+                                                 num_threads : 1));
+  // anything that got the old pool before the swap keeps it alive until
+  //  it's done with it, the last one out joins its workers
+}
+
+} // namespace bon
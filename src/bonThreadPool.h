@@ -0,0 +1,133 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* Worker threads for the parallel parts of the runtime library
+|*
+L*----------------------------------------------------------------------------*/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bon {
+
+// unit of work for the pool. execute is called once, on whichever thread
+// picks the job up, and done is set once it returns. the job isn't touched
+// by the pool after that, so whoever waited on it can free it
+struct Job {
+  void (*execute)(Job*);
+  std::atomic<bool> done;
+
+  explicit Job(void (*execute_fn)(Job*)) : execute(execute_fn), done(false) {}
+};
+
+// chase-lev deque, with the memory orders from Le et al. "Correct and
+// Efficient Work-Stealing for Weak Memory Models". the owning worker pushes
+// and pops at the bottom (newest first), any thread can steal from the top
+// (oldest first)
+class WorkDeque {
+public:
+  WorkDeque();
+
+  // owner only
+  void push(Job* job);
+  // owner only, nullptr if empty
+  Job* pop();
+  // nullptr if empty or another thread got the job first
+  Job* steal();
+
+private:
+  struct Buffer {
+    int64_t capacity;
+    std::unique_ptr<std::atomic<Job*>[]> slots;
+
+    explicit Buffer(int64_t size)
+      : capacity(size), slots(new std::atomic<Job*>[size]) {}
+    Job* get(int64_t i) {
+      return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+    void put(int64_t i, Job* job) {
+      slots[i & (capacity - 1)].store(job, std::memory_order_relaxed);
+    }
+  };
+
+  Buffer* grow(Buffer* buffer, int64_t bottom, int64_t top);
+
+  std::atomic<int64_t> top_;
+  std::atomic<int64_t> bottom_;
+  std::atomic<Buffer*> buffer_;
+  // buffers are kept until the deque goes away, since a thief may still be
+  // reading from one that was replaced
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+class ThreadPool {
+public:
+  // num_threads includes the thread calling run(), so a pool of size 1 has
+  // no workers and runs everything inline
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  size_t size() const { return workers_.size() + 1; }
+
+  // queues job. on a worker it goes on that worker's own deque, where it is
+  // run newest first unless an idle worker steals it, from any other thread
+  // it goes on a shared queue. with no workers it's run right away
+  void submit(Job* job);
+  // returns once job is done. the calling thread runs other queued jobs
+  // while it waits, so jobs can wait on jobs they submitted
+  void wait(Job* job);
+
+  // runs task(0) ... task(count-1) and returns once all of them are done.
+  // tasks can call run() themselves
+  void run(size_t count, const std::function<void(size_t)> &task);
+
+  // jobs submitted and not done yet, including ones being run
+  size_t jobs_in_flight() const { return in_flight_.load(); }
+
+private:
+  struct Worker {
+    WorkDeque deque;
+    std::thread thread;
+  };
+
+  void worker_loop(Worker* self);
+  // the calling thread's worker if it belongs to this pool, else nullptr
+  Worker* current_worker();
+  // own deque first, then the shared queue, then steals from the others
+  Job* find_job(Worker* self);
+  void execute(Job* job);
+  // wakes a sleeping thread if there are any
+  void notify_submitted();
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::deque<Job*> injected_;
+  std::atomic<size_t> injected_count_;
+  std::mutex mutex_;
+  // signalled when jobs are queued, or finish while someone waits on one
+  std::condition_variable cond_;
+  // bumped on every submit, a thread only goes to sleep if it hasn't
+  // changed since it last looked for jobs
+  std::atomic<uint64_t> epoch_;
+  std::atomic<size_t> sleepers_;
+  std::atomic<size_t> waiters_;
+  std::atomic<size_t> in_flight_;
+  std::atomic<bool> stopping_;
+};
+
+// pool shared by the runtime library. sized from BON_NUM_THREADS, or the
+// number of cores if that isn't set. hold on to the pool for as long as
+// jobs submitted to it are in flight, it may be replaced in the meantime
+std::shared_ptr<ThreadPool> runtime_thread_pool();
+// replaces the runtime pool. exits with an error if the current one has
+// jobs in flight
+void set_runtime_thread_count(size_t num_threads);
+
+} // namespace bon
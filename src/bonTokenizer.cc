@@ -16,7 +16,7 @@ namespace bon {
 
 int Tokenizer::next_char() {
   ++col_;
-  int chr = getchar();
+  int chr = input_->get();
   if (chr == '\n') {
     ++pos_.line;
     col_ = -1;
@@ -108,8 +108,8 @@ Token Tokenizer::next_token() {
     }
     if (col > indent_sizes_[indent_level_]) {
       if (indent_level_ >= MAX_INDENTS+1) {
-        bon::logger.set_line_column(pos_.line, col);
-        bon::logger.error("error", "Exceeded max indent level (20)");
+        logger_.set_line_column(pos_.line, col);
+        logger_.error("error", "Exceeded max indent level (20)");
       }
       ++indent_level_;
       indent_sizes_[indent_level_] = col;
@@ -170,8 +170,8 @@ Token Tokenizer::next_token() {
           continue;
         }
         else {
-          bon::logger.set_line_column(pos_.line, col_);
-          bon::logger.error("error", "unrecognized escape sequence");
+          logger_.set_line_column(pos_.line, col_);
+          logger_.error("error", "unrecognized escape sequence");
         }
       }
       if (last_char_ == '\\') {
@@ -217,6 +217,14 @@ Token Tokenizer::next_token() {
       return tok_while;
     if (identifier_ == "do")
       return tok_do;
+    if (identifier_ == "for")
+      return tok_for;
+    if (identifier_ == "in")
+      return tok_in;
+    if (identifier_ == "yield")
+      return tok_yield;
+    if (identifier_ == "await")
+      return tok_await;
     if (identifier_ == "else")
       return tok_else;
     if (identifier_ == "end")
@@ -261,8 +269,8 @@ Token Tokenizer::next_token() {
     do {
       if (last_char_ == '.') {
         if (is_float) {
-          bon::logger.set_line_column(pos_.line, col_);
-          bon::logger.error("error", "malformed floating point number");
+          logger_.set_line_column(pos_.line, col_);
+          logger_.error("error", "malformed floating point number");
         }
         is_float = true;
       }
@@ -273,12 +281,26 @@ Token Tokenizer::next_token() {
     if (num_str == ".") {
       return tok_dot;
     }
-    else if (is_float) {
+
+    // optional type suffix, e.g. 255u8 or 1.5f32
+    num_suffix_ = "";
+    if (last_char_ == 'i' || last_char_ == 'u' || last_char_ == 'f') {
+      do {
+        num_suffix_ += last_char_;
+        last_char_ = next_char();
+      } while (isalnum(last_char_));
+    }
+
+    if (is_float) {
       num_val_ = strtod(num_str.c_str(), nullptr);
       return tok_number;
     }
     else {
-      int_val_ = strtoll(num_str.c_str(), nullptr, 10);
+      // keep the bit pattern of u64 literals above the int64 range
+      int_val_ = num_suffix_ == "u64" ?
+                 static_cast<int64_t>(strtoull(num_str.c_str(), nullptr, 10))
+                 :
+                 strtoll(num_str.c_str(), nullptr, 10);
       return tok_integer;
     }
   }
@@ -297,7 +319,7 @@ Token Tokenizer::next_token() {
   }
 
   if (last_char_ == '\n') {
-    bon::logger.error("internal error", "unexpected newline");
+    logger_.error("internal error", "unexpected newline");
     at_line_start_ = true;
     last_char_ = next_char();
     return next_token();
@@ -445,7 +467,8 @@ Token Tokenizer::next_token() {
       {';', tok_sep},
       {'<', tok_lt},
       {'>', tok_gt},
-      {'=', tok_assign}
+      {'=', tok_assign},
+      {'@', tok_attribute}
     };
   auto tok = token_map.find(this_char);
   if (tok == token_map.end()) {
@@ -455,7 +478,8 @@ Token Tokenizer::next_token() {
   return tok->second;
 }
 
-Tokenizer::Tokenizer() {
+Tokenizer::Tokenizer(Logger &logger)
+  : logger_(logger), input_(&std::cin) {
   reset();
 }
 
@@ -538,6 +562,14 @@ std::string Tokenizer::token_type(Token token) {
       return "'while'";
     case tok_do:
       return "'do'";
+    case tok_for:
+      return "'for'";
+    case tok_in:
+      return "'in'";
+    case tok_yield:
+      return "'yield'";
+    case tok_await:
+      return "'await'";
     case tok_import:
       return "'import'";
     case tok_indent:
@@ -614,6 +646,8 @@ std::string Tokenizer::token_type(Token token) {
       return "'true'";
     case tok_class:
       return "'type'";
+    case tok_attribute:
+      return "'@'";
     case tok_unary:
       return "'unary'";
     case tok_unit:
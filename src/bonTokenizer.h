@@ -7,6 +7,7 @@ L*----------------------------------------------------------------------------*/
 #pragma once
 #include "bonLogger.h"
 
+#include <istream>
 #include <vector>
 #include <string>
 
@@ -45,6 +46,13 @@ enum Token {
   tok_else,
   tok_while,
   tok_do,
+  tok_for,
+  tok_in,
+
+  // generators
+  tok_yield,
+  // async functions
+  tok_await,
 
   // binary ops
   tok_add,
@@ -82,6 +90,8 @@ enum Token {
   tok_struct,
   tok_typeclass,
   tok_impl,
+  // e.g. @soa
+  tok_attribute,
 
   // builtin
   tok_sizeof,
@@ -106,6 +116,9 @@ enum Token {
 
 class Tokenizer {
 private:
+  Logger &logger_;
+  // source being tokenized, std::cin unless set_input() is called
+  std::istream* input_;
   static constexpr size_t MAX_INDENTS = 20;
   std::vector<Token> token_cache;
   int indent_sizes_[MAX_INDENTS];
@@ -113,6 +126,8 @@ private:
   std::string identifier_;
   double num_val_;
   int64_t int_val_;
+  // type suffix of the last number literal, e.g. "u8" - empty if none
+  std::string num_suffix_;
   bool bool_val_;
   DocPosition pos_;
   size_t col_;
@@ -128,8 +143,9 @@ private:
   Token eof_token();
 
 public:
-  Tokenizer();
+  explicit Tokenizer(Logger &logger);
   void reset();
+  void set_input(std::istream* input) { input_ = input; }
   DocPosition get_position();
   void override_position(DocPosition pos);
 
@@ -138,6 +154,7 @@ public:
 
   double number_value() { return num_val_; }
   int64_t integer_value() { return int_val_; }
+  std::string number_suffix() { return num_suffix_; }
   std::string identifier() { return identifier_; }
   bool bool_value() { return bool_val_; }
 
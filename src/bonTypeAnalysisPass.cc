@@ -12,37 +12,37 @@ namespace bon {
 
 // floating point number
 void TypeAnalysisPass::process(NumberExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 }
 
 // integer number
 void TypeAnalysisPass::process(IntegerExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 }
 
 // string
 void TypeAnalysisPass::process(StringExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 }
 
 // boolean
 void TypeAnalysisPass::process(BoolExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 }
 
 // unit ()
 void TypeAnalysisPass::process(UnitExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 }
 
 // variable
 void TypeAnalysisPass::process(VariableExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 }
 
 // value constructor
 void TypeAnalysisPass::process(ValueConstructorExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   // node->push_type_environment();
   TypeVariable* variant_type = get_type_from_constructor(node->constructor_);
@@ -85,7 +85,7 @@ void TypeAnalysisPass::process(UnaryExprAST* node) {
       state_.function_envs[Callee].push_back(std::make_pair(mangled_name,
                                                             node->Env));
     });
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   node->Operand->run_pass(this);
   unify(node->Operand->type_var_, node->type_var_);
 }
@@ -114,7 +114,7 @@ void TypeAnalysisPass::process(BinaryExprAST* node) {
 
   node->LHS->run_pass(this);
   node->RHS->run_pass(this);
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   if (node->Op == tok_dot) {
     // lookup type of field
@@ -158,7 +158,7 @@ void TypeAnalysisPass::process(IfExprAST* node) {
   if (node->Else) {
     node->Else->run_pass(this);
   }
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   unify(node->Cond->type_var_, BoolType);
   if (node->Else) {
     unify(node->Then->type_var_, node->Else->type_var_);
@@ -174,11 +174,20 @@ void TypeAnalysisPass::process(IfExprAST* node) {
 void TypeAnalysisPass::process(WhileExprAST* node) {
   node->condition_->run_pass(this);
   node->body_->run_pass(this);
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   unify(node->condition_->type_var_, BoolType);
   unify(node->type_var_, UnitType);
 }
 
+// ForExprAST
+void TypeAnalysisPass::process(ForExprAST* node) {
+  node->generator_->run_pass(this);
+  node->body_->run_pass(this);
+  logger_.set_line_column(node->line_num_, node->column_num_);
+  unify(node->generator_->type_var_, generator_type(node->var_->type_var_));
+  unify(node->type_var_, UnitType);
+}
+
 // MatchCaseExprAST
 void TypeAnalysisPass::process(MatchCaseExprAST* node) {
   node->condition_->run_pass(this);
@@ -221,7 +230,76 @@ void TypeAnalysisPass::process(MatchExprAST* node) {
 
 // CallExprAST
 void TypeAnalysisPass::process(CallExprAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  // numeric conversion e.g. u8(x), checked during codegen
+  if (auto target_type = sized_numeric_type(node->Callee)) {
+    if (node->Args.size() != 1) {
+      logger_.error("type error", "numeric conversion " + node->Callee
+                                  + " takes a single argument");
+      return;
+    }
+    node->Args[0]->run_pass(this);
+    logger_.set_line_column(node->line_num_, node->column_num_);
+    unify(node->type_var_, target_type);
+    return;
+  }
+
+  if (simd_type(node->Callee) || is_simd_builtin(node->Callee)) {
+    process_simd_builtin(node);
+    return;
+  }
+
+  // is_soa(x), whether x's class has an @soa layout, checked during codegen
+  if (node->Callee == "is_soa") {
+    if (node->Args.size() != 1) {
+      logger_.error("type error", "is_soa takes a single argument");
+      return;
+    }
+    node->Args[0]->run_pass(this);
+    logger_.set_line_column(node->line_num_, node->column_num_);
+    unify(node->type_var_, BoolType);
+    return;
+  }
+
+  // the type of a variable is known by the time it's indexed, so a[i] on an
+  //  array doesn't get mistaken for a call to vec's unsafe_at
+  if (node->Callee == "array"
+      || (is_array_method(node->Callee) && !node->Args.empty()
+          && is_array_type(node->Args[0]->type_var_))) {
+    process_array_builtin(node);
+    return;
+  }
+
+  if (node->Callee == "spawn" || node->Callee == "join") {
+    process_task_builtin(node);
+    return;
+  }
+
+  if (is_parallel_builtin(node->Callee)) {
+    process_parallel_builtin(node);
+    return;
+  }
+
+  if (is_atomic_builtin(node->Callee)) {
+    process_atomic_builtin(node);
+    return;
+  }
+
+  if (node->Callee == "yield") {
+    process_yield(node);
+    return;
+  }
+
+  if (node->Callee == "await") {
+    process_await(node);
+    return;
+  }
+
+  if (is_async_builtin(node->Callee)) {
+    process_async_builtin(node);
+    return;
+  }
 
   // push_environment(node->Env);
   AutoScope pop_env([this, node]{
@@ -271,7 +349,7 @@ void TypeAnalysisPass::process(CallExprAST* node) {
                                                       func_type_var);
 
   // reset line/column changed by arguments
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
 
   if (!func && state_.all_functions.count(node->Callee) == 0) {
     // TODO: handle this by creating an ExternFunctionAST node
@@ -282,9 +360,9 @@ void TypeAnalysisPass::process(CallExprAST* node) {
       auto &protoAST = FI->second;
       if (node->Args.size() != protoAST->Args.size()) {
         std::ostringstream msg;
-        logger.error("error", msg << "function " << node->Callee <<
-                     " takes " << protoAST->Args.size() << " argument(s), but "
-                     << node->Args.size() << " were given");
+        logger_.error("error", msg << "function " << node->Callee <<
+                      " takes " << protoAST->Args.size() << " argument(s), but "
+                      << node->Args.size() << " were given");
         return;
       }
       unify(func_type_var, protoAST->type_var_);
@@ -294,23 +372,24 @@ void TypeAnalysisPass::process(CallExprAST* node) {
     }
 
     std::ostringstream msg;
-    logger.error("error", msg << "calling undefined function " << node->Callee);
+    logger_.error("error",
+                  msg << "calling undefined function " << node->Callee);
     return;
   }
 
   if (func == nullptr) {
     std::ostringstream msg;
-    logger.error("internal error", msg << "function "
-                                       << node->Callee
-                                       << " missing from active node list");
+    logger_.error("internal error", msg << "function "
+                                        << node->Callee
+                                        << " missing from active node list");
     return;
   }
 
   if (node->Args.size() != func->Params.size()) {
     std::ostringstream msg;
-    logger.error("error", msg << "function " << node->Callee << " takes "
-                              << func->Params.size() << " argument(s), but "
-                              << node->Args.size() << " were given");
+    logger_.error("error", msg << "function " << node->Callee << " takes "
+                               << func->Params.size() << " argument(s), but "
+                               << node->Args.size() << " were given");
     return;
   }
 
@@ -338,9 +417,13 @@ void TypeAnalysisPass::process(SizeofExprAST* node) {
 void TypeAnalysisPass::process(PtrOffsetExprAST* node) {
   node->arg_->run_pass(this);
   node->offset_->run_pass(this);
+  if (node->capacity_) {
+    node->capacity_->run_pass(this);
+    unify(node->capacity_->type_var_, IntType);
+  }
   // make sure it's a pointer type
 
-  auto ptr_type = flatten_variable(bon::PointerType);
+  auto ptr_type = flatten_variable(state_.types.pointer_type);
 
   push_environment(node->type_env_);
 
@@ -353,9 +436,408 @@ void TypeAnalysisPass::process(PtrOffsetExprAST* node) {
   unify(node->type_var_, get_type_of_pointer(node->arg_->type_var_));
 }
 
+void TypeAnalysisPass::process_array_builtin(CallExprAST* node) {
+  for (auto &arg : node->Args) {
+    arg->run_pass(this);
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto &args = node->Args;
+  auto &name = node->Callee;
+  if (name == "array") {
+    // array(n, x), n elements set to x
+    auto length = args.size() == 2 ?
+                  dynamic_cast<IntegerExprAST*>(args[0].get()) : nullptr;
+    if (!length || length->Val <= 0) {
+      logger_.error("type error", "array takes a positive integer constant "
+                                  "(the length) and the initial value of the "
+                                  "elements");
+      return;
+    }
+    auto element = args[1]->type_var_;
+    if (is_concrete_type(element) && !is_array_element_type(element)) {
+      logger_.error("type error", "arrays can only hold numbers, bools and "
+                                  "simd vectors");
+      return;
+    }
+    unify(node->type_var_, array_type(element, length->Val));
+    return;
+  }
+
+  auto element = array_element_type(args[0]->type_var_);
+  if (name == "unsafe_at") {
+    if (args.size() != 2) {
+      logger_.error("type error", "indexing an array takes a single index");
+      return;
+    }
+    unify(args[1]->type_var_, IntType);
+    unify(node->type_var_, element);
+  }
+  else if (name == "set") {
+    if (args.size() != 3) {
+      logger_.error("type error", "set takes an index and a value");
+      return;
+    }
+    unify(args[1]->type_var_, IntType);
+    unify(args[2]->type_var_, element);
+    unify(node->type_var_, UnitType);
+  }
+  else if (name == "len") {
+    if (args.size() != 1) {
+      logger_.error("type error", "len doesn't take any arguments");
+      return;
+    }
+    unify(node->type_var_, IntType);
+  }
+}
+
+void TypeAnalysisPass::process_task_builtin(CallExprAST* node) {
+  for (auto &arg : node->Args) {
+    arg->run_pass(this);
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  if (node->Args.size() != 1) {
+    logger_.error("type error", "join takes a single task");
+    return;
+  }
+  // the parser turns spawn(f, a, b) into spawn(f(a, b))
+  if (node->Callee == "spawn") {
+    unify(node->type_var_, task_type(node->Args[0]->type_var_));
+    // the task may run until it's joined, so anything else it's given has
+    //  to be moved into it with '*'. generic arguments are checked by
+    //  codegen, once their types are known
+    auto call = static_cast<CallExprAST*>(node->Args[0].get());
+    for (auto &arg : call->Args) {
+      auto moved = dynamic_cast<UnaryExprAST*>(arg.get());
+      auto type_var = arg->type_var_;
+      if (moved && moved->Opcode == tok_mul) {
+        if (is_task_type(type_var) || is_generator_type(type_var)
+            || is_async_type(type_var)) {
+          logger_.error("type error", "tasks, generators and async calls "
+                                      "can't be moved into a task");
+        }
+      }
+      else if (is_concrete_type(type_var)
+               && !is_task_shareable_type(type_var)) {
+        logger_.error("type error", "only numbers, bools, atomics and "
+                                    "channels can be shared with a task, "
+                                    "move other arguments into it with '*'");
+      }
+    }
+  }
+  else {
+    auto result = new TypeVariable();
+    unify(node->Args[0]->type_var_, task_type(result));
+    unify(node->type_var_, result);
+  }
+}
+
+// the parser rewrites these to
+//  name(lo, hi, grain, [init,] captured..., body[, combine])
+//  with placeholders in body and combine sharing the types of the index,
+//  captured arguments and init
+void TypeAnalysisPass::process_parallel_builtin(CallExprAST* node) {
+  for (auto &arg : node->Args) {
+    arg->run_pass(this);
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto &args = node->Args;
+  for (size_t i = 0; i < 3; ++i) {
+    unify(args[i]->type_var_, IntType);
+  }
+  if (node->Callee == "par_reduce") {
+    auto result = args[3]->type_var_;
+    unify(args[args.size() - 2]->type_var_, result);
+    unify(args.back()->type_var_, result);
+    unify(node->type_var_, result);
+  }
+  else if (node->Callee == "par_map") {
+    // the output vector is the last captured argument
+    unify(node->type_var_, args[args.size() - 2]->type_var_);
+  }
+  else {
+    unify(node->type_var_, UnitType);
+  }
+}
+
+// the memory order given as the last argument is checked during codegen,
+//  as it has to be written out (SeqCst, Acquire, ...)
+void TypeAnalysisPass::process_atomic_builtin(CallExprAST* node) {
+  for (auto &arg : node->Args) {
+    arg->run_pass(this);
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto &args = node->Args;
+  auto name = node->Callee;
+  if (name.compare(0, 7, "padded_") == 0) {
+    name = name.substr(7);
+  }
+  if (name.compare(0, 7, "atomic_") == 0) {
+    if (args.size() != 1) {
+      logger_.error("type error", node->Callee + " takes the initial value");
+      return;
+    }
+    TypeVariable* value = nullptr;
+    if (name == "atomic_int") {
+      value = IntType;
+    }
+    else if (name == "atomic_bool") {
+      value = BoolType;
+    }
+    else {
+      std::vector<TypeVariable*> element = {new TypeVariable()};
+      value = new TypeVariable(new TypeOperator("Pointer", element));
+    }
+    unify(args[0]->type_var_, value);
+    unify(node->type_var_, atomic_type(value));
+    return;
+  }
+
+  // operands after the atomic, not counting the memory order
+  size_t operands = 1;
+  auto result = new TypeVariable();
+  if (name == "load") {
+    operands = 0;
+  }
+  else if (name == "store") {
+    unify(node->type_var_, UnitType);
+  }
+  else if (name == "compare_exchange" || name == "compare_exchange_weak") {
+    operands = 2;
+    unify(node->type_var_, BoolType);
+  }
+  if (args.size() != operands + 1 && args.size() != operands + 2) {
+    std::ostringstream msg;
+    logger_.error("type error", msg << name << " takes an atomic, "
+                                    << operands << " value(s) and optionally "
+                                    << "a memory order");
+    return;
+  }
+  unify(args[0]->type_var_, atomic_type(result));
+  for (size_t i = 1; i <= operands; ++i) {
+    unify(args[i]->type_var_, result);
+  }
+  if (name != "store" && name.compare(0, 16, "compare_exchange") != 0) {
+    unify(node->type_var_, result);
+  }
+}
+
+void TypeAnalysisPass::process_yield(CallExprAST* node) {
+  node->Args[0]->run_pass(this);
+  logger_.set_line_column(node->line_num_, node->column_num_);
+  if (!generator_item_) {
+    logger_.error("type error", "yield outside of a function");
+    return;
+  }
+  unify(node->Args[0]->type_var_, generator_item_);
+  unify(node->type_var_, UnitType);
+}
+
+void TypeAnalysisPass::process_await(CallExprAST* node) {
+  node->Args[0]->run_pass(this);
+  logger_.set_line_column(node->line_num_, node->column_num_);
+  if (!async_result_) {
+    logger_.error("type error", "await outside of a function");
+    return;
+  }
+  // i/o gives back what the system call returned, or -errno
+  if (resolve_variable(node->Args[0]->type_var_) == IoType) {
+    unify(node->type_var_, IntType);
+    return;
+  }
+  unify(node->Args[0]->type_var_, async_type(node->type_var_));
+}
+
+void TypeAnalysisPass::process_async_builtin(CallExprAST* node) {
+  for (auto &arg : node->Args) {
+    arg->run_pass(this);
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  size_t num_args = node->Callee == "run_async_threads" ? 2 : 1;
+  if (node->Args.size() != num_args) {
+    logger_.error("type error", node->Callee + " takes "
+                                + (num_args == 1 ? "a single async call"
+                                                 : "an async call and a "
+                                                  "number of threads"));
+    return;
+  }
+  auto result = new TypeVariable();
+  unify(node->Args[0]->type_var_, async_type(result));
+  if (num_args == 2) {
+    unify(node->Args[1]->type_var_, IntType);
+  }
+  // start_async gives back the call, to be awaited later
+  if (node->Callee == "start_async") {
+    unify(node->type_var_, node->Args[0]->type_var_);
+  }
+  else {
+    unify(node->type_var_, result);
+  }
+}
+
+// the simd_* operations need concrete vector types, generic code goes
+//  through the Simd typeclass (stdlib/simd.bon) instead
+void TypeAnalysisPass::process_simd_builtin(CallExprAST* node) {
+  for (auto &arg : node->Args) {
+    arg->run_pass(this);
+  }
+  logger_.set_line_column(node->line_num_, node->column_num_);
+
+  auto &args = node->Args;
+  auto &name = node->Callee;
+  auto arg_count_error = [this, &name](const std::string &expected) {
+    logger_.error("type error", name + " takes " + expected);
+  };
+
+  // constructor: splat f64x4(x), lanes f64x4(a, b, c, d),
+  //  conversion f64x4(an i64x4) or load f64x4(pointer, index)
+  if (auto vector_type = simd_type(name)) {
+    auto element = simd_element_type(vector_type);
+    auto lanes = simd_lanes(vector_type);
+    if (args.size() == 1 && is_simd_type(args[0]->type_var_)) {
+      // lane counts are checked during codegen
+    }
+    else if (args.size() == 1) {
+      unify(args[0]->type_var_, element);
+    }
+    else if (args.size() == 2 && is_pointer_type(args[0]->type_var_)) {
+      unify(get_type_of_pointer(args[0]->type_var_), element);
+      unify(args[1]->type_var_, IntType);
+    }
+    else if (args.size() == lanes) {
+      for (auto &arg : args) {
+        unify(arg->type_var_, element);
+      }
+    }
+    else {
+      std::ostringstream msg;
+      msg << "1 or " << lanes << " arguments, or a pointer and an index";
+      arg_count_error(msg.str());
+      return;
+    }
+    unify(node->type_var_, vector_type);
+    return;
+  }
+
+  // element-wise operations, these don't need to know the vector type
+  if (name == "simd_swizzle") {
+    if (args.size() < 2) {
+      arg_count_error("a vector and one index per lane");
+      return;
+    }
+    for (size_t i = 1; i < args.size(); ++i) {
+      unify(args[i]->type_var_, IntType);
+    }
+    unify(node->type_var_, args[0]->type_var_);
+    return;
+  }
+  if (name == "simd_sqrt") {
+    if (args.size() != 1) {
+      arg_count_error("1 argument");
+      return;
+    }
+    unify(node->type_var_, args[0]->type_var_);
+    return;
+  }
+  if (name == "simd_min" || name == "simd_max") {
+    if (args.size() != 2) {
+      arg_count_error("2 arguments");
+      return;
+    }
+    unify(args[0]->type_var_, args[1]->type_var_);
+    unify(node->type_var_, args[0]->type_var_);
+    return;
+  }
+  if (name == "simd_select") {
+    if (args.size() != 3) {
+      arg_count_error("a mask and 2 vectors");
+      return;
+    }
+    unify(args[1]->type_var_, args[2]->type_var_);
+    unify(node->type_var_, args[1]->type_var_);
+    if (is_simd_type(args[1]->type_var_)) {
+      unify(args[0]->type_var_,
+            simd_mask_type(simd_lanes(args[1]->type_var_)));
+    }
+    return;
+  }
+  if (name == "simd_any" || name == "simd_all") {
+    if (args.size() != 1) {
+      arg_count_error("1 argument");
+      return;
+    }
+    unify(node->type_var_, BoolType);
+    return;
+  }
+
+  // the rest need the vector type to work out the result type
+  size_t vector_arg = name == "simd_store" ? 2 : 0;
+  if (args.size() <= vector_arg
+      || !is_simd_type(args[vector_arg]->type_var_)) {
+    logger_.error("type error", name + " expects a simd vector argument "
+                                "with a known type");
+    return;
+  }
+  auto vector_type = args[vector_arg]->type_var_;
+  auto element = simd_element_type(vector_type);
+
+  if (name == "simd_store") {
+    // simd_store(pointer, index, vector)
+    if (args.size() != 3) {
+      arg_count_error("a pointer, an index and a vector");
+      return;
+    }
+    if (!is_pointer_type(args[0]->type_var_)) {
+      logger_.error("type error", "simd_store expects a pointer as its first "
+                                  "argument");
+      return;
+    }
+    unify(get_type_of_pointer(args[0]->type_var_), element);
+    unify(args[1]->type_var_, IntType);
+    unify(node->type_var_, UnitType);
+  }
+  else if (name == "simd_lane") {
+    if (args.size() != 2) {
+      arg_count_error("a vector and an index");
+      return;
+    }
+    unify(args[1]->type_var_, IntType);
+    unify(node->type_var_, element);
+  }
+  else if (name == "simd_with_lane") {
+    if (args.size() != 3) {
+      arg_count_error("a vector, an index and a value");
+      return;
+    }
+    unify(args[1]->type_var_, IntType);
+    unify(args[2]->type_var_, element);
+    unify(node->type_var_, vector_type);
+  }
+  else if (name.compare(0, 12, "simd_reduce_") == 0) {
+    if (args.size() != 1) {
+      arg_count_error("1 argument");
+      return;
+    }
+    unify(node->type_var_, element);
+  }
+  else {
+    // comparisons, simd_lt etc.
+    if (args.size() != 2) {
+      arg_count_error("2 arguments");
+      return;
+    }
+    unify(args[0]->type_var_, args[1]->type_var_);
+    unify(node->type_var_, simd_mask_type(simd_lanes(vector_type)));
+  }
+}
+
 // PrototypeAST
 void TypeAnalysisPass::process(PrototypeAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   auto ret_var = get_function_return_type(node->type_var_);
   unify(node->ret_type_, ret_var);
 }
@@ -369,24 +851,52 @@ void TypeAnalysisPass::process(FunctionAST* node) {
     });
 
   node->Proto->run_pass(this);
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   std::vector<TypeVariable*> param_types;
-  for (auto param : node->Params) {
-    if (!param) {
-      continue;
-    }
-    // param->run_pass(this);
-    param_types.push_back(param->type_var_);
+  for (auto &arg : node->Proto->Args) {
+    // unused parameters have no expression, only a type variable
+    param_types.push_back(node->param_name_to_tvar_[arg]);
   }
   auto func_type_var = build_function_type(param_types);
   unify(node->Proto->type_var_, func_type_var);
-  // TODO: clean this up
-  // unify return type with body expression type
   auto ret_type = get_function_return_type(node->type_var());
-  unify(node->last_expr_->type_var_, ret_type);
-  unify(node->Proto->ret_type_, ret_type);
-  node->Body->run_pass(this);
-  unify(node->Body->type_var_, ret_type);
+  if (node->generator_ && node->async_) {
+    logger_.error("type error", "a function can't both yield and await");
+    return;
+  }
+  auto outer_result = async_result_;
+  async_result_ = nullptr;
+  AutoScope restore_result([this, outer_result]{
+      async_result_ = outer_result;
+    });
+  if (node->generator_) {
+    // calling a generator gives back the suspended call, whatever its
+    //  body ends with
+    auto outer_item = generator_item_;
+    generator_item_ = new TypeVariable();
+    unify(ret_type, generator_type(generator_item_));
+    unify(node->Proto->ret_type_, ret_type);
+    node->Body->run_pass(this);
+    generator_item_ = outer_item;
+  }
+  else if (node->async_) {
+    // calling an async function gives back the call, which only runs once
+    //  it's started or awaited
+    async_result_ = new TypeVariable();
+    unify(ret_type, async_type(async_result_));
+    unify(node->last_expr_->type_var_, async_result_);
+    unify(node->Proto->ret_type_, ret_type);
+    node->Body->run_pass(this);
+    unify(node->Body->type_var_, async_result_);
+  }
+  else {
+    // TODO: clean this up
+    // unify return type with body expression type
+    unify(node->last_expr_->type_var_, ret_type);
+    unify(node->Proto->ret_type_, ret_type);
+    node->Body->run_pass(this);
+    unify(node->Body->type_var_, ret_type);
+  }
 
   // force generating names for free variables
   node->type_var()->get_name();
@@ -400,7 +910,7 @@ void TypeAnalysisPass::process(TypeAST* node) {
 
 // TypeclassAST
 void TypeAnalysisPass::process(TypeclassAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   for (auto &impl : node->impls) {
     impl->run_pass(this);
   }
@@ -408,7 +918,7 @@ void TypeAnalysisPass::process(TypeclassAST* node) {
 
 // TypeclassImplAST
 void TypeAnalysisPass::process(TypeclassImplAST* node) {
-  logger.set_line_column(node->line_num_, node->column_num_);
+  logger_.set_line_column(node->line_num_, node->column_num_);
   for (auto &method_entry : node->methods_) {
     auto &method = method_entry.second;
     method->run_pass(this);
@@ -26,6 +26,7 @@ public:
   void process(BinaryExprAST* node) override;
   void process(IfExprAST* node) override;
   void process(WhileExprAST* node) override;
+  void process(ForExprAST* node) override;
   void process(MatchCaseExprAST* node) override;
   void process(MatchExprAST* node) override;
   void process(CallExprAST* node) override;
@@ -38,10 +39,35 @@ public:
   void process(TypeclassImplAST* node) override;
 
   TypeAnalysisPass(ModuleState &state)
-    : state_(state) {}
+    : state_(state), logger_(state.logger), generator_item_(nullptr),
+      async_result_(nullptr) {}
 
 private:
   ModuleState &state_;
+  Logger &logger_;
+  // type of the values yielded by the generator function being analysed,
+  //  nullptr outside of one
+  TypeVariable* generator_item_;
+  // type of what the async function being analysed ends with, nullptr
+  //  outside of one
+  TypeVariable* async_result_;
+
+  // simd constructors (f64x4(x), ...) and simd_* operations
+  void process_simd_builtin(CallExprAST* node);
+  // array(n, x), and indexing, set and len on fixed length arrays
+  void process_array_builtin(CallExprAST* node);
+  // spawn(f(a, b)) and join(task)
+  void process_task_builtin(CallExprAST* node);
+  // parallel_for, par_map and par_reduce
+  void process_parallel_builtin(CallExprAST* node);
+  // atomic_int(x), ... and load, store, fetch_add, ... on them
+  void process_atomic_builtin(CallExprAST* node);
+  // yield x
+  void process_yield(CallExprAST* node);
+  // await x, for x an async call or i/o
+  void process_await(CallExprAST* node);
+  // run_async(x), run_async_threads(x, n) and start_async(x)
+  void process_async_builtin(CallExprAST* node);
 };
 
 } // namespace bon
@@ -10,63 +10,100 @@ L*----------------------------------------------------------------------------*/
 #include "term_colors.h"
 #include "bonLogger.h"
 
+#include <cassert>
 #include <iostream>
+#include <atomic>
 #include <stdexcept>
 
 namespace bon {
 
-struct EnvironmentStack {
-    std::vector<TypeEnv> stack;
-    EnvironmentStack() {
-        stack.push_back(TypeEnv());
-    }
+static std::vector<TypeVariable*> s_empty_types;
+static thread_local TypeContext* tl_type_context = nullptr;
 
-    void push(TypeEnv &env) {
-        stack.push_back(env);
-    }
+TypeContext* set_type_context(TypeContext* context) {
+    auto previous = tl_type_context;
+    tl_type_context = context;
+    return previous;
+}
 
-    TypeEnv pop() {
-        TypeEnv result = stack.back();
-        stack.pop_back();
-        return result;
-    }
+// context of the compilation running on this thread
+static TypeContext &types() {
+    assert(tl_type_context && "no type context set on this thread");
+    return *tl_type_context;
+}
 
-    TypeVariable* find(std::string key) {
-        for (int i = stack.size()-1; i >= 0; --i) {
-            auto result = stack[i].find(key);
-            if (result != stack[i].end()) {
-                return result->second;
-            }
+// the builtin types below are made before any compilation starts, and are
+//  shared by all of them. the symbols of their constructors, and of the
+//  others the type checker looks for, are interned then, so they're the
+//  same in every context. other names are interned by the context they're
+//  used in, and go away with it
+static std::unordered_map<std::string, Symbol> &builtin_symbols() {
+    static std::unordered_map<std::string, Symbol> symbols;
+    return symbols;
+}
+// set by the first context, builtin symbols are only read after that
+static std::atomic<bool> s_builtins_sealed(false);
+
+Symbol intern(const std::string &name) {
+    auto &builtins = builtin_symbols();
+    auto builtin = builtins.find(name);
+    if (builtin != builtins.end()) {
+        return builtin->second;
+    }
+    if (!tl_type_context) {
+        // the builtins are shared by every compilation, and only read once
+        //  the first context exists, so they can't grow after that
+        if (s_builtins_sealed) {
+            throw std::logic_error("interning '" + name
+                                   + "' outside of a type context");
         }
-        return nullptr;
+        return builtins.emplace(name, builtins.size()).first->second;
     }
+    auto &symbols = types().symbols;
+    return symbols.emplace(name, builtins.size() + symbols.size())
+                  .first->second;
+}
 
-    TypeVariable* end() {
-        return nullptr;
+bool find_symbol(const std::string &name, Symbol &symbol) {
+    auto &builtins = builtin_symbols();
+    auto builtin = builtins.find(name);
+    if (builtin != builtins.end()) {
+        symbol = builtin->second;
+        return true;
     }
-
-    TypeVariable* &operator[](std::string key) {
-        return stack.back()[key];
+    if (!tl_type_context) {
+        return false;
     }
-};
-
-static TypeNameGenerator s_type_name_gen;
-static std::vector<TypeVariable*> s_empty_types;
-static EnvironmentStack s_type_env;
-static std::vector<TypeEnv> s_env_stack;
-// registry of user defined types
-static TypeEnv s_type_registry;
-static TypeEnv s_type_constructors;
-// typing environment for class type variables
-static TypeEnv s_typeclass_env;
-static IndexMap s_constructor_values;
-// map from constructor name to map from field name to field index
-static std::map<std::string, IndexMap> s_constructor_field_indices;
+    auto &symbols = tl_type_context->symbols;
+    auto entry = symbols.find(name);
+    if (entry == symbols.end()) {
+        return false;
+    }
+    symbol = entry->second;
+    return true;
+}
 
 TypeVariable* IntType =
                 new TypeVariable(new TypeOperator("int", s_empty_types));
 TypeVariable* FloatType =
                 new TypeVariable(new TypeOperator("float", s_empty_types));
+// sized numeric types, int and float are 64 bit
+TypeVariable* I8Type =
+                new TypeVariable(new TypeOperator("i8", s_empty_types));
+TypeVariable* I16Type =
+                new TypeVariable(new TypeOperator("i16", s_empty_types));
+TypeVariable* I32Type =
+                new TypeVariable(new TypeOperator("i32", s_empty_types));
+TypeVariable* U8Type =
+                new TypeVariable(new TypeOperator("u8", s_empty_types));
+TypeVariable* U16Type =
+                new TypeVariable(new TypeOperator("u16", s_empty_types));
+TypeVariable* U32Type =
+                new TypeVariable(new TypeOperator("u32", s_empty_types));
+TypeVariable* U64Type =
+                new TypeVariable(new TypeOperator("u64", s_empty_types));
+TypeVariable* F32Type =
+                new TypeVariable(new TypeOperator("f32", s_empty_types));
 TypeVariable* StringType =
                 new TypeVariable(new TypeOperator("string", s_empty_types));
 TypeVariable* BoolType =
@@ -74,19 +111,114 @@ TypeVariable* BoolType =
 TypeVariable* UnitType =
                 new TypeVariable(new TypeOperator("()", s_empty_types));
 
-std::vector<TypeVariable*> s_ptr_elem_type = {new TypeVariable()};
-TypeVariable* PointerType =
-                new TypeVariable(new TypeOperator("Pointer", s_ptr_elem_type));
+struct NumericTypeInfo {
+    TypeVariable* type;
+    unsigned bits;
+    bool is_float;
+    bool is_unsigned;
+};
+
+// i64 and f64 are just other names for int and float
+static std::map<std::string, NumericTypeInfo> s_numeric_types = {
+    {"int", {IntType, 64, false, false}},
+    {"i64", {IntType, 64, false, false}},
+    {"i32", {I32Type, 32, false, false}},
+    {"i16", {I16Type, 16, false, false}},
+    {"i8", {I8Type, 8, false, false}},
+    {"u64", {U64Type, 64, false, true}},
+    {"u32", {U32Type, 32, false, true}},
+    {"u16", {U16Type, 16, false, true}},
+    {"u8", {U8Type, 8, false, true}},
+    {"float", {FloatType, 64, true, false}},
+    {"f64", {FloatType, 64, true, false}},
+    {"f32", {F32Type, 32, true, false}},
+};
+
+struct SimdTypeInfo {
+    TypeVariable* type;
+    // element type, bool for masks
+    TypeVariable* element;
+    unsigned lanes;
+};
+
+static std::map<std::string, SimdTypeInfo> s_simd_types;
+
+static void add_simd_type(const std::string &type_name, TypeVariable* element,
+                          unsigned lanes) {
+    auto type = new TypeVariable(new TypeOperator(type_name, s_empty_types));
+    s_simd_types[type_name] = {type, element, lanes};
+}
+
+static bool init_simd_types() {
+    // 128, 256 and 512 bit vectors, i.e. sse, avx and avx-512 registers
+    add_simd_type("f64x2", FloatType, 2);
+    add_simd_type("f64x4", FloatType, 4);
+    add_simd_type("f64x8", FloatType, 8);
+    add_simd_type("f32x4", F32Type, 4);
+    add_simd_type("f32x8", F32Type, 8);
+    add_simd_type("f32x16", F32Type, 16);
+    add_simd_type("i64x2", IntType, 2);
+    add_simd_type("i64x4", IntType, 4);
+    add_simd_type("i64x8", IntType, 8);
+    add_simd_type("i32x4", I32Type, 4);
+    add_simd_type("i32x8", I32Type, 8);
+    add_simd_type("i32x16", I32Type, 16);
+    // result of comparing two vectors with the same number of lanes
+    add_simd_type("mask2", BoolType, 2);
+    add_simd_type("mask4", BoolType, 4);
+    add_simd_type("mask8", BoolType, 8);
+    add_simd_type("mask16", BoolType, 16);
+    return true;
+}
+
+static bool s_simd_types_initialized = init_simd_types();
 
 // opaque raw pointer for interop with c apis
 TypeVariable* CPointerType =
                 new TypeVariable(new TypeOperator("cpointer", s_empty_types));
 
+// i/o started by the async runtime, awaiting it gives its int result
+TypeVariable* IoType =
+                new TypeVariable(new TypeOperator("io", s_empty_types));
+
+// constructors the type checker treats specially
+static const Symbol s_function_symbol = intern(" -> ");
+static const Symbol s_product_symbol = intern(" * ");
+static const Symbol s_sum_symbol = intern(" | ");
+static const Symbol s_pointer_symbol = intern("Pointer");
+static const Symbol s_task_symbol = intern("task");
+static const Symbol s_atomic_symbol = intern("atomic");
+static const Symbol s_generator_symbol = intern("generator");
+static const Symbol s_async_symbol = intern("async");
+// the stdlib's channel class, which tasks can share
+static const Symbol s_channel_symbol = intern("Channel");
+static const std::unordered_set<Symbol> s_primitive_symbols = {
+    intern("int"), intern("float"), intern("string"), intern("bool"),
+    intern("()")};
+
+TypeContext::TypeContext(Logger &logger)
+: logger(logger)
+{
+    s_builtins_sealed = true;
+    std::vector<TypeVariable*> element_type = {new TypeVariable()};
+    pointer_type = new TypeVariable(new TypeOperator("Pointer",
+                                                     element_type));
+}
+
+// class a constructor belongs to, nullptr for anything else
+static TypeVariable* constructor_class(Symbol constructor) {
+    auto entry = types().type_constructors.find(constructor);
+    if (entry == types().type_constructors.end()) {
+        return nullptr;
+    }
+    return entry->second;
+}
+
 void dump_environment() {
     // std::cout << "Environment state:" << std::endl;
-    // for (size_t i = 0; i < s_type_env.stack.size(); ++i) {
+    // for (size_t i = 0; i < types().type_env.stack.size(); ++i) {
     //     std::cout << "Environment #" << i << ":" << std::endl;
-    //     for (auto &entry : s_type_env.stack[i]) {
+    //     for (auto &entry : types().type_env.stack[i]) {
     //         auto type = entry.second->get_root();
     //         if (type->type_operator_ != nullptr) {
     //             std::cout << "type operator: " << type->type_operator_->type_constructor_ << std::endl;
@@ -97,43 +229,43 @@ void dump_environment() {
 }
 
 void reset_type_variables() {
-    // s_type_name_gen.reset();
+    // types().type_name_gen.reset();
     // while (s_env_stack.size() > 0) {
     //     s_env_stack.pop_back();
     // }
-    // s_type_env.clear();
+    // types().type_env.clear();
 }
 
-void push_environment(std::map<std::string, TypeVariable*> &env) {
-    s_type_env.push(env);
-    // // s_type_name_gen.reset();
-    // s_env_stack.push_back(s_type_env);
+void push_environment(TypeEnv &env) {
+    types().type_env.push(env);
+    // // types().type_name_gen.reset();
+    // s_env_stack.push_back(types().type_env);
     // for (auto &entry : env) {
-    //     auto debug_env = s_type_env;
-    //     s_type_env[entry.first] = entry.second->get_root();
+    //     auto debug_env = types().type_env;
+    //     types().type_env[entry.first] = entry.second->get_root();
     // }
     // // this doesn't overwrite:
-    // // s_type_env.insert(env.begin(), env.end());
+    // // types().type_env.insert(env.begin(), env.end());
 
-    // // s_type_env = env;
+    // // types().type_env = env;
 }
 
 TypeEnv pop_environment() {
-    return s_type_env.pop();
-    // TypeEnv env_copy = s_type_env;
+    return types().type_env.pop();
+    // TypeEnv env_copy = types().type_env;
     // if (s_env_stack.size() > 0) {
-    //     s_type_env = s_env_stack.back();
+    //     types().type_env = s_env_stack.back();
     //     s_env_stack.pop_back();
     // }
     // else {
-    //     s_type_env.clear();
+    //     types().type_env.clear();
     // }
 
     // // for (auto &entry : env_copy) {
-    // //     auto debug_env = s_type_env;
+    // //     auto debug_env = types().type_env;
     // //     auto type = entry.second->get_root();
     // //     if (is_concrete_type(type)) {
-    // //         s_type_env[entry.first] = type;
+    // //         types().type_env[entry.first] = type;
     // //     }
     // // }
 
@@ -141,19 +273,19 @@ TypeEnv pop_environment() {
 }
 
 void push_typeclass_environment(TypeEnv &env) {
-    s_typeclass_env = env;
+    types().typeclass_env = env;
 }
 
 TypeEnv pop_typeclass_environment() {
-    return s_typeclass_env;
+    return types().typeclass_env;
 }
 
 void register_type(std::string type_name, TypeVariable* tvar) {
-    if (s_type_registry.find(type_name) != s_type_registry.end()) {
-        bon::logger.error("type error", "type name already exists");
+    if (types().type_registry.find(type_name) != types().type_registry.end()) {
+        types().logger.error("type error", "type name already exists");
         return;
     }
-    s_type_registry[type_name] = tvar;
+    types().type_registry[type_name] = tvar;
 }
 
 std::string TypeOperator::to_string(TypeVariableSet &occurs,
@@ -161,6 +293,10 @@ std::string TypeOperator::to_string(TypeVariableSet &occurs,
     if (types_.empty()) {
         return type_constructor_;
     }
+    // fixed length arrays are written like their type annotations, float[3]
+    if (types_.size() == 1 && type_constructor_[0] == '[') {
+        return types_[0]->get_name(store_name, occurs) + type_constructor_;
+    }
     if (types_.size() == 1) {
         return type_constructor_ + " " + types_[0]->get_name(store_name, occurs);
     }
@@ -203,8 +339,8 @@ std::string get_variant_name(TypeVariable* type_var) {
 
 std::string TypeVariable::get_name(bool store_name, TypeVariableSet occurs) {
     // check for recursion
-    bool in_registry = s_type_registry.find(variant_name_)
-                       != s_type_registry.end();
+    bool in_registry = types().type_registry.find(variant_name_)
+                       != types().type_registry.end();
     // if (occurs.count(this) > 0 && in_registry) {
     // if (occurs.size() > 0 && in_registry) {
     //     return variant_name_;
@@ -226,7 +362,7 @@ std::string TypeVariable::get_name(bool store_name, TypeVariableSet occurs) {
         return type_node->type_operator_->to_string(occurs, store_name);
     }
     else {
-        auto type_name = s_type_name_gen.new_type_name();
+        auto type_name = types().type_name_gen.new_type_name();
         if (store_name) {
             type_node->type_name_ = type_name;
         }
@@ -277,7 +413,7 @@ void _get_fresh_variable(TypeVariable* type_var,
                 //  but we want a fresh one
                 auto new_var = new TypeVariable();
                 new_var->get_name();
-                s_type_env[type_name] = new_var;
+                types().type_env[type_name] = new_var;
             }
             else {
                 _get_fresh_variable(type_root, occurs);
@@ -306,7 +442,7 @@ TypeVariable* _gen_variable(TypeVariable* type_var,
             if (type_name != "") {
                 // type name may already exist in environment,
                 //  but we want a fresh one
-                s_type_env[type_name] = new TypeVariable();
+                types().type_env[type_name] = new TypeVariable();
             }
             type = _gen_variable(type_root, occurs);
         }
@@ -326,20 +462,20 @@ TypeVariable* resolve_variable(TypeVariable* type_var,
     // check if type is in environment
     std::string type_name = type_var->type_name_;
     if (type_name != "") {
-        auto inst_type = s_type_env.find(type_name);
-        if (inst_type != s_type_env.end()) {
-            while (type_name != "" && inst_type != s_type_env.end()) {
+        auto inst_type = types().type_env.find(type_name);
+        if (inst_type != types().type_env.end()) {
+            while (type_name != "" && inst_type != types().type_env.end()) {
                 // use type var from environment
                 type_var = inst_type->get_root();
                 auto old_name = type_name;
                 type_name = type_var->type_name_;
                 if (type_name != "") {
                     if (old_name == type_name) {
-                        bon::logger.error("internal error",
-                                          "unexpected cycle in type resolver");
+                        types().logger.error("internal error",
+                                    "unexpected cycle in type resolver");
                         return type_var;
                     }
-                    inst_type = s_type_env.find(type_name);
+                    inst_type = types().type_env.find(type_name);
                 }
                 else {
                     type_name = "";
@@ -349,22 +485,19 @@ TypeVariable* resolve_variable(TypeVariable* type_var,
         else if (update_environment) {
             // allocate fresh variable and update environment
             type_var = new TypeVariable();
-            s_type_env[type_name] = type_var;
+            types().type_env[type_name] = type_var;
         }
     }
     return type_var;
 }
 
 bool is_primitive_type(TypeVariable* type_var) {
-    static std::set<std::string> primitives = {"int", "float", "string",
-                                               "bool", "()"};
-
     if (!type_var->type_operator_) {
         return false;
     }
 
-    auto type_name = type_var->type_operator_->type_constructor_;
-    return primitives.count(type_name) > 0;
+    return s_primitive_symbols.count(type_var->type_operator_->type_symbol_)
+           > 0;
 }
 
 // Flattens a potentially long chain of variables
@@ -410,8 +543,8 @@ TypeVariable* flatten_variable(TypeVariable* type_var) {
 bool sum_type_matches(TypeOperator* variant, TypeOperator* constructor) {
     for (auto &con : variant->types_) {
         if (con->type_operator_
-            && con->type_operator_->type_constructor_
-               == constructor->type_constructor_) {
+            && con->type_operator_->type_symbol_
+               == constructor->type_symbol_) {
             return type_operators_match(con->type_operator_, constructor);
         }
     }
@@ -432,15 +565,14 @@ bool _type_operators_match(TypeOperator* lhs, TypeOperator* rhs,
     occurs.insert(lhs);
     occurs.insert(rhs);
 
-    if (lhs->type_constructor_ != rhs->type_constructor_) {
-        if (lhs->type_constructor_ == " | ") {
+    if (lhs->type_symbol_ != rhs->type_symbol_) {
+        if (lhs->type_symbol_ == s_sum_symbol) {
             return sum_type_matches(lhs, rhs);
         }
-        else if (rhs->type_constructor_ == " | ") {
+        else if (rhs->type_symbol_ == s_sum_symbol) {
             return sum_type_matches(rhs, lhs);
         }
-        else if (auto variant =
-                    get_type_from_constructor(lhs->type_constructor_)) {
+        else if (auto variant = constructor_class(lhs->type_symbol_)) {
             variant = resolve_variable(variant);
             if (!variant->type_operator_) {
                 return false;
@@ -483,8 +615,8 @@ bool type_operators_match(TypeOperator* lhs, TypeOperator* rhs) {
 bool sum_type_can_unify(TypeOperator* variant, TypeOperator* constructor) {
     for (auto &con : variant->types_) {
         if (con->type_operator_
-            && con->type_operator_->type_constructor_
-               == constructor->type_constructor_) {
+            && con->type_operator_->type_symbol_
+               == constructor->type_symbol_) {
             return can_unify(con->type_operator_, constructor);
         }
     }
@@ -506,15 +638,14 @@ bool _can_unify(TypeOperator* lhs, TypeOperator* rhs,
     occurs.insert(lhs);
     occurs.insert(rhs);
 
-    if (lhs->type_constructor_ != rhs->type_constructor_) {
-        if (lhs->type_constructor_ == " | ") {
+    if (lhs->type_symbol_ != rhs->type_symbol_) {
+        if (lhs->type_symbol_ == s_sum_symbol) {
             return sum_type_matches(lhs, rhs);
         }
-        else if (rhs->type_constructor_ == " | ") {
+        else if (rhs->type_symbol_ == s_sum_symbol) {
             return sum_type_matches(rhs, lhs);
         }
-        else if (auto variant =
-                    get_type_from_constructor(lhs->type_constructor_)) {
+        else if (auto variant = constructor_class(lhs->type_symbol_)) {
             variant = resolve_variable(variant);
             if (!variant->type_operator_) {
                 return false;
@@ -570,8 +701,8 @@ void unify_sum_type(TypeOperator* variant, TypeOperator* constructor,
                     std::set<TypeOperator*> &occurs) {
     for (auto &con : variant->types_) {
         if (con->type_operator_
-            && con->type_operator_->type_constructor_
-               == constructor->type_constructor_) {
+            && con->type_operator_->type_symbol_
+               == constructor->type_symbol_) {
             unify_type_operators(con->type_operator_, constructor, occurs);
             return;
         }
@@ -587,19 +718,19 @@ void unify_type_operators(TypeOperator* lhs, TypeOperator* rhs,
         return;
     }
 
-    if (lhs->type_constructor_ != rhs->type_constructor_) {
-        if (lhs->type_constructor_ == " | ") {
+    if (lhs->type_symbol_ != rhs->type_symbol_) {
+        if (lhs->type_symbol_ == s_sum_symbol) {
             unify_sum_type(lhs, rhs, occurs);
         }
-        else if (rhs->type_constructor_ == " | ") {
+        else if (rhs->type_symbol_ == s_sum_symbol) {
             unify_sum_type(rhs, lhs, occurs);
         }
         return;
     }
 
     if (lhs->types_.size() != rhs->types_.size()) {
-        bon::logger.error("type error",
-                          "attempting to unify types of different shape");
+        types().logger.error("type error",
+                             "attempting to unify types of different shape");
         return;
     }
 
@@ -645,7 +776,7 @@ void _unify(TypeVariable* lhs, TypeVariable* rhs,
         auto mismatch_str = lhs_type->get_name() + " != "
                                                  + rhs_type->get_name();
         dump_environment();
-        bon::logger.error("type mismatch", mismatch_str);
+        types().logger.error("type mismatch", mismatch_str);
         return;
     }
 
@@ -676,14 +807,190 @@ bool is_boxed_type(TypeVariable* type_var) {
     if (type_var->type_operator_ == nullptr) {
         return false;
     }
-    auto op = type_var->type_operator_->type_constructor_;
-    if (op == " * " || op == " | " || op == " -> " || isupper(op[0])) {
+    // enum values are just their constructor index
+    if (is_enum_type(type_var)) {
+        return false;
+    }
+    auto type_op = type_var->type_operator_;
+    if (type_op->type_symbol_ == s_product_symbol
+        || type_op->type_symbol_ == s_sum_symbol
+        || type_op->type_symbol_ == s_function_symbol
+        || isupper(type_op->type_constructor_[0])) {
         return true;
     }
 
     return false;
 }
 
+// largest class (in fields) we're willing to store by value in a buffer
+static const size_t s_max_inline_fields = 16;
+
+std::vector<TypeVariable*> get_constructor_fields(TypeVariable* type_var) {
+    std::vector<TypeVariable*> fields;
+    type_var = resolve_variable(type_var);
+    if (type_var->type_operator_ == nullptr) {
+        return fields;
+    }
+    for (auto type : type_var->type_operator_->types_) {
+        type = resolve_variable(type);
+        // product type, so add individual members
+        if (type->type_operator_
+            && type->type_operator_->type_symbol_ == s_product_symbol) {
+            for (auto member : type->type_operator_->types_) {
+                fields.push_back(resolve_variable(member));
+            }
+            continue;
+        }
+        fields.push_back(type);
+    }
+    return fields;
+}
+
+bool is_inline_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    auto type_op = type_var->type_operator_;
+    if (type_op == nullptr) {
+        return false;
+    }
+    if (!isupper(type_op->type_constructor_[0])
+        || type_op->type_symbol_ == s_pointer_symbol) {
+        return false;
+    }
+
+    // only classes with a single constructor (no tag to dispatch on)
+    auto class_type = constructor_class(type_op->type_symbol_);
+    if (class_type == nullptr) {
+        return false;
+    }
+    class_type = resolve_variable(class_type);
+    if (class_type->type_operator_ == nullptr
+        || class_type->type_operator_->type_symbol_
+           != type_op->type_symbol_) {
+        return false;
+    }
+
+    // fields must be plain scalars, so a byte copy of the object never
+    // duplicates ownership of anything it points to
+    auto fields = get_constructor_fields(type_var);
+    if (fields.empty() || fields.size() > s_max_inline_fields) {
+        return false;
+    }
+    for (auto field : fields) {
+        // arrays are only as plain as their elements
+        if (is_array_type(field)
+            && !is_array_element_type(array_element_type(field))) {
+            return false;
+        }
+        if (!is_numeric_type(field) && !is_simd_type(field)
+            && !is_array_type(field) && field != BoolType
+            && !is_enum_type(field)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool set_soa_layout(TypeVariable* class_type) {
+    class_type = resolve_variable(class_type);
+    if (!is_inline_type(class_type)) {
+        return false;
+    }
+    // columns are indexed with a single stride, so all fields are 8 bytes
+    for (auto field : get_constructor_fields(class_type)) {
+        if (numeric_type_bits(field) != 64) {
+            return false;
+        }
+    }
+    types().soa_constructors.insert(class_type->type_operator_->type_symbol_);
+    return true;
+}
+
+bool is_soa_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    if (type_var->type_operator_ == nullptr) {
+        return false;
+    }
+    return types().soa_constructors.count(
+                                type_var->type_operator_->type_symbol_) > 0;
+}
+
+bool is_enum_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    auto type_op = type_var->type_operator_;
+    if (type_op == nullptr) {
+        return false;
+    }
+    // a constructor stands for its class, e.g. Cyan for color
+    if (isupper(type_op->type_constructor_[0])) {
+        if (!type_op->types_.empty()) {
+            return false;
+        }
+        auto class_type = constructor_class(type_op->type_symbol_);
+        if (class_type == nullptr) {
+            return false;
+        }
+        type_op = resolve_variable(class_type)->type_operator_;
+        if (type_op == nullptr) {
+            return false;
+        }
+        // single nullary constructor
+        if (type_op->type_symbol_ != s_sum_symbol) {
+            return type_op->types_.empty();
+        }
+    }
+    if (type_op->type_symbol_ != s_sum_symbol) {
+        return false;
+    }
+    for (auto constructor : type_op->types_) {
+        auto con_op = resolve_variable(constructor)->type_operator_;
+        if (con_op == nullptr || !con_op->types_.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TypeVariable* nullable_payload_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    auto type_op = type_var->type_operator_;
+    if (type_op == nullptr || type_op->type_symbol_ != s_sum_symbol
+        || type_op->types_.size() != 2) {
+        return nullptr;
+    }
+    TypeVariable* payload = nullptr;
+    bool has_nullary = false;
+    for (auto constructor : type_op->types_) {
+        auto con_op = resolve_variable(constructor)->type_operator_;
+        if (con_op == nullptr || con_op->types_.size() > 1) {
+            return nullptr;
+        }
+        if (con_op->types_.empty()) {
+            has_nullary = true;
+        }
+        else {
+            payload = resolve_variable(con_op->types_[0]);
+        }
+    }
+    // raw pointers can already be null. small objects can be slots of a
+    //  buffer (e.g. from vec's at), which the Option mustn't own, so they
+    //  keep an allocation of their own
+    if (!has_nullary || payload == nullptr || !is_boxed_type(payload)
+        || is_inline_type(payload) || is_pointer_type(payload)
+        || payload == CPointerType) {
+        return nullptr;
+    }
+    // several fields are a tuple, and functions and nullable objects can't
+    //  spare the null pointer
+    auto payload_op = payload->type_operator_;
+    if (payload_op->type_symbol_ == s_product_symbol
+        || payload_op->type_symbol_ == s_function_symbol
+        || nullable_payload_type(payload) != nullptr) {
+        return nullptr;
+    }
+    return payload;
+}
+
 bool _is_concrete_type(TypeVariable* type_var,
                        std::set<TypeOperator*> &occurs) {
     type_var = resolve_variable(type_var);
@@ -697,7 +1004,6 @@ bool _is_concrete_type(TypeVariable* type_var,
 
     occurs.insert(type_var->type_operator_);
 
-    auto op = type_var->type_operator_->type_constructor_;
     for (auto& type : type_var->type_operator_->types_) {
         if (!_is_concrete_type(type, occurs)) {
             return false;
@@ -712,10 +1018,97 @@ bool is_concrete_type(TypeVariable* type_var) {
     return _is_concrete_type(type_var, occurs);
 }
 
+// root of type_var, following named variables through env only. what
+//  the environment stack resolves them to otherwise depends on which
+//  function is asking, so those give nullptr, as do free variables
+TypeVariable* _closed_root(TypeVariable* type_var, TypeEnv &env) {
+    std::set<TypeVariable*> occurs;
+    type_var = type_var->get_root();
+    while (type_var->type_name_ != "") {
+        auto inst_type = env.find(type_var->type_name_);
+        if (inst_type == env.end() || occurs.count(type_var) > 0) {
+            return nullptr;
+        }
+        occurs.insert(type_var);
+        type_var = inst_type->second->get_root();
+    }
+    return type_var->type_operator_ ? type_var : nullptr;
+}
+
+bool _closed_type_name(TypeVariable* type_var, TypeEnv &env,
+                       std::map<TypeVariable*, size_t> &occurs,
+                       std::string &name) {
+    type_var = _closed_root(type_var, env);
+    if (!type_var) {
+        return false;
+    }
+    auto seen = occurs.find(type_var);
+    if (seen != occurs.end()) {
+        // recursive (or shared) types refer back to where they were named
+        name += "#" + std::to_string(seen->second);
+        return true;
+    }
+    size_t index = occurs.size();
+    occurs[type_var] = index;
+
+    name += "(" + type_var->type_operator_->type_constructor_;
+    for (auto &type : type_var->type_operator_->types_) {
+        name += " ";
+        if (!_closed_type_name(type, env, occurs, name)) {
+            return false;
+        }
+    }
+    name += ")";
+    return true;
+}
+
+std::string closed_type_name(TypeVariable* type_var, TypeEnv &env) {
+    std::map<TypeVariable*, size_t> occurs;
+    std::string name;
+    if (!_closed_type_name(type_var, env, occurs, name)) {
+        return "";
+    }
+    return name;
+}
+
+// classes with several constructors go by their first one, as a value
+//  built by any of them can match a parameter of the class
+std::string _class_key(TypeOperator* type_operator) {
+    auto variant = type_operator;
+    auto class_type = constructor_class(type_operator->type_symbol_);
+    if (class_type && class_type->get_root()->type_operator_) {
+        variant = class_type->get_root()->type_operator_;
+    }
+    if (variant->type_symbol_ != s_sum_symbol) {
+        return type_operator->type_constructor_;
+    }
+    if (variant->types_.empty()
+        || !variant->types_[0]->get_root()->type_operator_) {
+        return "";
+    }
+    return variant->types_[0]->get_root()->type_operator_->type_constructor_;
+}
+
+std::string dispatch_key(TypeVariable* func_type, TypeEnv &env) {
+    auto root = _closed_root(func_type, env);
+    if (!root || root->type_operator_->type_symbol_ != s_function_symbol) {
+        return "";
+    }
+    auto first_arg = _closed_root(root->type_operator_->types_[0], env);
+    if (first_arg && first_arg->type_operator_->type_symbol_ == s_product_symbol
+        && !first_arg->type_operator_->types_.empty()) {
+        first_arg = _closed_root(first_arg->type_operator_->types_[0], env);
+    }
+    if (!first_arg) {
+        return "";
+    }
+    return _class_key(first_arg->type_operator_);
+}
+
 bool is_pointer_type(TypeVariable* type_var) {
     type_var = resolve_variable(type_var);
     if (type_var->type_operator_) {
-        return type_var->type_operator_->type_constructor_ == "Pointer";
+        return type_var->type_operator_->type_symbol_ == s_pointer_symbol;
     }
     return false;
 }
@@ -765,11 +1158,11 @@ TypeVariable* build_tuple_type(std::vector<TypeVariable*> &param_types) {
 
 TypeVariable* build_variant_type(TypeVariable* v_type, TypeMap &variant_types,
                                  IndexMap &fields) {
-    std::vector<TypeVariable*> types;
+    std::vector<TypeVariable*> constructors;
     for (auto &pair : variant_types) {
-        if (s_type_constructors.find(pair.first) != s_type_constructors.end()) {
-            bon::logger.error("type error",
-                              "type constructor already exists");
+        if (types().type_constructors.count(intern(pair.first)) > 0) {
+            types().logger.error("type error",
+                                 "type constructor already exists");
         }
         std::vector<TypeVariable*> constr_type;
         if (pair.second) {
@@ -782,18 +1175,18 @@ TypeVariable* build_variant_type(TypeVariable* v_type, TypeMap &variant_types,
         // object without having to pattern match
         if (variant_types.size() == 1) {
             unify(v_type, tcon_var);
-            s_type_constructors[pair.first] = v_type;
-            s_constructor_values[pair.first] = 0;
-            s_constructor_field_indices[pair.first] = fields;
+            types().type_constructors[intern(pair.first)] = v_type;
+            types().constructor_values[pair.first] = 0;
+            types().constructor_field_indices[pair.first] = fields;
             return tcon_var;
         }
-        types.push_back(tcon_var);
+        constructors.push_back(tcon_var);
     }
-    auto var_type = new TypeVariable(new TypeOperator(" | ", types));
+    auto var_type = new TypeVariable(new TypeOperator(" | ", constructors));
     uint32_t tcon_idx = 0;
     for (auto &pair : variant_types) {
-        s_type_constructors[pair.first] = v_type;
-        s_constructor_values[pair.first] = tcon_idx;
+        types().type_constructors[intern(pair.first)] = v_type;
+        types().constructor_values[pair.first] = tcon_idx;
         ++tcon_idx;
     }
     unify(v_type, var_type);
@@ -801,23 +1194,24 @@ TypeVariable* build_variant_type(TypeVariable* v_type, TypeMap &variant_types,
 }
 
 uint32_t get_constructor_value(std::string constructor) {
-    if (s_constructor_values.find(constructor) == s_constructor_values.end()) {
-        bon::logger.error("error", "unknown constructor");
+    if (types().constructor_values.find(constructor)
+        == types().constructor_values.end()) {
+        types().logger.error("error", "unknown constructor");
     }
-    return s_constructor_values[constructor];
+    return types().constructor_values[constructor];
 }
 
 uint32_t get_constructor_field_index(std::string constructor,
                                      std::string field) {
-    if (s_constructor_field_indices.find(constructor)
-        == s_constructor_field_indices.end()) {
-        bon::logger.error("error", "unknown constructor");
+    if (types().constructor_field_indices.find(constructor)
+        == types().constructor_field_indices.end()) {
+        types().logger.error("error", "unknown constructor");
     }
-    if (s_constructor_field_indices[constructor].find(field)
-        == s_constructor_field_indices[constructor].end()) {
-            bon::logger.error("error", "unknown constructor field");
+    if (types().constructor_field_indices[constructor].find(field)
+        == types().constructor_field_indices[constructor].end()) {
+            types().logger.error("error", "unknown constructor field");
     }
-    return s_constructor_field_indices[constructor][field];
+    return types().constructor_field_indices[constructor][field];
 }
 
 TypeVariable* build_from_type_constructor(
@@ -827,7 +1221,7 @@ TypeVariable* build_from_type_constructor(
 }
 
 TypeVariable* get_type_from_constructor(std::string constructor) {
-    return s_type_constructors[constructor];
+    return constructor_class(intern(constructor));
 }
 
 std::string get_constructor_from_type(TypeVariable* type) {
@@ -841,7 +1235,7 @@ std::string get_constructor_from_type(TypeVariable* type) {
 TypeVariable* get_fn_arg_type(TypeVariable* fn_type, size_t arg_idx) {
     auto root = resolve_variable(fn_type);
     if (root && root->type_operator_ &&
-        root->type_operator_->type_constructor_ == " -> ") {
+        root->type_operator_->type_symbol_ == s_function_symbol) {
         auto args = resolve_variable(root->type_operator_->types_[0]);
         if (args->type_operator_) {
             if (args->type_operator_->types_.size() > arg_idx) {
@@ -867,7 +1261,7 @@ TypeVariable* get_function_return_type(TypeVariable* func_type) {
 std::vector<TypeVariable*> get_function_arg_types(TypeVariable* func_type) {
     auto root = resolve_variable(func_type);
     if (root && root->type_operator_) {
-        if (root->type_operator_->type_constructor_ == " | "
+        if (root->type_operator_->type_symbol_ == s_sum_symbol
             || isupper(root->type_operator_->type_constructor_[0])) {
             // don't recurse on variants or constructors
             std::vector<TypeVariable*> result;
@@ -875,7 +1269,7 @@ std::vector<TypeVariable*> get_function_arg_types(TypeVariable* func_type) {
             return result;
         }
         auto args = resolve_variable(root->type_operator_->types_[0]);
-        if (args->type_operator_->type_constructor_ == " | "
+        if (args->type_operator_->type_symbol_ == s_sum_symbol
             || isupper(args->type_operator_->type_constructor_[0])) {
             // don't recurse on variants or constructors
             std::vector<TypeVariable*> result;
@@ -895,12 +1289,264 @@ std::vector<TypeVariable*> get_function_arg_types(TypeVariable* func_type) {
     return std::vector<TypeVariable*>();
 }
 
+static const NumericTypeInfo* get_numeric_type_info(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    if (type_var->type_operator_ == nullptr) {
+        return nullptr;
+    }
+    static const auto by_symbol = [] {
+        std::unordered_map<Symbol, const NumericTypeInfo*> result;
+        for (auto &entry : s_numeric_types) {
+            result[entry.second.type->type_operator_->type_symbol_] =
+                                                            &entry.second;
+        }
+        return result;
+    }();
+    auto info = by_symbol.find(type_var->type_operator_->type_symbol_);
+    if (info == by_symbol.end() || info->second->type != type_var) {
+        return nullptr;
+    }
+    return info->second;
+}
+
+TypeVariable* sized_numeric_type(const std::string &type_name) {
+    auto info = s_numeric_types.find(type_name);
+    if (info == s_numeric_types.end()
+        || type_name == "int" || type_name == "float") {
+        return nullptr;
+    }
+    return info->second.type;
+}
+
+bool is_numeric_type(TypeVariable* type_var) {
+    return get_numeric_type_info(type_var) != nullptr;
+}
+
+bool is_integer_type(TypeVariable* type_var) {
+    auto info = get_numeric_type_info(type_var);
+    return info && !info->is_float;
+}
+
+bool is_float_type(TypeVariable* type_var) {
+    auto info = get_numeric_type_info(type_var);
+    return info && info->is_float;
+}
+
+bool is_unsigned_type(TypeVariable* type_var) {
+    auto info = get_numeric_type_info(type_var);
+    return info && info->is_unsigned;
+}
+
+unsigned numeric_type_bits(TypeVariable* type_var) {
+    auto info = get_numeric_type_info(type_var);
+    return info ? info->bits : 0;
+}
+
+static const SimdTypeInfo* get_simd_type_info(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    if (type_var->type_operator_ == nullptr) {
+        return nullptr;
+    }
+    static const auto by_symbol = [] {
+        std::unordered_map<Symbol, const SimdTypeInfo*> result;
+        for (auto &entry : s_simd_types) {
+            result[entry.second.type->type_operator_->type_symbol_] =
+                                                            &entry.second;
+        }
+        return result;
+    }();
+    auto info = by_symbol.find(type_var->type_operator_->type_symbol_);
+    if (info == by_symbol.end() || info->second->type != type_var) {
+        return nullptr;
+    }
+    return info->second;
+}
+
+TypeVariable* simd_type(const std::string &type_name) {
+    auto info = s_simd_types.find(type_name);
+    return info != s_simd_types.end() ? info->second.type : nullptr;
+}
+
+bool is_simd_type(TypeVariable* type_var) {
+    return get_simd_type_info(type_var) != nullptr;
+}
+
+bool is_mask_type(TypeVariable* type_var) {
+    auto info = get_simd_type_info(type_var);
+    return info && info->element == BoolType;
+}
+
+TypeVariable* simd_element_type(TypeVariable* type_var) {
+    auto info = get_simd_type_info(type_var);
+    return info ? info->element : nullptr;
+}
+
+unsigned simd_lanes(TypeVariable* type_var) {
+    auto info = get_simd_type_info(type_var);
+    return info ? info->lanes : 0;
+}
+
+TypeVariable* simd_mask_type(unsigned lanes) {
+    std::ostringstream type_name;
+    type_name << "mask" << lanes;
+    return simd_type(type_name.str());
+}
+
+static std::set<std::string> s_simd_builtins = {
+    "simd_store", "simd_lane", "simd_with_lane", "simd_swizzle",
+    "simd_select", "simd_any", "simd_all", "simd_min", "simd_max",
+    "simd_sqrt", "simd_eq", "simd_ne", "simd_lt", "simd_le", "simd_gt",
+    "simd_ge", "simd_reduce_add", "simd_reduce_mul", "simd_reduce_min",
+    "simd_reduce_max",
+};
+
+bool is_simd_builtin(const std::string &name) {
+    return s_simd_builtins.count(name) > 0;
+}
+
+TypeVariable* array_type(TypeVariable* element, size_t length) {
+    std::vector<TypeVariable*> types = {element};
+    std::ostringstream type_name;
+    type_name << "[" << length << "]";
+    return new TypeVariable(new TypeOperator(type_name.str(), types));
+}
+
+bool is_array_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    return type_var->type_operator_ != nullptr
+           && type_var->type_operator_->type_constructor_[0] == '['
+           && type_var->type_operator_->types_.size() == 1;
+}
+
+TypeVariable* array_element_type(TypeVariable* type_var) {
+    if (!is_array_type(type_var)) {
+        return nullptr;
+    }
+    return resolve_variable(type_var)->type_operator_->types_[0];
+}
+
+size_t array_length(TypeVariable* type_var) {
+    if (!is_array_type(type_var)) {
+        return 0;
+    }
+    auto type_name = resolve_variable(type_var)->type_operator_->type_constructor_;
+    return std::stoul(type_name.substr(1));
+}
+
+bool is_array_element_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    return is_numeric_type(type_var) || is_simd_type(type_var)
+           || type_var == BoolType;
+}
+
+bool is_array_method(const std::string &name) {
+    return name == "unsafe_at" || name == "set" || name == "len";
+}
+
+TypeVariable* task_type(TypeVariable* result) {
+    std::vector<TypeVariable*> types = {result};
+    return new TypeVariable(new TypeOperator("task", types));
+}
+
+bool is_task_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    return type_var->type_operator_ != nullptr
+           && type_var->type_operator_->type_symbol_ == s_task_symbol;
+}
+
+bool is_task_shareable_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    if (type_var == UnitType || type_var == BoolType
+        || is_numeric_type(type_var) || is_enum_type(type_var)
+        || is_simd_type(type_var) || is_mask_type(type_var)
+        || is_array_type(type_var) || is_atomic_type(type_var)) {
+        return true;
+    }
+    return type_var->type_operator_ != nullptr
+           && type_var->type_operator_->type_symbol_ == s_channel_symbol;
+}
+
+TypeVariable* atomic_type(TypeVariable* value) {
+    std::vector<TypeVariable*> types = {value};
+    return new TypeVariable(new TypeOperator("atomic", types));
+}
+
+bool is_atomic_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    return type_var->type_operator_ != nullptr
+           && type_var->type_operator_->type_symbol_ == s_atomic_symbol;
+}
+
+TypeVariable* atomic_value_type(TypeVariable* type_var) {
+    if (!is_atomic_type(type_var)) {
+        return nullptr;
+    }
+    return resolve_variable(type_var)->type_operator_->types_[0];
+}
+
+static std::set<std::string> s_atomic_builtins = {
+    "atomic_int", "atomic_bool", "atomic_ptr", "padded_atomic_int",
+    "padded_atomic_bool", "padded_atomic_ptr", "load", "store", "exchange",
+    "fetch_add", "fetch_sub", "fetch_and", "fetch_or", "fetch_xor",
+    "fetch_max", "fetch_min", "compare_exchange", "compare_exchange_weak",
+};
+
+bool is_atomic_builtin(const std::string &name) {
+    return s_atomic_builtins.count(name) > 0;
+}
+
+TypeVariable* generator_type(TypeVariable* item) {
+    std::vector<TypeVariable*> types = {item};
+    return new TypeVariable(new TypeOperator("generator", types));
+}
+
+bool is_generator_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    return type_var->type_operator_ != nullptr
+           && type_var->type_operator_->type_symbol_ == s_generator_symbol;
+}
+
+TypeVariable* generator_item_type(TypeVariable* type_var) {
+    if (!is_generator_type(type_var)) {
+        return nullptr;
+    }
+    return resolve_variable(type_var)->type_operator_->types_[0];
+}
+
+TypeVariable* async_type(TypeVariable* result) {
+    std::vector<TypeVariable*> types = {result};
+    return new TypeVariable(new TypeOperator("async", types));
+}
+
+bool is_async_type(TypeVariable* type_var) {
+    type_var = resolve_variable(type_var);
+    return type_var->type_operator_ != nullptr
+           && type_var->type_operator_->type_symbol_ == s_async_symbol;
+}
+
+TypeVariable* async_result_type(TypeVariable* type_var) {
+    if (!is_async_type(type_var)) {
+        return nullptr;
+    }
+    return resolve_variable(type_var)->type_operator_->types_[0];
+}
+
+bool is_async_builtin(const std::string &name) {
+    return name == "run_async" || name == "run_async_threads"
+           || name == "start_async";
+}
+
+bool is_parallel_builtin(const std::string &name) {
+    return name == "parallel_for" || name == "par_map"
+           || name == "par_reduce";
+}
+
 TypeVariable* type_variable_from_identifier(std::string type_name) {
-    if (type_name == "int") {
-        return IntType;
+    if (s_numeric_types.count(type_name) > 0) {
+        return s_numeric_types.at(type_name).type;
     }
-    else if (type_name == "float") {
-        return FloatType;
+    else if (s_simd_types.count(type_name) > 0) {
+        return s_simd_types.at(type_name).type;
     }
     else if (type_name == "string") {
         return StringType;
@@ -912,20 +1558,34 @@ TypeVariable* type_variable_from_identifier(std::string type_name) {
         return UnitType;
     }
     else if (type_name == "pointer") {
-        return PointerType;
+        return types().pointer_type;
     }
     else if (type_name == "cpointer") {
         return CPointerType;
     }
-    else if (s_type_registry.find(type_name) != s_type_registry.end()) {
-        return s_type_registry[type_name];
+    else if (type_name == "io") {
+        return IoType;
+    }
+    else if (type_name == "atomic_int") {
+        return atomic_type(IntType);
+    }
+    else if (type_name == "atomic_bool") {
+        return atomic_type(BoolType);
+    }
+    else if (type_name == "atomic_ptr") {
+        return atomic_type(types().pointer_type);
+    }
+    else if (types().type_registry.find(type_name)
+             != types().type_registry.end()) {
+        return types().type_registry[type_name];
     }
-    else if (s_typeclass_env.find(type_name) != s_typeclass_env.end()) {
-        return s_typeclass_env[type_name];
+    else if (types().typeclass_env.find(type_name)
+             != types().typeclass_env.end()) {
+        return types().typeclass_env[type_name];
     }
     std::ostringstream msg;
-    bon::logger.error("type error", msg << "unknown type " << type_name
-                                        << " used in type annotation" );
+    types().logger.error("type error", msg << "unknown type " << type_name
+                                           << " used in type annotation" );
     return nullptr;
 }
 
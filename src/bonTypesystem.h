@@ -7,20 +7,91 @@
 L*----------------------------------------------------------------------------*/
 
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
 #include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace bon {
 
+// a string interned by intern, which gives equal strings the same symbol.
+//  type constructors are interned as their TypeOperators are made, so the
+//  type checker compares them as integers. symbols belong to the type
+//  context they were interned in, except for those of the builtin types
+typedef uint32_t Symbol;
+Symbol intern(const std::string &name);
+// looks name up without interning it. false if it hasn't been interned
+//  (by this thread's type context, or as a builtin), so nothing can be
+//  keyed by it yet
+bool find_symbol(const std::string &name, Symbol &symbol);
+
+// table keyed by interned names, looked up by name or by its symbol. only
+//  operator[] interns the name, looking up a name that was never interned
+//  finds nothing. a hash table by default, with unspecified iteration
+//  order, OrderedSymbolMap (below) is for tables that are iterated
+template <typename T, typename Map = std::unordered_map<Symbol, T>>
+class SymbolMap {
+public:
+    typedef typename Map::iterator iterator;
+    typedef typename Map::const_iterator const_iterator;
+
+    T &operator[](const std::string &name) { return map_[intern(name)]; }
+    T &operator[](Symbol symbol) { return map_[symbol]; }
+    T &at(const std::string &name) {
+        Symbol symbol;
+        if (!find_symbol(name, symbol)) {
+            throw std::out_of_range("SymbolMap::at: " + name);
+        }
+        return map_.at(symbol);
+    }
+    iterator find(const std::string &name) {
+        Symbol symbol;
+        return find_symbol(name, symbol) ? map_.find(symbol) : map_.end();
+    }
+    const_iterator find(const std::string &name) const {
+        Symbol symbol;
+        return find_symbol(name, symbol) ? map_.find(symbol) : map_.end();
+    }
+    iterator find(Symbol symbol) { return map_.find(symbol); }
+    size_t count(const std::string &name) const {
+        Symbol symbol;
+        return find_symbol(name, symbol) ? map_.count(symbol) : 0;
+    }
+    size_t erase(const std::string &name) {
+        Symbol symbol;
+        return find_symbol(name, symbol) ? map_.erase(symbol) : 0;
+    }
+    iterator erase(const_iterator position) { return map_.erase(position); }
+
+    iterator begin() { return map_.begin(); }
+    iterator end() { return map_.end(); }
+    const_iterator begin() const { return map_.begin(); }
+    const_iterator end() const { return map_.end(); }
+    size_t size() const { return map_.size(); }
+    bool empty() const { return map_.empty(); }
+    void clear() { map_.clear(); }
+
+private:
+    Map map_;
+};
+
+// iterated in the order the names were first interned (e.g. declaration
+//  order for typeclasses), the same on every run
+template <typename T>
+using OrderedSymbolMap = SymbolMap<T, std::map<Symbol, T>>;
+
 class TypeVariable;
 // type environment is a map from type name to type variable
-typedef std::map<std::string, TypeVariable*> TypeEnv;
+typedef SymbolMap<TypeVariable*> TypeEnv;
 // map from program variable name to type variable
 typedef std::map<std::string, TypeVariable*> TypeMap;
 typedef std::set<TypeVariable*> TypeVariableSet;
 typedef std::map<std::string, uint32_t> IndexMap;
+class Logger;
 
 class TypeNameGenerator {
 public:
@@ -47,13 +118,80 @@ public:
     }
 };
 
+struct EnvironmentStack {
+    std::vector<TypeEnv> stack;
+    EnvironmentStack() {
+        stack.push_back(TypeEnv());
+    }
+
+    void push(TypeEnv &env) {
+        stack.push_back(env);
+    }
+
+    TypeEnv pop() {
+        TypeEnv result = stack.back();
+        stack.pop_back();
+        return result;
+    }
+
+    TypeVariable* find(const std::string &key) {
+        for (int i = stack.size()-1; i >= 0; --i) {
+            auto result = stack[i].find(key);
+            if (result != stack[i].end()) {
+                return result->second;
+            }
+        }
+        return nullptr;
+    }
+
+    TypeVariable* end() {
+        return nullptr;
+    }
+
+    TypeVariable* &operator[](const std::string &key) {
+        return stack.back()[key];
+    }
+};
+
+// typing state of a single compilation (see ModuleState). the functions
+//  below work on the context set for the calling thread, which lets
+//  independent compilations run on separate threads
+struct TypeContext {
+    Logger &logger;
+    TypeNameGenerator type_name_gen;
+    EnvironmentStack type_env;
+    // registry of user defined types
+    TypeEnv type_registry;
+    // class of each constructor, by the constructor's symbol
+    std::unordered_map<Symbol, TypeVariable*> type_constructors;
+    // typing environment for class type variables
+    TypeEnv typeclass_env;
+    IndexMap constructor_values;
+    // map from constructor name to map from field name to field index
+    std::map<std::string, IndexMap> constructor_field_indices;
+    // constructors of classes declared with @soa
+    std::unordered_set<Symbol> soa_constructors;
+    // 'pointer' in type annotations
+    TypeVariable* pointer_type;
+    // names interned by this context (see intern)
+    std::unordered_map<std::string, Symbol> symbols;
+
+    explicit TypeContext(Logger &logger);
+};
+
+// sets the context used on this thread, returns the one it replaces
+TypeContext* set_type_context(TypeContext* context);
+
 class TypeOperator {
 public:
     std::string type_constructor_;
+    // intern(type_constructor_), what types are matched on
+    Symbol type_symbol_;
     std::vector<TypeVariable*> types_;
     TypeOperator(std::string type_constructor,
                  std::vector<TypeVariable*> &types)
-    : type_constructor_(type_constructor), types_(types)
+    : type_constructor_(type_constructor),
+      type_symbol_(intern(type_constructor)), types_(types)
     {
     }
 
@@ -79,8 +217,8 @@ public:
     void set_type(TypeVariable* new_type);
 };
 
-void push_environment(std::map<std::string, TypeVariable*> &env);
-std::map<std::string, TypeVariable*> pop_environment();
+void push_environment(TypeEnv &env);
+TypeEnv pop_environment();
 void dump_environment();
 void reset_type_variables();
 
@@ -120,7 +258,32 @@ uint32_t get_constructor_field_index(std::string constructor,
 TypeVariable* get_fn_arg_type(TypeVariable* fn_type, size_t arg_idx);
 
 bool is_boxed_type(TypeVariable* type_var);
+// small single-constructor classes with scalar fields, which containers
+// store by value instead of as pointers to separately allocated objects
+bool is_inline_type(TypeVariable* type_var);
+// store objects of this (inline) class as one column per field in buffers.
+// returns false if the class can't be laid out that way.
+bool set_soa_layout(TypeVariable* class_type);
+bool is_soa_type(TypeVariable* type_var);
+// classes whose constructors all take no arguments (e.g. Red | Green | Blue),
+// their values are just the constructor index, as an i32
+bool is_enum_type(TypeVariable* type_var);
+// classes shaped like Option (one constructor without fields, one holding a
+// single object), which are a nullable pointer to the object: None is null,
+// and Some(x) is x itself. returns the type of the object, or nullptr.
+// small (inline) objects are excluded, see is_inline_type
+TypeVariable* nullable_payload_type(TypeVariable* type_var);
+// field types of a constructor, in declaration order
+std::vector<TypeVariable*> get_constructor_fields(TypeVariable* type_var);
 bool is_concrete_type(TypeVariable* type_var);
+// name of type_var if it has no type variables in it, with named ones
+//  looked up in env only. "" otherwise. unlike get_name, it doesn't depend
+//  on (or change) the environment
+std::string closed_type_name(TypeVariable* type_var, TypeEnv &env);
+// what typeclass impls are indexed by: the outer type constructor of the
+//  first argument of func_type, constructors going by the class they belong
+//  to. "" if that's a type variable, named ones looked up in env only
+std::string dispatch_key(TypeVariable* func_type, TypeEnv &env);
 bool is_pointer_type(TypeVariable* type_var);
 TypeVariable* get_type_of_pointer(TypeVariable* type_var);
 
@@ -128,12 +291,94 @@ TypeVariable* get_function_return_type(TypeVariable* func_type);
 std::vector<TypeVariable*> get_function_arg_types(TypeVariable* func_type);
 TypeVariable* type_variable_from_identifier(std::string ident);
 
+// sized numeric types (i8 ... u64, f32, f64) by name, nullptr for any other
+//  name, including int and float
+TypeVariable* sized_numeric_type(const std::string &type_name);
+// int, float, and the sized numeric types
+bool is_numeric_type(TypeVariable* type_var);
+bool is_integer_type(TypeVariable* type_var);
+bool is_float_type(TypeVariable* type_var);
+bool is_unsigned_type(TypeVariable* type_var);
+// width of a numeric type, 0 for anything else
+unsigned numeric_type_bits(TypeVariable* type_var);
+
+// simd vector types (f64x4, i32x8, ...) and masks (mask4, ...) by name,
+//  nullptr for any other name
+TypeVariable* simd_type(const std::string &type_name);
+bool is_simd_type(TypeVariable* type_var);
+bool is_mask_type(TypeVariable* type_var);
+// type of each lane, bool for masks
+TypeVariable* simd_element_type(TypeVariable* type_var);
+// number of lanes, 0 for anything that isn't a simd type
+unsigned simd_lanes(TypeVariable* type_var);
+// mask produced by comparing vectors with this many lanes
+TypeVariable* simd_mask_type(unsigned lanes);
+// operations on simd vectors that are lowered directly by the compiler
+//  (simd_lt, simd_reduce_add, ...)
+bool is_simd_builtin(const std::string &name);
+
+// fixed length arrays of numbers, bools or simd vectors, written float[3] in
+//  type annotations. the length is part of the type constructor ("[3]"), so
+//  arrays of different lengths don't unify
+TypeVariable* array_type(TypeVariable* element, size_t length);
+bool is_array_type(TypeVariable* type_var);
+TypeVariable* array_element_type(TypeVariable* type_var);
+// number of elements, 0 for anything that isn't an array
+size_t array_length(TypeVariable* type_var);
+// types arrays can hold
+bool is_array_element_type(TypeVariable* type_var);
+// vec methods that arrays also have (a[i], a.set(i, x) and a.len()), these
+//  are builtins when called on an array
+bool is_array_method(const std::string &name);
+
+// handle of a task started by spawn, joining it gives a value of result's
+//  type
+TypeVariable* task_type(TypeVariable* result);
+bool is_task_type(TypeVariable* type_var);
+// values spawn can hand to a task without moving them into it: numbers,
+//  bools, enums, simd vectors, arrays, and the atomics and channels tasks
+//  share with each other
+bool is_task_shareable_type(TypeVariable* type_var);
+// parallel_for, par_map and par_reduce
+bool is_parallel_builtin(const std::string &name);
+
+// cell holding an int, bool or pointer that is read and written atomically,
+//  written atomic_int, atomic_bool or atomic_ptr in type annotations
+TypeVariable* atomic_type(TypeVariable* value);
+bool is_atomic_type(TypeVariable* type_var);
+TypeVariable* atomic_value_type(TypeVariable* type_var);
+// constructors of atomics (atomic_int(0), padded_atomic_int(0), ...) and
+//  the operations on them (load, store, fetch_add, compare_exchange, ...)
+bool is_atomic_builtin(const std::string &name);
+
+// suspended call of a function with yield in its body, a for loop over it
+//  gets values of item's type
+TypeVariable* generator_type(TypeVariable* item);
+bool is_generator_type(TypeVariable* type_var);
+TypeVariable* generator_item_type(TypeVariable* type_var);
+
+// call of a function with await in its body, which only runs once it's
+//  started or awaited, awaiting it gives a value of result's type
+TypeVariable* async_type(TypeVariable* result);
+bool is_async_type(TypeVariable* type_var);
+TypeVariable* async_result_type(TypeVariable* type_var);
+// run_async, run_async_threads and start_async
+bool is_async_builtin(const std::string &name);
+
 extern TypeVariable* IntType;
 extern TypeVariable* FloatType;
+extern TypeVariable* I8Type;
+extern TypeVariable* I16Type;
+extern TypeVariable* I32Type;
+extern TypeVariable* U8Type;
+extern TypeVariable* U16Type;
+extern TypeVariable* U32Type;
+extern TypeVariable* U64Type;
+extern TypeVariable* F32Type;
 extern TypeVariable* StringType;
 extern TypeVariable* BoolType;
 extern TypeVariable* UnitType;
-extern TypeVariable* PointerType;
 extern TypeVariable* CPointerType;
+extern TypeVariable* IoType;
 
 } // namespace bon
@@ -0,0 +1,176 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* libbon - C API for compiling Bon source and calling it in-process
+|*
+L*----------------------------------------------------------------------------*/
+#include "libbon.h"
+#include "bonCompiler.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct bon_context {
+  bon::Compiler compiler;
+  // names of the added sources, in the order they're compiled
+  std::vector<std::string> sources;
+  bool compiled;
+  bool compile_failed;
+  std::string last_error;
+
+  bon_context() : compiled(false), compile_failed(false) {}
+};
+
+namespace {
+
+int fail(bon_context* context, const std::string &error) {
+  context->last_error = error;
+  return -1;
+}
+
+} // namespace
+
+bon_context* bon_create(const char* stdlib_path, const char** error) {
+  const char* unused_error;
+  if (!error) {
+    error = &unused_error;
+  }
+  if (!stdlib_path) {
+    stdlib_path = std::getenv("BON_STDLIB_PATH");
+    if (!stdlib_path) {
+      *error = "no stdlib path given, and BON_STDLIB_PATH isn't set";
+      return nullptr;
+    }
+  }
+
+  auto context = new bon_context();
+  auto &state = context->compiler.state();
+  state.stdlib_path = stdlib_path;
+  context->compiler.compile_file("prelude.bon", false);
+  if (state.logger.had_errors()) {
+    delete context;
+    *error = "couldn't compile prelude.bon from the stdlib path (errors are "
+             "printed to stdout)";
+    return nullptr;
+  }
+  *error = "";
+  return context;
+}
+
+void bon_destroy(bon_context* context) {
+  delete context;
+}
+
+int bon_set_args(int argc, const char** argv) {
+  if (argc < 0 || (argc > 0 && !argv)) {
+    return -1;
+  }
+  std::vector<std::string> args;
+  for (int i = 0; i < argc; ++i) {
+    args.push_back(argv[i] ? argv[i] : "");
+  }
+  bon::set_program_args(args);
+  return 0;
+}
+
+int bon_add_source(bon_context* context, const char* name,
+                   const char* source) {
+  if (!context) {
+    return -1;
+  }
+  if (!name || !source) {
+    return fail(context, "a source needs a name and text");
+  }
+  if (context->compiled) {
+    return fail(context, "sources can't be added once compiled");
+  }
+  context->compiler.add_source(name, source);
+  context->sources.push_back(name);
+  context->last_error = "";
+  return 0;
+}
+
+int bon_register_function(bon_context* context, const char* name,
+                          void* function) {
+  if (!context) {
+    return -1;
+  }
+  if (!name || !function) {
+    return fail(context, "a host function needs a name and an address");
+  }
+  if (context->compiled) {
+    return fail(context, "functions can't be registered once compiled");
+  }
+  context->compiler.add_host_function(name, function);
+  context->last_error = "";
+  return 0;
+}
+
+int bon_compile(bon_context* context) {
+  if (!context) {
+    return -1;
+  }
+  if (context->compiled) {
+    return fail(context, "already compiled");
+  }
+  if (context->sources.empty()) {
+    return fail(context, "no sources to compile");
+  }
+  context->compiled = true;
+
+  // like the files imported by the last source, the others are only parsed
+  //  until it's compiled along with them
+  auto &last_source = context->sources.back();
+  for (auto &source : context->sources) {
+    if (&source != &last_source) {
+      context->compiler.compile_file(source, false);
+    }
+  }
+  if (!context->compiler.compile_file(last_source, true)) {
+    context->compile_failed = true;
+    return fail(context, "compile errors");
+  }
+  context->last_error = "";
+  return 0;
+}
+
+void* bon_lookup(bon_context* context, const char* name, const char* type) {
+  if (!context) {
+    return nullptr;
+  }
+  if (!name || !type) {
+    fail(context, "a lookup needs a name and a type");
+    return nullptr;
+  }
+  if (!context->compiled || context->compile_failed) {
+    fail(context, "nothing compiled");
+    return nullptr;
+  }
+
+  auto function_type = context->compiler.get_function_type(name);
+  if (function_type == "") {
+    fail(context, std::string("no function named ") + name);
+    return nullptr;
+  }
+  if (function_type != type) {
+    fail(context, std::string(name) + " has type " + function_type
+                  + ", not " + type);
+    return nullptr;
+  }
+
+  auto function = context->compiler.get_function_address(name);
+  if (!function) {
+    fail(context, std::string("couldn't generate ") + name + " : "
+                  + function_type + " (is its type concrete?)");
+    return nullptr;
+  }
+  context->last_error = "";
+  return function;
+}
+
+const char* bon_last_error(bon_context* context) {
+  if (!context) {
+    return "no context, see the error from bon_create";
+  }
+  return context->last_error.c_str();
+}
@@ -0,0 +1,65 @@
+/*----------------------------------------------------------------------------*\
+|*
+|* libbon - C API for compiling Bon source and calling it in-process
+|*
+L*----------------------------------------------------------------------------*/
+#pragma once
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a compiler and the JIT it adds its code to. each context can be used from
+//  one thread at a time, different contexts from different threads at once.
+//  the functions below fail (returning -1 or NULL) when given a NULL context
+//  or NULL strings
+typedef struct bon_context bon_context;
+
+// stdlib_path is the directory prelude.bon and the other stdlib modules are
+//  in, or NULL for $BON_STDLIB_PATH. returns NULL if there's no stdlib path
+//  or the prelude can't be compiled, with *error (if error isn't NULL) set
+//  to what went wrong. *error is set to "" on success, and always points to
+//  a static string
+bon_context* bon_create(const char* stdlib_path, const char** error);
+// does nothing for NULL
+void bon_destroy(bon_context* context);
+
+// arguments the compiled code gets from get_arg, for every context in the
+//  process (argv[0] is get_arg(0)). set before compiling anything that reads
+//  them, as top-level expressions run in bon_compile. returns -1 if argv is
+//  NULL while argc isn't 0
+int bon_set_args(int argc, const char** argv);
+
+// adds source to be compiled, under name (used in error messages). other
+//  sources can import it as a module if name is "<module>.bon"
+int bon_add_source(bon_context* context, const char* name, const char* source);
+
+// cdefs named name call function, rather than a function of that name
+//  exported by the host process. has to be called before bon_compile
+int bon_register_function(bon_context* context, const char* name,
+                          void* function);
+
+// compiles the sources added so far, in the order they were added, and runs
+//  their top-level expressions. can be called once per context. returns 0,
+//  or -1 on errors (printed to stdout, see bon_last_error)
+int bon_compile(bon_context* context);
+
+// the compiled function name, checked to have the Bon type type, e.g.
+//  "int * int -> int". the function has to have a concrete type (annotate
+//  its parameters), and is called through a pointer of the matching c type:
+//    int      int64_t          float   double
+//    string   const char*      ()      void (as a return type)
+//  classes and vectors are passed as pointers to their objects, e.g.
+//    int64_t (*add)(int64_t, int64_t) =
+//      (int64_t (*)(int64_t, int64_t))bon_lookup(context, "add",
+//                                                "int * int -> int");
+//  returns NULL if there's no such function, or its type differs
+void* bon_lookup(bon_context* context, const char* name, const char* type);
+
+// what went wrong in the last call that failed, "" if nothing did
+const char* bon_last_error(bon_context* context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
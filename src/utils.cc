@@ -4,38 +4,24 @@
 |*
 L*----------------------------------------------------------------------------*/
 
-#include <cstdio>
-#include <unistd.h>
-#include <iostream>
 #include "utils.h"
-#include "bonLogger.h"
 
-std::string BON_STDLIB_PATH;
-int stdin_orig = -1;
-
-bool file_to_stdin(std::string filename) {
-  bon::logger.set_file_prefix("");
-  if (stdin_orig == -1) {
-    stdin_orig = dup(0);
-  }
-  fflush(stdin);
-  if (!freopen(filename.c_str(), "r", stdin)) {
+bool open_source_file(std::ifstream &file, const std::string &filename,
+                      const std::string &stdlib_path, bon::Logger &logger) {
+  logger.set_file_prefix("");
+  file.close();
+  file.clear();
+  file.open(filename);
+  if (!file) {
     // try again within stdlib directory
-    fflush(stdin);
-    if (!freopen((BON_STDLIB_PATH + "/" + filename).c_str(), "r", stdin)) {
-      bon::logger.set_line_column(0, 0);
-      bon::logger.error("error", "File not found: " + filename);
+    file.clear();
+    file.open(stdlib_path + "/" + filename);
+    if (!file) {
+      logger.set_line_column(0, 0);
+      logger.error("error", "File not found: " + filename);
       return false;
     }
-    bon::logger.set_file_prefix(BON_STDLIB_PATH + "/");
+    logger.set_file_prefix(stdlib_path + "/");
   }
   return true;
 }
-
-void restore_stdin() {
-  fflush(stdin);
-  fclose(stdin);
-  *stdin = *fdopen(stdin_orig, "r");
-  // close(stdin_orig);
-  // fflush(stdin);
-}
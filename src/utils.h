@@ -5,9 +5,12 @@
 L*----------------------------------------------------------------------------*/
 
 #pragma once
-#include <string>
+#include "bonLogger.h"
 
-extern std::string BON_STDLIB_PATH;
+#include <fstream>
+#include <string>
 
-bool file_to_stdin(std::string filename);
-void restore_stdin();
+// opens filename, or failing that the file of that name in stdlib_path.
+//  the logger's file prefix is set to the directory it was found in
+bool open_source_file(std::ifstream &file, const std::string &filename,
+                      const std::string &stdlib_path, bon::Logger &logger);